@@ -10,6 +10,15 @@
   Also logs a marker at ReadyToBoot so log readers can tell whether a
   subsequent failure occurred in firmware or the boot manager / OS loader.
 
+  Before the first of these notifications after ReadyToBoot, the start of the
+  FPDT firmware basic boot performance table (FBPT) is copied into the log as
+  hex so the host gets the phase, driver and image load timings even when the
+  boot fails. The FBPT is published by FirmwarePerformanceDxe at ReadyToBoot,
+  so nothing is copied for failures before then; its timestamps are hypervisor
+  reference time via HvTimerLib. The copy is logged at DEBUG_WARN so it is
+  kept by release builds, and PcdEfiDiagnosticsBootPerformanceLogLimit keeps
+  it small enough not to push earlier entries out of the log.
+
   Publishing the buffer's GPA to the host is handled by
   MsvmPkg/EfiDiagnosticsPei in PEI.
 
@@ -23,16 +32,134 @@
 
 #include <Uefi.h>
 
+#include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/EfiDiagnosticsLib.h>
+#include <Library/PcdLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
 #include <Guid/EventGroup.h>
 #include <Guid/UnableToBootEvent.h>
+#include <IndustryStandard/Acpi.h>
 #include <Protocol/ResetNotification.h>
 
+//
+// Bytes of the boot performance table per log line. Each byte is two hex
+// digits.
+//
+#define BOOT_PERFORMANCE_BYTES_PER_LINE  32
+
 STATIC EFI_RESET_NOTIFICATION_PROTOCOL  *mResetNotify;
+STATIC BOOLEAN                          mReadyToBootSignaled;
+STATIC BOOLEAN                          mBootPerformanceLogged;
+STATIC CONST CHAR8                      mHexDigits[] = "0123456789abcdef";
+
+/**
+  Find the firmware basic boot performance table through the FPDT.
+
+  @param[out] Length  Length in bytes of the table.
+
+  @retval The boot performance table, or NULL if the FPDT is not installed.
+**/
+STATIC
+EFI_ACPI_5_0_FPDT_PERFORMANCE_TABLE_HEADER *
+FindBootPerformanceTable (
+  OUT UINT32  *Length
+  )
+{
+  EFI_ACPI_DESCRIPTION_HEADER                              *Fpdt;
+  EFI_ACPI_5_0_FPDT_PERFORMANCE_RECORD_HEADER              *Record;
+  EFI_ACPI_5_0_FPDT_BOOT_PERFORMANCE_TABLE_POINTER_RECORD  *BootPointer;
+  EFI_ACPI_5_0_FPDT_PERFORMANCE_TABLE_HEADER               *Fbpt;
+  UINT32                                                   Offset;
+
+  Fpdt = (EFI_ACPI_DESCRIPTION_HEADER *)EfiLocateFirstAcpiTable (
+                                          EFI_ACPI_5_0_FIRMWARE_PERFORMANCE_DATA_TABLE_SIGNATURE
+                                          );
+  if (Fpdt == NULL) {
+    return NULL;
+  }
+
+  Offset = sizeof (EFI_ACPI_DESCRIPTION_HEADER);
+  while (Offset + sizeof (EFI_ACPI_5_0_FPDT_PERFORMANCE_RECORD_HEADER) <= Fpdt->Length) {
+    Record = (EFI_ACPI_5_0_FPDT_PERFORMANCE_RECORD_HEADER *)((UINT8 *)Fpdt + Offset);
+    if ((Record->Length < sizeof (EFI_ACPI_5_0_FPDT_PERFORMANCE_RECORD_HEADER)) ||
+        (Offset + Record->Length > Fpdt->Length))
+    {
+      break;
+    }
+
+    if ((Record->Type == EFI_ACPI_5_0_FPDT_RECORD_TYPE_FIRMWARE_BASIC_BOOT_POINTER) &&
+        (Record->Length >= sizeof (EFI_ACPI_5_0_FPDT_BOOT_PERFORMANCE_TABLE_POINTER_RECORD)))
+    {
+      BootPointer = (EFI_ACPI_5_0_FPDT_BOOT_PERFORMANCE_TABLE_POINTER_RECORD *)Record;
+      Fbpt        = (EFI_ACPI_5_0_FPDT_PERFORMANCE_TABLE_HEADER *)(UINTN)BootPointer->BootPerformanceTablePointer;
+      if ((Fbpt == NULL) || (Fbpt->Signature != EFI_ACPI_5_0_FPDT_BOOT_PERFORMANCE_TABLE_SIGNATURE)) {
+        return NULL;
+      }
+
+      *Length = Fbpt->Length;
+      return Fbpt;
+    }
+
+    Offset += Record->Length;
+  }
+
+  return NULL;
+}
+
+/**
+  Copy the boot performance table into the log as a hex blob, once per boot.
+
+  Each line is "FBPT <offset>: <hex bytes>", preceded by a header line with
+  the table's address and length so the host can reassemble it. The copy is
+  truncated to PcdEfiDiagnosticsBootPerformanceLogLimit bytes. Nothing is
+  copied before ReadyToBoot, since the table does not exist yet.
+**/
+STATIC
+VOID
+LogBootPerformanceTable (
+  VOID
+  )
+{
+  EFI_ACPI_5_0_FPDT_PERFORMANCE_TABLE_HEADER  *Fbpt;
+  UINT8                                       *Bytes;
+  UINT32                                      Length;
+  UINT32                                      Limit;
+  UINT32                                      Offset;
+  UINT32                                      Count;
+  UINT32                                      Index;
+  CHAR8                                       Line[BOOT_PERFORMANCE_BYTES_PER_LINE * 2 + 1];
+
+  Limit = FixedPcdGet32 (PcdEfiDiagnosticsBootPerformanceLogLimit);
+  if (!mReadyToBootSignaled || mBootPerformanceLogged || (Limit == 0)) {
+    return;
+  }
+
+  Fbpt = FindBootPerformanceTable (&Length);
+  if (Fbpt == NULL) {
+    DEBUG ((DEBUG_WARN, "%a: FPDT boot performance table not published.\n", __func__));
+    return;
+  }
+
+  mBootPerformanceLogged = TRUE;
+
+  DEBUG ((DEBUG_WARN, "FBPT @ %p Length 0x%x Logged 0x%x\n", Fbpt, Length, MIN (Length, Limit)));
+
+  Bytes  = (UINT8 *)Fbpt;
+  Length = MIN (Length, Limit);
+  for (Offset = 0; Offset < Length; Offset += Count) {
+    Count = MIN (BOOT_PERFORMANCE_BYTES_PER_LINE, Length - Offset);
+    for (Index = 0; Index < Count; Index++) {
+      Line[Index * 2]     = mHexDigits[Bytes[Offset + Index] >> 4];
+      Line[Index * 2 + 1] = mHexDigits[Bytes[Offset + Index] & 0xF];
+    }
+
+    Line[Count * 2] = '\0';
+    DEBUG ((DEBUG_WARN, "FBPT %08x: %a\n", Offset, Line));
+  }
+}
 
 /**
   Reset notification callback that tells the host to collect EFI diagnostics
@@ -49,6 +176,7 @@ OnResetProcessDiagnostics (
   )
 {
   DEBUG((DEBUG_ERROR, "%a: Reset notification callback called. ResetType = %d, ResetStatus = %r\n", __func__, ResetType, ResetStatus));
+  LogBootPerformanceTable ();
   NotifyHostToProcessEfiDiagnostics ();
 }
 
@@ -134,6 +262,7 @@ OnEventProcessDiagnostics (
   IN VOID       *Context
   )
 {
+  LogBootPerformanceTable ();
   NotifyHostToProcessEfiDiagnostics ();
 }
 
@@ -151,6 +280,7 @@ OnReadyToBoot (
   IN VOID       *Context
   )
 {
+  mReadyToBootSignaled = TRUE;
   DEBUG ((DEBUG_WARN, "%a: Transitioning to boot manager; errors past this point and before ExitBootServices suggest a boot manager issue.\n", __func__));
 }
 
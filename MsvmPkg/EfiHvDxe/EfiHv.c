@@ -36,7 +36,7 @@ EFI_EVENT mExitBootServicesEvent;
 BOOLEAN mAutoEoi;
 BOOLEAN mDirectTimerSupported;
 LIST_ENTRY mHostVisiblePageList;
-LIST_ENTRY mPinnedPageList;
+EFI_HV_PIN_TABLE mPinnedPageTable;
 UINT64 mSharedGpaBoundary;
 UINT64 mCanonicalizationMask;
 UINT32 mIsolationType;
@@ -139,7 +139,7 @@ EfiHvInitialize (
   }
 
   InitializeListHead(&mHostVisiblePageList);
-  InitializeListHead(&mPinnedPageList);
+  ZeroMem(&mPinnedPageTable, sizeof(mPinnedPageTable));
 
 #if defined(MDE_CPU_X64)
 
@@ -196,6 +196,21 @@ EfiHvInitialize (
     goto Cleanup;
   }
 
+#if defined(MDE_CPU_X64)
+
+  //
+  // Take over acceptance of any RAM that PlatformPei left unaccepted. This
+  // must follow the hypervisor connection, which captures the isolation
+  // configuration.
+  //
+  status = EfiHvpInstallMemoryAcceptProtocol();
+  if (EFI_ERROR(status))
+  {
+    goto Cleanup;
+  }
+
+#endif
+
   //
   // Register the HV protocols.
   //
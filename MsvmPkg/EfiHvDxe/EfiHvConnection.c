@@ -299,46 +299,34 @@ EfiHvDisconnectFromHypervisor (
 --*/
 {
   LIST_ENTRY *entry;
-  EFI_HV_PROTECTION_OBJECT *protectionObject;
-  EFI_HV_PIN_OBJECT *pinObject;
+  EFI_HV_PROTECTION_HANDLE protectionHandles[EFI_HV_VISIBILITY_BATCH_SIZE];
+  UINT32 handleCount;
   EFI_STATUS status;
 
   //
-  // Revoke host visibility for any pages that were made visible.
+  // Revoke host visibility for any pages that were made visible, a batch
+  // of ranges at a time so that they share hypercalls.
   //
   while (!IsListEmpty(&mHostVisiblePageList))
   {
-    entry = GetFirstNode(&mHostVisiblePageList);
-    protectionObject = BASE_CR(entry, EFI_HV_PROTECTION_OBJECT, ListEntry);
-    EfiHvMakeAddressRangeNotHostVisible(NULL, &protectionObject);
+    handleCount = 0;
+    for (entry = GetFirstNode(&mHostVisiblePageList);
+       (entry != &mHostVisiblePageList) && (handleCount < EFI_HV_VISIBILITY_BATCH_SIZE);
+       entry = GetNextNode(&mHostVisiblePageList, entry))
+    {
+      protectionHandles[handleCount] = BASE_CR(entry, EFI_HV_PROTECTION_OBJECT, ListEntry);
+      handleCount++;
+    }
+
+    EfiHvpMakeAddressRangesNotHostVisible(protectionHandles, handleCount);
   }
 
   //
   // Unpin any GPA ranges that were pinned for host DMA. Done before the
   // hypercall context is torn down so the unpin hypercalls can still
-  // reach the hypervisor. Bypass the tracking-list lookup in
-  // EfiHvUnpinAddressRange by removing the entry here and issuing the
-  // hypercall directly.
+  // reach the hypervisor.
   //
-  while (!IsListEmpty(&mPinnedPageList))
-  {
-    entry = GetFirstNode(&mPinnedPageList);
-    pinObject = BASE_CR(entry, EFI_HV_PIN_OBJECT, ListEntry);
-    RemoveEntryList(&pinObject->ListEntry);
-
-    status =
-      EfiHvpPinUnpinGpaPageRanges(
-        FALSE,
-        pinObject->NumberOfPages,
-        pinObject->GpaPageBase,
-        NULL);
-    if (EFI_ERROR(status))
-    {
-      FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
-    }
-
-    FreePool(pinObject);
-  }
+  EfiHvpUnpinAllTrackedGpaPageRanges();
 
   //
   // Free the bypass input page if required.
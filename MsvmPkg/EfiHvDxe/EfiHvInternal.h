@@ -23,7 +23,10 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/HvHypercallLib.h>
 #if defined(MDE_CPU_X64)
+#include <Library/DxeServicesTableLib.h>
 #include <Library/LocalApicLib.h>
+#include <Protocol/MemoryAccept.h>
+#include <Protocol/MemoryAcceptance.h>
 #endif
 #if defined(MDE_CPU_AARCH64)
 #include <Protocol/HardwareInterrupt.h>
@@ -31,6 +34,12 @@
 
 #define WINHVP_MAX_REPS_PER_HYPERCALL  0xFFF
 
+//
+// Number of ranges whose host visibility is revoked together without
+// allocating memory.
+//
+#define EFI_HV_VISIBILITY_BATCH_SIZE  32
+
 typedef struct _EFI_HV_SINT_CONFIGURATION
 {
   EFI_HV_INTERRUPT_HANDLER InterruptHandler;
@@ -66,15 +75,39 @@ typedef struct _EFI_HV_PROTECTION_OBJECT
   UINT32 NumberOfPages;
 } EFI_HV_PROTECTION_OBJECT, *PEFI_HV_PROTECTION_OBJECT;
 
+//
+// A run of consecutive GPA pages, used to describe the sparse page list of
+// a batched host visibility change.
+//
+typedef struct _EFI_HV_GPA_PAGE_EXTENT
+{
+  HV_GPA_PAGE_NUMBER GpaPageBase;
+  UINT32 PageCount;
+} EFI_HV_GPA_PAGE_EXTENT, *PEFI_HV_GPA_PAGE_EXTENT;
+
 typedef struct _EFI_HV_PIN_OBJECT
 {
-  LIST_ENTRY ListEntry;
   UINT64 RequestGpaPageBase;
   UINT32 RequestNumberOfPages;
   UINT64 GpaPageBase;
   UINT32 NumberOfPages;
 } EFI_HV_PIN_OBJECT, *PEFI_HV_PIN_OBJECT;
 
+//
+// Pinned GPA ranges, kept in one pool-allocated array sorted by
+// (RequestGpaPageBase, RequestNumberOfPages, GpaPageBase) so the objects of
+// an unpin request are found with a binary search and sit next to each other
+// in GPA order. Requests may overlap, for example two requests with the same
+// base and different sizes, so the table as a whole is not in GPA order. A
+// request with the same base and size as a tracked one is rejected.
+//
+typedef struct _EFI_HV_PIN_TABLE
+{
+  PEFI_HV_PIN_OBJECT Objects;
+  UINT32 Count;
+  UINT32 Capacity;
+} EFI_HV_PIN_TABLE, *PEFI_HV_PIN_TABLE;
+
 extern HV_HYPERCALL_CONTEXT mHvContext;
 extern HV_HYPERCALL_CONTEXT mHvBypassContext;
 extern BOOLEAN mUseBypassContext;
@@ -87,7 +120,7 @@ extern EFI_EVENT mExitBootServicesEvent;
 extern BOOLEAN mAutoEoi;
 extern BOOLEAN mDirectTimerSupported;
 extern LIST_ENTRY mHostVisiblePageList;
-extern LIST_ENTRY mPinnedPageList;
+extern EFI_HV_PIN_TABLE mPinnedPageTable;
 extern UINT64 mSharedGpaBoundary;
 extern UINT64 mCanonicalizationMask;
 extern UINT32 mIsolationType;
@@ -278,6 +311,15 @@ EfiHvpModifySparseGpaPageHostVisibility(
   OUT OPTIONAL    UINT32              *PageCountProcessed
   );
 
+EFI_STATUS
+EfiHvpModifySparseGpaPageListHostVisibility(
+  IN              HV_MAP_GPA_FLAGS              MapFlags,
+  IN              CONST EFI_HV_GPA_PAGE_EXTENT  *Extents,
+  IN              UINT32                        ExtentCount,
+  IN              UINT32                        PageCount,
+  OUT OPTIONAL    UINT32                        *PageCountProcessed
+  );
+
 EFI_STATUS
 EFIAPI
 EfiHvMakeAddressRangeHostVisible(
@@ -296,6 +338,12 @@ EfiHvMakeAddressRangeNotHostVisible(
   IN OUT  EFI_HV_PROTECTION_HANDLE *ProtectionHandle
   );
 
+VOID
+EfiHvpMakeAddressRangesNotHostVisible(
+  IN OUT  EFI_HV_PROTECTION_HANDLE    *ProtectionHandles,
+  IN      UINT32                      HandleCount
+  );
+
 EFI_STATUS
 EfiHvpPinUnpinGpaPageRanges(
   IN              BOOLEAN             Pin,
@@ -304,6 +352,11 @@ EfiHvpPinUnpinGpaPageRanges(
   OUT OPTIONAL    UINT32              *PageCountProcessed
   );
 
+VOID
+EfiHvpUnpinAllTrackedGpaPageRanges(
+  VOID
+  );
+
 EFI_STATUS
 EFIAPI
 EfiHvPinAddressRange(
@@ -320,3 +373,12 @@ EfiHvUnpinAddressRange(
   IN  VOID                *BaseAddress,
   IN  UINT32              ByteCount
   );
+
+#if defined(MDE_CPU_X64)
+
+EFI_STATUS
+EfiHvpInstallMemoryAcceptProtocol(
+  VOID
+  );
+
+#endif
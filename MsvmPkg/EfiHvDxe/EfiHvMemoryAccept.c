@@ -0,0 +1,231 @@
+/** @file
+  Implements EDKII_MEMORY_ACCEPT_PROTOCOL for hardware-isolated VMs without
+  a paravisor. PlatformPei reports RAM above the eagerly accepted region as
+  unaccepted, and the DXE core calls this protocol to accept that memory
+  the first time the page allocator hands it out.
+
+  Memory still unaccepted at ExitBootServices is accepted then, unless the
+  OS loader has declared through MSVM_MEMORY_ACCEPTANCE_PROTOCOL that the
+  OS accepts it itself.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+#include "EfiHvInternal.h"
+
+EFI_STATUS
+EFIAPI
+EfiHvAcceptMemory(
+  IN  EDKII_MEMORY_ACCEPT_PROTOCOL  *This,
+  IN  EFI_PHYSICAL_ADDRESS          StartAddress,
+  IN  UINTN                         Size
+  );
+
+EFI_STATUS
+EFIAPI
+EfiHvAllowUnacceptedMemory(
+  IN  MSVM_MEMORY_ACCEPTANCE_PROTOCOL *This
+  );
+
+STATIC EDKII_MEMORY_ACCEPT_PROTOCOL mMemoryAccept =
+{
+  EfiHvAcceptMemory
+};
+
+STATIC MSVM_MEMORY_ACCEPTANCE_PROTOCOL mMemoryAcceptance =
+{
+  EfiHvAllowUnacceptedMemory
+};
+
+STATIC EFI_HANDLE mMemoryAcceptHandle;
+STATIC EFI_EVENT mAcceptAllMemoryEvent;
+STATIC BOOLEAN mAcceptAllMemoryAtExitBootServices = TRUE;
+
+EFI_STATUS
+EFIAPI
+EfiHvAcceptMemory(
+  IN  EDKII_MEMORY_ACCEPT_PROTOCOL  *This,
+  IN  EFI_PHYSICAL_ADDRESS          StartAddress,
+  IN  UINTN                         Size
+  )
+/*++
+  Accepts a range of unaccepted RAM.
+
+  @param This A pointer to the EDKII_MEMORY_ACCEPT_PROTOCOL instance.
+
+  @param StartAddress Page aligned address of the range.
+
+  @param Size Page aligned size of the range in bytes.
+
+  @returns EFI status.
+
+--*/
+{
+  EFI_STATUS status;
+
+  if ((Size == 0) ||
+    ((StartAddress & EFI_PAGE_MASK) != 0) ||
+    ((Size & EFI_PAGE_MASK) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  status = EfiUpdatePageRangeAcceptance(
+    mIsolationType,
+    mSvsmCallingArea,
+    StartAddress / EFI_PAGE_SIZE,
+    Size / EFI_PAGE_SIZE,
+    TRUE);
+  if (EFI_ERROR(status))
+  {
+
+    //
+    // Acceptance only fails if the host is misbehaving; the memory cannot
+    // be used safely.
+    //
+    FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+  }
+
+  return status;
+}
+
+EFI_STATUS
+EFIAPI
+EfiHvAllowUnacceptedMemory(
+  IN  MSVM_MEMORY_ACCEPTANCE_PROTOCOL *This
+  )
+/*++
+  Records that the OS accepts unaccepted memory itself, so that it is left
+  unaccepted at ExitBootServices.
+
+  @param This A pointer to the MSVM_MEMORY_ACCEPTANCE_PROTOCOL instance.
+
+  @returns EFI status.
+
+--*/
+{
+  mAcceptAllMemoryAtExitBootServices = FALSE;
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+EFIAPI
+EfiHvpAcceptAllMemory(
+  IN  EFI_EVENT   Event,
+  IN  VOID        *Context
+  )
+/*++
+  BeforeExitBootServices callback that accepts all remaining unaccepted
+  memory and returns it to the memory map as conventional memory, for an OS
+  that cannot accept memory itself.
+
+  Changing the memory map makes the first ExitBootServices call fail with
+  EFI_INVALID_PARAMETER, after which the OS loader gets the memory map again
+  and retries. Later calls find nothing left to accept.
+
+  @param Event The event.
+
+  @param Context Unused.
+
+--*/
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR *memorySpaceMap;
+  UINTN descriptorCount;
+  UINTN index;
+  EFI_STATUS status;
+
+  if (!mAcceptAllMemoryAtExitBootServices)
+  {
+    return;
+  }
+
+  status = gDS->GetMemorySpaceMap(&descriptorCount, &memorySpaceMap);
+  if (EFI_ERROR(status))
+  {
+    DEBUG((DEBUG_ERROR, "--- %a: failed to get the memory space map - %r \n", __func__, status));
+    return;
+  }
+
+  for (index = 0; index < descriptorCount; index++)
+  {
+    if (memorySpaceMap[index].GcdMemoryType != EfiGcdMemoryTypeUnaccepted)
+    {
+      continue;
+    }
+
+    EfiHvAcceptMemory(
+      &mMemoryAccept,
+      memorySpaceMap[index].BaseAddress,
+      memorySpaceMap[index].Length);
+
+    status = gDS->RemoveMemorySpace(
+      memorySpaceMap[index].BaseAddress,
+      memorySpaceMap[index].Length);
+    if (!EFI_ERROR(status))
+    {
+      status = gDS->AddMemorySpace(
+        EfiGcdMemoryTypeSystemMemory,
+        memorySpaceMap[index].BaseAddress,
+        memorySpaceMap[index].Length,
+        EFI_MEMORY_CPU_CAPABILITY_MASK);
+    }
+
+    if (EFI_ERROR(status))
+    {
+      DEBUG((DEBUG_ERROR, "--- %a: failed to convert accepted memory at 0x%lx - %r \n",
+        __func__, memorySpaceMap[index].BaseAddress, status));
+      break;
+    }
+  }
+
+  FreePool(memorySpaceMap);
+}
+
+EFI_STATUS
+EfiHvpInstallMemoryAcceptProtocol(
+  VOID
+  )
+/*++
+  Installs the memory accept protocols when memory acceptance is owned by
+  this firmware, which is the case when hardware isolated without a
+  paravisor, and arranges for unaccepted memory to be accepted at
+  ExitBootServices.
+
+  @returns EFI status.
+
+--*/
+{
+  EFI_STATUS status;
+
+  if (!IsHardwareIsolatedNoParavisorEx(mIsolationType, IsParavisorPresent()))
+  {
+    return EFI_SUCCESS;
+  }
+
+  status = gBS->CreateEventEx(
+          EVT_NOTIFY_SIGNAL,
+          TPL_NOTIFY,
+          EfiHvpAcceptAllMemory,
+          NULL,
+          &gEfiEventBeforeExitBootServicesGuid,
+          &mAcceptAllMemoryEvent);
+  if (EFI_ERROR(status))
+  {
+    DEBUG((DEBUG_ERROR, "--- %a: failed to create the BeforeExitBootServices event - %r \n", __func__, status));
+    return status;
+  }
+
+  status = gBS->InstallMultipleProtocolInterfaces(
+          &mMemoryAcceptHandle,
+          &gEdkiiMemoryAcceptProtocolGuid, &mMemoryAccept,
+          &gMsvmMemoryAcceptanceProtocolGuid, &mMemoryAcceptance,
+          NULL);
+  if (EFI_ERROR(status))
+  {
+    DEBUG((DEBUG_ERROR, "--- %a: failed to install the protocols - %r \n", __func__, status));
+    gBS->CloseEvent(mAcceptAllMemoryEvent);
+  }
+
+  return status;
+}
@@ -6,26 +6,88 @@
 **/
 #include "EfiHvInternal.h"
 
+#if defined(MDE_CPU_X64)
+
+STATIC
 EFI_STATUS
-EFIAPI
-EfiHvpModifySparseGpaPageHostVisibility(
-  IN              HV_MAP_GPA_FLAGS    MapFlags,
-  IN              UINT32              PageCount,
-  IN              HV_GPA_PAGE_NUMBER  GpaPageBase,
-  OUT OPTIONAL    UINT32              *PageCountProcessed
+EfiHvpUpdateGpaPageListAcceptance(
+  IN  CONST EFI_HV_GPA_PAGE_EXTENT  *Extents,
+  IN  UINT32                        ExtentCount,
+  IN  UINT32                        PageCount,
+  IN  BOOLEAN                       Accept
+  )
+/*++
+  Updates hardware acceptance for the first PageCount pages of a page
+  extent list.
+
+  @param Extents The page extents.
+
+  @param ExtentCount The number of extents.
+
+  @param PageCount The number of pages, taken in list order, to update.
+
+  @param Accept TRUE to accept the pages, FALSE to revoke acceptance.
+
+  @returns EFI status.
+
+--*/
+{
+  EFI_STATUS status;
+  UINT32 extentIndex;
+  UINT32 extentPageCount;
+
+  for (extentIndex = 0; (extentIndex < ExtentCount) && (PageCount != 0); extentIndex++)
+  {
+    extentPageCount = MIN(Extents[extentIndex].PageCount, PageCount);
+    if (extentPageCount == 0)
+    {
+      continue;
+    }
+
+    status = EfiUpdatePageRangeAcceptance(
+      mIsolationType,
+      mSvsmCallingArea,
+      Extents[extentIndex].GpaPageBase,
+      extentPageCount,
+      Accept);
+    if (EFI_ERROR(status))
+    {
+      return status;
+    }
+
+    PageCount -= extentPageCount;
+  }
+
+  return EFI_SUCCESS;
+}
+
+#endif
+
+EFI_STATUS
+EfiHvpModifySparseGpaPageListHostVisibility(
+  IN              HV_MAP_GPA_FLAGS              MapFlags,
+  IN              CONST EFI_HV_GPA_PAGE_EXTENT  *Extents,
+  IN              UINT32                        ExtentCount,
+  IN              UINT32                        PageCount,
+  OUT OPTIONAL    UINT32                        *PageCountProcessed
   )
 /*++
-  Handles the ModifySparseGpaPageHostVisibility hypercall.
+  Handles the ModifySparseGpaPageHostVisibility hypercall for a list of page
+  extents. The pages of all extents are packed into the sparse page list of
+  each rep hypercall, so many small ranges cost as few hypercalls as one
+  range of the same total size.
 
   @param MapFlags Access permissions provided to the host.
 
-  @param PageCount The number of pages to modify.
+  @param Extents The page extents to modify.
 
-  @param GpaPageBase Supplies the address of the first target GPA to accept. The
-              remaining pages will be modified sequentially from this GPA.
+  @param ExtentCount The number of extents.
+
+  @param PageCount The number of pages to modify, taken in order from the
+              start of the extent list. Must not exceed the pages in the list.
 
   @param PageCountProcessed If present, the number of pages that are successfully processed
-                will be returned in this.
+                will be returned in this. These are always the first pages of the list.
 
   @returns EFI status.
 
@@ -42,7 +104,9 @@ EfiHvpModifySparseGpaPageHostVisibility(
   UINT32 possibleRepsPerCall;
   UINT32 repsInCurrentCall;
   UINT32 repsProcessedThisCall;
-  UINT32 gpaPageBaseIndex = 0;
+  UINT32 extentIndex;
+  UINT32 extentOffset;
+  UINT64 listPageCount;
   UINT32 i;
   UINT32 totalPageCountProcessed = 0;
   BOOLEAN paravisorPresent;
@@ -58,6 +122,18 @@ EfiHvpModifySparseGpaPageHostVisibility(
     return EFI_INVALID_PARAMETER;
   }
 
+  listPageCount = 0;
+  for (extentIndex = 0; extentIndex < ExtentCount; extentIndex++)
+  {
+    listPageCount += Extents[extentIndex].PageCount;
+  }
+
+  if (listPageCount < PageCount)
+  {
+    DEBUG((DEBUG_ERROR, "%a: page count %u exceeds extent list\n", __func__, PageCount));
+    return EFI_INVALID_PARAMETER;
+  }
+
   paravisorPresent = IsParavisorPresent();
 
 #if defined(MDE_CPU_X64)
@@ -75,36 +151,55 @@ EfiHvpModifySparseGpaPageHostVisibility(
     if (!mHvBypassContext.Connected)
     {
       UINT64 pagesProcessed;
+      UINT32 extentPageCount;
 
-      if (MapFlags != 0)
-      {
-        status = EfiMakePageRangeHostVisible(
-          mIsolationType,
-          mSvsmCallingArea,
-          GpaPageBase,
-          PageCount,
-          &pagesProcessed);
-      }
-      else
-      {
-        status = EfiMakePageRangeHostNotVisible(
-          mIsolationType,
-          mSvsmCallingArea,
-          GpaPageBase,
-          PageCount,
-          &pagesProcessed);
-      }
-
-      if (EFI_ERROR(status))
+      status = EFI_SUCCESS;
+      for (extentIndex = 0;
+         (extentIndex < ExtentCount) && (totalPageCountProcessed < PageCount);
+         extentIndex++)
       {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        extentPageCount = MIN(Extents[extentIndex].PageCount, PageCount - totalPageCountProcessed);
+        if (extentPageCount == 0)
+        {
+          continue;
+        }
+
+        if (MapFlags != 0)
+        {
+          status = EfiMakePageRangeHostVisible(
+            mIsolationType,
+            mSvsmCallingArea,
+            Extents[extentIndex].GpaPageBase,
+            extentPageCount,
+            &pagesProcessed);
+        }
+        else
+        {
+          status = EfiMakePageRangeHostNotVisible(
+            mIsolationType,
+            mSvsmCallingArea,
+            Extents[extentIndex].GpaPageBase,
+            extentPageCount,
+            &pagesProcessed);
+        }
+
+        if (EFI_ERROR(status))
+        {
+          FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        }
+
+        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR_IF_FALSE(pagesProcessed <= extentPageCount);
+
+        totalPageCountProcessed += (UINT32)pagesProcessed;
+        if (pagesProcessed != extentPageCount)
+        {
+          break;
+        }
       }
 
-      FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR_IF_FALSE(pagesProcessed <= PageCount);
-
       if (PageCountProcessed != NULL)
       {
-        *PageCountProcessed = (UINT32)pagesProcessed;
+        *PageCountProcessed = totalPageCountProcessed;
       }
 
       return status;
@@ -116,10 +211,9 @@ EfiHvpModifySparseGpaPageHostVisibility(
     //
     if (MapFlags != 0)
     {
-      status = EfiUpdatePageRangeAcceptance(
-        mIsolationType,
-        mSvsmCallingArea,
-        GpaPageBase,
+      status = EfiHvpUpdateGpaPageListAcceptance(
+        Extents,
+        ExtentCount,
         PageCount,
         FALSE);
       if (EFI_ERROR(status))
@@ -147,6 +241,9 @@ EfiHvpModifySparseGpaPageHostVisibility(
 
   pInputBuffer = (PHV_INPUT_MODIFY_SPARSE_GPA_PAGE_HOST_VISIBILITY)mHvPages->HypercallInputPage;
 
+  extentIndex = 0;
+  extentOffset = 0;
+
   for (;;)
   {
     if (PageCount == 0)
@@ -177,11 +274,18 @@ EfiHvpModifySparseGpaPageHostVisibility(
     //
     // Fill page numbers
     // N.B. instead of copying from an existing list of page numbers, we
-    // generate a list of consecutive numbers from GpaPageBase.
+    // walk the extent list, continuing where the previous call stopped.
     //
-    for (i = 0; i < repsInCurrentCall; i++, gpaPageBaseIndex++)
+    for (i = 0; i < repsInCurrentCall; i++)
     {
-      pInputBuffer->GpaPageList[i] = GpaPageBase + gpaPageBaseIndex;
+      while (extentOffset == Extents[extentIndex].PageCount)
+      {
+        extentIndex++;
+        extentOffset = 0;
+      }
+
+      pInputBuffer->GpaPageList[i] = Extents[extentIndex].GpaPageBase + extentOffset;
+      extentOffset++;
     }
 
     //
@@ -236,10 +340,9 @@ EfiHvpModifySparseGpaPageHostVisibility(
     //
     if (MapFlags == 0)
     {
-      status = EfiUpdatePageRangeAcceptance(
-        mIsolationType,
-        mSvsmCallingArea,
-        GpaPageBase,
+      status = EfiHvpUpdateGpaPageListAcceptance(
+        Extents,
+        ExtentCount,
         totalPageCountProcessed,
         TRUE);
       if (EFI_ERROR(status))
@@ -259,6 +362,44 @@ EfiHvpModifySparseGpaPageHostVisibility(
   return status;
 }
 
+EFI_STATUS
+EFIAPI
+EfiHvpModifySparseGpaPageHostVisibility(
+  IN              HV_MAP_GPA_FLAGS    MapFlags,
+  IN              UINT32              PageCount,
+  IN              HV_GPA_PAGE_NUMBER  GpaPageBase,
+  OUT OPTIONAL    UINT32              *PageCountProcessed
+  )
+/*++
+  Handles the ModifySparseGpaPageHostVisibility hypercall for one range.
+
+  @param MapFlags Access permissions provided to the host.
+
+  @param PageCount The number of pages to modify.
+
+  @param GpaPageBase Supplies the address of the first target GPA to accept. The
+              remaining pages will be modified sequentially from this GPA.
+
+  @param PageCountProcessed If present, the number of pages that are successfully processed
+                will be returned in this.
+
+  @returns EFI status.
+
+--*/
+{
+  EFI_HV_GPA_PAGE_EXTENT extent;
+
+  extent.GpaPageBase = GpaPageBase;
+  extent.PageCount = PageCount;
+
+  return EfiHvpModifySparseGpaPageListHostVisibility(
+    MapFlags,
+    &extent,
+    1,
+    PageCount,
+    PageCountProcessed);
+}
+
 EFI_STATUS
 EFIAPI
 EfiHvMakeAddressRangeHostVisible(
@@ -415,53 +556,114 @@ EfiHvMakeAddressRangeHostVisible(
 }
 
 VOID
-EFIAPI
-EfiHvMakeAddressRangeNotHostVisible(
-  IN      EFI_HV_IVM_PROTOCOL *This,
-  IN OUT  EFI_HV_PROTECTION_HANDLE *ProtectionHandle
+EfiHvpMakeAddressRangesNotHostVisible(
+  IN OUT  EFI_HV_PROTECTION_HANDLE    *ProtectionHandles,
+  IN      UINT32                      HandleCount
   )
 /*++
-  Makes a chunk of memory not visible to the host.
+  Makes several chunks of memory not visible to the host, committing the
+  pages of up to EFI_HV_VISIBILITY_BATCH_SIZE ranges together. No memory is
+  allocated, so this may be used during ExitBootServices.
   Note: Memory visibility changes for hardware-isolated
       systems may change the contents of the pages.
 
-  @param This A pointer to the EFI_HV_PROTOCOL instance.
+  @param ProtectionHandles Distinct objects used to track the memory
+              ranges. Each is set to NULL.
 
-  @param ProtectionHandle Object used to track memory range.
-
-  @returns EFI status.
+  @param HandleCount The number of handles.
 
 --*/
 {
-  EFI_STATUS status;
+  EFI_HV_GPA_PAGE_EXTENT extents[EFI_HV_VISIBILITY_BATCH_SIZE];
   EFI_HV_PROTECTION_OBJECT *protectionObject;
+  UINT32 batchCount;
+  UINT32 pageCount;
+  UINT32 index;
+  EFI_STATUS status;
 
-  if (ProtectionHandle == NULL || *ProtectionHandle == NULL)
+  if (ProtectionHandles == NULL)
   {
-    // fail fast here as this error either indicates a double free or another address range
-    // is not made private, which can cause a security issue due to unexpected host visibility.
     FAIL_FAST(EFI_INVALID_PARAMETER, "Invalid protection handle");
   }
 
-  protectionObject = (EFI_HV_PROTECTION_OBJECT *)(*ProtectionHandle);
-
-  RemoveEntryList(&protectionObject->ListEntry);
+  for (index = 0; index < HandleCount; index++)
+  {
+    if (ProtectionHandles[index] == NULL)
+    {
+      // fail fast here as this error either indicates a double free or another address range
+      // is not made private, which can cause a security issue due to unexpected host visibility.
+      FAIL_FAST(EFI_INVALID_PARAMETER, "Invalid protection handle");
+    }
+  }
 
-  status =
-    EfiHvpModifySparseGpaPageHostVisibility(
-      HV_MAP_GPA_PERMISSIONS_NONE,
-      protectionObject->NumberOfPages,
-      protectionObject->GpaPageBase,
-      NULL);
-  if (EFI_ERROR(status))
+  while (HandleCount != 0)
   {
+    batchCount = MIN(HandleCount, EFI_HV_VISIBILITY_BATCH_SIZE);
 
     //
-    // This is not allowed to fail - need to fail fast
+    // A range holds at most MAX_UINT32 bytes, so the page count of a batch
+    // cannot overflow.
     //
-    FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    pageCount = 0;
+    for (index = 0; index < batchCount; index++)
+    {
+      protectionObject = (EFI_HV_PROTECTION_OBJECT *)ProtectionHandles[index];
+      RemoveEntryList(&protectionObject->ListEntry);
+      extents[index].GpaPageBase = protectionObject->GpaPageBase;
+      extents[index].PageCount = protectionObject->NumberOfPages;
+      pageCount += protectionObject->NumberOfPages;
+    }
+
+    status =
+      EfiHvpModifySparseGpaPageListHostVisibility(
+        HV_MAP_GPA_PERMISSIONS_NONE,
+        extents,
+        batchCount,
+        pageCount,
+        NULL);
+    if (EFI_ERROR(status))
+    {
+
+      //
+      // This is not allowed to fail - need to fail fast
+      //
+      FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    }
+
+    for (index = 0; index < batchCount; index++)
+    {
+      FreePool(ProtectionHandles[index]);
+      ProtectionHandles[index] = NULL;
+    }
+
+    ProtectionHandles += batchCount;
+    HandleCount -= batchCount;
+  }
+}
+
+VOID
+EFIAPI
+EfiHvMakeAddressRangeNotHostVisible(
+  IN      EFI_HV_IVM_PROTOCOL *This,
+  IN OUT  EFI_HV_PROTECTION_HANDLE *ProtectionHandle
+  )
+/*++
+  Makes a chunk of memory not visible to the host.
+  Note: Memory visibility changes for hardware-isolated
+      systems may change the contents of the pages.
+
+  @param This A pointer to the EFI_HV_PROTOCOL instance.
+
+  @param ProtectionHandle Object used to track memory range.
+
+  @returns EFI status.
+
+--*/
+{
+  if (ProtectionHandle == NULL)
+  {
+    FAIL_FAST(EFI_INVALID_PARAMETER, "Invalid protection handle");
   }
 
-  FreePool(protectionObject);
-  *ProtectionHandle = NULL;
+  EfiHvpMakeAddressRangesNotHostVisible(ProtectionHandle, 1);
 }
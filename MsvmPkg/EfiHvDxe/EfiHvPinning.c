@@ -177,6 +177,175 @@ EfiHvpPinUnpinGpaPageRanges(
   return status;
 }
 
+STATIC
+VOID
+EfiHvpIssueUnpinGpaPageRanges(
+  IN  PHV_INPUT_GPA_PAGE_PINNING  InputBuffer,
+  IN  UINT32                      RangeCount
+  )
+/*++
+  Issues HvCallUnpinGpaPageRanges for a range list already built in the
+  hypercall input page. Unpinning a range this driver pinned cannot
+  legitimately fail.
+
+  @param InputBuffer The hypercall input page holding the range list.
+
+  @param RangeCount The number of ranges in the list.
+
+--*/
+{
+  HV_STATUS hvStatus;
+  UINT32 rangesProcessed;
+
+  rangesProcessed = 0;
+  hvStatus =
+    HvHypercallIssue(
+      mBypassOnly ? &mHvBypassContext : &mHvContext,
+      HvCallUnpinGpaPageRanges,
+      FALSE, // not fast
+      RangeCount,
+      EfiHvpBasePa((UINTN)InputBuffer),
+      0, // no output
+      &rangesProcessed);
+  if ((EFI_ERROR(EfiHvConvertStatus(hvStatus))) || (rangesProcessed != RangeCount))
+  {
+    FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+  }
+}
+
+STATIC
+VOID
+EfiHvpUnpinPinObjects(
+  IN  CONST EFI_HV_PIN_OBJECT *PinObjects,
+  IN  UINT32                  PinObjectCount
+  )
+/*++
+  Unpins the GPA ranges of a run of pin objects that is sorted by GPA.
+  Ranges that abut are coalesced, and the ranges are packed into as few
+  HvCallUnpinGpaPageRanges calls as the input page allows.
+
+  @param PinObjects The pin objects to unpin.
+
+  @param PinObjectCount The number of pin objects.
+
+--*/
+{
+  PHV_INPUT_GPA_PAGE_PINNING pInputBuffer;
+  EFI_TPL oldTpl;
+  HV_GPA_PAGE_NUMBER gpaPageBase;
+  UINT64 pageCount;
+  UINT32 pagesBuilt;
+  UINT32 rangesBuilt;
+  UINT32 rangeCount;
+  UINT32 index;
+
+  if (PinObjectCount == 0)
+  {
+    return;
+  }
+
+  pInputBuffer = (PHV_INPUT_GPA_PAGE_PINNING)mHvPages->HypercallInputPage;
+  rangeCount = 0;
+
+  oldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+  ZeroMem(pInputBuffer, HV_PAGE_SIZE);
+
+  index = 0;
+  while (index < PinObjectCount)
+  {
+    gpaPageBase = PinObjects[index].GpaPageBase;
+    pageCount = PinObjects[index].NumberOfPages;
+    index += 1;
+
+    while ((index < PinObjectCount) &&
+      (PinObjects[index].GpaPageBase == gpaPageBase + pageCount))
+    {
+      pageCount += PinObjects[index].NumberOfPages;
+      index += 1;
+    }
+
+    while (pageCount != 0)
+    {
+      if (rangeCount == HV_GPA_PAGE_PINNING_MAX_RANGE_COUNT)
+      {
+        EfiHvpIssueUnpinGpaPageRanges(pInputBuffer, rangeCount);
+        ZeroMem(pInputBuffer, HV_PAGE_SIZE);
+        rangeCount = 0;
+      }
+
+      EfiHvBuildGpaPageRangeList(
+        &pInputBuffer->GpaRangeList[rangeCount],
+        HV_GPA_PAGE_PINNING_MAX_RANGE_COUNT - rangeCount,
+        gpaPageBase,
+        (UINT32)MIN(pageCount, MAX_UINT32),
+        &rangesBuilt,
+        &pagesBuilt);
+
+      rangeCount += rangesBuilt;
+      gpaPageBase += pagesBuilt;
+      pageCount -= pagesBuilt;
+    }
+  }
+
+  if (rangeCount != 0)
+  {
+    EfiHvpIssueUnpinGpaPageRanges(pInputBuffer, rangeCount);
+  }
+
+  gBS->RestoreTPL(oldTpl);
+}
+
+STATIC
+UINT32
+EfiHvpFindPinObject(
+  IN  HV_GPA_PAGE_NUMBER  RequestGpaPageBase,
+  IN  UINT32              RequestPageCount,
+  IN  HV_GPA_PAGE_NUMBER  GpaPageBase
+  )
+/*++
+  Binary searches the pin table for the first object that does not sort
+  before (RequestGpaPageBase, RequestPageCount, GpaPageBase).
+
+  @param RequestGpaPageBase The request base to search for.
+
+  @param RequestPageCount The request size to search for.
+
+  @param GpaPageBase The pinned base to search for within the request.
+
+  @returns The index of the object, or the table count if every object
+           sorts before the key.
+
+--*/
+{
+  UINT32 low;
+  UINT32 high;
+  UINT32 middle;
+  PEFI_HV_PIN_OBJECT pinObject;
+
+  low = 0;
+  high = mPinnedPageTable.Count;
+  while (low < high)
+  {
+    middle = low + (high - low) / 2;
+    pinObject = &mPinnedPageTable.Objects[middle];
+    if ((pinObject->RequestGpaPageBase < RequestGpaPageBase) ||
+      ((pinObject->RequestGpaPageBase == RequestGpaPageBase) &&
+       (pinObject->RequestNumberOfPages < RequestPageCount)) ||
+      ((pinObject->RequestGpaPageBase == RequestGpaPageBase) &&
+       (pinObject->RequestNumberOfPages == RequestPageCount) &&
+       (pinObject->GpaPageBase < GpaPageBase)))
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
 EFI_STATUS
 EfiHvpTrackPinnedGpaPageRange(
   IN  HV_GPA_PAGE_NUMBER  RequestGpaPageBase,
@@ -185,24 +354,47 @@ EfiHvpTrackPinnedGpaPageRange(
   IN  UINT32              PinnedPageCount
   )
 {
-  EFI_HV_PIN_OBJECT *pinObject;
+  PEFI_HV_PIN_OBJECT objects;
+  UINT32 capacity;
+  UINT32 index;
 
   if (PinnedPageCount == 0)
   {
     FAIL_FAST(EFI_INVALID_PARAMETER, "Invalid tracked pin range");
   }
 
-  pinObject = AllocatePool(sizeof(*pinObject));
-  if (pinObject == NULL)
+  //
+  // Grow the table geometrically so tracking a pin is an amortized
+  // constant number of pool allocations.
+  //
+  if (mPinnedPageTable.Count == mPinnedPageTable.Capacity)
   {
-    return EFI_OUT_OF_RESOURCES;
+    capacity = MAX(mPinnedPageTable.Capacity * 2, 32);
+    objects =
+      ReallocatePool(
+        mPinnedPageTable.Capacity * sizeof(EFI_HV_PIN_OBJECT),
+        capacity * sizeof(EFI_HV_PIN_OBJECT),
+        mPinnedPageTable.Objects);
+    if (objects == NULL)
+    {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    mPinnedPageTable.Objects = objects;
+    mPinnedPageTable.Capacity = capacity;
   }
 
-  pinObject->RequestGpaPageBase = RequestGpaPageBase;
-  pinObject->RequestNumberOfPages = RequestPageCount;
-  pinObject->GpaPageBase = PinnedGpaPageBase;
-  pinObject->NumberOfPages = PinnedPageCount;
-  InsertTailList(&mPinnedPageList, &pinObject->ListEntry);
+  index = EfiHvpFindPinObject(RequestGpaPageBase, RequestPageCount, PinnedGpaPageBase);
+  CopyMem(
+    &mPinnedPageTable.Objects[index + 1],
+    &mPinnedPageTable.Objects[index],
+    (mPinnedPageTable.Count - index) * sizeof(EFI_HV_PIN_OBJECT));
+
+  mPinnedPageTable.Objects[index].RequestGpaPageBase = RequestGpaPageBase;
+  mPinnedPageTable.Objects[index].RequestNumberOfPages = RequestPageCount;
+  mPinnedPageTable.Objects[index].GpaPageBase = PinnedGpaPageBase;
+  mPinnedPageTable.Objects[index].NumberOfPages = PinnedPageCount;
+  mPinnedPageTable.Count += 1;
 
   return EFI_SUCCESS;
 }
@@ -213,43 +405,58 @@ EfiHvpUnpinTrackedGpaPageRanges(
   IN  UINT32              RequestPageCount
   )
 {
-  LIST_ENTRY *entry;
-  LIST_ENTRY *nextEntry;
-  EFI_HV_PIN_OBJECT *pinObject;
-  EFI_STATUS status;
-  UINT32 rangesUnpinned;
+  PEFI_HV_PIN_OBJECT objects;
+  UINT32 first;
+  UINT32 end;
+
+  //
+  // All objects of the request sit next to each other, in GPA order.
+  //
+  objects = mPinnedPageTable.Objects;
+  first = EfiHvpFindPinObject(RequestGpaPageBase, RequestPageCount, 0);
+  end = first;
+  while ((end < mPinnedPageTable.Count) &&
+    (objects[end].RequestGpaPageBase == RequestGpaPageBase) &&
+    (objects[end].RequestNumberOfPages == RequestPageCount))
+  {
+    end += 1;
+  }
 
-  rangesUnpinned = 0;
-  for (entry = GetFirstNode(&mPinnedPageList);
-     !IsNull(&mPinnedPageList, entry);
-     entry = nextEntry)
+  if (first == end)
   {
-    nextEntry = GetNextNode(&mPinnedPageList, entry);
-    pinObject = BASE_CR(entry, EFI_HV_PIN_OBJECT, ListEntry);
-    if ((pinObject->RequestGpaPageBase != RequestGpaPageBase) ||
-      (pinObject->RequestNumberOfPages != RequestPageCount))
-    {
-      continue;
-    }
+    return 0;
+  }
 
-    RemoveEntryList(&pinObject->ListEntry);
+  EfiHvpUnpinPinObjects(&objects[first], end - first);
 
-    status =
-      EfiHvpPinUnpinGpaPageRanges(
-        FALSE,
-        pinObject->NumberOfPages,
-        pinObject->GpaPageBase,
-        NULL);
-    if (EFI_ERROR(status))
-    {
-      FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
-    }
+  CopyMem(
+    &objects[first],
+    &objects[end],
+    (mPinnedPageTable.Count - end) * sizeof(EFI_HV_PIN_OBJECT));
+  mPinnedPageTable.Count -= end - first;
 
-    FreePool(pinObject);
-    rangesUnpinned += 1;
+  return end - first;
+}
+
+VOID
+EfiHvpUnpinAllTrackedGpaPageRanges(
+  VOID
+  )
+/*++
+  Unpins every tracked GPA range and frees the pin table. Used when the
+  connection to the hypervisor is torn down; objects whose ranges abut
+  share hypercall ranges.
+
+--*/
+{
+  EfiHvpUnpinPinObjects(mPinnedPageTable.Objects, mPinnedPageTable.Count);
+
+  if (mPinnedPageTable.Objects != NULL)
+  {
+    FreePool(mPinnedPageTable.Objects);
   }
 
-  return rangesUnpinned;
+  ZeroMem(&mPinnedPageTable, sizeof(mPinnedPageTable));
 }
 
 VOID
@@ -557,6 +764,7 @@ EfiHvPinAddressRange(
   UINT32 pageCount;
   UINT64 gpaPageBase;
   BOOLEAN pinApplied;
+  UINT32 index;
   EFI_STATUS status;
 
   if (PinApplied != NULL)
@@ -577,6 +785,20 @@ EfiHvPinAddressRange(
   gpaPageBase = (UINTN)BaseAddress / EFI_PAGE_SIZE;
   pinApplied = FALSE;
 
+  //
+  // A second pin of the same request could not be told apart from the first
+  // when unpinning.
+  //
+  index = EfiHvpFindPinObject(gpaPageBase, pageCount, 0);
+  if ((index < mPinnedPageTable.Count) &&
+    (mPinnedPageTable.Objects[index].RequestGpaPageBase == gpaPageBase) &&
+    (mPinnedPageTable.Objects[index].RequestNumberOfPages == pageCount))
+  {
+    status = EFI_ALREADY_STARTED;
+    DEBUG((DEBUG_ERROR, "--- %a: range is already pinned - %r \n", __func__, status));
+    return status;
+  }
+
   status =
     EfiHvpPinGpaPageRangeSkippingAlwaysPinnedPages(
       gpaPageBase,
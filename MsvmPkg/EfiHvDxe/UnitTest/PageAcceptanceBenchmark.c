@@ -0,0 +1,1108 @@
+/** @file
+    Host based benchmark of hardware page acceptance and host visibility
+    changes on isolated VMs without a paravisor.
+
+    HostVisibilityLib and EfiHvPageVisibility.c are linked against recording
+    models of PVALIDATE, the GHCB MSR protocol, the SVSM core PVALIDATE call,
+    TDG.MEM.PAGE.ACCEPT and the ModifySparseGpaPageHostVisibility hypercall.
+    The models keep per page state so that every run is also checked for
+    correctness: the host maps guest memory with large pages except for the
+    first 2 MB and any page whose visibility has changed, so large page
+    requests over such pages fail with a size mismatch, as on hardware.
+    Validation state is tracked per 4 KB page; RMP page size rules beyond
+    that are not modelled.
+
+    Guest memory comes from a memory map in the IGVM parameter format read
+    by ParseIgvmMemoryMap and from a config blob in the format read by
+    GetUefiConfigInfo. Costs are reported per GB so that changes in the
+    number of instructions, exits and hypercalls show up in CI without
+    confidential hardware, and each run is held to a budget.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../EfiHvInternal.h"
+#include <BiosInterface.h>
+#include <Library/UnitTestLib.h>
+#include <Library/UnitTestHostBaseLib.h>
+
+#define UNIT_TEST_APP_NAME     "Page Acceptance and Visibility Benchmark"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Guest physical memory modelled by the benchmark.
+//
+#define BENCHMARK_MEMORY_PAGES      (SIZE_64GB / EFI_PAGE_SIZE)
+#define BENCHMARK_PAGES_PER_GB      (SIZE_1GB / EFI_PAGE_SIZE)
+#define BENCHMARK_MAXIMUM_RANGES    16
+
+//
+// Per page model state.
+//
+#define PAGE_STATE_VALIDATED        0x01
+#define PAGE_STATE_SHARED           0x02
+#define PAGE_STATE_SPLIT            0x04
+
+//
+// Architectural values used by the models. These mirror the private
+// definitions in HostVisibilityLib.
+//
+#define BENCHMARK_MSR_GHCB                  0xC0010130
+#define BENCHMARK_GHCB_INFO_PSC_REQUEST     0x014
+#define BENCHMARK_GHCB_INFO_PSC_RESPONSE    0x015
+#define BENCHMARK_GHCB_SVSM_CALL            0x016
+#define BENCHMARK_GHCB_PSC_PRIVATE          0x001
+#define BENCHMARK_GHCB_PSC_SHARED           0x002
+
+#define BENCHMARK_SNP_SUCCESS               0
+#define BENCHMARK_SNP_FAIL_INPUT            1
+#define BENCHMARK_SNP_FAIL_SIZEMISMATCH     6
+#define BENCHMARK_SNP_FAIL_UNCHANGED        0x10
+
+#define BENCHMARK_SVSM_CORE_PVALIDATE       1
+#define BENCHMARK_SVSM_ERR_PVALIDATE        0x80001000
+#define BENCHMARK_SVSM_PVALIDATE_SIZE       0x1
+#define BENCHMARK_SVSM_PVALIDATE_VALIDATE   0x4
+
+#define BENCHMARK_TDX_SUCCESS               0
+#define BENCHMARK_TDX_ALREADY_ACCEPTED      (0x00000B0AULL << 32)
+#define BENCHMARK_TDX_SIZE_MISMATCH         (0xC0000B0BULL << 32)
+#define BENCHMARK_TDX_OPERAND_INVALID       (0xC0000100ULL << 32)
+
+//
+// IGVM memory map entry, as parsed by ParseIgvmMemoryMap.
+//
+typedef struct {
+    UINT64  StartingGpaPageNumber;
+    UINT64  NumberOfPages;
+    UINT16  Type;
+    UINT16  Flags;
+    UINT32  Reserved;
+} BENCHMARK_IGVM_MEMORY_MAP_ENTRY;
+
+#define BENCHMARK_IGVM_MEMORY               0x0
+#define BENCHMARK_IGVM_PLATFORM_RESERVED    0x1
+
+//
+// Header of the SVSM core PVALIDATE calling area.
+//
+typedef struct {
+    UINT8   CallPending;
+    UINT8   Reserved1[7];
+    UINT16  NumberOfEntries;
+    UINT16  NextEntryIndex;
+    UINT32  Reserved2;
+} BENCHMARK_SVSM_PVALIDATE;
+
+//
+// A config blob as sent by the host: the structure count, BIOS information
+// and a memory map.
+//
+typedef struct {
+    UEFI_CONFIG_STRUCTURE_COUNT     Count;
+    UEFI_CONFIG_BIOS_INFORMATION    BiosInformation;
+    UEFI_CONFIG_HEADER              MemoryMapHeader;
+    VM_MEMORY_RANGE_V5              MemoryMap[4];
+} BENCHMARK_CONFIG_BLOB;
+
+typedef struct {
+    HV_GPA_PAGE_NUMBER  BasePage;
+    UINT64              PageCount;
+} BENCHMARK_RANGE;
+
+typedef struct {
+    CONST CHAR8      *Name;
+    BENCHMARK_RANGE  Ranges[BENCHMARK_MAXIMUM_RANGES];
+    UINT32           RangeCount;
+    UINT64           PageCount;
+} BENCHMARK_MEMORY_MAP;
+
+typedef struct {
+    UINT64  Pvalidate;
+    UINT64  TdAccept;
+    UINT64  VmgExit;
+    UINT64  PageStateChange;
+    UINT64  SvsmCall;
+    UINT64  Hypercall;
+    UINT64  HypercallRep;
+} BENCHMARK_COUNTS;
+
+//
+// Budgets hold the total of instructions, exits and hypercalls per GB. They
+// sit just above the current costs so that a regression fails the run.
+//
+// Workload ranges are made visible one at a time, as drivers do, and made
+// not visible again in one batch, as ExitBootServices does.
+//
+typedef struct {
+    CONST CHAR8  *Name;
+    UINT32       IsolationType;
+    BOOLEAN      Svsm;
+    UINT32       HostPageLevel;
+    UINT64       AcceptBudgetPerGb;
+    UINT64       VisibilityBudgetPerGb;
+    UINT64       EarlyVisibilityBudgetPerGb;
+} BENCHMARK_PLATFORM;
+
+STATIC CONST BENCHMARK_PLATFORM  mPlatforms[] = {
+    { "SNP",      UefiIsolationTypeSnp, FALSE, 1, 600, 316000, 1100000 },
+    { "SNP+SVSM", UefiIsolationTypeSnp, TRUE,  1, 600, 331000,  875000 },
+    { "TDX",      UefiIsolationTypeTdx, FALSE, 2, 120, 286000,       0 },
+};
+
+//
+// A 16 GB VM as described by IGVM parameters, with a reserved page range
+// below the MMIO gap.
+//
+STATIC CONST BENCHMARK_IGVM_MEMORY_MAP_ENTRY  mIgvmMemoryMap[] = {
+    { 0x0,      0xEFF00,  BENCHMARK_IGVM_MEMORY,            0, 0 },
+    { 0xEFF00,  0x100,    BENCHMARK_IGVM_PLATFORM_RESERVED, 0, 0 },
+    { 0x100000, 0x300000, BENCHMARK_IGVM_MEMORY,            0, 0 },
+    { 0,        0,        0,                                0, 0 },
+};
+
+//
+// A 64 GB VM as described by the config blob, with two NUMA nodes above
+// 4 GB and persistent memory at the top.
+//
+STATIC CONST BENCHMARK_CONFIG_BLOB  mConfigBlob = {
+    { { UefiConfigStructureCount, sizeof (UEFI_CONFIG_STRUCTURE_COUNT) }, 3, sizeof (BENCHMARK_CONFIG_BLOB) },
+    { { UefiConfigBiosInformation, sizeof (UEFI_CONFIG_BIOS_INFORMATION) }, 0, { 0, 0 } },
+    { UefiConfigMemoryMap, sizeof (UEFI_CONFIG_HEADER) + 4 * sizeof (VM_MEMORY_RANGE_V5) },
+    {
+        { 0x0,              0xB8000000,         0,                                      0 },
+        { SIZE_4GB,         28 * SIZE_1GB,      0,                                      0 },
+        { 32 * SIZE_1GB,    30 * SIZE_1GB,      0,                                      0 },
+        { 62 * SIZE_1GB,    SIZE_2GB,           VM_MEMORY_RANGE_FLAG_PERSISTENT_MEMORY, 0 },
+    },
+};
+
+//
+// Globals normally owned by the rest of EfiHvDxe.
+//
+HV_HYPERCALL_CONTEXT  mHvContext;
+HV_HYPERCALL_CONTEXT  mHvBypassContext;
+BOOLEAN               mBypassOnly;
+PEFI_HV_PAGES         mHvPages;
+LIST_ENTRY            mHostVisiblePageList = INITIALIZE_LIST_HEAD_VARIABLE (mHostVisiblePageList);
+UINT32                mIsolationType;
+VOID                  *mSvsmCallingArea;
+
+STATIC EFI_BOOT_SERVICES  mBootServices;
+EFI_BOOT_SERVICES         *gBS = &mBootServices;
+
+STATIC UINT8                     *mPageState;
+STATIC UINT8                     mOutOfRangePageState;
+STATIC BOOLEAN                   mModelError;
+STATIC UINT32                    mHostPageLevel;
+STATIC UINT64                    mGhcbMsr;
+STATIC VOID                      *mSvsmCallingAreaAllocation;
+STATIC BENCHMARK_COUNTS          mCounts;
+STATIC BENCHMARK_MEMORY_MAP      mMemoryMaps[2];
+
+
+STATIC
+UINT8 *
+ModelPage (
+    IN  HV_GPA_PAGE_NUMBER  PageNumber
+    )
+{
+    if (PageNumber >= BENCHMARK_MEMORY_PAGES) {
+        mModelError = TRUE;
+        return &mOutOfRangePageState;
+    }
+
+    return &mPageState[PageNumber];
+}
+
+
+/**
+  Return TRUE if the host maps the naturally aligned page of the given level
+  (0 for 4 KB, 1 for 2 MB, 2 for 1 GB) at that size.
+**/
+STATIC
+BOOLEAN
+HostMapsLargePage (
+    IN  HV_GPA_PAGE_NUMBER  PageNumber,
+    IN  UINT32              Level
+    )
+{
+    UINT64  Index;
+    UINT64  PageCount;
+
+    if (Level == 0) {
+        return TRUE;
+    }
+
+    if ((Level > mHostPageLevel) || (PageNumber < (SIZE_2MB / EFI_PAGE_SIZE))) {
+        return FALSE;
+    }
+
+    PageCount = 1ULL << (9 * Level);
+    for (Index = 0; Index < PageCount; Index++) {
+        if ((*ModelPage (PageNumber + Index) & PAGE_STATE_SPLIT) != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+  Model PVALIDATE, returning the SNP error code.
+**/
+STATIC
+UINT64
+ModelPvalidate (
+    IN  HV_GPA_PAGE_NUMBER  PageNumber,
+    IN  UINT32              Level,
+    IN  BOOLEAN             Validate,
+    OUT BOOLEAN             *Unchanged
+    )
+{
+    UINT64  Index;
+    UINT64  PageCount;
+    UINT8   *State;
+
+    mCounts.Pvalidate++;
+    *Unchanged = FALSE;
+
+    PageCount = 1ULL << (9 * Level);
+    if ((Level > 1) ||
+        ((PageNumber & (PageCount - 1)) != 0) ||
+        (PageNumber + PageCount > BENCHMARK_MEMORY_PAGES))
+    {
+        return BENCHMARK_SNP_FAIL_INPUT;
+    }
+
+    if (!HostMapsLargePage (PageNumber, Level)) {
+        return BENCHMARK_SNP_FAIL_SIZEMISMATCH;
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        State = ModelPage (PageNumber + Index);
+        if ((*State & PAGE_STATE_SHARED) != 0) {
+            return BENCHMARK_SNP_FAIL_INPUT;
+        }
+
+        if (((*State & PAGE_STATE_VALIDATED) != 0) == Validate) {
+            *Unchanged = TRUE;
+            return BENCHMARK_SNP_SUCCESS;
+        }
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        State = ModelPage (PageNumber + Index);
+        *State = Validate ? (*State | PAGE_STATE_VALIDATED) : (*State & ~PAGE_STATE_VALIDATED);
+    }
+
+    return BENCHMARK_SNP_SUCCESS;
+}
+
+
+/**
+  Model a change of page ownership between guest and host. The host maps a
+  converted page with 4 KB pages from then on.
+**/
+STATIC
+VOID
+ModelConvertPage (
+    IN  HV_GPA_PAGE_NUMBER  PageNumber,
+    IN  BOOLEAN             Shared
+    )
+{
+    UINT8  *State;
+
+    State = ModelPage (PageNumber);
+    if ((mIsolationType == UefiIsolationTypeSnp) && ((*State & PAGE_STATE_VALIDATED) != 0)) {
+        //
+        // The guest must rescind validation before giving a page away.
+        //
+        mModelError = TRUE;
+    }
+
+    *State = PAGE_STATE_SPLIT | (Shared ? PAGE_STATE_SHARED : 0);
+}
+
+
+UINT64
+EFIAPI
+_sev_pvalidate (
+    IN  VOID    *Address,
+        UINT32  PageSize,
+        UINT32  Validate,
+    OUT UINT64  *ErrorCode
+    )
+{
+    BOOLEAN  Unchanged;
+
+    *ErrorCode = ModelPvalidate ((UINTN)Address / EFI_PAGE_SIZE, PageSize, Validate != 0, &Unchanged);
+    return Unchanged ? 1 : 0;
+}
+
+
+/**
+  Model the SVSM core PVALIDATE call, which processes calling area entries
+  until one fails.
+**/
+STATIC
+UINT64
+ModelSvsmPvalidate (
+    IN  UINT64  Parameter
+    )
+{
+    BENCHMARK_SVSM_PVALIDATE  *Pvalidate;
+    UINT64                    *Entries;
+    UINT64                    Entry;
+    UINT64                    ErrorCode;
+    BOOLEAN                   Unchanged;
+
+    mCounts.SvsmCall++;
+
+    Pvalidate = (BENCHMARK_SVSM_PVALIDATE *)(UINTN)(Parameter - OFFSET_OF (BENCHMARK_SVSM_PVALIDATE, NumberOfEntries));
+    Entries   = (UINT64 *)(Pvalidate + 1);
+    ErrorCode = 0;
+
+    while (Pvalidate->NextEntryIndex < Pvalidate->NumberOfEntries) {
+        Entry     = Entries[Pvalidate->NextEntryIndex];
+        ErrorCode = ModelPvalidate (
+                        Entry / EFI_PAGE_SIZE,
+                        (UINT32)(Entry & BENCHMARK_SVSM_PVALIDATE_SIZE),
+                        (Entry & BENCHMARK_SVSM_PVALIDATE_VALIDATE) != 0,
+                        &Unchanged
+                        );
+        if (Unchanged) {
+            ErrorCode = BENCHMARK_SNP_FAIL_UNCHANGED;
+        }
+
+        if (ErrorCode != BENCHMARK_SNP_SUCCESS) {
+            ErrorCode += BENCHMARK_SVSM_ERR_PVALIDATE;
+            break;
+        }
+
+        Pvalidate->NextEntryIndex++;
+    }
+
+    Pvalidate->CallPending = 0;
+    return ErrorCode;
+}
+
+
+UINT64
+EFIAPI
+MsVmgExit (
+    UINT64  VmgExitRax,
+    UINT64  VmgExitRcx
+    )
+{
+    mCounts.VmgExit++;
+
+    if ((mGhcbMsr & 0xFFF) == BENCHMARK_GHCB_INFO_PSC_REQUEST) {
+        mCounts.PageStateChange++;
+
+        switch (RShiftU64 (mGhcbMsr, 52)) {
+        case BENCHMARK_GHCB_PSC_PRIVATE:
+            ModelConvertPage (RShiftU64 (mGhcbMsr, 12) & (BIT40 - 1), FALSE);
+            break;
+
+        case BENCHMARK_GHCB_PSC_SHARED:
+            ModelConvertPage (RShiftU64 (mGhcbMsr, 12) & (BIT40 - 1), TRUE);
+            break;
+
+        default:
+            mModelError = TRUE;
+            return 0;
+        }
+
+        mGhcbMsr = BENCHMARK_GHCB_INFO_PSC_RESPONSE;
+        return 0;
+    }
+
+    if ((mGhcbMsr == BENCHMARK_GHCB_SVSM_CALL) && (VmgExitRax == BENCHMARK_SVSM_CORE_PVALIDATE)) {
+        return ModelSvsmPvalidate (VmgExitRcx);
+    }
+
+    mModelError = TRUE;
+    return MAX_UINT64;
+}
+
+
+STATIC
+UINT64
+EFIAPI
+ModelReadMsr64 (
+    IN  UINT32  Index
+    )
+{
+    if (Index != BENCHMARK_MSR_GHCB) {
+        mModelError = TRUE;
+        return 0;
+    }
+
+    return mGhcbMsr;
+}
+
+
+STATIC
+UINT64
+EFIAPI
+ModelWriteMsr64 (
+    IN  UINT32  Index,
+    IN  UINT64  Value
+    )
+{
+    if (Index != BENCHMARK_MSR_GHCB) {
+        mModelError = TRUE;
+        return Value;
+    }
+
+    mGhcbMsr = Value;
+    return Value;
+}
+
+
+UINT64
+EFIAPI
+_tdx_tdg_mem_page_accept (
+    UINT64  AcceptGpa
+    )
+{
+    HV_GPA_PAGE_NUMBER  PageNumber;
+    UINT32              Level;
+    UINT64              PageCount;
+    UINT64              Index;
+
+    mCounts.TdAccept++;
+
+    Level      = (UINT32)(AcceptGpa & 0x7);
+    PageNumber = AcceptGpa / EFI_PAGE_SIZE;
+    PageCount  = 1ULL << (9 * Level);
+
+    if ((Level > 2) ||
+        ((PageNumber & (PageCount - 1)) != 0) ||
+        (PageNumber + PageCount > BENCHMARK_MEMORY_PAGES))
+    {
+        return BENCHMARK_TDX_OPERAND_INVALID;
+    }
+
+    if (!HostMapsLargePage (PageNumber, Level)) {
+        return BENCHMARK_TDX_SIZE_MISMATCH;
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        if ((mPageState[PageNumber + Index] & PAGE_STATE_SHARED) != 0) {
+            return BENCHMARK_TDX_OPERAND_INVALID;
+        }
+
+        if ((mPageState[PageNumber + Index] & PAGE_STATE_VALIDATED) != 0) {
+            return BENCHMARK_TDX_ALREADY_ACCEPTED;
+        }
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        mPageState[PageNumber + Index] |= PAGE_STATE_VALIDATED;
+    }
+
+    return BENCHMARK_TDX_SUCCESS;
+}
+
+
+//
+// The TDX conversion used before the hypervisor connection is established
+// depends on the shared GPA boundary PCD, which is set at runtime by
+// PlatformPei, so it is not exercised here.
+//
+UINT64
+EFIAPI
+_tdx_vmcall_map_gpa (
+    UINT64  Gpa,
+    UINT64  Size,
+    UINT64  *FailedGpa
+    )
+{
+    mModelError = TRUE;
+    return MAX_UINT64;
+}
+
+
+HV_STATUS
+HvHypercallIssue (
+    IN              HV_HYPERCALL_CONTEXT    *Context,
+                    HV_CALL_CODE            CallCode,
+                    BOOLEAN                 Fast,
+                    UINT32                  CountOfElements,
+                    UINT64                  FirstRegister,
+                    UINT64                  SecondRegister,
+    OUT OPTIONAL    UINT32                  *ElementsProcessed
+    )
+{
+    PHV_INPUT_MODIFY_SPARSE_GPA_PAGE_HOST_VISIBILITY  Input;
+    UINT32                                            Index;
+
+    mCounts.Hypercall++;
+
+    if ((CallCode != HvCallModifySparseGpaPageHostVisibility) || Fast || !Context->Connected) {
+        mModelError = TRUE;
+        return HV_STATUS_INVALID_PARAMETER;
+    }
+
+    Input = (PHV_INPUT_MODIFY_SPARSE_GPA_PAGE_HOST_VISIBILITY)(UINTN)FirstRegister;
+    for (Index = 0; Index < CountOfElements; Index++) {
+        mCounts.HypercallRep++;
+        ModelConvertPage (Input->GpaPageList[Index], Input->HostVisibility != HV_MAP_GPA_PERMISSIONS_NONE);
+    }
+
+    if (ElementsProcessed != NULL) {
+        *ElementsProcessed = CountOfElements;
+    }
+
+    return HV_STATUS_SUCCESS;
+}
+
+
+EFI_STATUS
+EfiHvConvertStatus (
+    IN  HV_STATUS  Status
+    )
+{
+    return (Status == HV_STATUS_SUCCESS) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+
+UINTN
+EfiHvpBasePa (
+    UINTN  Address
+    )
+{
+    return Address;
+}
+
+
+VOID *
+EfiHvpSharedVa (
+    VOID  *Address
+    )
+{
+    return Address;
+}
+
+
+BOOLEAN
+IsParavisorPresent (
+    VOID
+    )
+{
+    return FALSE;
+}
+
+
+BOOLEAN
+IsIsolatedEx (
+    UINT32  IsolationType
+    )
+{
+    return IsolationType != UefiIsolationTypeNone;
+}
+
+
+BOOLEAN
+IsHardwareIsolatedEx (
+    UINT32  IsolationType
+    )
+{
+    return (IsolationType == UefiIsolationTypeSnp) || (IsolationType == UefiIsolationTypeTdx);
+}
+
+
+BOOLEAN
+IsSoftwareIsolatedEx (
+    UINT32  IsolationType
+    )
+{
+    return IsolationType == UefiIsolationTypeVbs;
+}
+
+
+BOOLEAN
+IsHardwareIsolatedNoParavisorEx (
+    UINT32   IsolationType,
+    BOOLEAN  ParavisorPresent
+    )
+{
+    return IsHardwareIsolatedEx (IsolationType) && !ParavisorPresent;
+}
+
+
+STATIC
+EFI_TPL
+EFIAPI
+TestRaiseTpl (
+    IN EFI_TPL  NewTpl
+    )
+{
+    return TPL_APPLICATION;
+}
+
+
+STATIC
+VOID
+EFIAPI
+TestRestoreTpl (
+    IN EFI_TPL  OldTpl
+    )
+{
+}
+
+
+/**
+  Read the RAM ranges of an IGVM memory map, with the checks made by
+  ParseIgvmMemoryMap.
+**/
+STATIC
+EFI_STATUS
+ReadIgvmMemoryMap (
+    IN  CONST BENCHMARK_IGVM_MEMORY_MAP_ENTRY  *Entries,
+    IN  UINTN                                  EntryCount,
+    OUT BENCHMARK_MEMORY_MAP                   *MemoryMap
+    )
+{
+    UINTN   Index;
+    UINT64  NextPage;
+
+    NextPage = 0;
+    for (Index = 0; (Index < EntryCount) && (Entries[Index].NumberOfPages != 0); Index++) {
+        if ((Entries[Index].StartingGpaPageNumber < NextPage) ||
+            (Entries[Index].StartingGpaPageNumber + Entries[Index].NumberOfPages <= Entries[Index].StartingGpaPageNumber))
+        {
+            return EFI_DEVICE_ERROR;
+        }
+
+        NextPage = Entries[Index].StartingGpaPageNumber + Entries[Index].NumberOfPages;
+
+        switch (Entries[Index].Type) {
+        case BENCHMARK_IGVM_MEMORY:
+            if (MemoryMap->RangeCount == BENCHMARK_MAXIMUM_RANGES) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+
+            MemoryMap->Ranges[MemoryMap->RangeCount].BasePage  = Entries[Index].StartingGpaPageNumber;
+            MemoryMap->Ranges[MemoryMap->RangeCount].PageCount = Entries[Index].NumberOfPages;
+            MemoryMap->RangeCount++;
+            MemoryMap->PageCount += Entries[Index].NumberOfPages;
+            break;
+
+        case BENCHMARK_IGVM_PLATFORM_RESERVED:
+            break;
+
+        default:
+            return EFI_DEVICE_ERROR;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+/**
+  Walk a config blob the way GetUefiConfigInfo does and read the RAM ranges
+  of its memory map. Reserved and persistent ranges are not accepted.
+**/
+STATIC
+EFI_STATUS
+ReadConfigMemoryMap (
+    IN  CONST VOID            *Blob,
+    OUT BENCHMARK_MEMORY_MAP  *MemoryMap
+    )
+{
+    CONST UEFI_CONFIG_STRUCTURE_COUNT  *Count;
+    CONST UEFI_CONFIG_HEADER           *Header;
+    CONST VM_MEMORY_RANGE_V5           *Ranges;
+    UINT32                             Offset;
+    UINT32                             Structure;
+    UINT32                             RangeCount;
+    UINT32                             Index;
+
+    Count = Blob;
+    if ((Count->Header.Type != UefiConfigStructureCount) ||
+        (Count->Header.Length != sizeof (*Count)))
+    {
+        return EFI_DEVICE_ERROR;
+    }
+
+    Offset = Count->Header.Length;
+    for (Structure = 1; Structure < Count->TotalStructureCount; Structure++) {
+        Header = (CONST UEFI_CONFIG_HEADER *)((CONST UINT8 *)Blob + Offset);
+        if ((Offset + sizeof (*Header) > Count->TotalConfigBlobSize) ||
+            (Header->Length < sizeof (*Header)) ||
+            (Header->Length > Count->TotalConfigBlobSize - Offset))
+        {
+            return EFI_DEVICE_ERROR;
+        }
+
+        Offset += Header->Length;
+        if (Header->Type != UefiConfigMemoryMap) {
+            continue;
+        }
+
+        Ranges     = (CONST VM_MEMORY_RANGE_V5 *)((CONST UEFI_CONFIG_MEMORY_MAP *)Header)->MemoryMap;
+        RangeCount = (Header->Length - sizeof (*Header)) / sizeof (VM_MEMORY_RANGE_V5);
+        for (Index = 0; Index < RangeCount; Index++) {
+            if ((Ranges[Index].Flags & (VM_MEMORY_RANGE_FLAG_PLATFORM_RESERVED | VM_MEMORY_RANGE_FLAG_PERSISTENT_MEMORY)) != 0) {
+                continue;
+            }
+
+            if (MemoryMap->RangeCount == BENCHMARK_MAXIMUM_RANGES) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+
+            MemoryMap->Ranges[MemoryMap->RangeCount].BasePage  = Ranges[Index].BaseAddress / EFI_PAGE_SIZE;
+            MemoryMap->Ranges[MemoryMap->RangeCount].PageCount = Ranges[Index].Length / EFI_PAGE_SIZE;
+            MemoryMap->RangeCount++;
+            MemoryMap->PageCount += Ranges[Index].Length / EFI_PAGE_SIZE;
+        }
+    }
+
+    return (MemoryMap->RangeCount != 0) ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+
+STATIC
+VOID
+ResetModel (
+    IN  CONST BENCHMARK_PLATFORM  *Platform
+    )
+{
+    SetMem (mPageState, BENCHMARK_MEMORY_PAGES, 0);
+    ZeroMem (&mCounts, sizeof (mCounts));
+    mModelError    = FALSE;
+    mGhcbMsr       = 0;
+    mIsolationType = Platform->IsolationType;
+    mHostPageLevel = Platform->HostPageLevel;
+    mSvsmCallingArea = Platform->Svsm ? ALIGN_POINTER (mSvsmCallingAreaAllocation, EFI_PAGE_SIZE) : NULL;
+}
+
+
+STATIC
+BOOLEAN
+RangeHasState (
+    IN  HV_GPA_PAGE_NUMBER  BasePage,
+    IN  UINT64              PageCount,
+    IN  UINT8               State
+    )
+{
+    UINT64  Index;
+
+    for (Index = 0; Index < PageCount; Index++) {
+        if ((mPageState[BasePage + Index] & (PAGE_STATE_VALIDATED | PAGE_STATE_SHARED)) != State) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/**
+  Report the recorded counts per GB and return their total per GB.
+**/
+STATIC
+UINT64
+ReportCounts (
+    IN  CONST CHAR8  *Scenario,
+    IN  CONST CHAR8  *MemoryMapName,
+    IN  CONST CHAR8  *PlatformName,
+    IN  UINT64       PageCount
+    )
+{
+    UINT64  Total;
+
+    Total = mCounts.Pvalidate + mCounts.TdAccept + mCounts.VmgExit + mCounts.Hypercall;
+
+    DEBUG ((DEBUG_INFO,
+        "%a %a %a: per GB %lu PVALIDATE, %lu TDCALL, %lu VMGEXIT (%lu page state changes, %lu SVSM calls), %lu hypercalls (%lu reps), total %lu\n",
+        Scenario,
+        MemoryMapName,
+        PlatformName,
+        mCounts.Pvalidate * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.TdAccept * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.VmgExit * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.PageStateChange * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.SvsmCall * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.Hypercall * BENCHMARK_PAGES_PER_GB / PageCount,
+        mCounts.HypercallRep * BENCHMARK_PAGES_PER_GB / PageCount,
+        Total * BENCHMARK_PAGES_PER_GB / PageCount));
+
+    return Total * BENCHMARK_PAGES_PER_GB / PageCount;
+}
+
+
+/**
+  Accept all RAM in each memory map, as PlatformPei does at boot, and check
+  that every RAM page and nothing else ends up accepted.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkBootAcceptance (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST BENCHMARK_PLATFORM    *Platform;
+    CONST BENCHMARK_MEMORY_MAP  *MemoryMap;
+    UINTN                       PlatformIndex;
+    UINTN                       MapIndex;
+    UINT32                      Index;
+    UINT64                      AcceptedPages;
+    UINT64                      Page;
+
+    for (MapIndex = 0; MapIndex < ARRAY_SIZE (mMemoryMaps); MapIndex++) {
+        MemoryMap = &mMemoryMaps[MapIndex];
+
+        for (PlatformIndex = 0; PlatformIndex < ARRAY_SIZE (mPlatforms); PlatformIndex++) {
+            Platform = &mPlatforms[PlatformIndex];
+            ResetModel (Platform);
+
+            for (Index = 0; Index < MemoryMap->RangeCount; Index++) {
+                UT_ASSERT_NOT_EFI_ERROR (
+                    EfiUpdatePageRangeAcceptance (
+                        mIsolationType,
+                        mSvsmCallingArea,
+                        MemoryMap->Ranges[Index].BasePage,
+                        MemoryMap->Ranges[Index].PageCount,
+                        TRUE
+                        )
+                    );
+            }
+
+            UT_ASSERT_FALSE (mModelError);
+
+            AcceptedPages = 0;
+            for (Page = 0; Page < BENCHMARK_MEMORY_PAGES; Page++) {
+                AcceptedPages += mPageState[Page] & PAGE_STATE_VALIDATED;
+            }
+
+            UT_ASSERT_EQUAL (AcceptedPages, MemoryMap->PageCount);
+            for (Index = 0; Index < MemoryMap->RangeCount; Index++) {
+                UT_ASSERT_TRUE (RangeHasState (MemoryMap->Ranges[Index].BasePage, MemoryMap->Ranges[Index].PageCount, PAGE_STATE_VALIDATED));
+            }
+
+            UT_ASSERT_TRUE (ReportCounts ("Accept", MemoryMap->Name, Platform->Name, MemoryMap->PageCount) <= Platform->AcceptBudgetPerGb);
+        }
+    }
+
+    return UNIT_TEST_PASSED;
+}
+
+
+//
+// A shared buffer of the visibility workload.
+//
+typedef struct {
+    VOID    *BaseAddress;
+    UINT32  ByteCount;
+} BENCHMARK_VISIBILITY_RANGE;
+
+/**
+  Build a set of shared buffers like those of a running VM: 2 MB aligned
+  bounce buffers, VMBus ring buffers and single page message buffers, all
+  within the first gigabyte above 1 GB.
+**/
+STATIC
+UINT32
+BuildVisibilityWorkload (
+    OUT BENCHMARK_VISIBILITY_RANGE  *Ranges,
+    OUT UINT64                      *PageCount
+    )
+{
+    UINT32              Count;
+    UINT32              Index;
+    HV_GPA_PAGE_NUMBER  BasePage;
+
+    Count      = 0;
+    *PageCount = 0;
+    BasePage   = BENCHMARK_PAGES_PER_GB;
+
+    for (Index = 0; Index < 8; Index++) {
+        Ranges[Count].BaseAddress = (VOID *)(UINTN)((BasePage + Index * 1024) * EFI_PAGE_SIZE);
+        Ranges[Count].ByteCount   = SIZE_2MB;
+        Count++;
+    }
+
+    BasePage += 8 * 1024;
+    for (Index = 0; Index < 32; Index++) {
+        Ranges[Count].BaseAddress = (VOID *)(UINTN)((BasePage + Index * 17) * EFI_PAGE_SIZE);
+        Ranges[Count].ByteCount   = 16 * EFI_PAGE_SIZE;
+        Count++;
+    }
+
+    BasePage += 32 * 17;
+    for (Index = 0; Index < 64; Index++) {
+        Ranges[Count].BaseAddress = (VOID *)(UINTN)((BasePage + Index * 2) * EFI_PAGE_SIZE);
+        Ranges[Count].ByteCount   = EFI_PAGE_SIZE;
+        Count++;
+    }
+
+    for (Index = 0; Index < Count; Index++) {
+        *PageCount += Ranges[Index].ByteCount / EFI_PAGE_SIZE;
+    }
+
+    return Count;
+}
+
+
+/**
+  Make the workload visible and private again in each phase: through the
+  hypercall once the hypervisor is connected, and with the GHCB protocol
+  directly before that.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkVisibility (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    BENCHMARK_VISIBILITY_RANGE  Ranges[128];
+    EFI_HV_PROTECTION_HANDLE    Handles[128];
+    CONST BENCHMARK_PLATFORM    *Platform;
+    UINT64                      WorkloadPages;
+    UINT32                      RangeCount;
+    UINTN                       PlatformIndex;
+    UINT32                      Phase;
+    UINT32                      Index;
+    UINT64                      Budget;
+
+    RangeCount = BuildVisibilityWorkload (Ranges, &WorkloadPages);
+
+    for (PlatformIndex = 0; PlatformIndex < ARRAY_SIZE (mPlatforms); PlatformIndex++) {
+        Platform = &mPlatforms[PlatformIndex];
+
+        for (Phase = 0; Phase < 2; Phase++) {
+            mHvContext.Connected       = (Phase == 0);
+            mHvBypassContext.Connected = (Phase == 0);
+            Budget = (Phase == 0) ? Platform->VisibilityBudgetPerGb : Platform->EarlyVisibilityBudgetPerGb;
+            if (Budget == 0) {
+                continue;
+            }
+
+            ResetModel (Platform);
+            UT_ASSERT_NOT_EFI_ERROR (EfiUpdatePageRangeAcceptance (mIsolationType, mSvsmCallingArea, BENCHMARK_PAGES_PER_GB, BENCHMARK_PAGES_PER_GB, TRUE));
+            ZeroMem (&mCounts, sizeof (mCounts));
+
+            for (Index = 0; Index < RangeCount; Index++) {
+                UT_ASSERT_NOT_EFI_ERROR (
+                    EfiHvMakeAddressRangeHostVisible (
+                        NULL,
+                        HV_MAP_GPA_READABLE | HV_MAP_GPA_WRITABLE,
+                        Ranges[Index].BaseAddress,
+                        Ranges[Index].ByteCount,
+                        FALSE,
+                        &Handles[Index]));
+                UT_ASSERT_TRUE (RangeHasState ((UINTN)Ranges[Index].BaseAddress / EFI_PAGE_SIZE, Ranges[Index].ByteCount / EFI_PAGE_SIZE, PAGE_STATE_SHARED));
+            }
+
+            EfiHvpMakeAddressRangesNotHostVisible (Handles, RangeCount);
+            UT_ASSERT_FALSE (mModelError);
+            UT_ASSERT_TRUE (IsListEmpty (&mHostVisiblePageList));
+            UT_ASSERT_TRUE (RangeHasState (BENCHMARK_PAGES_PER_GB, BENCHMARK_PAGES_PER_GB, PAGE_STATE_VALIDATED));
+
+            UT_ASSERT_TRUE (ReportCounts ((Phase == 0) ? "Visibility" : "EarlyVisibility", "workload", Platform->Name, WorkloadPages) <= Budget);
+        }
+    }
+
+    mHvContext.Connected       = FALSE;
+    mHvBypassContext.Connected = FALSE;
+    return UNIT_TEST_PASSED;
+}
+
+
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+    VOID
+    )
+{
+    EFI_STATUS                  Status;
+    UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+    UNIT_TEST_SUITE_HANDLE      Suite;
+
+    mBootServices.RaiseTPL   = TestRaiseTpl;
+    mBootServices.RestoreTPL = TestRestoreTpl;
+    gUnitTestHostBaseLib.X86->AsmReadMsr64  = ModelReadMsr64;
+    gUnitTestHostBaseLib.X86->AsmWriteMsr64 = ModelWriteMsr64;
+
+    mPageState                 = AllocatePool (BENCHMARK_MEMORY_PAGES);
+    mHvPages                   = AllocateZeroPool (sizeof (*mHvPages));
+    mSvsmCallingAreaAllocation = AllocateZeroPool (2 * EFI_PAGE_SIZE);
+    if ((mPageState == NULL) || (mHvPages == NULL) || (mSvsmCallingAreaAllocation == NULL)) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Exit;
+    }
+
+    mMemoryMaps[0].Name = "IGVM-16GB";
+    Status = ReadIgvmMemoryMap (mIgvmMemoryMap, ARRAY_SIZE (mIgvmMemoryMap), &mMemoryMaps[0]);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    mMemoryMaps[1].Name = "Config-64GB";
+    Status = ReadConfigMemoryMap (&mConfigBlob, &mMemoryMaps[1]);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    Status = CreateUnitTestSuite (&Suite, Framework, "Page Acceptance and Visibility", "EfiHvDxe.PageAcceptance", NULL, NULL);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    AddTestCase (Suite, "Boot acceptance of RAM stays within budget", "BootAcceptance", BenchmarkBootAcceptance, NULL, NULL, NULL);
+    AddTestCase (Suite, "Visibility round trips stay within budget", "Visibility", BenchmarkVisibility, NULL, NULL, NULL);
+
+    Status = RunAllTestSuites (Framework);
+
+Exit:
+    if (Framework != NULL) {
+        FreeUnitTestFramework (Framework);
+    }
+
+    if (mPageState != NULL) {
+        FreePool (mPageState);
+    }
+
+    if (mHvPages != NULL) {
+        FreePool (mHvPages);
+    }
+
+    if (mSvsmCallingAreaAllocation != NULL) {
+        FreePool (mSvsmCallingAreaAllocation);
+    }
+
+    return Status;
+}
+
+
+int
+main (
+    int   argc,
+    char  *argv[]
+    )
+{
+    return UefiTestMain ();
+}
@@ -0,0 +1,53 @@
+/** @file
+  Shared definitions for the config blob index passed from PEI to DXE via a HOB.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#pragma once
+
+#include <Uefi.h>
+#include <BiosInterface.h>
+
+//
+// GUID used to identify the config blob index HOB. PlatformPei publishes a
+// single HOB with this GUID after every structure in the config blob has
+// been validated. The HOB data is a CONFIG_BLOB_INDEX.
+//
+#define CONFIG_BLOB_INDEX_HOB_GUID \
+  { 0x7f8ae2b3, 0x2db3, 0x40f4, { 0xaf, 0xfd, 0xa9, 0xf5, 0x9b, 0x14, 0xa1, 0x48 } }
+
+extern EFI_GUID gMsvmConfigBlobIndexHobGuid;
+
+//
+// Number of structure types tracked by the index, one entry per type.
+// Types at or beyond this value are not indexed.
+//
+#define CONFIG_BLOB_INDEX_ENTRY_COUNT (UefiConfigPcieBarApertures + 1)
+
+//
+// Location of the first structure of a given type.
+//
+// Offset is from the start of the config blob. Length is the length of the
+// structure including its header. Count is the number of structures of this
+// type in the blob; zero means the type is not present.
+//
+typedef struct _CONFIG_BLOB_INDEX_ENTRY
+{
+    UINT32  Offset;
+    UINT32  Length;
+    UINT32  Count;
+} CONFIG_BLOB_INDEX_ENTRY;
+
+//
+// HOB payload: the config blob location and the per-type index.
+//
+typedef struct _CONFIG_BLOB_INDEX
+{
+    UINT64                  BlobBase;
+    UINT32                  BlobSize;
+    UINT32                  EntryCount;
+    CONFIG_BLOB_INDEX_ENTRY Entries[CONFIG_BLOB_INDEX_ENTRY_COUNT];
+} CONFIG_BLOB_INDEX;
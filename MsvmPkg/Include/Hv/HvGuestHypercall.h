@@ -927,6 +927,7 @@ typedef enum _HV_REGISTER_NAME
     HvRegisterCpuManagementVersion = 0x00090007,
     HvRegisterVpAssistPage         = 0x00090013,
     HvRegisterVpRootSignalCount    = 0x00090014,
+    HvRegisterReferenceTsc         = 0x00090017,
 
     // Performance statistics Registers
     HvRegisterStatsPartitionRetail   = 0x00090020,
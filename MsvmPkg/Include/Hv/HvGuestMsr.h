@@ -195,6 +195,39 @@ typedef union _HV_X64_MSR_HYPERCALL_CONTENTS
     };
 } HV_X64_MSR_HYPERCALL_CONTENTS, *PHV_X64_MSR_HYPERCALL_CONTENTS;
 
+//
+// Declare the MSR used to place the reference TSC page. On AArch64 the same
+// layout is used for HvRegisterReferenceTsc.
+//
+#define HV_X64_MSR_REFERENCE_TSC HvSyntheticMsrReferenceTsc
+
+typedef union _HV_REFERENCE_TSC_MSR_CONTENTS
+{
+    UINT64 AsUINT64;
+    struct
+    {
+        UINT64 Enable               : 1;
+        UINT64 ReservedP            : 11;
+        UINT64 GpaPageNumber        : 52;
+    };
+} HV_REFERENCE_TSC_MSR_CONTENTS, *PHV_REFERENCE_TSC_MSR_CONTENTS;
+
+//
+// Layout of the reference TSC page. The reference time, in 100ns units, is
+// ((Tsc * TscScale) >> 64) + TscOffset. A TscSequence of zero means the page
+// is not valid and the reference time counter must be read instead.
+//
+#define HV_REFERENCE_TSC_SEQUENCE_INVALID 0
+
+typedef struct _HV_REFERENCE_TSC_PAGE
+{
+    volatile UINT32 TscSequence;
+    UINT32          Reserved1;
+    volatile UINT64 TscScale;
+    volatile INT64  TscOffset;
+    UINT64          Reserved2[509];
+} HV_REFERENCE_TSC_PAGE, *PHV_REFERENCE_TSC_PAGE;
+
 #define HV_CRASH_MAXIMUM_MESSAGE_SIZE     4096ull
 
 typedef union _HV_CRASH_CTL_REG_CONTENTS
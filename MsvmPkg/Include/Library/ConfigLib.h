@@ -9,6 +9,7 @@
 #pragma once
 
 #include <BiosInterface.h>
+#include <ConfigBlobIndex.h>
 #include <UefiConstants.h>
 
 typedef
@@ -63,4 +64,53 @@ enum
 CONFIG_GET_UINT32   GetNfitSize;
 CONFIG_SET_UINT64   GetNfit;
 CONFIG_SET_UINT64   SetVpmemACPIBuffer;
-CONFIG_SET_UINT64   SetGenerationIdAddress;
\ No newline at end of file
+CONFIG_SET_UINT64   SetGenerationIdAddress;
+
+//
+// Accessors for the config blob index published by PlatformPei. Each lookup
+// is a table access; the structures were validated in PEI. All of them return
+// NULL (or zero) when the structure is absent or when no config blob was
+// provided, as on hardware-isolated VMs without a paravisor.
+//
+
+UEFI_CONFIG_HEADER*
+GetConfigStructure(
+    UINT32 Type
+    );
+
+UINT32
+GetConfigStructureCount(
+    UINT32 Type
+    );
+
+void*
+GetConfigStructureData(
+    UINT32 Type,
+    UINT32* DataSize
+    );
+
+void*
+GetConfigMemoryMap(
+    UINT32* Size
+    );
+
+CHAR8*
+GetConfigSmbiosString(
+    UINT32 Type,
+    UINT32* Length
+    );
+
+UEFI_CONFIG_FLAGS*
+GetConfigFlags(
+    void
+    );
+
+UEFI_CONFIG_PROCESSOR_INFORMATION*
+GetConfigProcessorInformation(
+    void
+    );
+
+UEFI_CONFIG_MMIO_RANGES*
+GetConfigMmioRanges(
+    void
+    );
@@ -0,0 +1,38 @@
+/** @file
+  Protocol through which an OS loader declares that the OS accepts memory
+  reported as EfiUnacceptedMemoryType itself. When no loader calls it, the
+  firmware accepts all remaining memory before ExitBootServices completes.
+
+  The GUID and layout are those of the OVMF SEV memory acceptance protocol,
+  which OS loaders with unaccepted memory support already look for.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+#pragma once
+
+#define MSVM_MEMORY_ACCEPTANCE_PROTOCOL_GUID \
+  {0xc5a010fe, 0x38a7, 0x4531, {0x8a, 0x4a, 0x05, 0x00, 0xd2, 0xfd, 0x16, 0x49}}
+
+typedef struct _MSVM_MEMORY_ACCEPTANCE_PROTOCOL MSVM_MEMORY_ACCEPTANCE_PROTOCOL;
+
+/**
+  Declares that the OS accepts unaccepted memory itself, so the firmware
+  leaves it unaccepted at ExitBootServices.
+
+  @param This A pointer to the MSVM_MEMORY_ACCEPTANCE_PROTOCOL instance.
+
+  @returns EFI status.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *MSVM_ALLOW_UNACCEPTED_MEMORY)(
+  IN  MSVM_MEMORY_ACCEPTANCE_PROTOCOL *This
+  );
+
+struct _MSVM_MEMORY_ACCEPTANCE_PROTOCOL
+{
+  MSVM_ALLOW_UNACCEPTED_MEMORY AllowUnacceptedMemory;
+};
+
+extern EFI_GUID gMsvmMemoryAcceptanceProtocolGuid;
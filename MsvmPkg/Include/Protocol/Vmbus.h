@@ -187,5 +187,23 @@ typedef struct _VMBUS_DEVICE_PATH
 
 } VMBUS_DEVICE_PATH;
 
+//
+// Sub-channels of a multi-channel device are installed on their own handles.
+// Their device path is the primary channel's device path with this node
+// appended. Class drivers bind only to the primary channel, and locate and
+// open its sub-channels themselves.
+//
+#define EFI_VMBUS_SUBCHANNEL_DEVICE_PATH_GUID \
+    {0xe9533767, 0x3181, 0x42fa, {0xa3, 0x09, 0x31, 0x03, 0x99, 0xf8, 0x2d, 0xe5}}
+
+typedef struct _VMBUS_SUBCHANNEL_DEVICE_PATH
+{
+    VENDOR_DEVICE_PATH VendorDevicePath;
+
+    UINT16 SubChannelIndex;
+    UINT16 Reserved;
+
+} VMBUS_SUBCHANNEL_DEVICE_PATH;
+
 extern EFI_GUID gEfiVmbusProtocolGuid;
 extern EFI_GUID gEfiVmbusLegacyProtocolGuid;
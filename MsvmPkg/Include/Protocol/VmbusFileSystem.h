@@ -20,6 +20,12 @@
 
 #define VMBFS_VERSION_WIN10         VMBFS_MAKE_VERSION(1, 0)
 
+//
+// Adds host file handles. A file is opened once by path and later requests
+// reference the returned handle instead of carrying the path.
+//
+#define VMBFS_VERSION_FILE_HANDLES  VMBFS_MAKE_VERSION(1, 1)
+
 
 typedef enum _VMBFS_MESSAGE_TYPE
 {
@@ -33,6 +39,17 @@ typedef enum _VMBFS_MESSAGE_TYPE
     VmbfsMessageTypeReadFileRdma,
     VmbfsMessageTypeReadFileRdmaResponse,
 
+    //
+    // VMBFS_VERSION_FILE_HANDLES and later. Reads by handle are answered with
+    // VmbfsMessageTypeReadFileResponse and VmbfsMessageTypeReadFileRdmaResponse.
+    //
+    VmbfsMessageTypeOpenFile,
+    VmbfsMessageTypeOpenFileResponse,
+    VmbfsMessageTypeCloseFile,
+    VmbfsMessageTypeCloseFileResponse,
+    VmbfsMessageTypeReadFileByHandle,
+    VmbfsMessageTypeReadFileRdmaByHandle,
+
     VmbfsMessageTypeMax
 
 } VMBFS_MESSAGE_TYPE, *PVMBFS_MESSAGE_TYPE;
@@ -156,6 +173,71 @@ typedef struct _VMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE
 
 STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE, 8)
 
+typedef struct _VMBFS_MESSAGE_OPEN_FILE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    CHAR16 FilePath[];
+
+} VMBFS_MESSAGE_OPEN_FILE, *PVMBFS_MESSAGE_OPEN_FILE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_OPEN_FILE, 0)
+
+typedef struct _VMBFS_MESSAGE_OPEN_FILE_RESPONSE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    UINT32 Status;
+
+    UINT32 Flags;
+    UINT64 FileSize;
+    UINT64 FileHandle;
+
+} VMBFS_MESSAGE_OPEN_FILE_RESPONSE, *PVMBFS_MESSAGE_OPEN_FILE_RESPONSE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_OPEN_FILE_RESPONSE, 24)
+
+typedef struct _VMBFS_MESSAGE_CLOSE_FILE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    UINT64 FileHandle;
+
+} VMBFS_MESSAGE_CLOSE_FILE, *PVMBFS_MESSAGE_CLOSE_FILE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_CLOSE_FILE, 8)
+
+typedef struct _VMBFS_MESSAGE_CLOSE_FILE_RESPONSE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    UINT32 Status;
+
+} VMBFS_MESSAGE_CLOSE_FILE_RESPONSE, *PVMBFS_MESSAGE_CLOSE_FILE_RESPONSE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_CLOSE_FILE_RESPONSE, 4)
+
+typedef struct _VMBFS_MESSAGE_READ_FILE_BY_HANDLE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    UINT64 FileHandle;
+    UINT32 ByteCount;
+    UINT32 Reserved;
+    UINT64 Offset;
+
+} VMBFS_MESSAGE_READ_FILE_BY_HANDLE, *PVMBFS_MESSAGE_READ_FILE_BY_HANDLE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_READ_FILE_BY_HANDLE, 24)
+
+typedef struct _VMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE
+{
+    VMBFS_MESSAGE_HEADER Header;
+    UINT64 FileHandle;
+    UINT32 Handle;
+    UINT32 ByteCount;
+    UINT64 FileOffset;
+    UINT64 TokenOffset;
+
+} VMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE, *PVMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE;
+
+STATIC_ASSERT_VMBFS_MESSAGE_SIZE (VMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE, 32)
+
 #pragma pack(pop)
 
 #ifdef _MSC_VER
@@ -28,11 +28,30 @@ UINT64               mCanonicalizationMask;
 LIST_ENTRY           mAllocContextListHead;
 
 //
-// Pre-allocated bounce block pool. Each block is a contiguous host-visible
-// region; Map() sub-allocates contiguous page runs from a block via the
-// per-block AllocBitmap.
+// Pre-allocated bounce block pools, indexed by IOMMU_BOUNCE_POOL. Each block
+// is a contiguous host-visible region; Map() sub-allocates contiguous page
+// runs from a block via the per-block AllocBitmap.
 //
-LIST_ENTRY           mBounceBlockListHead;
+LIST_ENTRY           mBounceBlockListHead[IoMmuBouncePoolMax];
+
+//
+// Bounce slot cache per pool, indexed by run length in pages minus one.
+// See IOMMU_BOUNCE_SLOT_CLASS in IoMmuBounce.h.
+//
+IOMMU_BOUNCE_SLOT_CLASS  mBounceSlotClasses[IoMmuBouncePoolMax][IOMMU_BOUNCE_SLOT_CLASS_COUNT];
+
+//
+// Number of bounce runs released so far. Used as the clock that ages idle
+// blocks for trimming.
+//
+UINT64               mBounceReleaseCount;
+
+//
+// Set once ExitBootServices starts. Unmap() is still called from
+// ExitBootServices handlers, where freeing pages and changing host
+// visibility are no longer allowed, so idle blocks are kept from then on.
+//
+BOOLEAN              mBounceTrimStopped;
 
 //
 // Bounce dispatch state, resolved once at driver entry. A set of
@@ -110,8 +129,16 @@ IoMmuInitializeBounce (
     VOID
     )
 {
+    IOMMU_BOUNCE_POOL  Pool;
+
     InitializeListHead (&mAllocContextListHead);
-    InitializeListHead (&mBounceBlockListHead);
+    for (Pool = IoMmuBouncePoolLow; Pool < IoMmuBouncePoolMax; Pool++) {
+        InitializeListHead (&mBounceBlockListHead[Pool]);
+    }
+
+    ZeroMem (mBounceSlotClasses, sizeof (mBounceSlotClasses));
+    mBounceReleaseCount = 0;
+    mBounceTrimStopped  = FALSE;
 
     mSharedGpaBoundary = (EFI_PHYSICAL_ADDRESS)PcdGet64 (PcdIsolationSharedGpaBoundary);
     mCanonicalizationMask = PcdGet64 (PcdIsolationSharedGpaCanonicalizationBitmask);
@@ -329,59 +356,204 @@ IoMmuReleaseAddressRangeFromDma (
 
 //
 // ---------------------------------------------------------------------------
-// Pre-allocated bounce block pool.
+// Pre-allocated bounce block pools.
 //
-// Each IOMMU_BOUNCE_BLOCK is a contiguous, DMA-prepared region of pages
-// allocated below 4GB. Map() requests are satisfied by sub-allocating a
-// contiguous run of free pages from one of the blocks (via the per-block
-// AllocBitmap). If no existing block can satisfy a request, a new block is
-// allocated and prepared for DMA (one set of hypervisor calls per new
-// block, not per Map). Blocks are kept around for the lifetime of the
-// driver to amortize the cost across many DMA operations.
+// Each IOMMU_BOUNCE_BLOCK is a contiguous, DMA-prepared region of pages,
+// allocated below 4GB for the low pool and anywhere for the high pool.
+// Map() requests are satisfied by sub-allocating a contiguous run of free
+// pages from one of the blocks of the caller's pool (via the per-block
+// AllocBitmap, searched a 64-bit word at a time). If no existing block can
+// satisfy a request, a new block is allocated and prepared for DMA (one set
+// of hypervisor calls per new block, not per Map). Blocks are kept around
+// to amortize that cost across many DMA operations; only blocks grown on
+// demand that then sit unused for IOMMU_BOUNCE_TRIM_IDLE_RELEASES releases
+// are given back.
 // ---------------------------------------------------------------------------
 //
 
 /**
-  Find the lowest contiguous run of `RunLength` clear bits in `Bitmap`,
-  considering only bits [0, BitmapSize). Returns the starting bit index
-  via *StartBit on success.
+  Return the index of the first clear bit at or after `From` in `Bitmap`,
+  or `BitmapSize` if every bit in [From, BitmapSize) is set. Bits past
+  BitmapSize in the last word are never set, so they must be clipped.
+**/
+STATIC
+UINT32
+FindNextClearBit (
+    IN  CONST UINT64  *Bitmap,
+    IN  UINT32        BitmapSize,
+    IN  UINT32        From
+    )
+{
+    UINT32  Word;
+    UINT64  Bits;
+
+    if (From >= BitmapSize) {
+        return BitmapSize;
+    }
+
+    Word = From >> 6;
+    Bits = ~Bitmap[Word] & (MAX_UINT64 << (From & 63));
+
+    while (Bits == 0) {
+        Word++;
+        if ((Word << 6) >= BitmapSize) {
+            return BitmapSize;
+        }
+
+        Bits = ~Bitmap[Word];
+    }
+
+    return MIN ((Word << 6) + (UINT32)LowBitSet64 (Bits), BitmapSize);
+}
+
+
+/**
+  Return the index of the first set bit at or after `From` in `Bitmap`,
+  or `BitmapSize` if every bit in [From, BitmapSize) is clear.
+**/
+STATIC
+UINT32
+FindNextSetBit (
+    IN  CONST UINT64  *Bitmap,
+    IN  UINT32        BitmapSize,
+    IN  UINT32        From
+    )
+{
+    UINT32  Word;
+    UINT64  Bits;
+
+    if (From >= BitmapSize) {
+        return BitmapSize;
+    }
+
+    Word = From >> 6;
+    Bits = Bitmap[Word] & (MAX_UINT64 << (From & 63));
+
+    while (Bits == 0) {
+        Word++;
+        if ((Word << 6) >= BitmapSize) {
+            return BitmapSize;
+        }
+
+        Bits = Bitmap[Word];
+    }
+
+    return MIN ((Word << 6) + (UINT32)LowBitSet64 (Bits), BitmapSize);
+}
+
+
+/**
+  Return one past the index of the last set bit before `Before` in
+  `Bitmap`, or 0 if every bit in [0, Before) is clear. This is the start of
+  the clear run that ends at `Before`.
+**/
+STATIC
+UINT32
+FindPreviousSetBitEnd (
+    IN  CONST UINT64  *Bitmap,
+    IN  UINT32        Before
+    )
+{
+    UINT32  Word;
+    UINT64  Bits;
+
+    if (Before == 0) {
+        return 0;
+    }
+
+    Word = (Before - 1) >> 6;
+    Bits = Bitmap[Word] & (MAX_UINT64 >> (63 - ((Before - 1) & 63)));
+
+    while (Bits == 0) {
+        if (Word == 0) {
+            return 0;
+        }
+
+        Word--;
+        Bits = Bitmap[Word];
+    }
+
+    return (Word << 6) + (UINT32)HighBitSet64 (Bits) + 1;
+}
+
+
+/**
+  Find the first run of at least `RunLength` clear bits in `Bitmap` whose
+  start lies in [From, Limit), considering only bits [0, BitmapSize).
+  Whole words of set or clear bits are skipped at once. The length of the
+  longest clear run seen is accumulated into *LargestRun.
+**/
+STATIC
+BOOLEAN
+FindFreeRunInRange (
+    IN     CONST UINT64  *Bitmap,
+    IN     UINT32        BitmapSize,
+    IN     UINT32        RunLength,
+    IN     UINT32        From,
+    IN     UINT32        Limit,
+    OUT    UINT32        *StartBit,
+    IN OUT UINT32        *LargestRun
+    )
+{
+    UINT32  RunStart;
+    UINT32  RunEnd;
+
+    RunStart = FindNextClearBit (Bitmap, BitmapSize, From);
+    while (RunStart < Limit) {
+        RunEnd = FindNextSetBit (Bitmap, BitmapSize, RunStart);
+        if (RunEnd - RunStart >= RunLength) {
+            *StartBit = RunStart;
+            return TRUE;
+        }
+
+        *LargestRun = MAX (*LargestRun, RunEnd - RunStart);
+        RunStart    = FindNextClearBit (Bitmap, BitmapSize, RunEnd);
+    }
+
+    return FALSE;
+}
+
+
+/**
+  Find a contiguous run of `RunLength` free pages in `Block`, starting the
+  search at the block's next-fit hint and wrapping around to the start of
+  the block. On failure every free run has been visited, so the block's
+  LargestFreeRun is made exact.
 **/
 STATIC
 BOOLEAN
 FindFreeRun (
-    IN  UINT64  *Bitmap,
-    IN  UINT32  BitmapSize,
-    IN  UINT32  RunLength,
-    OUT UINT32  *StartBit
+    IN  PIOMMU_BOUNCE_BLOCK  Block,
+    IN  UINT32               RunLength,
+    OUT UINT32               *StartBit
     )
 {
-    UINT32  i;
-    UINT32  Run;
+    UINT32  LargestRun;
 
-    if ((RunLength == 0) || (RunLength > BitmapSize)) {
+    if ((RunLength == 0) || (RunLength > Block->LargestFreeRun)) {
         return FALSE;
     }
 
-    Run = 0;
-    for (i = 0; i < BitmapSize; i++) {
-        if ((Bitmap[i >> 6] & ((UINT64)1 << (i & 63))) == 0) {
-            Run++;
-            if (Run == RunLength) {
-                *StartBit = i + 1 - RunLength;
-                return TRUE;
-            }
-        } else {
-            Run = 0;
-        }
+    LargestRun = 0;
+
+    if (FindFreeRunInRange (Block->AllocBitmap, Block->BlockPageCount, RunLength,
+                            Block->NextFitHint, Block->BlockPageCount, StartBit, &LargestRun) ||
+        FindFreeRunInRange (Block->AllocBitmap, Block->BlockPageCount, RunLength,
+                            0, Block->NextFitHint, StartBit, &LargestRun))
+    {
+        return TRUE;
     }
 
+    Block->LargestFreeRun = LargestRun;
     return FALSE;
 }
 
 
 /**
   Set or clear a contiguous run of `Count` bits starting at `Start` in
-  `Bitmap`. `Set` selects between OR (TRUE) and AND-NOT (FALSE).
+  `Bitmap`. `Set` selects between OR (TRUE) and AND-NOT (FALSE). Partial
+  words at either end are updated with a mask and whole words in between
+  are filled directly.
 **/
 STATIC
 VOID
@@ -392,26 +564,56 @@ UpdateBitmapRun (
     IN     BOOLEAN  Set
     )
 {
-    UINT32  i;
-    UINT32  Bit;
+    UINT32  Word;
+    UINT32  Bits;
     UINT64  Mask;
 
-    for (i = 0; i < Count; i++) {
-        Bit  = Start + i;
-        Mask = (UINT64)1 << (Bit & 63);
+    Word = Start >> 6;
+    while (Count > 0) {
+        Bits = MIN (Count, 64 - (Start & 63));
+        Mask = (Bits == 64) ? MAX_UINT64 : ((((UINT64)1 << Bits) - 1) << (Start & 63));
+
         if (Set) {
-            Bitmap[Bit >> 6] |= Mask;
+            Bitmap[Word] |= Mask;
         } else {
-            Bitmap[Bit >> 6] &= ~Mask;
+            Bitmap[Word] &= ~Mask;
         }
+
+        Start += Bits;
+        Count -= Bits;
+        Word++;
+    }
+}
+
+
+/**
+  Mark `Count` pages starting at `Start` in use in `Block` and move the
+  next-fit hint past them.
+**/
+STATIC
+VOID
+ClaimBounceRun (
+    IN OUT PIOMMU_BOUNCE_BLOCK  Block,
+    IN     UINT32               Start,
+    IN     UINT32               Count
+    )
+{
+    UpdateBitmapRun (Block->AllocBitmap, Start, Count, TRUE);
+    Block->InUsePageCount += Count;
+
+    Block->NextFitHint = Start + Count;
+    if (Block->NextFitHint >= Block->BlockPageCount) {
+        Block->NextFitHint = 0;
     }
 }
 
 
 /**
   Allocate a new bounce block of `PageCount` pages, prepare it for DMA,
-  and insert it at the tail of the bounce block list.
+  and insert it at the tail of the pool's bounce block list.
 
+  @param[in]   Pool        Pool the block serves. Low pool blocks are
+                           allocated below 4GB.
   @param[in]   PageCount   Number of pages in the new block.
   @param[out]  BlockOut    The newly allocated block on success.
 
@@ -420,6 +622,7 @@ UpdateBitmapRun (
 **/
 EFI_STATUS
 IoMmuPreAllocateBounceBlock (
+    IN  IOMMU_BOUNCE_POOL       Pool,
     IN  UINT32                  PageCount,
     OUT PIOMMU_BOUNCE_BLOCK     *BlockOut
     )
@@ -427,9 +630,11 @@ IoMmuPreAllocateBounceBlock (
     EFI_STATUS              Status;
     PIOMMU_BOUNCE_BLOCK     Block;
     EFI_PHYSICAL_ADDRESS    PhysicalAddress;
+    EFI_ALLOCATE_TYPE       AllocateType;
     UINT32                  BitmapWordCount;
 
     ASSERT (PageCount > 0);
+    ASSERT (Pool < IoMmuBouncePoolMax);
 
     Block = AllocateZeroPool (sizeof (IOMMU_BOUNCE_BLOCK));
     if (Block == NULL) {
@@ -444,30 +649,44 @@ IoMmuPreAllocateBounceBlock (
     }
 
     //
-    // Allocate the block below 4GB so it can satisfy both 32-bit and
-    // 64-bit DMA Map() requests without further constraints.
+    // Low pool blocks go below 4GB so they can satisfy both 32-bit and
+    // 64-bit DMA Map() requests. High pool blocks only serve 64-bit
+    // requests and take whatever memory the allocator hands out, which is
+    // the top of memory first.
     //
-    PhysicalAddress = SIZE_4GB - 1;
+    if (Pool == IoMmuBouncePoolLow) {
+        AllocateType    = AllocateMaxAddress;
+        PhysicalAddress = SIZE_4GB - 1;
+    } else {
+        AllocateType    = AllocateAnyPages;
+        PhysicalAddress = 0;
+    }
+
     Status = gBS->AllocatePages (
-                     AllocateMaxAddress,
+                     AllocateType,
                      EfiBootServicesData,
                      PageCount,
                      &PhysicalAddress
                      );
     if (EFI_ERROR (Status)) {
         DEBUG ((DEBUG_ERROR,
-            "IoMmu: AllocateBounceBlock: AllocatePages(%d pages, <4GB) failed: %r\n",
-            PageCount, Status));
+            "IoMmu: AllocateBounceBlock: AllocatePages(%d pages, pool %d) failed: %r\n",
+            PageCount, Pool, Status));
         FreePool (Block->AllocBitmap);
         FreePool (Block);
         return Status;
     }
 
     Block->Signature       = IOMMU_BOUNCE_BLOCK_SIGNATURE;
+    Block->Pool            = Pool;
     Block->BlockBase       = (VOID *)(UINTN)PhysicalAddress;
     Block->BlockPageCount  = PageCount;
     Block->BitmapWordCount = BitmapWordCount;
     Block->InUsePageCount  = 0;
+    Block->CachedPageCount = 0;
+    Block->NextFitHint     = 0;
+    Block->LargestFreeRun  = PageCount;
+    Block->IdleSince       = mBounceReleaseCount;
     Block->IsPreparedForDma = FALSE;
 
     Status = IoMmuPrepareAddressRangeForDma (
@@ -486,59 +705,237 @@ IoMmuPreAllocateBounceBlock (
     }
 
     Block->IsPreparedForDma = TRUE;
-    InsertTailList (&mBounceBlockListHead, &Block->Link);
+    InsertTailList (&mBounceBlockListHead[Pool], &Block->Link);
 
     DEBUG ((DEBUG_INFO,
-        "IoMmu: AllocateBounceBlock: Block=%p Base=%p Pages=%d\n",
-        Block, Block->BlockBase, PageCount));
+        "IoMmu: AllocateBounceBlock: Block=%p Base=%p Pages=%d Pool=%d\n",
+        Block, Block->BlockBase, PageCount, Pool));
 
     *BlockOut = Block;
     return EFI_SUCCESS;
 }
 
 
+/**
+  Remove an unused bounce block from its pool, revoke its host visibility
+  and return its pages to the system.
+**/
+STATIC
+VOID
+FreeBounceBlock (
+    IN PIOMMU_BOUNCE_BLOCK      Block
+    )
+{
+    ASSERT (Block->InUsePageCount == 0);
+
+    DEBUG ((DEBUG_INFO,
+        "IoMmu: Trimming idle bounce block %p (%d pages, pool %d)\n",
+        Block, Block->BlockPageCount, Block->Pool));
+
+    RemoveEntryList (&Block->Link);
+    if (Block->IsPreparedForDma) {
+        IoMmuReleaseAddressRangeFromDma (&Block->DmaContext);
+        Block->IsPreparedForDma = FALSE;
+    }
+
+    gBS->FreePages ((EFI_PHYSICAL_ADDRESS)(UINTN)Block->BlockBase, Block->BlockPageCount);
+    FreePool (Block->AllocBitmap);
+    FreePool (Block);
+}
+
+
+/**
+  Free every block that has been unused for at least
+  IOMMU_BOUNCE_TRIM_IDLE_RELEASES releases. The first block of each pool
+  is kept so a burst of DMA after a quiet period still finds a prepared
+  block.
+**/
+STATIC
+VOID
+TrimIdleBounceBlocks (
+    VOID
+    )
+{
+    IOMMU_BOUNCE_POOL       Pool;
+    LIST_ENTRY              *Entry;
+    PIOMMU_BOUNCE_BLOCK     Block;
+
+    for (Pool = IoMmuBouncePoolLow; Pool < IoMmuBouncePoolMax; Pool++) {
+        Entry = GetNextNode (&mBounceBlockListHead[Pool], GetFirstNode (&mBounceBlockListHead[Pool]));
+        while (!IsNull (&mBounceBlockListHead[Pool], Entry)) {
+            Block = BASE_CR (Entry, IOMMU_BOUNCE_BLOCK, Link);
+            Entry = GetNextNode (&mBounceBlockListHead[Pool], Entry);
+
+            if ((Block->InUsePageCount == 0) &&
+                (mBounceReleaseCount - Block->IdleSince >= IOMMU_BOUNCE_TRIM_IDLE_RELEASES)) {
+                FreeBounceBlock (Block);
+            }
+        }
+    }
+}
+
+
+/**
+  Return a run of pages to its block's bitmap.
+**/
+STATIC
+VOID
+ReleaseBounceRun (
+    IN PIOMMU_BOUNCE_BLOCK      Block,
+    IN UINT32                   StartPageIndex,
+    IN UINT32                   PageCount
+    )
+{
+    UINT32  RunStart;
+    UINT32  RunEnd;
+
+    UpdateBitmapRun (Block->AllocBitmap, StartPageIndex, PageCount, FALSE);
+    Block->InUsePageCount -= PageCount;
+
+    //
+    // The released pages merge with the free runs on either side. Raise
+    // the block's upper bound to cover the merged run so it is considered
+    // again by IoMmuAcquireBouncePages.
+    //
+    if (Block->InUsePageCount == 0) {
+        Block->LargestFreeRun = Block->BlockPageCount;
+        Block->IdleSince      = mBounceReleaseCount;
+    } else {
+        RunStart = FindPreviousSetBitEnd (Block->AllocBitmap, StartPageIndex);
+        RunEnd   = FindNextSetBit (Block->AllocBitmap, Block->BlockPageCount, StartPageIndex + PageCount);
+        Block->LargestFreeRun = MAX (Block->LargestFreeRun, RunEnd - RunStart);
+    }
+}
+
+
+/**
+  Find a run of `PageCount` free pages in the bitmap of an existing block
+  of `Pool`.
+**/
+STATIC
+BOOLEAN
+AcquireBounceRunFromPool (
+    IN  IOMMU_BOUNCE_POOL       Pool,
+    IN  UINT32                  PageCount,
+    OUT PIOMMU_BOUNCE_BLOCK     *Block,
+    OUT UINT32                  *StartPageIndex
+    )
+{
+    LIST_ENTRY              *Entry;
+    PIOMMU_BOUNCE_BLOCK     Candidate;
+    UINT32                  StartBit;
+
+    //
+    // FindFreeRun skips blocks whose LargestFreeRun is too short without
+    // scanning them.
+    //
+    for (Entry = GetFirstNode (&mBounceBlockListHead[Pool]);
+         !IsNull (&mBounceBlockListHead[Pool], Entry);
+         Entry = GetNextNode (&mBounceBlockListHead[Pool], Entry))
+    {
+        Candidate = BASE_CR (Entry, IOMMU_BOUNCE_BLOCK, Link);
+
+        if (FindFreeRun (Candidate, PageCount, &StartBit)) {
+            ClaimBounceRun (Candidate, StartBit, PageCount);
+            *Block          = Candidate;
+            *StartPageIndex = StartBit;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+VOID
+IoMmuStopBounceTrimming (
+    VOID
+    )
+{
+    mBounceTrimStopped = TRUE;
+}
+
+
+VOID
+IoMmuDrainBounceSlotCache (
+    VOID
+    )
+{
+    IOMMU_BOUNCE_POOL           Pool;
+    UINT32                      ClassIndex;
+    IOMMU_BOUNCE_SLOT_CLASS     *SlotClass;
+    IOMMU_BOUNCE_SLOT           *Slot;
+
+    for (Pool = IoMmuBouncePoolLow; Pool < IoMmuBouncePoolMax; Pool++) {
+        for (ClassIndex = 0; ClassIndex < IOMMU_BOUNCE_SLOT_CLASS_COUNT; ClassIndex++) {
+            SlotClass = &mBounceSlotClasses[Pool][ClassIndex];
+
+            if (SlotClass->Hits + SlotClass->Misses != 0) {
+                DEBUG ((DEBUG_VERBOSE,
+                    "IoMmu: bounce slot cache pool %d, %d pages: %ld hits, %ld misses, %d cached\n",
+                    Pool, ClassIndex + 1, SlotClass->Hits, SlotClass->Misses, SlotClass->Count));
+            }
+
+            while (SlotClass->Count > 0) {
+                SlotClass->Count--;
+                Slot = &SlotClass->Slots[SlotClass->Count];
+                Slot->Block->CachedPageCount -= ClassIndex + 1;
+                ReleaseBounceRun (Slot->Block, Slot->StartPage, ClassIndex + 1);
+            }
+        }
+    }
+}
+
+
 EFI_STATUS
 IoMmuAcquireBouncePages (
+    IN  IOMMU_BOUNCE_POOL       Pool,
     IN  UINT32                  PageCount,
     OUT PIOMMU_BOUNCE_BLOCK     *Block,
     OUT UINT32                  *StartPageIndex,
     OUT VOID                    **BounceBase
     )
 {
-    LIST_ENTRY              *Entry;
     PIOMMU_BOUNCE_BLOCK     Candidate;
     UINT32                  StartBit;
     EFI_STATUS              Status;
     UINT32                  NewBlockPages;
+    IOMMU_BOUNCE_SLOT_CLASS *SlotClass;
 
-    if (PageCount == 0) {
+    if ((PageCount == 0) || (Pool >= IoMmuBouncePoolMax)) {
         return EFI_INVALID_PARAMETER;
     }
 
-    StartBit = 0;
-
     //
-    // Try to satisfy from an existing pooled block.
+    // Reuse a recently released run of the same size. Its pages are still
+    // marked in use, so no bitmap update is needed.
     //
-    for (Entry = GetFirstNode (&mBounceBlockListHead);
-         !IsNull (&mBounceBlockListHead, Entry);
-         Entry = GetNextNode (&mBounceBlockListHead, Entry))
-    {
-        Candidate = BASE_CR (Entry, IOMMU_BOUNCE_BLOCK, Link);
-
-        if (PageCount > Candidate->BlockPageCount) {
-            continue;
+    if (PageCount <= IOMMU_BOUNCE_SLOT_CLASS_COUNT) {
+        SlotClass = &mBounceSlotClasses[Pool][PageCount - 1];
+        if (SlotClass->Count > 0) {
+            SlotClass->Hits++;
+            SlotClass->Count--;
+            Candidate = SlotClass->Slots[SlotClass->Count].Block;
+            StartBit  = SlotClass->Slots[SlotClass->Count].StartPage;
+            Candidate->CachedPageCount -= PageCount;
+            goto Found;
         }
 
-        if (FindFreeRun (Candidate->AllocBitmap, Candidate->BlockPageCount, PageCount, &StartBit)) {
-            UpdateBitmapRun (Candidate->AllocBitmap, StartBit, PageCount, TRUE);
-            Candidate->InUsePageCount += PageCount;
+        SlotClass->Misses++;
+    }
 
-            *Block          = Candidate;
-            *StartPageIndex = StartBit;
-            *BounceBase     = (VOID *)((UINTN)Candidate->BlockBase + ((UINTN)StartBit * EFI_PAGE_SIZE));
-            return EFI_SUCCESS;
-        }
+    //
+    // Try to satisfy from an existing pooled block. If that fails, cached
+    // runs may be fragmenting the blocks; return them to the bitmaps and
+    // try once more before growing the pool.
+    //
+    if (AcquireBounceRunFromPool (Pool, PageCount, &Candidate, &StartBit)) {
+        goto Found;
+    }
+
+    IoMmuDrainBounceSlotCache ();
+    if (AcquireBounceRunFromPool (Pool, PageCount, &Candidate, &StartBit)) {
+        goto Found;
     }
 
     //
@@ -553,19 +950,28 @@ IoMmuAcquireBouncePages (
         NewBlockPages = IOMMU_BOUNCE_GROWTH_BLOCK_PAGES;
     }
 
-    Status = IoMmuPreAllocateBounceBlock (NewBlockPages, &Candidate);
+    Status = IoMmuPreAllocateBounceBlock (Pool, NewBlockPages, &Candidate);
     if (EFI_ERROR (Status)) {
+        //
+        // A 64-bit caller can still use low memory; go through the low
+        // pool rather than fail the Map().
+        //
+        if (Pool == IoMmuBouncePoolHigh) {
+            return IoMmuAcquireBouncePages (IoMmuBouncePoolLow, PageCount, Block, StartPageIndex, BounceBase);
+        }
+
         return Status;
     }
     DEBUG ((DEBUG_INFO,
         "IoMmuAcquireBouncePages: Allocated new bounce block %p with %d pages to satisfy request for %d pages\n",
         Candidate, Candidate->BlockPageCount, PageCount));
-    UpdateBitmapRun (Candidate->AllocBitmap, 0, PageCount, TRUE);
-    Candidate->InUsePageCount = PageCount;
+    ClaimBounceRun (Candidate, 0, PageCount);
+    StartBit = 0;
 
+Found:
     *Block          = Candidate;
-    *StartPageIndex = 0;
-    *BounceBase     = Candidate->BlockBase;
+    *StartPageIndex = StartBit;
+    *BounceBase     = (VOID *)((UINTN)Candidate->BlockBase + ((UINTN)StartBit * EFI_PAGE_SIZE));
     return EFI_SUCCESS;
 }
 
@@ -577,11 +983,37 @@ IoMmuReleaseBouncePages (
     IN UINT32                   PageCount
     )
 {
+    IOMMU_BOUNCE_SLOT_CLASS     *SlotClass;
+
     ASSERT (Block != NULL);
     ASSERT (Block->Signature == IOMMU_BOUNCE_BLOCK_SIGNATURE);
     ASSERT (PageCount > 0);
     ASSERT (StartPageIndex + PageCount <= Block->BlockPageCount);
 
-    UpdateBitmapRun (Block->AllocBitmap, StartPageIndex, PageCount, FALSE);
-    Block->InUsePageCount -= PageCount;
+    mBounceReleaseCount++;
+
+    //
+    // Park small runs in the slot cache, leaving them marked in use.
+    //
+    if (PageCount <= IOMMU_BOUNCE_SLOT_CLASS_COUNT) {
+        SlotClass = &mBounceSlotClasses[Block->Pool][PageCount - 1];
+        if (SlotClass->Count < IOMMU_BOUNCE_SLOT_DEPTH) {
+            SlotClass->Slots[SlotClass->Count].Block     = Block;
+            SlotClass->Slots[SlotClass->Count].StartPage = StartPageIndex;
+            SlotClass->Count++;
+            Block->CachedPageCount += PageCount;
+            return;
+        }
+    }
+
+    ReleaseBounceRun (Block, StartPageIndex, PageCount);
+
+    //
+    // Trimming is only considered when this release leaves the block
+    // unused. The walk also frees other blocks that have aged past the
+    // threshold since they went idle.
+    //
+    if ((Block->InUsePageCount == 0) && !mBounceTrimStopped) {
+        TrimIdleBounceBlocks ();
+    }
 }
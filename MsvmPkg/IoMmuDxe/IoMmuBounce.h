@@ -50,9 +50,9 @@ typedef UINT32 IOMMU_BOUNCE_MODE;
 #define IOMMU_BOUNCE_MODE_NONE              0x00000000
 
 //
-// Funnel DMA through the pre-allocated bounce pool (pages allocated
-// below 4GB so they satisfy both 32-bit and 64-bit DMA). Set by
-// IsIsolated() and by the soft PcdForceDmaBounceEnabled override.
+// Funnel DMA through the pre-allocated bounce pools (see
+// IOMMU_BOUNCE_POOL). Set by IsIsolated() and by the soft
+// PcdForceDmaBounceEnabled override.
 //
 #define IOMMU_BOUNCE_MODE_BOUNCE            BIT0
 
@@ -83,28 +83,59 @@ typedef struct _IOMMU_DMA_RANGE_CONTEXT
     BOOLEAN                      PinApplied;
 } IOMMU_DMA_RANGE_CONTEXT;
 
+//
+// IOMMU_BOUNCE_POOL - the DMA width a bounce block serves.
+//
+// Blocks in the low pool are allocated below 4GB and serve every Map()
+// caller. Blocks in the high pool are allocated wherever memory is free and
+// serve only 64-bit operations (BusMasterRead64/BusMasterWrite64, which the
+// PCI host bridge issues for devices with DUAL_ADDRESS_CYCLE set), so those
+// callers leave low memory to 32-bit bus masters. A 64-bit caller only
+// falls back to the low pool when no high block can be allocated.
+//
+typedef enum {
+    IoMmuBouncePoolLow,
+    IoMmuBouncePoolHigh,
+    IoMmuBouncePoolMax
+} IOMMU_BOUNCE_POOL;
+
 //
 // Page counts for bounce blocks. Each block is allocated as a contiguous,
-// DMA-prepared region below 4GB. Map() requests are satisfied by
-// sub-allocating contiguous page runs from a block.
+// DMA-prepared region. Map() requests are satisfied by sub-allocating
+// contiguous page runs from a block.
 //
-// IOMMU_BOUNCE_INITIAL_BLOCK_PAGES: size of the single block pre-allocated
-//   at driver entry. Sized to absorb large boot-time DMA transfers (e.g.
-//   NVMe namespace reads up to ~2 MB) without a lazy allocation.
+// IOMMU_BOUNCE_INITIAL_BLOCK_PAGES: size of the single low block
+//   pre-allocated at driver entry. Sized to absorb large boot-time DMA
+//   transfers (e.g. NVMe namespace reads up to ~2 MB) without a lazy
+//   allocation.
 //
-// IOMMU_BOUNCE_GROWTH_BLOCK_PAGES: minimum size used when the pool is
+// IOMMU_BOUNCE_GROWTH_BLOCK_PAGES: minimum size used when a pool is
 //   exhausted and a new block must be allocated on demand. The new block
 //   is sized to MAX(request, growth) so small requests don't reserve a
 //   disproportionately large region.
 //
+// IOMMU_BOUNCE_TRIM_IDLE_RELEASES: number of bounce releases a grown block
+//   may sit completely unused before it is returned to the system. The
+//   first block of each pool is never trimmed.
+//
 #define IOMMU_BOUNCE_INITIAL_BLOCK_PAGES  1024
 #define IOMMU_BOUNCE_GROWTH_BLOCK_PAGES   32
+#define IOMMU_BOUNCE_TRIM_IDLE_RELEASES   4096
 
 //
 // IOMMU_BOUNCE_BLOCK - a contiguous, DMA-prepared region of pages backing
-// Map() requests. The block is kept prepared for the lifetime of the
-// driver. Per-page in-use state is tracked via a bitmap sized to
-// BlockPageCount.
+// Map() requests. The block stays prepared until it is trimmed, at which
+// point host visibility is revoked and its pages are freed. Per-page in-use
+// state is tracked via a bitmap sized to BlockPageCount.
+//
+// NextFitHint is the page index after the most recent allocation; searches
+// start there and wrap. LargestFreeRun is an upper bound on the longest run
+// of free pages: it is made exact whenever a search of the block fails and
+// raised when pages are released, so blocks that cannot satisfy a request
+// are skipped without touching their bitmap.
+//
+// IdleSince is the value of the pool release counter when InUsePageCount
+// last dropped to zero; it ages the block for trimming.
 //
 #define IOMMU_BOUNCE_BLOCK_SIGNATURE  SIGNATURE_32('i','o','m','b')
 
@@ -112,15 +143,46 @@ typedef struct _IOMMU_BOUNCE_BLOCK
 {
     UINT32                        Signature;
     LIST_ENTRY                    Link;
+    IOMMU_BOUNCE_POOL             Pool;
     VOID                          *BlockBase;          // contiguous host-visible base (private VA)
     UINT32                        BlockPageCount;
     UINT32                        BitmapWordCount;     // number of UINT64 words in AllocBitmap
     UINT64                        *AllocBitmap;        // 1 bit per page; 1 = in use
-    UINT32                        InUsePageCount;
+    UINT32                        InUsePageCount;      // includes pages held by the slot cache
+    UINT32                        CachedPageCount;     // pages held by the slot cache
+    UINT32                        NextFitHint;
+    UINT32                        LargestFreeRun;
+    UINT64                        IdleSince;
     BOOLEAN                       IsPreparedForDma;
     IOMMU_DMA_RANGE_CONTEXT       DmaContext;
 } IOMMU_BOUNCE_BLOCK, *PIOMMU_BOUNCE_BLOCK;
 
+//
+// Bounce slot cache - per-size-class LIFOs of recently released page runs
+// kept in front of the bitmap allocator. Runs of up to
+// IOMMU_BOUNCE_SLOT_CLASS_COUNT pages are cached by exact page count so the
+// common small Map()/Unmap() pair skips the bitmap entirely. Each pool has
+// its own set of classes. Cached runs stay marked in use in their block's
+// bitmap until the caches are drained, which happens when no block can
+// satisfy a request from its bitmap.
+//
+#define IOMMU_BOUNCE_SLOT_CLASS_COUNT  8
+#define IOMMU_BOUNCE_SLOT_DEPTH        16
+
+typedef struct _IOMMU_BOUNCE_SLOT
+{
+    PIOMMU_BOUNCE_BLOCK           Block;
+    UINT32                        StartPage;
+} IOMMU_BOUNCE_SLOT;
+
+typedef struct _IOMMU_BOUNCE_SLOT_CLASS
+{
+    UINT32                        Count;
+    IOMMU_BOUNCE_SLOT             Slots[IOMMU_BOUNCE_SLOT_DEPTH];
+    UINT64                        Hits;
+    UINT64                        Misses;
+} IOMMU_BOUNCE_SLOT_CLASS;
+
 //
 // MAP_CONTEXT - tracking structure for an active Map operation. Stored as
 // the Mapping handle returned to callers. Records which bounce block and
@@ -241,9 +303,10 @@ IoMmuReleaseAddressRangeFromDma (
 
 /**
   Pre-allocate a bounce block of `PageCount` pages, make it host-visible,
-  and add it to the pool. Used to populate the pool at driver init so the
+  and add it to a pool. Used to populate the pool at driver init so the
   common-case Map() path needs no hypercall.
 
+  @param[in]   Pool        Pool the block serves; selects the address limit.
   @param[in]   PageCount   Number of pages in the new block.
   @param[out]  BlockOut    The newly allocated block on success.
 
@@ -252,15 +315,20 @@ IoMmuReleaseAddressRangeFromDma (
 **/
 EFI_STATUS
 IoMmuPreAllocateBounceBlock (
+    IN  IOMMU_BOUNCE_POOL       Pool,
     IN  UINT32                  PageCount,
     OUT PIOMMU_BOUNCE_BLOCK     *BlockOut
     );
 
 /**
-  Acquire a contiguous run of bounce pages from the pool. Allocates a new
-  bounce block (and makes it host-visible) on demand if no existing block
-  has a sufficient contiguous free run.
-
+  Acquire a contiguous run of bounce pages from a pool. Small runs are
+  taken from the bounce slot cache when it holds one of the requested size.
+  Allocates a new bounce block (and makes it host-visible) on demand if no
+  existing block has a sufficient contiguous free run, even after the slot
+  cache has been drained. High pool requests fall back to the low pool when
+  a high block cannot be allocated.
+
+  @param[in]   Pool             Pool matching the caller's DMA width.
   @param[in]   PageCount        Number of contiguous pages required.
   @param[out]  Block            Owning bounce block.
   @param[out]  StartPageIndex   Starting page index within the block.
@@ -271,6 +339,7 @@ IoMmuPreAllocateBounceBlock (
 **/
 EFI_STATUS
 IoMmuAcquireBouncePages (
+    IN  IOMMU_BOUNCE_POOL       Pool,
     IN  UINT32                  PageCount,
     OUT PIOMMU_BOUNCE_BLOCK     *Block,
     OUT UINT32                  *StartPageIndex,
@@ -279,8 +348,12 @@ IoMmuAcquireBouncePages (
 
 /**
   Release a previously acquired contiguous run of bounce pages back to the
-  pool. The pages remain host-visible (the owning block stays host-visible
-  for its lifetime).
+  pool. Small runs are parked in the bounce slot cache for reuse by the next
+  request of the same size. The pages remain host-visible. When the release
+  leaves a block unused, grown blocks that have been idle for
+  IOMMU_BOUNCE_TRIM_IDLE_RELEASES releases are trimmed: their host
+  visibility is revoked and their pages are freed. No blocks are trimmed
+  after IoMmuStopBounceTrimming has been called.
 
   @param[in]  Block            Owning bounce block.
   @param[in]  StartPageIndex   Starting page index within the block.
@@ -292,3 +365,23 @@ IoMmuReleaseBouncePages (
     IN UINT32                   StartPageIndex,
     IN UINT32                   PageCount
     );
+
+/**
+  Stop trimming idle bounce blocks. Called when ExitBootServices starts,
+  after which releases must not free pages or change host visibility.
+**/
+VOID
+IoMmuStopBounceTrimming (
+    VOID
+    );
+
+/**
+  Return every run held by the bounce slot cache to its block's bitmap.
+  Called when the pool is under pressure so that cached runs can be merged
+  into larger free runs.
+**/
+VOID
+IoMmuDrainBounceSlotCache (
+    VOID
+    );
+
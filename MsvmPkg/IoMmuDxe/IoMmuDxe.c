@@ -29,6 +29,11 @@
 //
 extern LIST_ENTRY  mAllocContextListHead;
 
+//
+// Signaled before ExitBootServices runs its handlers.
+//
+STATIC EFI_EVENT  mBeforeExitBootServicesEvent;
+
 
 /**
   EDKII_IOMMU_PROTOCOL.SetAttribute - Set IOMMU access attributes.
@@ -205,6 +210,7 @@ IoMmuMap (
         PIOMMU_BOUNCE_BLOCK             BounceBlock;
         UINT32                          BounceStartPage;
         UINTN                           RequestedPages;
+        IOMMU_BOUNCE_POOL               Pool;
 
         RequestedPages = EFI_SIZE_TO_PAGES (*NumberOfBytes);
 
@@ -225,12 +231,20 @@ IoMmuMap (
         BouncePageCount = (UINT32)RequestedPages;
 
         //
-        // The bounce block pool always allocates blocks below 4GB, so the
-        // run returned here is safe for both 32-bit and 64-bit DMA devices.
-        // Operation-based DmaMemoryTop checks (4GB cap) are therefore
-        // implicitly satisfied.
+        // Route by DMA width. The PCI host bridge only issues the 64-bit
+        // operations for devices with DUAL_ADDRESS_CYCLE set, so those can
+        // bounce through the high pool; everything else needs a run below
+        // 4GB from the low pool.
         //
+        if (Operation == EdkiiIoMmuOperationBusMasterRead64 ||
+            Operation == EdkiiIoMmuOperationBusMasterWrite64) {
+            Pool = IoMmuBouncePoolHigh;
+        } else {
+            Pool = IoMmuBouncePoolLow;
+        }
+
         Status = IoMmuAcquireBouncePages (
+                     Pool,
                      BouncePageCount,
                      &BounceBlock,
                      &BounceStartPage,
@@ -365,8 +379,8 @@ IoMmuUnmap (
 
     //
     // Release the bounce pages back to the pool. The owning bounce block
-    // remains prepared for DMA for its lifetime, so no per-Unmap hypervisor
-    // call is required.
+    // stays prepared for DMA, so no per-Unmap hypervisor call is required
+    // unless the release lets an idle block be trimmed.
     //
     if ((MapContext->Operation != EdkiiIoMmuOperationBusMasterCommonBuffer) &&
       (MapContext->Operation != EdkiiIoMmuOperationBusMasterCommonBuffer64))
@@ -561,6 +575,28 @@ STATIC EDKII_IOMMU_PROTOCOL  mIoMmuProtocol = {
 };
 
 
+/**
+  BeforeExitBootServices callback. Drivers unmap their DMA buffers from
+  their ExitBootServices handlers, and releasing a bounce run may trim
+  idle blocks, which frees pages and revokes host visibility. Neither is
+  allowed once ExitBootServices has started, so trimming stops here,
+  before any of those handlers run.
+
+  @param[in]  Event     The event being signaled.
+  @param[in]  Context   Unused.
+**/
+STATIC
+VOID
+EFIAPI
+IoMmuBeforeExitBootServices (
+    IN EFI_EVENT  Event,
+    IN VOID       *Context
+    )
+{
+    IoMmuStopBounceTrimming ();
+}
+
+
 /**
   IoMmuDxe driver entry point.
 
@@ -604,13 +640,35 @@ IoMmuDxeEntryPoint (
             return Status;
         }
 
+        Status = gBS->CreateEventEx (
+                        EVT_NOTIFY_SIGNAL,
+                        TPL_CALLBACK,
+                        IoMmuBeforeExitBootServices,
+                        NULL,
+                        &gEfiEventBeforeExitBootServicesGuid,
+                        &mBeforeExitBootServicesEvent
+                        );
+        if (EFI_ERROR (Status)) {
+            //
+            // Without the event there is no safe point to stop trimming,
+            // so keep every block for the life of the driver.
+            //
+            DEBUG ((DEBUG_WARN,
+                "IoMmuDxe: Failed to create BeforeExitBootServices event, bounce blocks will not be trimmed: %r\n",
+                Status));
+            IoMmuStopBounceTrimming ();
+        }
+
         //
         // Pre-allocate one bounce block up front so the common-case Map()
         // path needs no AllocatePages/MakeAddressRangeHostVisible hypercall.
         // Failure here is non-fatal: subsequent Map() calls will lazily
-        // allocate a block on demand.
+        // allocate a block on demand. The initial block is in the low pool,
+        // which every caller can use; the high pool is grown by the first
+        // 64-bit Map().
         //
         BlockStatus = IoMmuPreAllocateBounceBlock (
+                          IoMmuBouncePoolLow,
                           IOMMU_BOUNCE_INITIAL_BLOCK_PAGES,
                           &InitialBlock
                           );
@@ -0,0 +1,645 @@
+/** @file
+    Host based checks and micro-benchmark of the IoMmuDxe bounce page
+    allocator.
+
+    The allocator is exercised through IoMmuAcquireBouncePages and
+    IoMmuReleaseBouncePages, which is what every bounced Map()/Unmap() pair
+    does, in pure-bounce mode so no hypervisor calls are involved. Block
+    memory comes from the host heap.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <time.h>
+#include <cmocka.h>
+
+#include "../IoMmuBounce.h"
+#include <Library/UnitTestLib.h>
+
+#define UNIT_TEST_APP_NAME     "IoMmuDxe Bounce Allocator Tests"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Number of live mappings kept by the randomized and benchmark workloads.
+//
+#define BOUNCE_TEST_SLOTS           256
+#define BOUNCE_TEST_ITERATIONS      200000
+#define BOUNCE_BENCHMARK_CYCLES     2000000
+
+extern LIST_ENTRY               mBounceBlockListHead[IoMmuBouncePoolMax];
+extern IOMMU_BOUNCE_SLOT_CLASS  mBounceSlotClasses[IoMmuBouncePoolMax][IOMMU_BOUNCE_SLOT_CLASS_COUNT];
+
+typedef struct {
+    PIOMMU_BOUNCE_BLOCK  Block;
+    UINT32               StartPage;
+    UINT32               PageCount;
+} BOUNCE_TEST_MAPPING;
+
+STATIC BOUNCE_TEST_MAPPING  mMappings[BOUNCE_TEST_SLOTS];
+STATIC UINT32               mRandomState = 0x2545F491;
+
+//
+// Allocation type of the most recent block allocation and the number of
+// block allocations not yet freed.
+//
+STATIC EFI_ALLOCATE_TYPE    mLastAllocateType;
+STATIC UINT32               mOutstandingAllocations;
+
+//
+// Boot services used by the bounce block pool.
+//
+STATIC
+EFI_STATUS
+EFIAPI
+TestAllocatePages (
+    IN     EFI_ALLOCATE_TYPE     Type,
+    IN     EFI_MEMORY_TYPE       MemoryType,
+    IN     UINTN                 Pages,
+    IN OUT EFI_PHYSICAL_ADDRESS  *Memory
+    )
+{
+    VOID  *Buffer;
+
+    Buffer = AllocatePool (Pages * EFI_PAGE_SIZE);
+    if (Buffer == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    *Memory = (EFI_PHYSICAL_ADDRESS)(UINTN)Buffer;
+    mLastAllocateType = Type;
+    mOutstandingAllocations++;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+TestFreePages (
+    IN EFI_PHYSICAL_ADDRESS  Memory,
+    IN UINTN                 Pages
+    )
+{
+    FreePool ((VOID *)(UINTN)Memory);
+    mOutstandingAllocations--;
+    return EFI_SUCCESS;
+}
+
+STATIC EFI_BOOT_SERVICES  mBootServices;
+EFI_BOOT_SERVICES         *gBS = &mBootServices;
+
+BOOLEAN
+EFIAPI
+IsIsolated (
+    VOID
+    )
+{
+    return FALSE;
+}
+
+
+STATIC
+UINT32
+NextRandom (
+    VOID
+    )
+{
+    mRandomState ^= mRandomState << 13;
+    mRandomState ^= mRandomState >> 17;
+    mRandomState ^= mRandomState << 5;
+    return mRandomState;
+}
+
+
+/**
+  Mapping sizes in pages, weighted toward the small transfers storage and
+  network drivers issue with an occasional large read.
+**/
+STATIC
+UINT32
+RandomPageCount (
+    VOID
+    )
+{
+    UINT32  Roll;
+
+    Roll = NextRandom () % 100;
+    if (Roll < 60) {
+        return 1;
+    } else if (Roll < 85) {
+        return 2 + NextRandom () % 3;
+    } else if (Roll < 98) {
+        return 8 + NextRandom () % 25;
+    }
+
+    return 64 + NextRandom () % 192;
+}
+
+
+STATIC
+VOID
+FreeBouncePool (
+    VOID
+    )
+{
+    IOMMU_BOUNCE_POOL    Pool;
+    PIOMMU_BOUNCE_BLOCK  Block;
+
+    for (Pool = IoMmuBouncePoolLow; Pool < IoMmuBouncePoolMax; Pool++) {
+        while (!IsListEmpty (&mBounceBlockListHead[Pool])) {
+            Block = BASE_CR (GetFirstNode (&mBounceBlockListHead[Pool]), IOMMU_BOUNCE_BLOCK, Link);
+            RemoveEntryList (&Block->Link);
+            gBS->FreePages ((EFI_PHYSICAL_ADDRESS)(UINTN)Block->BlockBase, Block->BlockPageCount);
+            FreePool (Block->AllocBitmap);
+            FreePool (Block);
+        }
+    }
+}
+
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+InitializePool (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    PIOMMU_BOUNCE_BLOCK  Block;
+
+    mBounceMode = IOMMU_BOUNCE_MODE_BOUNCE;
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuInitializeBounce ());
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuPreAllocateBounceBlock (IoMmuBouncePoolLow, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES, &Block));
+
+    ZeroMem (mMappings, sizeof (mMappings));
+    mRandomState = 0x2545F491;
+
+    return UNIT_TEST_PASSED;
+}
+
+
+STATIC
+VOID
+EFIAPI
+CleanupPool (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    UINT32  Index;
+
+    for (Index = 0; Index < BOUNCE_TEST_SLOTS; Index++) {
+        if (mMappings[Index].Block != NULL) {
+            IoMmuReleaseBouncePages (mMappings[Index].Block, mMappings[Index].StartPage, mMappings[Index].PageCount);
+            mMappings[Index].Block = NULL;
+        }
+    }
+
+    IoMmuDrainBounceSlotCache ();
+    FreeBouncePool ();
+}
+
+
+/**
+  Return TRUE if `Block` has `PageCount` free pages in a row, checking the
+  bitmap one bit at a time.
+**/
+STATIC
+BOOLEAN
+ReferenceHasFreeRun (
+    IN PIOMMU_BOUNCE_BLOCK  Block,
+    IN UINT32               PageCount
+    )
+{
+    UINT32  Page;
+    UINT32  Run;
+
+    Run = 0;
+    for (Page = 0; Page < Block->BlockPageCount; Page++) {
+        if ((Block->AllocBitmap[Page >> 6] & LShiftU64 (1, Page & 63)) == 0) {
+            if (++Run == PageCount) {
+                return TRUE;
+            }
+        } else {
+            Run = 0;
+        }
+    }
+
+    return FALSE;
+}
+
+
+STATIC
+UINT32
+CountBlocks (
+    VOID
+    )
+{
+    LIST_ENTRY  *Entry;
+    UINT32      Count;
+
+    Count = 0;
+    for (Entry = GetFirstNode (&mBounceBlockListHead[IoMmuBouncePoolLow]);
+         !IsNull (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry);
+         Entry = GetNextNode (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry))
+    {
+        Count++;
+    }
+
+    return Count;
+}
+
+
+/**
+  Randomly map and unmap runs of pages, checking that runs never overlap,
+  that the in-use accounting matches the bitmap, and that a new block is
+  only grown when no existing block had room.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestRandomMapUnmap (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    UINT32               Iteration;
+    UINT32               Slot;
+    UINT32               PageCount;
+    UINT32               Page;
+    UINT32               BlockCount;
+    BOOLEAN              HadRoom;
+    LIST_ENTRY           *Entry;
+    PIOMMU_BOUNCE_BLOCK  Block;
+    PIOMMU_BOUNCE_BLOCK  NewBlock;
+    UINT32               StartPage;
+    VOID                 *BounceBase;
+    UINT8                *Owner;
+    UINT32               InUse;
+
+    for (Iteration = 0; Iteration < BOUNCE_TEST_ITERATIONS; Iteration++) {
+        Slot = NextRandom () % BOUNCE_TEST_SLOTS;
+
+        if (mMappings[Slot].Block != NULL) {
+            IoMmuReleaseBouncePages (mMappings[Slot].Block, mMappings[Slot].StartPage, mMappings[Slot].PageCount);
+            mMappings[Slot].Block = NULL;
+            continue;
+        }
+
+        PageCount  = RandomPageCount ();
+        BlockCount = CountBlocks ();
+        HadRoom    = FALSE;
+        for (Entry = GetFirstNode (&mBounceBlockListHead[IoMmuBouncePoolLow]);
+             !IsNull (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry);
+             Entry = GetNextNode (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry))
+        {
+            HadRoom |= ReferenceHasFreeRun (BASE_CR (Entry, IOMMU_BOUNCE_BLOCK, Link), PageCount);
+        }
+
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, PageCount, &NewBlock, &StartPage, &BounceBase));
+        UT_ASSERT_TRUE (StartPage + PageCount <= NewBlock->BlockPageCount);
+        UT_ASSERT_EQUAL ((UINTN)BounceBase, (UINTN)NewBlock->BlockBase + (UINTN)StartPage * EFI_PAGE_SIZE);
+
+        if (HadRoom) {
+            //
+            // No block was grown.
+            //
+            UT_ASSERT_EQUAL (CountBlocks (), BlockCount);
+        }
+
+        mMappings[Slot].Block     = NewBlock;
+        mMappings[Slot].StartPage = StartPage;
+        mMappings[Slot].PageCount = PageCount;
+    }
+
+    //
+    // Return cached runs to the bitmaps, then rebuild page ownership from
+    // the live mappings and compare it with every block's bitmap and in-use
+    // count.
+    //
+    IoMmuDrainBounceSlotCache ();
+
+    for (Entry = GetFirstNode (&mBounceBlockListHead[IoMmuBouncePoolLow]);
+         !IsNull (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry);
+         Entry = GetNextNode (&mBounceBlockListHead[IoMmuBouncePoolLow], Entry))
+    {
+        Block = BASE_CR (Entry, IOMMU_BOUNCE_BLOCK, Link);
+        Owner = AllocateZeroPool (Block->BlockPageCount);
+        UT_ASSERT_NOT_NULL (Owner);
+
+        InUse = 0;
+        for (Slot = 0; Slot < BOUNCE_TEST_SLOTS; Slot++) {
+            if (mMappings[Slot].Block != Block) {
+                continue;
+            }
+
+            for (Page = mMappings[Slot].StartPage; Page < mMappings[Slot].StartPage + mMappings[Slot].PageCount; Page++) {
+                UT_ASSERT_EQUAL (Owner[Page], 0);
+                Owner[Page] = 1;
+                InUse++;
+            }
+        }
+
+        for (Page = 0; Page < Block->BlockPageCount; Page++) {
+            UT_ASSERT_EQUAL ((Block->AllocBitmap[Page >> 6] >> (Page & 63)) & 1, Owner[Page]);
+        }
+
+        UT_ASSERT_EQUAL (Block->InUsePageCount, InUse);
+        UT_ASSERT_EQUAL (Block->CachedPageCount, 0);
+        UT_ASSERT_TRUE (!ReferenceHasFreeRun (Block, Block->LargestFreeRun + 1));
+
+        FreePool (Owner);
+    }
+
+    return UNIT_TEST_PASSED;
+}
+
+
+/**
+  Check that small released runs are handed back by the slot cache
+  without touching the bitmap, and that draining frees them.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestSlotCacheReuse (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    PIOMMU_BOUNCE_BLOCK  Block;
+    PIOMMU_BOUNCE_BLOCK  ReusedBlock;
+    UINT32               StartPage;
+    UINT32               ReusedStartPage;
+    VOID                 *BounceBase;
+    UINT32               Index;
+
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 2, &Block, &StartPage, &BounceBase));
+    UT_ASSERT_EQUAL (mBounceSlotClasses[IoMmuBouncePoolLow][1].Misses, 1);
+
+    IoMmuReleaseBouncePages (Block, StartPage, 2);
+    UT_ASSERT_EQUAL (mBounceSlotClasses[IoMmuBouncePoolLow][1].Count, 1);
+    UT_ASSERT_EQUAL (Block->InUsePageCount, 2);
+    UT_ASSERT_EQUAL (Block->CachedPageCount, 2);
+    UT_ASSERT_TRUE (!ReferenceHasFreeRun (Block, Block->BlockPageCount));
+
+    //
+    // A request of another size does not take the cached run.
+    //
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 1, &ReusedBlock, &ReusedStartPage, &BounceBase));
+    UT_ASSERT_TRUE (ReusedBlock != Block || ReusedStartPage != StartPage);
+    IoMmuReleaseBouncePages (ReusedBlock, ReusedStartPage, 1);
+
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 2, &ReusedBlock, &ReusedStartPage, &BounceBase));
+    UT_ASSERT_EQUAL ((UINTN)ReusedBlock, (UINTN)Block);
+    UT_ASSERT_EQUAL (ReusedStartPage, StartPage);
+    UT_ASSERT_EQUAL (mBounceSlotClasses[IoMmuBouncePoolLow][1].Hits, 1);
+    UT_ASSERT_EQUAL (Block->CachedPageCount, 1);
+    IoMmuReleaseBouncePages (Block, StartPage, 2);
+
+    //
+    // Runs beyond the cache depth go straight back to the bitmap.
+    //
+    for (Index = 0; Index < IOMMU_BOUNCE_SLOT_DEPTH + 1; Index++) {
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 3, &mMappings[Index].Block, &mMappings[Index].StartPage, &BounceBase));
+        mMappings[Index].PageCount = 3;
+    }
+
+    for (Index = 0; Index < IOMMU_BOUNCE_SLOT_DEPTH + 1; Index++) {
+        IoMmuReleaseBouncePages (mMappings[Index].Block, mMappings[Index].StartPage, 3);
+        mMappings[Index].Block = NULL;
+    }
+
+    UT_ASSERT_EQUAL (mBounceSlotClasses[IoMmuBouncePoolLow][2].Count, IOMMU_BOUNCE_SLOT_DEPTH);
+    UT_ASSERT_EQUAL (Block->CachedPageCount, 1 + 2 + IOMMU_BOUNCE_SLOT_DEPTH * 3);
+    UT_ASSERT_EQUAL (Block->InUsePageCount, Block->CachedPageCount);
+
+    IoMmuDrainBounceSlotCache ();
+    UT_ASSERT_EQUAL (mBounceSlotClasses[IoMmuBouncePoolLow][2].Count, 0);
+    UT_ASSERT_EQUAL (Block->CachedPageCount, 0);
+    UT_ASSERT_EQUAL (Block->InUsePageCount, 0);
+    UT_ASSERT_EQUAL (Block->LargestFreeRun, Block->BlockPageCount);
+
+    return UNIT_TEST_PASSED;
+}
+
+
+/**
+  Check that high pool requests get their own blocks, allocated without the
+  4GB limit, and that blocks grown on demand are trimmed once they have
+  been idle long enough while the first block of a pool is kept.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestHighPoolAndTrim (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    PIOMMU_BOUNCE_BLOCK  LowBlock;
+    PIOMMU_BOUNCE_BLOCK  HighBlock;
+    PIOMMU_BOUNCE_BLOCK  GrownBlock;
+    PIOMMU_BOUNCE_BLOCK  Block;
+    UINT32               LowStart;
+    UINT32               HighStart;
+    UINT32               GrownStart;
+    UINT32               StartPage;
+    VOID                 *BounceBase;
+    UINT32               Index;
+
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 1);
+
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolHigh, 16, &HighBlock, &HighStart, &BounceBase));
+    UT_ASSERT_EQUAL (HighBlock->Pool, IoMmuBouncePoolHigh);
+    UT_ASSERT_EQUAL (mLastAllocateType, AllocateAnyPages);
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 2);
+
+    //
+    // Fill the low block so the next low request grows the low pool.
+    //
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES, &LowBlock, &LowStart, &BounceBase));
+    UT_ASSERT_EQUAL (LowBlock->Pool, IoMmuBouncePoolLow);
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 16, &GrownBlock, &GrownStart, &BounceBase));
+    UT_ASSERT_TRUE (GrownBlock != LowBlock);
+    UT_ASSERT_EQUAL (mLastAllocateType, AllocateMaxAddress);
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 3);
+
+    IoMmuReleaseBouncePages (GrownBlock, GrownStart, 16);
+    IoMmuReleaseBouncePages (LowBlock, LowStart, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES);
+    IoMmuReleaseBouncePages (HighBlock, HighStart, 16);
+
+    //
+    // Keep the first low block busy until the grown block has aged out.
+    //
+    for (Index = 0; Index < IOMMU_BOUNCE_TRIM_IDLE_RELEASES; Index++) {
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 16, &Block, &StartPage, &BounceBase));
+        UT_ASSERT_EQUAL ((UINTN)Block, (UINTN)LowBlock);
+        IoMmuReleaseBouncePages (Block, StartPage, 16);
+    }
+
+    //
+    // The grown low block is gone; the first block of each pool remains.
+    //
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 2);
+    UT_ASSERT_EQUAL (CountBlocks (), 1);
+    UT_ASSERT_EQUAL ((UINTN)BASE_CR (GetFirstNode (&mBounceBlockListHead[IoMmuBouncePoolHigh]), IOMMU_BOUNCE_BLOCK, Link), (UINTN)HighBlock);
+
+    return UNIT_TEST_PASSED;
+}
+
+
+/**
+  Check that no block is trimmed once trimming has been stopped for
+  ExitBootServices, however long it has been idle.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestNoTrimAfterExitBootServices (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    PIOMMU_BOUNCE_BLOCK  LowBlock;
+    PIOMMU_BOUNCE_BLOCK  GrownBlock;
+    PIOMMU_BOUNCE_BLOCK  Block;
+    UINT32               LowStart;
+    UINT32               GrownStart;
+    UINT32               StartPage;
+    VOID                 *BounceBase;
+    UINT32               Index;
+
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES, &LowBlock, &LowStart, &BounceBase));
+    UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 16, &GrownBlock, &GrownStart, &BounceBase));
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 2);
+
+    IoMmuStopBounceTrimming ();
+
+    IoMmuReleaseBouncePages (GrownBlock, GrownStart, 16);
+    IoMmuReleaseBouncePages (LowBlock, LowStart, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES);
+    for (Index = 0; Index < 2 * IOMMU_BOUNCE_TRIM_IDLE_RELEASES; Index++) {
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES, &Block, &StartPage, &BounceBase));
+        IoMmuReleaseBouncePages (Block, StartPage, IOMMU_BOUNCE_INITIAL_BLOCK_PAGES);
+    }
+
+    UT_ASSERT_EQUAL (mOutstandingAllocations, 2);
+    UT_ASSERT_EQUAL (CountBlocks (), 2);
+
+    return UNIT_TEST_PASSED;
+}
+
+
+/**
+  Time Map/Unmap cycles against a fragmented pool. Every other page of the
+  initial block stays mapped, so only single pages fit in it and every
+  larger request has to skip it.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkFragmentedMapUnmap (
+    IN UNIT_TEST_CONTEXT  Context
+    )
+{
+    PIOMMU_BOUNCE_BLOCK  Blocks[IOMMU_BOUNCE_INITIAL_BLOCK_PAGES];
+    UINT32               StartPages[IOMMU_BOUNCE_INITIAL_BLOCK_PAGES];
+    PIOMMU_BOUNCE_BLOCK  Block;
+    UINT32               StartPage;
+    VOID                 *BounceBase;
+    UINT32               Index;
+    UINT32               Cycle;
+    UINT32               Slot;
+    UINT32               PageCount;
+    clock_t              Start;
+    clock_t              Elapsed;
+
+    for (Index = 0; Index < IOMMU_BOUNCE_INITIAL_BLOCK_PAGES; Index++) {
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, 1, &Blocks[Index], &StartPages[Index], &BounceBase));
+    }
+
+    for (Index = 0; Index < IOMMU_BOUNCE_INITIAL_BLOCK_PAGES; Index += 2) {
+        IoMmuReleaseBouncePages (Blocks[Index], StartPages[Index], 1);
+    }
+
+    Start = clock ();
+    for (Cycle = 0; Cycle < BOUNCE_BENCHMARK_CYCLES; Cycle++) {
+        Slot = NextRandom () % BOUNCE_TEST_SLOTS;
+        if (mMappings[Slot].Block != NULL) {
+            IoMmuReleaseBouncePages (mMappings[Slot].Block, mMappings[Slot].StartPage, mMappings[Slot].PageCount);
+            mMappings[Slot].Block = NULL;
+        }
+
+        PageCount = RandomPageCount ();
+        UT_ASSERT_NOT_EFI_ERROR (IoMmuAcquireBouncePages (IoMmuBouncePoolLow, PageCount, &Block, &StartPage, &BounceBase));
+        mMappings[Slot].Block     = Block;
+        mMappings[Slot].StartPage = StartPage;
+        mMappings[Slot].PageCount = PageCount;
+    }
+
+    Elapsed = clock () - Start;
+
+    DEBUG ((DEBUG_INFO,
+        "BenchmarkFragmentedMapUnmap: %u cycles in %u ms (%u ns per cycle), %u%% single page slot cache hits\n",
+        BOUNCE_BENCHMARK_CYCLES,
+        (UINT32)(Elapsed * 1000 / CLOCKS_PER_SEC),
+        (UINT32)((UINT64)Elapsed * 1000000000 / CLOCKS_PER_SEC / BOUNCE_BENCHMARK_CYCLES),
+        (UINT32)(mBounceSlotClasses[IoMmuBouncePoolLow][0].Hits * 100 / (mBounceSlotClasses[IoMmuBouncePoolLow][0].Hits + mBounceSlotClasses[IoMmuBouncePoolLow][0].Misses))));
+
+    for (Index = 1; Index < IOMMU_BOUNCE_INITIAL_BLOCK_PAGES; Index += 2) {
+        IoMmuReleaseBouncePages (Blocks[Index], StartPages[Index], 1);
+    }
+
+    return UNIT_TEST_PASSED;
+}
+
+
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+    VOID
+    )
+{
+    EFI_STATUS                  Status;
+    UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+    UNIT_TEST_SUITE_HANDLE      Suite;
+
+    mBootServices.AllocatePages = TestAllocatePages;
+    mBootServices.FreePages     = TestFreePages;
+
+    Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    Status = CreateUnitTestSuite (&Suite, Framework, "Bounce Allocator", "IoMmuDxe.Bounce", NULL, NULL);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    AddTestCase (Suite, "Random map/unmap keeps the bitmap consistent", "RandomMapUnmap", TestRandomMapUnmap, InitializePool, CleanupPool, NULL);
+    AddTestCase (Suite, "Small runs are reused through the slot cache", "SlotCacheReuse", TestSlotCacheReuse, InitializePool, CleanupPool, NULL);
+    AddTestCase (Suite, "High pool routing and idle block trimming", "HighPoolAndTrim", TestHighPoolAndTrim, InitializePool, CleanupPool, NULL);
+    AddTestCase (Suite, "No trimming after ExitBootServices", "NoTrimAfterExitBootServices", TestNoTrimAfterExitBootServices, InitializePool, CleanupPool, NULL);
+    AddTestCase (Suite, "Map/unmap cycles on a fragmented pool", "FragmentedBenchmark", BenchmarkFragmentedMapUnmap, InitializePool, CleanupPool, NULL);
+
+    Status = RunAllTestSuites (Framework);
+
+Exit:
+    if (Framework != NULL) {
+        FreeUnitTestFramework (Framework);
+    }
+
+    return Status;
+}
+
+
+int
+main (
+    int   argc,
+    char  *argv[]
+    )
+{
+    return UefiTestMain ();
+}
@@ -6,12 +6,24 @@
 
 **/
 
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/BiosDeviceLib.h>
+#include <Library/ConfigLib.h>
 #include <Library/DebugLib.h>
+#include <Library/HobLib.h>
 #include <Library/IoLib.h>
 
 #include <BiosInterface.h>
+#include <ConfigBlobIndex.h>
+
+//
+// The config blob index HOB, located on first use. mConfigBlobIndexSearched
+// is set once the HOB list has been searched so a missing index is not
+// searched for again.
+//
+static CONFIG_BLOB_INDEX* mConfigBlobIndex = NULL;
+static BOOLEAN mConfigBlobIndexSearched = FALSE;
 
 UINT32
 GetNfitSize(
@@ -107,3 +119,269 @@ Return Value:
     WriteBiosDevice(BiosConfigGenerationIdPtrLow, (UINT32)Value);
     WriteBiosDevice(BiosConfigGenerationIdPtrHigh, (UINT32)(Value >> 32));
 }
+
+static
+CONFIG_BLOB_INDEX*
+GetConfigBlobIndex(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the config blob index published by PlatformPei.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The config blob index, or NULL if PEI did not publish one.
+
+--*/
+{
+    EFI_HOB_GUID_TYPE* guidHob;
+
+    if (!mConfigBlobIndexSearched)
+    {
+        guidHob = GetFirstGuidHob(&gMsvmConfigBlobIndexHobGuid);
+        if (guidHob != NULL &&
+            GET_GUID_HOB_DATA_SIZE(guidHob) >= sizeof(CONFIG_BLOB_INDEX))
+        {
+            mConfigBlobIndex = (CONFIG_BLOB_INDEX*)GET_GUID_HOB_DATA(guidHob);
+        }
+
+        mConfigBlobIndexSearched = TRUE;
+    }
+
+    return mConfigBlobIndex;
+}
+
+UEFI_CONFIG_HEADER*
+GetConfigStructure(
+    UINT32 Type
+    )
+/*++
+
+Routine Description:
+
+    Returns the first config structure of the given type.
+
+Arguments:
+
+    Type - the config structure type, one of UefiStructureType
+
+Return Value:
+
+    A pointer to the structure header, or NULL if the structure is absent.
+
+--*/
+{
+    CONFIG_BLOB_INDEX* index = GetConfigBlobIndex();
+
+    if (index == NULL ||
+        Type >= index->EntryCount ||
+        index->Entries[Type].Count == 0)
+    {
+        return NULL;
+    }
+
+    return (UEFI_CONFIG_HEADER*)(UINTN)(index->BlobBase + index->Entries[Type].Offset);
+}
+
+UINT32
+GetConfigStructureCount(
+    UINT32 Type
+    )
+/*++
+
+Routine Description:
+
+    Returns the number of config structures of the given type.
+
+Arguments:
+
+    Type - the config structure type, one of UefiStructureType
+
+Return Value:
+
+    The number of structures of the type in the config blob.
+
+--*/
+{
+    CONFIG_BLOB_INDEX* index = GetConfigBlobIndex();
+
+    if (index == NULL || Type >= index->EntryCount)
+    {
+        return 0;
+    }
+
+    return index->Entries[Type].Count;
+}
+
+void*
+GetConfigStructureData(
+    UINT32 Type,
+    UINT32* DataSize
+    )
+/*++
+
+Routine Description:
+
+    Returns the data following the header of the first config structure of
+    the given type.
+
+Arguments:
+
+    Type - the config structure type, one of UefiStructureType
+
+    DataSize - returns the size of the data in bytes
+
+Return Value:
+
+    A pointer to the structure data, or NULL if the structure is absent.
+
+--*/
+{
+    UEFI_CONFIG_HEADER* header = GetConfigStructure(Type);
+
+    if (header == NULL)
+    {
+        *DataSize = 0;
+        return NULL;
+    }
+
+    //
+    // Use the length recorded in the index rather than the header. PEI
+    // normalizes the memory map in place, which can shorten it.
+    //
+    *DataSize = GetConfigBlobIndex()->Entries[Type].Length - sizeof(UEFI_CONFIG_HEADER);
+    return header + 1;
+}
+
+void*
+GetConfigMemoryMap(
+    UINT32* Size
+    )
+/*++
+
+Routine Description:
+
+    Returns the memory map from the config blob. The entry format depends on
+    the legacy memory map flag in the BIOS information structure.
+
+Arguments:
+
+    Size - returns the size of the memory map in bytes
+
+Return Value:
+
+    A pointer to the first memory map entry, or NULL if there is no config blob.
+
+--*/
+{
+    return GetConfigStructureData(UefiConfigMemoryMap, Size);
+}
+
+CHAR8*
+GetConfigSmbiosString(
+    UINT32 Type,
+    UINT32* Length
+    )
+/*++
+
+Routine Description:
+
+    Returns an SMBIOS string structure from the config blob. The strings are
+    padded to 8 bytes and may not be terminated, so the length is returned.
+
+Arguments:
+
+    Type - one of the UefiConfigSmbios*String structure types
+
+    Length - returns the string length in characters, not counting any
+        terminator
+
+Return Value:
+
+    A pointer to the string, or NULL if the structure is absent.
+
+--*/
+{
+    UINT32 dataSize;
+    CHAR8* string = GetConfigStructureData(Type, &dataSize);
+
+    *Length = (string == NULL) ? 0 : (UINT32)AsciiStrnLenS(string, dataSize);
+    return string;
+}
+
+UEFI_CONFIG_FLAGS*
+GetConfigFlags(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the UEFI config flags structure.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    A pointer to the structure, or NULL if there is no config blob.
+
+--*/
+{
+    return (UEFI_CONFIG_FLAGS*)GetConfigStructure(UefiConfigFlags);
+}
+
+UEFI_CONFIG_PROCESSOR_INFORMATION*
+GetConfigProcessorInformation(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the processor information structure.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    A pointer to the structure, or NULL if there is no config blob.
+
+--*/
+{
+    return (UEFI_CONFIG_PROCESSOR_INFORMATION*)GetConfigStructure(UefiConfigProcessorInformation);
+}
+
+UEFI_CONFIG_MMIO_RANGES*
+GetConfigMmioRanges(
+    void
+    )
+/*++
+
+Routine Description:
+
+    Returns the MMIO ranges structure. PEI checked that it holds exactly two
+    ranges; the low and high gaps may be in either order.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    A pointer to the structure, or NULL if there is no config blob.
+
+--*/
+{
+    return (UEFI_CONFIG_MMIO_RANGES*)GetConfigStructure(UefiConfigMmioRanges);
+}
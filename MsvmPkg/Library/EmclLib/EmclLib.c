@@ -28,6 +28,7 @@ typedef struct _EMCL_LIB_COMPLETION_CONTEXT
 
 extern EFI_GUID gEfiEmclTagProtocolGuid;
 extern EFI_GUID gEfiVmbusChannelDevicePathGuid;
+extern EFI_GUID gEfiVmbusSubChannelDevicePathGuid;
 
 EFI_STATUS
 EFIAPI
@@ -403,6 +404,20 @@ EmclChannelTypeAndInstanceSupported (
                         status = EFI_SUCCESS;
                     }
 
+                    //
+                    // Sub-channels are opened by the driver managing the
+                    // primary channel and are never supported on their own.
+                    //
+                    devicePathNode = NextDevicePathNode(devicePathNode);
+                    if ((DevicePathType(devicePathNode) == HARDWARE_DEVICE_PATH) &&
+                        (DevicePathSubType(devicePathNode) == HW_VENDOR_DP) &&
+                        CompareGuid(
+                            &((VENDOR_DEVICE_PATH*) devicePathNode)->Guid,
+                            &gEfiVmbusSubChannelDevicePathGuid))
+                    {
+                        status = EFI_UNSUPPORTED;
+                    }
+
                     break;
                 }
             }
@@ -81,6 +81,17 @@ typedef struct _SVSM_PVALIDATE {
 
 #define TDX_TDG_STATUS(_status_) ((_status_) >> 32)
 
+//
+// TDG.MEM.PAGE.ACCEPT page size levels. Each level covers 512 pages of the
+// level below it.
+//
+
+#define TDX_ACCEPT_PAGE_SIZE_4KB    0
+#define TDX_ACCEPT_PAGE_SIZE_2MB    1
+#define TDX_ACCEPT_PAGE_SIZE_1GB    2
+
+#define TDX_ACCEPT_PAGE_COUNT(_size_) (1ULL << (9 * (_size_)))
+
 typedef union _TDX_ACCEPT_GPA {
     UINT64 AsUINT64;
     struct {
@@ -240,8 +251,8 @@ Return Value:
         // Attempt to validate a 2 MB page if possible.
         //
 
-        if (((StartingPageNumber & (SIZE_2MB - 1)) == 0) &&
-            (PageCount >= SIZE_2MB))
+        if (((StartingPageNumber & ((SIZE_2MB / EFI_PAGE_SIZE) - 1)) == 0) &&
+            (PageCount >= (SIZE_2MB / EFI_PAGE_SIZE)))
         {
             if (_sev_pvalidate(
                 (VOID*)(StartingPageNumber * EFI_PAGE_SIZE),
@@ -347,20 +358,25 @@ Return Value:
 
     largePageSize = SIZE_2MB / HV_PAGE_SIZE;
 
+    errorCode = SVSM_SUCCESS;
     while (PageCount != 0)
     {
         //
-        // Fill the parameter page with as many entries as will fit.
+        // Fill the parameter page with as many entries as will fit. The
+        // status of the previous call is kept so that a large page that
+        // failed with a size mismatch is retried as small pages.
         //
 
-        errorCode = SVSM_SUCCESS;
         pageNumber = StartingPageNumber;
         pagesRemaining = PageCount;
         numberOfEntries = 0;
         while ((pagesRemaining != 0) && (numberOfEntries < maximumEntries))
         {
             pageArray[numberOfEntries] = pageNumber * EFI_PAGE_SIZE;
-            pageArray[numberOfEntries] |= SVSM_PVALIDATE_VALIDATE_MASK;
+            if (Accept)
+            {
+                pageArray[numberOfEntries] |= SVSM_PVALIDATE_VALIDATE_MASK;
+            }
 
             //
             // Insert a large page entry if possible, but only if the last
@@ -410,6 +426,19 @@ Return Value:
             return EFI_SECURITY_VIOLATION;
         }
 
+        //
+        // The SVSM must report progress within the request, unless it
+        // stopped on a large page that has to be retried as small pages.
+        //
+
+        if ((pvalidate->NextEntryIndex > numberOfEntries) ||
+            ((pvalidate->NextEntryIndex == 0) &&
+             ((errorCode != SVSM_ERR_PVALIDATE_SIZE_MISMATCH) ||
+              ((pageArray[0] & SVSM_PVALIDATE_SIZE_MASK) == 0))))
+        {
+            return EFI_SECURITY_VIOLATION;
+        }
+
         //
         // Consume as many entries as were successful.
         //
@@ -465,56 +494,53 @@ Return Value:
 --*/
 {
     TDX_ACCEPT_GPA acceptGpa;
-    HV_GPA_PAGE_NUMBER largePageSize;
+    UINT32 pageSize;
+    UINT64 sizePageCount;
     UINT64 errorCode;
 
     acceptGpa.AsUINT64 = 0;
     acceptGpa.GpaPageNumber = StartingPageNumber;
 
-    largePageSize = SIZE_2MB / HV_PAGE_SIZE;
-
     while (PageCount != 0)
     {
         //
-        // Attempt to validate a 2 MB page if possible.
+        // Attempt to accept a 1 GB page, then a 2 MB page, if the range is
+        // aligned and long enough, falling back to the next smaller size
+        // when the host has mapped the range with smaller pages.
         //
 
-        if (((acceptGpa.GpaPageNumber & (largePageSize - 1)) == 0) &&
-            (PageCount >= largePageSize))
+        pageSize = TDX_ACCEPT_PAGE_SIZE_1GB;
+        for (;;)
         {
-            acceptGpa.PageSize = 1;
-            errorCode = _tdx_tdg_mem_page_accept(acceptGpa);
-            if (TDX_TDG_STATUS(errorCode) == TDX_SUCCESS)
-            {
-                acceptGpa.GpaPageNumber += largePageSize;
-                PageCount -= largePageSize;
-                continue;
-            }
-            else if (TDX_TDG_STATUS(errorCode) != TDX_PAGE_SIZE_MISMATCH)
+            sizePageCount = TDX_ACCEPT_PAGE_COUNT(pageSize);
+            if (((acceptGpa.GpaPageNumber & (sizePageCount - 1)) == 0) &&
+                (PageCount >= sizePageCount))
             {
-                DEBUG((DEBUG_VERBOSE,
-                       "Failed to accept (large) page at 0x%lx errorCode 0x%lx\n",
-                       acceptGpa.GpaPageNumber,
-                       errorCode));
-
-                return EFI_SECURITY_VIOLATION;
+                acceptGpa.PageSize = pageSize;
+                errorCode = _tdx_tdg_mem_page_accept(acceptGpa);
+                if (TDX_TDG_STATUS(errorCode) == TDX_SUCCESS)
+                {
+                    break;
+                }
+
+                if ((pageSize == TDX_ACCEPT_PAGE_SIZE_4KB) ||
+                    (TDX_TDG_STATUS(errorCode) != TDX_PAGE_SIZE_MISMATCH))
+                {
+                    DEBUG((DEBUG_VERBOSE,
+                           "Failed to accept page at 0x%lx size %u errorCode 0x%lx\n",
+                           acceptGpa.GpaPageNumber,
+                           pageSize,
+                           errorCode));
+
+                    return EFI_SECURITY_VIOLATION;
+                }
             }
-        }
-
-        acceptGpa.PageSize = 0;
-        errorCode = _tdx_tdg_mem_page_accept(acceptGpa);
-        if (TDX_TDG_STATUS(errorCode) != TDX_SUCCESS)
-        {
-            DEBUG((DEBUG_VERBOSE,
-                   "Failed to accept (small) page at 0x%lx errorCode 0x%lx\n",
-                   acceptGpa.GpaPageNumber,
-                   errorCode));
 
-            return EFI_SECURITY_VIOLATION;
+            pageSize -= 1;
         }
 
-        acceptGpa.GpaPageNumber += 1;
-        PageCount -= 1;
+        acceptGpa.GpaPageNumber += sizePageCount;
+        PageCount -= sizePageCount;
     }
 
     return EFI_SUCCESS;
@@ -597,7 +623,6 @@ Return Value:
 
 EFI_STATUS
 VispPvalidateSinglePage(
-    IN OPTIONAL VOID                *SvsmCallingArea,
                 HV_GPA_PAGE_NUMBER  PageNumber,
                 BOOLEAN             Validate
     )
@@ -605,14 +630,10 @@ VispPvalidateSinglePage(
 
 Routine Description:
 
-    This routine executes PVALIDATE for a single page, either directly or via
-    a call to the SVSM.
+    This routine executes PVALIDATE directly for a single page.
 
 Arguments:
 
-    SvsmCallingArea - If an SVSM is present, supplies a pointer to the SVSM
-                      calling area, otherwise supplies NULL.
-
     PageNumber - Supplies the GPA page number to process.
 
     Validate - Supplies the validation argument for PVALIDATE.
@@ -624,48 +645,75 @@ Return Value:
 --*/
 {
     UINT64 errorCode;
-    UINT64* pageArray;
-    SVSM_PVALIDATE *pvalidate;
 
-    if (SvsmCallingArea != NULL)
+    if (_sev_pvalidate((VOID*)(PageNumber * EFI_PAGE_SIZE), 0, Validate, &errorCode) != 0)
     {
-        //
-        // Locate the SVSM calling area.  This page will be used as the parameter page.
-        //
+        return EFI_SECURITY_VIOLATION;
+    }
 
-        pvalidate = SvsmCallingArea;
-        pageArray = (UINT64*)(pvalidate + 1);
-        *pageArray = PageNumber * EFI_PAGE_SIZE;
-        if (Validate)
-        {
-            *pageArray |= SVSM_PVALIDATE_VALIDATE_MASK;
-        }
+    if (errorCode != 0)
+    {
+        return EFI_SECURITY_VIOLATION;
+    }
 
-        pvalidate->NumberOfEntries = 1;
-        pvalidate->NextEntryIndex = 0;
-        pvalidate->CallPending = 1;
-        while (pvalidate->CallPending)
-        {
-            errorCode = VispCallSvsm(SVSM_CORE_PVALIDATE,
-                                     (UINTN)&pvalidate->NumberOfEntries);
-        }
+    return EFI_SUCCESS;
+}
 
-        if (errorCode != SVSM_SUCCESS)
-        {
-            return EFI_SECURITY_VIOLATION;
-        }
+
+EFI_STATUS
+VispPvalidatePageRange(
+    IN OPTIONAL VOID                *SvsmCallingArea,
+                HV_GPA_PAGE_NUMBER  StartingPageNumber,
+                UINT64              PageCount,
+                BOOLEAN             Validate
+    )
+/*++
+
+Routine Description:
+
+    This routine executes PVALIDATE for a range of pages, either directly or
+    via the SVSM.  With an SVSM, the calling area is filled with as many
+    entries as fit, so a range costs one SVSM call per calling area page
+    rather than one per page.
+
+Arguments:
+
+    SvsmCallingArea - If an SVSM is present, supplies a pointer to the SVSM
+                      calling area, otherwise supplies NULL.
+
+    StartingPageNumber - Supplies the starting GPA page number of the range to
+                         process.
+
+    PageCount - Supplies the number of pages to process.
+
+    Validate - Supplies the validation argument for PVALIDATE.
+
+Return Value:
+
+    EFI_STATUS.
+
+--*/
+{
+    EFI_STATUS status;
+
+    if (SvsmCallingArea != NULL)
+    {
+        return EfiUpdatePageRangeAcceptanceSnpSvsm(SvsmCallingArea,
+                                                   StartingPageNumber,
+                                                   PageCount,
+                                                   Validate);
     }
-    else
+
+    while (PageCount != 0)
     {
-        if (_sev_pvalidate((VOID*)(PageNumber * EFI_PAGE_SIZE), 0, 0, &errorCode) != 0)
+        status = VispPvalidateSinglePage(StartingPageNumber, Validate);
+        if (EFI_ERROR(status))
         {
-            return EFI_SECURITY_VIOLATION;
+            return status;
         }
 
-        if (errorCode != 0)
-        {
-            return EFI_SECURITY_VIOLATION;
-        }
+        StartingPageNumber += 1;
+        PageCount -= 1;
     }
 
     return EFI_SUCCESS;
@@ -718,18 +766,18 @@ Return Value:
         *PagesProcessed = 0;
     }
 
-    while (PageCount != 0)
-    {
-        //
-        // Ensure this page is no longer a valid private address.
-        //
+    //
+    // Ensure the pages are no longer valid private addresses.
+    //
 
-        status = VispPvalidateSinglePage(SvsmCallingArea, StartingPageNumber, FALSE);
-        if (EFI_ERROR(status))
-        {
-            return status;
-        }
+    status = VispPvalidatePageRange(SvsmCallingArea, StartingPageNumber, PageCount, FALSE);
+    if (EFI_ERROR(status))
+    {
+        return status;
+    }
 
+    while (PageCount != 0)
+    {
         //
         // Request a page conversion via the GHCB register protocol.
         //
@@ -744,11 +792,11 @@ Return Value:
         if (ghcbMsr.AsUINT64 != GHCB_INFO_PAGE_STATE_UPDATED)
         {
             //
-            // Restore this page to an accepted state since the visibility was not
-            // modified.
+            // Restore the remaining pages to an accepted state since their
+            // visibility was not modified.
             //
 
-            VispPvalidateSinglePage(SvsmCallingArea, StartingPageNumber, TRUE);
+            VispPvalidatePageRange(SvsmCallingArea, StartingPageNumber, PageCount, TRUE);
             return EFI_SECURITY_VIOLATION;
         }
 
@@ -994,14 +1042,17 @@ Return Value:
 --*/
 {
     GHCB_MSR ghcbMsr;
+    UINT64 pagesConverted;
     EFI_STATUS status;
+    EFI_STATUS validateStatus;
 
     if (PagesProcessed != NULL)
     {
         *PagesProcessed = 0;
     }
 
-    while (PageCount != 0)
+    status = EFI_SUCCESS;
+    for (pagesConverted = 0; pagesConverted < PageCount; pagesConverted += 1)
     {
         //
         // Request a page conversion via the GHCB register protocol.
@@ -1009,36 +1060,40 @@ Return Value:
 
         ghcbMsr.AsUINT64 = 0;
         ghcbMsr.GhcbInfo = GHCB_INFO_PAGE_STATE_CHANGE;
-        ghcbMsr.GpaPageNumber = StartingPageNumber;
-        ghcbMsr.ExtraData = GHCB_DATA_PAGE_STATE_SHARED;
+        ghcbMsr.GpaPageNumber = StartingPageNumber + pagesConverted;
+        ghcbMsr.ExtraData = GHCB_DATA_PAGE_STATE_PRIVATE;
 
         ghcbMsr.AsUINT64 = SpecialGhcbCall(ghcbMsr.AsUINT64);
 
         if (ghcbMsr.AsUINT64 != GHCB_INFO_PAGE_STATE_UPDATED)
         {
-            return EFI_SECURITY_VIOLATION;
+            status = EFI_SECURITY_VIOLATION;
+            break;
         }
+    }
 
-        //
-        // Validate this page to make it accessible again.
-        //
-
-        status = VispPvalidateSinglePage(SvsmCallingArea, StartingPageNumber, TRUE);
-        if (EFI_ERROR(status))
-        {
-            return status;
-        }
+    //
+    // Validate the converted pages to make them accessible again.
+    //
 
-        if (PagesProcessed != NULL)
+    if (pagesConverted != 0)
+    {
+        validateStatus = VispPvalidatePageRange(SvsmCallingArea,
+                                                StartingPageNumber,
+                                                pagesConverted,
+                                                TRUE);
+        if (EFI_ERROR(validateStatus))
         {
-            *PagesProcessed += 1;
+            return validateStatus;
         }
+    }
 
-        StartingPageNumber += 1;
-        PageCount -= 1;
+    if (PagesProcessed != NULL)
+    {
+        *PagesProcessed = pagesConverted;
     }
 
-    return EFI_SUCCESS;
+    return status;
 }
 
 
@@ -0,0 +1,407 @@
+/** @file
+    Host based tests of TDX page acceptance in HostVisibilityLib.
+
+    TDG.MEM.PAGE.ACCEPT is replaced by a fake that models a host which maps
+    each region of guest memory with 1 GB, 2 MB or 4 KB pages. Accepting a
+    page larger than the host mapping fails with a size mismatch, exactly as
+    the TDX module reports it, and every page may be accepted only once.
+    The tests check that each page is accepted and count the TDCALLs made.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Uefi.h>
+#include <Hv/HvGuest.h>
+#include <IsolationTypes.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/HostVisibilityLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UnitTestLib.h>
+
+#define UNIT_TEST_APP_NAME     "HostVisibilityLib TDX Acceptance Tests"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Guest memory modelled by the fake TDX module.
+//
+#define TDX_TEST_MEMORY_PAGES       (SIZE_8GB / EFI_PAGE_SIZE)
+#define TDX_TEST_PAGES_PER_2MB      (SIZE_2MB / EFI_PAGE_SIZE)
+#define TDX_TEST_PAGES_PER_1GB      (SIZE_1GB / EFI_PAGE_SIZE)
+
+#define TDX_TEST_SUCCESS            0
+#define TDX_TEST_SIZE_MISMATCH      (0xC0000B0BULL << 32)
+#define TDX_TEST_ALREADY_ACCEPTED   (0x00000B0AULL << 32)
+#define TDX_TEST_OPERAND_INVALID    (0xC0000100ULL << 32)
+
+typedef struct {
+    HV_GPA_PAGE_NUMBER  StartPage;
+    UINT64              PageCount;
+    UINT32              MappingSize;
+} TDX_TEST_MAPPING;
+
+STATIC UINT8   *mAccepted;
+STATIC UINT8   *mMappingSize;
+STATIC UINT64  mCallCount[3];
+STATIC UINT64  mMismatchCount;
+STATIC UINT64  mFailAtPage;
+
+UINT64
+EFIAPI
+_tdx_tdg_mem_page_accept (
+    UINT64  AcceptGpa
+    )
+{
+    HV_GPA_PAGE_NUMBER  PageNumber;
+    UINT32              PageSize;
+    UINT64              PageCount;
+    UINT64              Index;
+
+    PageSize   = (UINT32)(AcceptGpa & 3);
+    PageNumber = AcceptGpa >> 12;
+    PageCount  = 1ULL << (9 * PageSize);
+
+    //
+    // The TDX module rejects unaligned and reserved page sizes.
+    //
+    if ((PageSize > 2) ||
+        ((PageNumber & (PageCount - 1)) != 0) ||
+        (PageNumber + PageCount > TDX_TEST_MEMORY_PAGES))
+    {
+        return TDX_TEST_OPERAND_INVALID;
+    }
+
+    mCallCount[PageSize]++;
+
+    if ((mFailAtPage >= PageNumber) && (mFailAtPage < PageNumber + PageCount)) {
+        return TDX_TEST_OPERAND_INVALID;
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        if (mMappingSize[PageNumber + Index] < PageSize) {
+            mMismatchCount++;
+            return TDX_TEST_SIZE_MISMATCH;
+        }
+    }
+
+    for (Index = 0; Index < PageCount; Index++) {
+        if (mAccepted[PageNumber + Index] != 0) {
+            return TDX_TEST_ALREADY_ACCEPTED;
+        }
+    }
+
+    SetMem (&mAccepted[PageNumber], PageCount, 1);
+    return TDX_TEST_SUCCESS;
+}
+
+//
+// The rest of the library is not exercised by these tests; these calls fail
+// if it is reached.
+//
+
+UINT64
+EFIAPI
+_tdx_vmcall_map_gpa (
+    UINT64  Gpa,
+    UINT64  Size,
+    UINT64  *FailedGpa
+    )
+{
+    return MAX_UINT64;
+}
+
+UINT64
+EFIAPI
+_sev_pvalidate (
+    VOID    *Address,
+    UINT32  PageSize,
+    UINT32  Validate,
+    UINT64  *ErrorCode
+    )
+{
+    return MAX_UINT64;
+}
+
+UINT64
+EFIAPI
+MsVmgExit (
+    UINT64  VmgExitRax,
+    UINT64  VmgExitRcx
+    )
+{
+    return MAX_UINT64;
+}
+
+STATIC
+VOID
+MapMemory (
+    IN  CONST TDX_TEST_MAPPING  *Mappings,
+    IN  UINTN                   MappingCount
+    )
+{
+    UINTN  Index;
+
+    SetMem (mMappingSize, TDX_TEST_MEMORY_PAGES, 0);
+    for (Index = 0; Index < MappingCount; Index++) {
+        SetMem (&mMappingSize[Mappings[Index].StartPage], Mappings[Index].PageCount, (UINT8)Mappings[Index].MappingSize);
+    }
+}
+
+STATIC
+UINT64
+TotalCalls (
+    VOID
+    )
+{
+    return mCallCount[0] + mCallCount[1] + mCallCount[2];
+}
+
+STATIC
+BOOLEAN
+RangeAccepted (
+    IN  HV_GPA_PAGE_NUMBER  StartPage,
+    IN  UINT64              PageCount
+    )
+{
+    UINT64  Index;
+
+    for (Index = 0; Index < TDX_TEST_MEMORY_PAGES; Index++) {
+        if ((mAccepted[Index] != 0) != ((Index >= StartPage) && (Index < StartPage + PageCount))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+ResetModel (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    SetMem (mAccepted, TDX_TEST_MEMORY_PAGES, 0);
+    ZeroMem (mCallCount, sizeof (mCallCount));
+    mMismatchCount = 0;
+    mFailAtPage    = MAX_UINT64;
+    return UNIT_TEST_PASSED;
+}
+
+/**
+  Memory the host maps with 1 GB pages is accepted one TDCALL per GB.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestGigabyteMappedRange (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST TDX_TEST_MAPPING  Map[] = {
+        { 0, TDX_TEST_MEMORY_PAGES, 2 },
+    };
+
+    MapMemory (Map, ARRAY_SIZE (Map));
+
+    UT_ASSERT_NOT_EFI_ERROR (EfiUpdatePageRangeAcceptance (UefiIsolationTypeTdx, NULL, TDX_TEST_PAGES_PER_1GB, 4 * TDX_TEST_PAGES_PER_1GB, TRUE));
+    UT_ASSERT_TRUE (RangeAccepted (TDX_TEST_PAGES_PER_1GB, 4 * TDX_TEST_PAGES_PER_1GB));
+    UT_ASSERT_EQUAL (mCallCount[2], 4);
+    UT_ASSERT_EQUAL (TotalCalls (), 4);
+
+    return UNIT_TEST_PASSED;
+}
+
+/**
+  An unaligned range uses 4 KB pages up to the first 2 MB boundary, 2 MB
+  pages up to the first 1 GB boundary, and the reverse at its end.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestUnalignedRange (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST TDX_TEST_MAPPING  Map[] = {
+        { 0, TDX_TEST_MEMORY_PAGES, 2 },
+    };
+    HV_GPA_PAGE_NUMBER      StartPage;
+    UINT64                  PageCount;
+
+    MapMemory (Map, ARRAY_SIZE (Map));
+
+    //
+    // 1 MB up to 2 GB + 1 MB.
+    //
+    StartPage = SIZE_1MB / EFI_PAGE_SIZE;
+    PageCount = 2 * TDX_TEST_PAGES_PER_1GB;
+
+    UT_ASSERT_NOT_EFI_ERROR (EfiUpdatePageRangeAcceptance (UefiIsolationTypeTdx, NULL, StartPage, PageCount, TRUE));
+    UT_ASSERT_TRUE (RangeAccepted (StartPage, PageCount));
+    UT_ASSERT_EQUAL (mCallCount[0], 2 * (TDX_TEST_PAGES_PER_2MB / 2));
+    UT_ASSERT_EQUAL (mCallCount[1], 511);
+    UT_ASSERT_EQUAL (mCallCount[2], 1);
+    UT_ASSERT_EQUAL (mMismatchCount, 0);
+
+    //
+    // The same range one page at a time, as before large pages were tried,
+    // takes two orders of magnitude more calls.
+    //
+    UT_ASSERT_TRUE (TotalCalls () * 100 < PageCount);
+
+    return UNIT_TEST_PASSED;
+}
+
+/**
+  A representative VM memory map: low memory below the 3 GB MMIO gap mapped
+  with 2 MB pages apart from 4 KB mappings at 0 and just below 2 GB, and high
+  memory mapped with 1 GB pages except for one gigabyte the host split into
+  2 MB pages.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestMixedMappings (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST TDX_TEST_MAPPING  Map[] = {
+        { 0,                                                TDX_TEST_PAGES_PER_2MB,                                 0 },
+        { TDX_TEST_PAGES_PER_2MB,                           3 * TDX_TEST_PAGES_PER_1GB - TDX_TEST_PAGES_PER_2MB,    1 },
+        { 2 * TDX_TEST_PAGES_PER_1GB - TDX_TEST_PAGES_PER_2MB, TDX_TEST_PAGES_PER_2MB,                              0 },
+        { 4 * TDX_TEST_PAGES_PER_1GB,                       TDX_TEST_PAGES_PER_1GB,                                 2 },
+        { 5 * TDX_TEST_PAGES_PER_1GB,                       TDX_TEST_PAGES_PER_1GB,                                 1 },
+        { 6 * TDX_TEST_PAGES_PER_1GB,                       2 * TDX_TEST_PAGES_PER_1GB,                             2 },
+    };
+    UINT64                  LowPages;
+    UINT64                  HighPages;
+
+    MapMemory (Map, ARRAY_SIZE (Map));
+
+    //
+    // Low memory from page 16: 4 KB pages up to 2 MB, then 2 MB pages. The
+    // gigabytes at 1 GB and 2 GB are tried as 1 GB pages first, and the
+    // 2 MB range below 2 GB is tried as a 2 MB page before falling back to
+    // 4 KB pages.
+    //
+    LowPages = 3 * TDX_TEST_PAGES_PER_1GB - 16;
+    UT_ASSERT_NOT_EFI_ERROR (EfiUpdatePageRangeAcceptance (UefiIsolationTypeTdx, NULL, 16, LowPages, TRUE));
+    UT_ASSERT_TRUE (RangeAccepted (16, LowPages));
+    UT_ASSERT_EQUAL (mMismatchCount, 3);
+    UT_ASSERT_EQUAL (mCallCount[2], 2);
+    UT_ASSERT_EQUAL (mCallCount[1], 3 * 512 - 1);
+    UT_ASSERT_EQUAL (mCallCount[0], (TDX_TEST_PAGES_PER_2MB - 16) + TDX_TEST_PAGES_PER_2MB);
+
+    //
+    // High memory: three 1 GB pages, one mismatch and 512 2 MB pages for
+    // the split gigabyte.
+    //
+    ResetModel (NULL);
+    HighPages = 4 * TDX_TEST_PAGES_PER_1GB;
+    UT_ASSERT_NOT_EFI_ERROR (EfiUpdatePageRangeAcceptance (UefiIsolationTypeTdx, NULL, 4 * TDX_TEST_PAGES_PER_1GB, HighPages, TRUE));
+    UT_ASSERT_TRUE (RangeAccepted (4 * TDX_TEST_PAGES_PER_1GB, HighPages));
+    UT_ASSERT_EQUAL (mCallCount[2], 4);
+    UT_ASSERT_EQUAL (mCallCount[1], 512);
+    UT_ASSERT_EQUAL (mCallCount[0], 0);
+    UT_ASSERT_EQUAL (mMismatchCount, 1);
+
+    return UNIT_TEST_PASSED;
+}
+
+/**
+  Errors other than a size mismatch are not retried with smaller pages.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+TestFailureIsNotRetried (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST TDX_TEST_MAPPING  Map[] = {
+        { 0, TDX_TEST_MEMORY_PAGES, 2 },
+    };
+
+    MapMemory (Map, ARRAY_SIZE (Map));
+    mFailAtPage = TDX_TEST_PAGES_PER_1GB + 5;
+
+    UT_ASSERT_STATUS_EQUAL (
+        EfiUpdatePageRangeAcceptance (UefiIsolationTypeTdx, NULL, 0, 2 * TDX_TEST_PAGES_PER_1GB, TRUE),
+        EFI_SECURITY_VIOLATION
+        );
+    UT_ASSERT_TRUE (RangeAccepted (0, TDX_TEST_PAGES_PER_1GB));
+    UT_ASSERT_EQUAL (TotalCalls (), 2);
+
+    return UNIT_TEST_PASSED;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+    VOID
+    )
+{
+    EFI_STATUS                  Status;
+    UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+    UNIT_TEST_SUITE_HANDLE      Suite;
+
+    mAccepted    = AllocatePool (TDX_TEST_MEMORY_PAGES);
+    mMappingSize = AllocatePool (TDX_TEST_MEMORY_PAGES);
+    if ((mAccepted == NULL) || (mMappingSize == NULL)) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Exit;
+    }
+
+    Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    Status = CreateUnitTestSuite (&Suite, Framework, "TDX Acceptance", "HostVisibilityLib.Tdx", NULL, NULL);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    AddTestCase (Suite, "1 GB mapped memory is accepted with 1 GB pages", "GigabyteMapped", TestGigabyteMappedRange, ResetModel, NULL, NULL);
+    AddTestCase (Suite, "Unaligned ranges step up and down through page sizes", "Unaligned", TestUnalignedRange, ResetModel, NULL, NULL);
+    AddTestCase (Suite, "Smaller host mappings fall back on size mismatch", "MixedMappings", TestMixedMappings, ResetModel, NULL, NULL);
+    AddTestCase (Suite, "Other errors stop acceptance", "FailureIsNotRetried", TestFailureIsNotRetried, ResetModel, NULL, NULL);
+
+    Status = RunAllTestSuites (Framework);
+
+Exit:
+    if (Framework != NULL) {
+        FreeUnitTestFramework (Framework);
+    }
+
+    if (mAccepted != NULL) {
+        FreePool (mAccepted);
+    }
+
+    if (mMappingSize != NULL) {
+        FreePool (mMappingSize);
+    }
+
+    return Status;
+}
+
+
+int
+main (
+    int   argc,
+    char  *argv[]
+    )
+{
+    return UefiTestMain ();
+}
@@ -0,0 +1,244 @@
+/** @file
+  Library setup for the DXE version of HvTimerLib. Long stalls arm a one-shot
+  synthetic timer and halt the processor until it fires, so that the physical
+  processor is free for other work during long firmware waits.
+
+  Every DXE image linked with this library shares one synthetic timer. The
+  first instance to see the HV protocol configures it and installs
+  gMsvmHvTimerLibIdleTimerGuid; later instances only arm it. Configuring a
+  timer cancels it, so it must only be configured once. Sharing is safe
+  because the timer is only armed with interrupts disabled, immediately
+  before halting, so one stall can never be waiting on an expiry that
+  another has replaced.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+--*/
+
+#include <PiDxe.h>
+
+#include <Protocol/EfiHv.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+// The HV protocol, set once the idle timer has been configured.
+EFI_HV_PROTOCOL *mHvTimerLibHv = NULL;
+
+// Event handles and registration for the HV protocol notification
+EFI_EVENT   mHvProtocolNotifyEvent = NULL;
+VOID        *mHvProtocolRegistration = NULL;
+EFI_EVENT   mBeforeExitBootServicesEvent = NULL;
+
+#if defined(MDE_CPU_X64)
+VOID EFIAPI MsEnableInterruptsAndSleep (VOID);
+#endif
+
+VOID
+EFIAPI
+HvTimerLibHvProtocolNotify(
+    IN EFI_EVENT Event,
+    IN void*     Context
+    )
+{
+    EFI_STATUS status;
+    EFI_HV_PROTOCOL *hv;
+    EFI_HANDLE handle;
+    VOID *idleTimer;
+
+    status = gBS->LocateProtocol(&gEfiHvProtocolGuid, mHvProtocolRegistration, (VOID **)&hv);
+    if (EFI_ERROR(status))
+    {
+        return;
+    }
+
+    gBS->CloseEvent(mHvProtocolNotifyEvent);
+    mHvProtocolNotifyEvent = NULL;
+
+    //
+    // The idle timer raises an interrupt directly so that no SINT has to be
+    // shared with the drivers that own one. Without direct mode, stalls spin.
+    // The timer is configured without a handler; waking the processor is all
+    // that is needed.
+    //
+    if (!hv->DirectTimerSupported())
+    {
+        return;
+    }
+
+    //
+    // If another image has already configured the timer, share it.
+    //
+    status = gBS->LocateProtocol(&gMsvmHvTimerLibIdleTimerGuid, NULL, &idleTimer);
+    if (!EFI_ERROR(status))
+    {
+        mHvTimerLibHv = hv;
+        return;
+    }
+
+    status = hv->ConfigureTimer(hv,
+                                FixedPcdGet8(PcdHvTimerLibIdleTimerIndex),
+                                0,
+                                FALSE, // one-shot
+                                TRUE,  // direct
+                                FixedPcdGet8(PcdHvTimerLibIdleVector),
+                                NULL);
+    if (EFI_ERROR(status))
+    {
+        DEBUG((DEBUG_WARN, "--- %a: failed to configure the idle timer - %r \n", __func__, status));
+        return;
+    }
+
+    handle = NULL;
+    status = gBS->InstallProtocolInterface(&handle,
+                                           &gMsvmHvTimerLibIdleTimerGuid,
+                                           EFI_NATIVE_INTERFACE,
+                                           NULL);
+    if (EFI_ERROR(status))
+    {
+        DEBUG((DEBUG_WARN, "--- %a: failed to publish the idle timer - %r \n", __func__, status));
+        return;
+    }
+
+    mHvTimerLibHv = hv;
+}
+
+VOID
+EFIAPI
+HvTimerLibBeforeExitBootServicesHandler(
+    IN EFI_EVENT Event,
+    IN void*     Context
+    )
+{
+    // EfiHvDxe disconnects from the hypervisor during ExitBootServices, so
+    // stop using the timer before any ExitBootServices handler runs.
+    mHvTimerLibHv = NULL;
+}
+
+BOOLEAN
+HvTimerLibIdle(
+    IN  UINT64 Current,
+    IN  UINT64 Deadline
+    )
+/*++
+
+Routine Description:
+
+    Arms the idle timer for the deadline and halts the processor until an
+    interrupt arrives. The caller rechecks the time after every wake, since
+    any interrupt ends the halt.
+
+    The timer is armed and the deadline rechecked with interrupts disabled,
+    and interrupts are only enabled by the halt itself, so an expiry cannot
+    be taken before the processor halts. Without that, a lost wakeup would
+    stall until the next unrelated interrupt.
+
+    Only the BSP runs with interrupts enabled in DXE, and the timer is only
+    configured on the BSP, so stalls with interrupts disabled (including all
+    AP stalls) spin.
+
+Arguments:
+
+    Current - The current reference time.
+
+    Deadline - The reference time at which the stall ends.
+
+Return Value:
+
+    TRUE if the processor was halted, FALSE if the caller must spin.
+
+--*/
+{
+    EFI_HV_PROTOCOL *hv;
+
+    hv = mHvTimerLibHv;
+    if ((hv == NULL) ||
+        ((Deadline - Current) < FixedPcdGet64(PcdHvTimerLibIdleThreshold)) ||
+        !GetInterruptState())
+    {
+        return FALSE;
+    }
+
+    DisableInterrupts();
+    hv->SetTimer(hv, FixedPcdGet8(PcdHvTimerLibIdleTimerIndex), Deadline);
+
+    //
+    // If the deadline passed while arming, the expiry may already be pending
+    // or lost; do not halt.
+    //
+    if (GetPerformanceCounter() >= Deadline)
+    {
+        EnableInterrupts();
+        return TRUE;
+    }
+
+#if defined(MDE_CPU_X64)
+    //
+    // STI only takes effect after the following HLT, so a pending expiry
+    // ends the halt rather than being taken before it.
+    //
+    MsEnableInterruptsAndSleep();
+#elif defined(MDE_CPU_AARCH64)
+    //
+    // WFI completes on a pending interrupt even while interrupts are masked;
+    // it is taken once they are enabled.
+    //
+    CpuSleep();
+    EnableInterrupts();
+#endif
+    return TRUE;
+}
+
+EFI_STATUS
+EFIAPI
+HvTimerDxeLibConstructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+    EFI_STATUS status;
+
+    if (!PcdGetBool(PcdHvEnabled))
+    {
+        return EFI_SUCCESS;
+    }
+
+    mHvProtocolNotifyEvent = EfiCreateProtocolNotifyEvent(&gEfiHvProtocolGuid,
+                                                          TPL_CALLBACK,
+                                                          HvTimerLibHvProtocolNotify,
+                                                          NULL,
+                                                          &mHvProtocolRegistration);
+    ASSERT(mHvProtocolNotifyEvent != NULL);
+
+    status = gBS->CreateEventEx(EVT_NOTIFY_SIGNAL,
+                              TPL_NOTIFY,
+                              HvTimerLibBeforeExitBootServicesHandler,
+                              NULL,
+                              &gEfiEventBeforeExitBootServicesGuid,
+                              &mBeforeExitBootServicesEvent);
+    ASSERT_EFI_ERROR(status);
+
+    return status;
+}
+
+EFI_STATUS
+EFIAPI
+HvTimerDxeLibDestructor(
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  if (mHvProtocolNotifyEvent != NULL) {
+    gBS->CloseEvent (mHvProtocolNotifyEvent);
+  }
+
+  if (mBeforeExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (mBeforeExitBootServicesEvent);
+  }
+
+  return EFI_SUCCESS;
+}
@@ -1,6 +1,8 @@
 /** @file
   This file implements the TimerLib library class using the hypervisor
-  reference time counter.
+  reference time. When the hypervisor has a reference TSC page mapped, the
+  time is computed from the TSC (or the virtual counter on AArch64) without
+  leaving the guest; otherwise the reference time counter is read.
 
   Copyright (c) Microsoft Corporation.
   SPDX-License-Identifier: BSD-2-Clause-Patent
@@ -8,15 +10,189 @@
 #include <stdint.h>
 #include <Base.h>
 #include <Hv/HvGuestMsr.h>
+#include <Hv/HvGuestCpuid.h>
 #include <Library/BaseLib.h>
 #include <Library/TimerLib.h>
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
 
-#if defined(MDE_CPU_AARCH64)
+#if defined(MDE_CPU_X64)
+#include "MsCpuid.h"
+#elif defined(MDE_CPU_AARCH64)
+#include <Library/ArmLib.h>
 #include <Library/HvHypercallLib.h>
 #endif
 
+//
+// The reference TSC page, or NULL if the hypervisor has not mapped one (or it
+// may no longer be used). The page is located on first use so that modules
+// which never read the time never touch the reference TSC MSR.
+//
+BOOLEAN mHvReferenceTscProbed = FALSE;
+PHV_REFERENCE_TSC_PAGE mHvReferenceTscPage = NULL;
+
+//
+// Provided by each library instance. Halts the processor until at most the
+// given deadline and returns TRUE, or returns FALSE if the caller must spin.
+//
+extern BOOLEAN HvTimerLibIdle(UINT64 Current, UINT64 Deadline);
+
+
+VOID
+HvTimerpProbeReferenceTscPage(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Locates the reference TSC page if the hypervisor has one enabled. The page
+    itself is placed by PlatformPei.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    HV_REFERENCE_TSC_MSR_CONTENTS referenceTsc;
+#if defined(MDE_CPU_X64)
+    HV_CPUID_RESULT cpuidResult;
+#endif
+
+    referenceTsc.AsUINT64 = 0;
+
+#if defined(MDE_CPU_X64)
+
+    MsCpuid(cpuidResult.AsUINT32, HvCpuIdFunctionMsHvFeatures);
+    if (cpuidResult.MsHvFeatures.PartitionPrivileges.AccessPartitionReferenceTsc)
+    {
+        referenceTsc.AsUINT64 = AsmReadMsr64(HV_X64_MSR_REFERENCE_TSC);
+    }
+
+#elif defined(MDE_CPU_AARCH64)
+
+    if (AsmGetVpRegister64(HvRegisterReferenceTsc, &referenceTsc.AsUINT64) != HV_STATUS_SUCCESS)
+    {
+        referenceTsc.AsUINT64 = 0;
+    }
+
+#endif
+
+    if (referenceTsc.Enable)
+    {
+        mHvReferenceTscPage =
+            (PHV_REFERENCE_TSC_PAGE)(UINTN)(referenceTsc.GpaPageNumber * SIZE_4KB);
+    }
+
+    mHvReferenceTscProbed = TRUE;
+}
+
+
+UINT64
+HvTimerpMultiplyHigh64(
+    IN  UINT64 Multiplicand,
+    IN  UINT64 Multiplier
+    )
+/*++
+
+Routine Description:
+
+    Computes the upper 64 bits of the 128 bit product of two 64 bit values.
+
+Arguments:
+
+    Multiplicand - The first value.
+
+    Multiplier - The second value.
+
+Return Value:
+
+    The upper 64 bits of the product.
+
+--*/
+{
+    UINT64 lowLow;
+    UINT64 lowHigh;
+    UINT64 highLow;
+    UINT64 highHigh;
+    UINT64 middle;
+
+    lowLow = (Multiplicand & MAX_UINT32) * (Multiplier & MAX_UINT32);
+    lowHigh = (Multiplicand & MAX_UINT32) * (Multiplier >> 32);
+    highLow = (Multiplicand >> 32) * (Multiplier & MAX_UINT32);
+    highHigh = (Multiplicand >> 32) * (Multiplier >> 32);
+
+    middle = (lowLow >> 32) + (lowHigh & MAX_UINT32) + (highLow & MAX_UINT32);
+
+    return highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+}
+
+
+BOOLEAN
+HvTimerpReadReferenceTscPage(
+    IN  PHV_REFERENCE_TSC_PAGE ReferenceTscPage,
+    OUT UINT64 *ReferenceTime
+    )
+/*++
+
+Routine Description:
+
+    Computes the reference time from the reference TSC page. The hypervisor
+    updates the scale and offset (e.g. after a migration) by changing the
+    sequence number, so the read is retried until a consistent snapshot is
+    seen.
+
+Arguments:
+
+    ReferenceTscPage - The reference TSC page.
+
+    ReferenceTime - Receives the reference time, in 100ns units.
+
+Return Value:
+
+    TRUE if the page was valid, FALSE if the reference time counter must be
+    read instead.
+
+--*/
+{
+    UINT32 sequence;
+    UINT64 counter;
+    UINT64 scale;
+    INT64 offset;
+
+    do
+    {
+        sequence = ReferenceTscPage->TscSequence;
+        if (sequence == HV_REFERENCE_TSC_SEQUENCE_INVALID)
+        {
+            return FALSE;
+        }
+
+        MemoryFence();
+
+#if defined(MDE_CPU_X64)
+        counter = AsmReadTsc();
+#elif defined(MDE_CPU_AARCH64)
+        counter = ArmReadCntvCt();
+#endif
+
+        scale = ReferenceTscPage->TscScale;
+        offset = ReferenceTscPage->TscOffset;
+
+        MemoryFence();
+
+    } while (ReferenceTscPage->TscSequence != sequence);
+
+    *ReferenceTime = HvTimerpMultiplyHigh64(counter, scale) + (UINT64)offset;
+    return TRUE;
+}
+
+
 VOID
 EFIAPI
 Stall100ns(
@@ -27,7 +203,8 @@ Stall100ns(
 Routine Description:
 
     Stalls the processor for the given amount of time by consulting the
-    hypervisor reference time counter.
+    hypervisor reference time. Where the library instance supports it, long
+    stalls halt the processor until a timer fires instead of spinning.
 
 Arguments:
 
@@ -47,7 +224,11 @@ Return Value:
     do
     {
 
-        CpuPause();
+        if (!HvTimerLibIdle(current, end))
+        {
+            CpuPause();
+        }
+
         current = GetPerformanceCounter();
 
     } while (current < end);
@@ -125,15 +306,31 @@ Return Value:
 
 --*/
 {
+    PHV_REFERENCE_TSC_PAGE referenceTscPage;
+    UINT64 referenceTime;
+#if defined(MDE_CPU_AARCH64)
+    HV_STATUS status;
+    UINT64 RegisterValue;
+#endif
+
+    if (!mHvReferenceTscProbed)
+    {
+        HvTimerpProbeReferenceTscPage();
+    }
+
+    referenceTscPage = mHvReferenceTscPage;
+    if ((referenceTscPage != NULL) &&
+        HvTimerpReadReferenceTscPage(referenceTscPage, &referenceTime))
+    {
+        return referenceTime;
+    }
+
 #if defined (MDE_CPU_X64)
 
     return AsmReadMsr64(HvSyntheticMsrTimeRefCount);
 
 #elif defined(MDE_CPU_AARCH64)
 
-    HV_STATUS status;
-    UINT64 RegisterValue;
-
     status = AsmGetVpRegister64(HvRegisterTimeRefCount, &RegisterValue);
     ASSERT(status == HV_STATUS_SUCCESS);
 
@@ -0,0 +1,34 @@
+/** @file
+  Library setup for HvTimerLib
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+--*/
+
+#include <Base.h>
+
+BOOLEAN
+HvTimerLibIdle(
+    IN  UINT64 Current,
+    IN  UINT64 Deadline
+    )
+/*++
+
+Routine Description:
+
+    This instance has no timer to wake the processor, so stalls always spin.
+
+Arguments:
+
+    Current - The current reference time.
+
+    Deadline - The reference time at which the stall ends.
+
+Return Value:
+
+    FALSE.
+
+--*/
+{
+    return FALSE;
+}
@@ -0,0 +1,76 @@
+/** @file
+  Library setup for the runtime version of HvTimerLib
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+--*/
+
+#include <PiDxe.h>
+
+#include <Hv/HvGuestMsr.h>
+#include <Library/DebugLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+extern BOOLEAN mHvReferenceTscProbed;
+extern PHV_REFERENCE_TSC_PAGE mHvReferenceTscPage;
+
+// Event handle for exit boot services event
+EFI_EVENT   mExitBootServicesEvent = NULL;
+
+VOID
+EFIAPI
+HvTimerLibExitBootServicesHandler(
+    IN EFI_EVENT Event,
+    IN void*     Context
+    )
+{
+    // The OS owns the reference TSC MSR from here on and the firmware's page
+    // is not mapped after SetVirtualAddressMap, so read the reference time
+    // counter instead.
+    mHvReferenceTscPage = NULL;
+    mHvReferenceTscProbed = TRUE;
+}
+
+BOOLEAN
+HvTimerLibIdle(
+    IN  UINT64 Current,
+    IN  UINT64 Deadline
+    )
+{
+    // Runtime stalls always spin; no timer is owned once the OS is running.
+    return FALSE;
+}
+
+EFI_STATUS
+EFIAPI
+HvTimerRuntimeLibConstructor (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+    EFI_STATUS status;
+
+    status = gBS->CreateEventEx(EVT_NOTIFY_SIGNAL,
+                              TPL_NOTIFY,
+                              HvTimerLibExitBootServicesHandler,
+                              NULL,
+                              &gEfiEventExitBootServicesGuid,
+                              &mExitBootServicesEvent);
+    ASSERT_EFI_ERROR(status);
+
+    return status;
+}
+
+EFI_STATUS
+EFIAPI
+HvTimerRuntimeLibDestructor(
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  if (mExitBootServicesEvent != NULL) {
+    gBS->CloseEvent (mExitBootServicesEvent);
+  }
+
+  return EFI_SUCCESS;
+}
@@ -39,6 +39,8 @@ PxeInit (
         Snp->Mode.MediaPresent = Snp->AdapterContext->NicInfo.MediaPresent;
     }
 
+    Snp->Mode.MaxPacketSize = Snp->AdapterContext->NicInfo.MaxFrameSize;
+
     Snp->Mode.State = EfiSimpleNetworkInitialized;
   }
   else
@@ -28,6 +28,7 @@
 #define CURR_NODE_ADDR_REQUEST_ID    0xFCAD
 #define SET_FILTER_REQUEST_ID        0x5CF1
 #define SET_STAT_ADDR_REQUEST_ID     0x5CAD
+#define OID_REQUEST_ID               0x0ACE
 
 //
 // NDIS Receive Filter masks
@@ -45,6 +46,34 @@
 
 #define TPL_NETVSC_CALLBACK                (TPL_CALLBACK + 2)
 
+//
+// The smallest MTU an Ethernet adapter must support.
+//
+#define NETVSC_MIN_MTU                     576
+
+//
+// NDIS_OFFLOAD_PARAMETERS value enabling receive offload when the VSP
+// supports it, leaving it unchanged otherwise.
+//
+#define NETVSC_OFFLOAD_PARAMETER(Receive) \
+    ((Receive) ? NDIS_OFFLOAD_PARAMETERS_RX_ENABLED_TX_DISABLED : NDIS_OFFLOAD_PARAMETERS_NO_CHANGE)
+
+//
+// Bytes of a send buffer section used by the RNDIS packet message ahead of
+// the frame data.
+//
+#define NETVSC_RNDIS_PACKET_OVERHEAD        sizeof(RNDIS_MESSAGE)
+
+//
+// The information buffer of RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS.
+//
+typedef struct _NETVSC_RSS_PARAMETERS
+{
+    NDIS_RECEIVE_SCALE_PARAMETERS   Parameters;
+    UINT32                          IndirectionTable[NDIS_RSS_INDIRECTION_TABLE_MAX_SIZE_REVISION_2];
+    UINT8                           HashKey[NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_2];
+} NETVSC_RSS_PARAMETERS;
+
 EFI_STATUS
 NetvscInit(
     IN  NIC_DATA_INSTANCE *AdapterInfo
@@ -105,6 +134,17 @@ Return Value:
     AdapterInfo->InitRndisStatus = (EFI_STATUS) -1;
     AdapterInfo->SetRxFilterStatus = (EFI_STATUS) -1;
     AdapterInfo->GetStnAddrStatus = (EFI_STATUS) -1;
+    AdapterInfo->OidRequestStatus = (EFI_STATUS) -1;
+
+    //
+    // The primary channel is always channel 0.
+    //
+    ZeroMem(AdapterInfo->Channels, sizeof(AdapterInfo->Channels));
+    AdapterInfo->Channels[0].AdapterInfo = AdapterInfo;
+    AdapterInfo->Channels[0].Emcl = AdapterInfo->Emcl;
+    AdapterInfo->ChannelCount = 1;
+    AdapterInfo->SubChannelCount = 0;
+    AdapterInfo->RssEnabled = FALSE;
 
     //
     // When the host has disabled media present notifications, NetvscDxe
@@ -165,6 +205,18 @@ Return Value:
         goto Cleanup;
     }
 
+    status = gBS->CreateEvent(
+        0,
+        0,
+        NULL,
+        NULL,
+        &AdapterInfo->OidRequestEvt);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
     //
     // Create the EMCL channel
     // The ReceiveCallback function must be set before starting the channel.
@@ -172,7 +224,7 @@ Return Value:
     status = AdapterInfo->Emcl->SetReceiveCallback(
         AdapterInfo->Emcl,
         NetvscReceiveCallback,
-        (VOID *) AdapterInfo,
+        (VOID *) &AdapterInfo->Channels[0],
         TPL_NETVSC_CALLBACK);
 
     if (EFI_ERROR(status))
@@ -184,13 +236,13 @@ Return Value:
     // Allocate receive and transmit buffers as a multiple of pages.  This is
     // required for isolated VMs and is acceptable in all VMs.
     //
-    AdapterInfo->RxBufferPageCount = (NVSC_DEFAULT_RECEIVE_BUFFER_SIZE + EFI_PAGE_SIZE - 1) >> EFI_PAGE_SHIFT;
-    AdapterInfo->TxBufferPageCount = (NVSC_DEFAULT_SEND_BUFFER_SIZE + EFI_PAGE_SIZE - 1) >> EFI_PAGE_SHIFT;
+    AdapterInfo->RxBufferPageCount = (UINT32) EFI_SIZE_TO_PAGES(PcdGet32(PcdNetvscReceiveBufferSize));
+    AdapterInfo->TxBufferPageCount = (UINT32) EFI_SIZE_TO_PAGES(PcdGet32(PcdNetvscSendBufferSize));
 
     status = AdapterInfo->Emcl->StartChannel(
         AdapterInfo->Emcl,
-        AdapterInfo->RxBufferPageCount,
-        AdapterInfo->TxBufferPageCount);
+        EFI_SIZE_TO_PAGES(NVSC_RING_BUFFER_SIZE),
+        EFI_SIZE_TO_PAGES(NVSC_RING_BUFFER_SIZE));
 
     if (EFI_ERROR(status))
     {
@@ -234,10 +286,16 @@ Return Value:
 
     //
     // Send NDIS config info and set version to be 6.
+    // The configured MTU is offered to the VSP, which accepts jumbo frames
+    // when the host allows them. The MTU actually used is queried once the
+    // RNDIS device is initialized.
     //
+    AdapterInfo->Mtu = MAX(PcdGet32(PcdNetvscMtu), NETVSC_MIN_MTU);
+    AdapterInfo->MaxFrameSize = AdapterInfo->Mtu + PXE_MAC_HEADER_LEN_ETHER;
+
     ZeroMem(&nvspMessage, sizeof(nvspMessage));
     nvspMessage.Header.MessageType = NvspMessage2TypeSendNdisConfig;
-    nvspMessage.Messages.Version2Messages.SendNdisConfig.MTU = MAXIMUM_ETHERNET_PACKET_SIZE;
+    nvspMessage.Messages.Version2Messages.SendNdisConfig.MTU = AdapterInfo->MaxFrameSize;
     nvspMessage.Messages.Version2Messages.SendNdisConfig.Capabilities.CorrelationId = 0;
     nvspMessage.Messages.Version2Messages.SendNdisConfig.Capabilities.Ieee8021q = 0;
     nvspMessage.Messages.Version2Messages.SendNdisConfig.Capabilities.SRIOV = 0;
@@ -406,11 +464,25 @@ Return Value:
 
     AdapterInfo->TxSectionSize = nvspMessage.Messages.Version1Messages.SendSendBufferComplete.SectionSize;
 
+    //
+    // A frame is always sent from a single send buffer section, so the
+    // section size chosen by the VSP bounds the MTU.
+    //
+    if (AdapterInfo->TxSectionSize < NETVSC_RNDIS_PACKET_OVERHEAD + NETVSC_MIN_MTU + PXE_MAC_HEADER_LEN_ETHER ||
+        AdapterInfo->TxSectionSize > AdapterInfo->TxBufferPageCount * EFI_PAGE_SIZE)
+    {
+        status = EFI_DEVICE_ERROR;
+        goto Cleanup;
+    }
+
+    AdapterInfo->MaxFrameSize = MIN(AdapterInfo->MaxFrameSize, AdapterInfo->TxSectionSize - (UINT32) NETVSC_RNDIS_PACKET_OVERHEAD);
+    AdapterInfo->Mtu = AdapterInfo->MaxFrameSize - PXE_MAC_HEADER_LEN_ETHER;
+
     //
     // The Ring Buffer should always have an empty slot to differentiate
     // between full and empty buffers. Hence the +1.
     //
-    AdapterInfo->TxBufCount = (NVSC_DEFAULT_SEND_BUFFER_SIZE/AdapterInfo->TxSectionSize) + 1;
+    AdapterInfo->TxBufCount = ((AdapterInfo->TxBufferPageCount * EFI_PAGE_SIZE)/AdapterInfo->TxSectionSize) + 1;
 
     //
     // Initializing various queues
@@ -422,6 +494,17 @@ Return Value:
         goto Cleanup;
     }
 
+    //
+    // Every transfer-page packet pinned by the RX queue holds at least one
+    // queue slot, so one tracking entry per slot is always sufficient.
+    //
+    status = RxTransferPacketPoolInit(&AdapterInfo->RxTransferPacketPool, AdapterInfo->RxQueueCount);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
     status = TxQueueInit(&AdapterInfo->FreeTxBuffersQueue,AdapterInfo->TxBufCount);
 
     if (EFI_ERROR(status))
@@ -439,7 +522,7 @@ Return Value:
         goto Cleanup;
     }
 
-    for (txBuffer = (UINT64) AdapterInfo->TxBuffer; (txBuffer + AdapterInfo->TxSectionSize)<=((UINT64)AdapterInfo->TxBuffer + NVSC_DEFAULT_SEND_BUFFER_SIZE); txBuffer += (AdapterInfo->TxSectionSize))
+    for (txBuffer = (UINT64) AdapterInfo->TxBuffer; (txBuffer + AdapterInfo->TxSectionSize)<=((UINT64)AdapterInfo->TxBuffer + (AdapterInfo->TxBufferPageCount * EFI_PAGE_SIZE)); txBuffer += (AdapterInfo->TxSectionSize))
     {
         if (TxQueueIsFull(&AdapterInfo->FreeTxBuffersQueue))
         {
@@ -449,6 +532,7 @@ Return Value:
     }
 
     AdapterInfo->RxFilter = 0;
+    AdapterInfo->RxChecksumOffloadEnabled = FALSE;
     AdapterInfo->ReceiveStarted = TRUE;
 
     //
@@ -477,7 +561,7 @@ Return Value:
     pInitRequest->RequestId = 0xBEEF;
     pInitRequest->MajorVersion = RNDIS_MAJOR_VERSION;
     pInitRequest->MinorVersion = RNDIS_MINOR_VERSION;
-    pInitRequest->MaxTransferSize = MAXIMUM_ETHERNET_PACKET_SIZE;
+    pInitRequest->MaxTransferSize = AdapterInfo->MaxFrameSize;
 
     pRndisMessage->NdisMessageType = REMOTE_NDIS_INITIALIZE_MSG;
     pRndisMessage->MessageLength = rndisMsgSize;
@@ -687,6 +771,42 @@ Return Value:
     AdapterInfo->BroadcastNodeAddress[4] = 0xFF;
     AdapterInfo->BroadcastNodeAddress[5] = 0xFF;
 
+    //
+    // The VSP reports the largest frame payload it accepts, which is smaller
+    // than the offered MTU when jumbo frames are not allowed on this host.
+    //
+    status = NetvscQueryMtu(AdapterInfo);
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    //
+    // Checksum offload is optional, the network stack checksums in software
+    // when it is not available.
+    //
+    status = NetvscSetOffloadParameters(AdapterInfo);
+    if (EFI_ERROR(status))
+    {
+        DEBUG((EFI_D_NET, "Netvsc: checksum offload is not available. Status = %r\n", status));
+        status = EFI_SUCCESS;
+    }
+
+    //
+    // vRSS lets the VSP spread received traffic over several channels, keeping
+    // more data in flight. The adapter works without it, so failures here are
+    // not fatal.
+    //
+    if (EFI_ERROR(NetvscAllocateSubChannels(AdapterInfo)))
+    {
+        DEBUG((EFI_D_NET, "Netvsc: vRSS is not available.\n"));
+        NetvscCloseSubChannels(AdapterInfo);
+    }
+    else
+    {
+        NetvscOpenSubChannels(AdapterInfo);
+    }
+
 Cleanup:
 
     if (EFI_ERROR(status))
@@ -766,95 +886,1034 @@ Returns:
         ndisFilter |= NDIS_PACKET_TYPE_ALL_MULTICAST;
     }
 
-    //
-    // Send RNDIS control message to set Receive Filters.
-    //
-    if (TxQueueIsEmpty(&AdapterInfo->FreeTxBuffersQueue))
+    //
+    // Send RNDIS control message to set Receive Filters.
+    //
+    if (TxQueueIsEmpty(&AdapterInfo->FreeTxBuffersQueue))
+    {
+        status  = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+    else
+    {
+        //
+        // The buffer is used temporarily for a sync transaction.
+        // Hence, dequeueing the buffer from the FreeTxBufferQueue isn't required.
+        //
+        TxQueueDequeue(&AdapterInfo->FreeTxBuffersQueue, (void**)&pRndisMessage);
+        TxQueueEnqueue(&AdapterInfo->FreeTxBuffersQueue, pRndisMessage);
+        rndisBufferIndex = (UINT32)((((UINT64) pRndisMessage) - ((UINT64) AdapterInfo->TxBuffer))/AdapterInfo->TxSectionSize);
+    }
+
+    //
+    // Set RndisMessage properties as needed to set Receive Filters
+    //
+    rndisMsgSize = RNDIS_MESSAGE_SIZE(RNDIS_SET_REQUEST) + sizeof(ndisFilter);
+
+    pSetRequest = &pRndisMessage->Message.SetRequest;
+    pSetRequest->RequestId = SET_FILTER_REQUEST_ID;
+    pSetRequest->Oid = RNDIS_OID_GEN_CURRENT_PACKET_FILTER;
+    pSetRequest->InformationBufferLength = sizeof(ndisFilter);
+    pSetRequest->InformationBufferOffset = sizeof(RNDIS_SET_REQUEST);
+    pSetRequest->DeviceVcHandle = 0;
+
+    CopyMem((UINT8*)(pSetRequest) + pSetRequest->InformationBufferOffset, &ndisFilter, sizeof(ndisFilter));
+
+    pRndisMessage->NdisMessageType = REMOTE_NDIS_SET_MSG;
+    pRndisMessage->MessageLength = rndisMsgSize;
+
+    ZeroMem(&nvspMessage, sizeof(nvspMessage));
+    nvspMessage.Header.MessageType = NvspMessage1TypeSendRNDISPacket;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.ChannelType = 1;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionIndex = rndisBufferIndex;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionSize = rndisMsgSize;
+
+    status = EmclSendPacketSync(
+        AdapterInfo->Emcl,
+        &nvspMessage,
+        sizeof(nvspMessage),
+        NULL,
+        0);
+
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    if (nvspMessage.Header.MessageType != NvspMessage1TypeSendRNDISPacketComplete)
+    {
+        status = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+
+    if (nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status != NvspStatusSuccess)
+    {
+        status = NvspStatusToEfiStatus(nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status);
+        goto Exit;
+    }
+
+    //
+    // This can be called from TPL_CALLBACK. Use WaitForEventInternal instead of gBS->WaitForEvent
+    // which enforces a TPL check for TPL_APPLICATION.
+    //
+    status = mInternalEventServices->WaitForEventInternal(1, &AdapterInfo->RxFilterEvt, &eventIndex);
+
+    if (EFI_ERROR(status))
+    {
+        AdapterInfo->RxFilter = (UINT8) oldFilter;
+        AdapterInfo->SetRxFilterStatus = (EFI_STATUS) -1;
+        goto Exit;
+    }
+
+    status = AdapterInfo->SetRxFilterStatus;
+    if (EFI_ERROR(status))
+    {
+        AdapterInfo->RxFilter = (UINT8) oldFilter;
+    }
+    AdapterInfo->SetRxFilterStatus = (EFI_STATUS) -1;
+
+Exit:
+
+    return status;
+}
+
+
+VOID
+NetvscOidRequestComplete(
+    IN  NIC_DATA_INSTANCE   *AdapterInfo,
+    IN  PRNDIS_MESSAGE      RndisMessage,
+    IN  UINT32              MessageLength
+    )
+/*++
+
+Routine Description:
+
+    Completes the outstanding OID request issued by NetvscOidRequest.
+    For a query, the returned information buffer is copied to the response
+    buffer supplied by the requester.
+
+Arguments:
+
+    AdapterInfo     - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+    RndisMessage    - The REMOTE_NDIS_QUERY_CMPLT or REMOTE_NDIS_SET_CMPLT message
+
+    MessageLength   - Length of the range containing RndisMessage
+
+--*/
+{
+    PRNDIS_QUERY_COMPLETE pQueryComplete;
+    UINT32 availableLength;
+    UINT32 copyLength;
+
+    AdapterInfo->OidRequestStatus = EFI_SUCCESS;
+
+    if (RndisMessage->NdisMessageType == REMOTE_NDIS_SET_CMPLT)
+    {
+        if (RndisMessage->Message.SetComplete.Status != RNDIS_STATUS_SUCCESS)
+        {
+            AdapterInfo->OidRequestStatus = EFI_DEVICE_ERROR;
+        }
+
+        goto Exit;
+    }
+
+    pQueryComplete = &RndisMessage->Message.QueryComplete;
+    if (pQueryComplete->Status != RNDIS_STATUS_SUCCESS ||
+        MessageLength < RNDIS_MESSAGE_SIZE(RNDIS_QUERY_COMPLETE))
+    {
+        AdapterInfo->OidRequestStatus = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+
+    //
+    // The information buffer offset is relative to the query completion.
+    //
+    availableLength = MessageLength - (UINT32)((UINTN)pQueryComplete - (UINTN)RndisMessage);
+    if (pQueryComplete->InformationBufferOffset > availableLength ||
+        pQueryComplete->InformationBufferLength > availableLength - pQueryComplete->InformationBufferOffset)
+    {
+        AdapterInfo->OidRequestStatus = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+
+    copyLength = MIN(pQueryComplete->InformationBufferLength, AdapterInfo->OidResponseLength);
+    if (AdapterInfo->OidResponse != NULL)
+    {
+        CopyMem(
+            AdapterInfo->OidResponse,
+            (UINT8*)pQueryComplete + pQueryComplete->InformationBufferOffset,
+            copyLength);
+    }
+
+    AdapterInfo->OidResponseLength = copyLength;
+
+Exit:
+
+    gBS->SignalEvent(AdapterInfo->OidRequestEvt);
+}
+
+
+EFI_STATUS
+NetvscOidRequest(
+    IN      NIC_DATA_INSTANCE   *AdapterInfo,
+    IN      UINT32              NdisMessageType,
+    IN      UINT32              Oid,
+    IN      VOID                *InformationBuffer OPTIONAL,
+    IN      UINT32              InformationBufferLength,
+    OUT     VOID                *Response OPTIONAL,
+    IN OUT  UINT32              *ResponseLength OPTIONAL
+    )
+/*++
+
+Routine Description:
+
+    Synchronously queries or sets an OID on the VSP through RNDIS.
+
+Arguments:
+
+    AdapterInfo             - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+    NdisMessageType         - REMOTE_NDIS_QUERY_MSG or REMOTE_NDIS_SET_MSG
+
+    Oid                     - The OID to query or set
+
+    InformationBuffer       - The information buffer sent with the request
+
+    InformationBufferLength - Length of InformationBuffer
+
+    Response                - Buffer receiving the information returned by a query
+
+    ResponseLength          - On input the size of Response, on output the number
+                              of bytes returned in Response
+
+Returns:
+
+    EFI_SUCCESS             - The request completed successfully
+
+    EFI_BAD_BUFFER_SIZE     - The request does not fit in a send buffer section
+
+    Other                   - Failure
+
+--*/
+{
+    PRNDIS_MESSAGE pRndisMessage;
+    PRNDIS_SET_REQUEST pSetRequest;
+    NVSP_MESSAGE nvspMessage;
+    UINT32 rndisMsgSize;
+    UINT32 rndisBufferIndex;
+    EFI_STATUS status;
+    UINTN eventIndex;
+
+    ASSERT(NdisMessageType == REMOTE_NDIS_QUERY_MSG || NdisMessageType == REMOTE_NDIS_SET_MSG);
+
+    //
+    // Query and set requests share the same layout.
+    //
+    rndisMsgSize = RNDIS_MESSAGE_SIZE(RNDIS_SET_REQUEST) + InformationBufferLength;
+    if (rndisMsgSize > AdapterInfo->TxSectionSize)
+    {
+        status = EFI_BAD_BUFFER_SIZE;
+        goto Exit;
+    }
+
+    if (TxQueueIsEmpty(&AdapterInfo->FreeTxBuffersQueue))
+    {
+        status = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+
+    //
+    // The buffer is used temporarily for a sync transaction.
+    // Hence, dequeueing the buffer from the FreeTxBufferQueue isn't required.
+    //
+    TxQueueDequeue(&AdapterInfo->FreeTxBuffersQueue, (void**)&pRndisMessage);
+    TxQueueEnqueue(&AdapterInfo->FreeTxBuffersQueue, pRndisMessage);
+    rndisBufferIndex = (UINT32)((((UINT64) pRndisMessage) - ((UINT64) AdapterInfo->TxBuffer))/AdapterInfo->TxSectionSize);
+
+    pSetRequest = &pRndisMessage->Message.SetRequest;
+    pSetRequest->RequestId = OID_REQUEST_ID;
+    pSetRequest->Oid = Oid;
+    pSetRequest->InformationBufferLength = InformationBufferLength;
+    pSetRequest->InformationBufferOffset = sizeof(RNDIS_SET_REQUEST);
+    pSetRequest->DeviceVcHandle = 0;
+
+    if (InformationBufferLength != 0)
+    {
+        CopyMem((UINT8*)(pSetRequest) + pSetRequest->InformationBufferOffset, InformationBuffer, InformationBufferLength);
+    }
+
+    pRndisMessage->NdisMessageType = NdisMessageType;
+    pRndisMessage->MessageLength = rndisMsgSize;
+
+    AdapterInfo->OidRequestStatus = (EFI_STATUS) -1;
+    AdapterInfo->OidResponse = Response;
+    AdapterInfo->OidResponseLength = (ResponseLength != NULL) ? *ResponseLength : 0;
+
+    ZeroMem(&nvspMessage, sizeof(nvspMessage));
+    nvspMessage.Header.MessageType = NvspMessage1TypeSendRNDISPacket;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.ChannelType = 1;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionIndex = rndisBufferIndex;
+    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionSize = rndisMsgSize;
+
+    status = EmclSendPacketSync(
+        AdapterInfo->Emcl,
+        &nvspMessage,
+        sizeof(nvspMessage),
+        NULL,
+        0);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    if (nvspMessage.Header.MessageType != NvspMessage1TypeSendRNDISPacketComplete)
+    {
+        status = EFI_DEVICE_ERROR;
+        goto Cleanup;
+    }
+
+    if (nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status != NvspStatusSuccess)
+    {
+        status = NvspStatusToEfiStatus(nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status);
+        goto Cleanup;
+    }
+
+    //
+    // This can be called from TPL_CALLBACK. Use WaitForEventInternal instead of gBS->WaitForEvent
+    // which enforces a TPL check for TPL_APPLICATION.
+    //
+    status = mInternalEventServices->WaitForEventInternal(1, &AdapterInfo->OidRequestEvt, &eventIndex);
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    status = AdapterInfo->OidRequestStatus;
+    if (!EFI_ERROR(status) && ResponseLength != NULL)
+    {
+        *ResponseLength = AdapterInfo->OidResponseLength;
+    }
+
+Cleanup:
+
+    AdapterInfo->OidRequestStatus = (EFI_STATUS) -1;
+    AdapterInfo->OidResponse = NULL;
+    AdapterInfo->OidResponseLength = 0;
+
+Exit:
+
+    return status;
+}
+
+
+EFI_STATUS
+NetvscQueryMtu(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
+
+Routine Description:
+
+    Lowers the MTU offered in the NDIS config to the largest frame payload
+    accepted by the VSP. When the VSP cannot report a usable value, standard
+    Ethernet frames are assumed.
+
+Arguments:
+
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+Returns:
+
+    EFI_SUCCESS - The MTU was set
+
+--*/
+{
+    UINT32 hostMtu = 0;
+    UINT32 responseLength;
+    EFI_STATUS status;
+
+    responseLength = sizeof(hostMtu);
+    status = NetvscOidRequest(
+        AdapterInfo,
+        REMOTE_NDIS_QUERY_MSG,
+        RNDIS_OID_GEN_MAXIMUM_FRAME_SIZE,
+        NULL,
+        0,
+        &hostMtu,
+        &responseLength);
+
+    if (EFI_ERROR(status) || responseLength != sizeof(hostMtu))
+    {
+        //
+        // VSPs that cannot report it only accept standard frames.
+        //
+        DEBUG((EFI_D_NET, "Netvsc: maximum frame size query failed. Status = %r\n", status));
+        hostMtu = MAXIMUM_ETHERNET_PACKET_SIZE - PXE_MAC_HEADER_LEN_ETHER;
+    }
+
+    if (hostMtu < NETVSC_MIN_MTU)
+    {
+        //
+        // No Ethernet adapter can be that limited, so the value is bogus.
+        // Keep the adapter usable with standard frames.
+        //
+        DEBUG((EFI_D_WARN, "Netvsc: ignoring maximum frame size %d below the minimum MTU.\n", hostMtu));
+        hostMtu = MAXIMUM_ETHERNET_PACKET_SIZE - PXE_MAC_HEADER_LEN_ETHER;
+    }
+
+    AdapterInfo->Mtu = MIN(AdapterInfo->Mtu, hostMtu);
+    AdapterInfo->MaxFrameSize = AdapterInfo->Mtu + PXE_MAC_HEADER_LEN_ETHER;
+
+    DEBUG((EFI_D_NET, "Netvsc: MTU %d, send section size %d.\n", AdapterInfo->Mtu, AdapterInfo->TxSectionSize));
+
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+NetvscSetOffloadParameters(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
+
+Routine Description:
+
+    Queries the receive checksum offloads the VSP supports and enables
+    them. Frames the VSP found corrupt are then dropped.
+
+    Transmit offload is not enabled: it requires the network stack to store
+    the pseudo-header checksum, and the stack computes full checksums.
+
+    Large send offload is left unchanged: SNP transmits a single frame no
+    larger than the MTU, so there is nothing for the VSP to segment.
+
+Arguments:
+
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+Returns:
+
+    EFI_SUCCESS     - The supported offloads were enabled
+
+    EFI_UNSUPPORTED - The VSP supports no receive checksum offload
+
+    Other           - Failure
+
+--*/
+{
+    NDIS_OFFLOAD capabilities;
+    NDIS_OFFLOAD_PARAMETERS offloadParameters;
+    UINT32 responseLength;
+    UINT32 ipv4Rx;
+    UINT32 ipv6Rx;
+    EFI_STATUS status;
+
+    AdapterInfo->RxChecksumOffloadEnabled = FALSE;
+
+    ZeroMem(&capabilities, sizeof(capabilities));
+    capabilities.Header.Type = NDIS_OBJECT_TYPE_OFFLOAD;
+    capabilities.Header.Revision = NDIS_OFFLOAD_REVISION_1;
+    capabilities.Header.Size = sizeof(NDIS_OFFLOAD);
+
+    responseLength = sizeof(capabilities);
+    status = NetvscOidRequest(
+        AdapterInfo,
+        REMOTE_NDIS_QUERY_MSG,
+        RNDIS_OID_TCP_OFFLOAD_HARDWARE_CAPABILITIES,
+        &capabilities,
+        sizeof(capabilities),
+        &capabilities,
+        &responseLength);
+
+    if (EFI_ERROR(status))
+    {
+        return status;
+    }
+
+    if (responseLength < OFFSET_OF(NDIS_OFFLOAD, Unused) ||
+        capabilities.Header.Type != NDIS_OBJECT_TYPE_OFFLOAD ||
+        capabilities.Header.Revision < NDIS_OFFLOAD_REVISION_1)
+    {
+        return EFI_DEVICE_ERROR;
+    }
+
+    ipv4Rx = capabilities.Checksum.IPv4Receive &
+             (NDIS_OFFLOAD_CSUM_TCP_SUPPORTED | NDIS_OFFLOAD_CSUM_UDP_SUPPORTED | NDIS_OFFLOAD_CSUM_IP_SUPPORTED);
+    ipv6Rx = capabilities.Checksum.IPv6Receive &
+             (NDIS_OFFLOAD_CSUM_TCP_SUPPORTED | NDIS_OFFLOAD_CSUM_UDP_SUPPORTED);
+
+    if (ipv4Rx == 0 && ipv6Rx == 0)
+    {
+        return EFI_UNSUPPORTED;
+    }
+
+    ZeroMem(&offloadParameters, sizeof(offloadParameters));
+    offloadParameters.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+    offloadParameters.Header.Revision = NDIS_OFFLOAD_PARAMETERS_REVISION_3;
+    offloadParameters.Header.Size = sizeof(NDIS_OFFLOAD_PARAMETERS);
+    offloadParameters.IPv4Checksum = NETVSC_OFFLOAD_PARAMETER((ipv4Rx & NDIS_OFFLOAD_CSUM_IP_SUPPORTED) != 0);
+    offloadParameters.TCPIPv4Checksum = NETVSC_OFFLOAD_PARAMETER((ipv4Rx & NDIS_OFFLOAD_CSUM_TCP_SUPPORTED) != 0);
+    offloadParameters.UDPIPv4Checksum = NETVSC_OFFLOAD_PARAMETER((ipv4Rx & NDIS_OFFLOAD_CSUM_UDP_SUPPORTED) != 0);
+    offloadParameters.TCPIPv6Checksum = NETVSC_OFFLOAD_PARAMETER((ipv6Rx & NDIS_OFFLOAD_CSUM_TCP_SUPPORTED) != 0);
+    offloadParameters.UDPIPv6Checksum = NETVSC_OFFLOAD_PARAMETER((ipv6Rx & NDIS_OFFLOAD_CSUM_UDP_SUPPORTED) != 0);
+
+    status = NetvscOidRequest(
+        AdapterInfo,
+        REMOTE_NDIS_SET_MSG,
+        RNDIS_OID_TCP_OFFLOAD_PARAMETERS,
+        &offloadParameters,
+        sizeof(offloadParameters),
+        NULL,
+        NULL);
+
+    if (EFI_ERROR(status))
+    {
+        return status;
+    }
+
+    AdapterInfo->RxChecksumOffloadEnabled = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+
+UINT32
+NetvscGetRxChecksumStatus(
+    IN  PRNDIS_PACKET   RndisPacket,
+    IN  UINT32          PacketLength
+    )
+/*++
+
+Routine Description:
+
+    Finds the checksum validation result reported by the VSP in the
+    per-packet information of a received packet.
+
+Arguments:
+
+    RndisPacket     - The received RNDIS_PACKET
+
+    PacketLength    - Length of the range containing RndisPacket
+
+Returns:
+
+    The NDIS_TCP_IP_CHECKSUM_PACKET_INFO receive flags, or 0 if the VSP did
+    not validate the packet.
+
+--*/
+{
+    PRNDIS_PER_PACKET_INFO pPerPacketInfo;
+    UINT32 offset;
+    UINT32 end;
+
+    if (RndisPacket->PerPacketInfoLength == 0 ||
+        RndisPacket->PerPacketInfoOffset > PacketLength ||
+        RndisPacket->PerPacketInfoLength > PacketLength - RndisPacket->PerPacketInfoOffset)
+    {
+        return 0;
+    }
+
+    offset = RndisPacket->PerPacketInfoOffset;
+    end = offset + RndisPacket->PerPacketInfoLength;
+
+    while (end - offset >= sizeof(RNDIS_PER_PACKET_INFO))
+    {
+        pPerPacketInfo = (PRNDIS_PER_PACKET_INFO)((UINT8*)RndisPacket + offset);
+        if (pPerPacketInfo->Size < sizeof(RNDIS_PER_PACKET_INFO) ||
+            pPerPacketInfo->Size > end - offset)
+        {
+            break;
+        }
+
+        if (pPerPacketInfo->Type == RNDIS_PPI_TCPIP_CHECKSUM &&
+            pPerPacketInfo->PerPacketInformationOffset <= pPerPacketInfo->Size - sizeof(UINT32))
+        {
+            return *(UINT32*)((UINT8*)pPerPacketInfo + pPerPacketInfo->PerPacketInformationOffset) &
+                   NDIS_TCPIP_CSUM_RX_STATUS_MASK;
+        }
+
+        offset += pPerPacketInfo->Size;
+    }
+
+    return 0;
+}
+
+
+EFI_STATUS
+NetvscAllocateSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
+
+Routine Description:
+
+    Asks the VSP for vRSS sub-channels. The VSP offers the granted sub-channels
+    asynchronously. The caller opens those already offered, and the rest are
+    opened by NetvscSubChannelOfferNotify as they are offered.
+
+Arguments:
+
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+Returns:
+
+    EFI_SUCCESS     - Sub-channels were granted, or none were requested
+
+    EFI_UNSUPPORTED - The VSP does not support RSS
+
+    Other           - Failure
+
+--*/
+{
+    NDIS_RECEIVE_SCALE_CAPABILITIES rssCapabilities;
+    NVSP_MESSAGE nvspMessage;
+    UINT32 responseLength;
+    UINT32 requested;
+    EFI_STATUS status;
+
+    requested = MIN(PcdGet32(PcdNetvscMaxSubChannels), NETVSC_MAX_CHANNELS - 1);
+    if (requested == 0)
+    {
+        status = EFI_SUCCESS;
+        goto Exit;
+    }
+
+    //
+    // The VSP expects the query to carry the header of the structure it
+    // fills in.
+    //
+    ZeroMem(&rssCapabilities, sizeof(rssCapabilities));
+    rssCapabilities.Header.Type = NDIS_OBJECT_TYPE_RSS_CAPABILITIES;
+    rssCapabilities.Header.Revision = NDIS_RECEIVE_SCALE_CAPABILITIES_REVISION_2;
+    rssCapabilities.Header.Size = sizeof(NDIS_RECEIVE_SCALE_CAPABILITIES);
+
+    responseLength = sizeof(rssCapabilities);
+    status = NetvscOidRequest(
+        AdapterInfo,
+        REMOTE_NDIS_QUERY_MSG,
+        RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES,
+        &rssCapabilities,
+        sizeof(rssCapabilities),
+        &rssCapabilities,
+        &responseLength);
+
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    if (responseLength < sizeof(rssCapabilities) ||
+        rssCapabilities.Header.Type != NDIS_OBJECT_TYPE_RSS_CAPABILITIES ||
+        rssCapabilities.NumberOfReceiveQueues < 2)
+    {
+        status = EFI_UNSUPPORTED;
+        goto Exit;
+    }
+
+    requested = MIN(requested, rssCapabilities.NumberOfReceiveQueues - 1);
+
+    //
+    // Sub-channel offers are matched by device path as they are installed.
+    //
+    status = gBS->CreateEvent(
+        EVT_NOTIFY_SIGNAL,
+        TPL_CALLBACK,
+        NetvscSubChannelOfferNotify,
+        AdapterInfo,
+        &AdapterInfo->SubChannelOfferEvt);
+
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    status = gBS->RegisterProtocolNotify(
+        &gEfiVmbusProtocolGuid,
+        AdapterInfo->SubChannelOfferEvt,
+        &AdapterInfo->SubChannelOfferRegistration);
+
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    ZeroMem(&nvspMessage, sizeof(nvspMessage));
+    nvspMessage.Header.MessageType = NvspMessage5TypeSubChannel;
+    nvspMessage.Messages.Version5Messages.SubChannelRequest.Operation = NvspSubchannelAllocate;
+    nvspMessage.Messages.Version5Messages.SubChannelRequest.NumSubChannels = requested;
+
+    status = EmclSendPacketSync(
+        AdapterInfo->Emcl,
+        &nvspMessage,
+        sizeof(nvspMessage),
+        NULL,
+        0);
+
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    if (nvspMessage.Header.MessageType != NvspMessage5TypeSubChannel)
+    {
+        status = EFI_DEVICE_ERROR;
+        goto Exit;
+    }
+
+    if (nvspMessage.Messages.Version5Messages.SubChannelRequestComplete.Status != NvspStatusSuccess)
+    {
+        status = NvspStatusToEfiStatus(nvspMessage.Messages.Version5Messages.SubChannelRequestComplete.Status);
+        goto Exit;
+    }
+
+    AdapterInfo->SubChannelCount = MIN(
+        nvspMessage.Messages.Version5Messages.SubChannelRequestComplete.NumSubChannels,
+        requested);
+
+    DEBUG((EFI_D_NET, "Netvsc: %d vRSS sub-channels granted.\n", AdapterInfo->SubChannelCount));
+
+Exit:
+
+    return status;
+}
+
+
+VOID
+EFIAPI
+NetvscSubChannelOfferNotify(
+    IN  EFI_EVENT   Event,
+    IN  VOID        *Context
+    )
+/*++
+
+Routine Description:
+
+    Notified when a VMBus channel is installed. VMBus installs offers from an
+    event below TPL_CALLBACK, so they cannot arrive while Initialize runs;
+    the ones offered after it are opened here. The event runs at
+    TPL_CALLBACK, the TPL SNP calls into the driver at, so it does not race
+    with transmit, receive or shutdown.
+
+Arguments:
+
+    Event   - The event.
+
+    Context - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+--*/
+{
+    NetvscOpenSubChannels((NIC_DATA_INSTANCE *) Context);
+}
+
+
+EFI_STATUS
+NetvscOpenSubChannel(
+    IN  NIC_DATA_INSTANCE   *AdapterInfo,
+    IN  UINT16              SubChannelIndex
+    )
+/*++
+
+Routine Description:
+
+    Opens an offered sub-channel and starts receiving on it.
+
+Arguments:
+
+    AdapterInfo     - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+    SubChannelIndex - The index of the sub-channel, starting at 1
+
+Returns:
+
+    EFI_SUCCESS     - The sub-channel was opened
+
+    EFI_NOT_FOUND   - The sub-channel has not been offered yet
+
+    Other           - Failure
+
+--*/
+{
+    VMBUS_SUBCHANNEL_DEVICE_PATH subChannelNode;
+    EFI_DEVICE_PATH_PROTOCOL *devicePath = NULL;
+    EFI_DEVICE_PATH_PROTOCOL *remainingDevicePath;
+    NETVSC_CHANNEL *channel;
+    EFI_HANDLE handle;
+    EFI_STATUS status;
+    BOOLEAN emclInstalled = FALSE;
+
+    ZeroMem(&subChannelNode, sizeof(subChannelNode));
+    subChannelNode.VendorDevicePath.Header.Type = HARDWARE_DEVICE_PATH;
+    subChannelNode.VendorDevicePath.Header.SubType = HW_VENDOR_DP;
+    SetDevicePathNodeLength(&subChannelNode.VendorDevicePath.Header, sizeof(subChannelNode));
+    CopyGuid(&subChannelNode.VendorDevicePath.Guid, &gEfiVmbusSubChannelDevicePathGuid);
+    subChannelNode.SubChannelIndex = SubChannelIndex;
+
+    devicePath = AppendDevicePathNode(AdapterInfo->BaseDevPath, &subChannelNode.VendorDevicePath.Header);
+    if (devicePath == NULL)
+    {
+        status = EFI_OUT_OF_RESOURCES;
+        goto Cleanup;
+    }
+
+    remainingDevicePath = devicePath;
+    status = gBS->LocateDevicePath(&gEfiVmbusProtocolGuid, &remainingDevicePath, &handle);
+    if (EFI_ERROR(status) || !IsDevicePathEnd(remainingDevicePath))
+    {
+        status = EFI_NOT_FOUND;
+        goto Cleanup;
+    }
+
+    status = EmclInstallProtocol(handle);
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    emclInstalled = TRUE;
+    channel = &AdapterInfo->Channels[AdapterInfo->ChannelCount];
+
+    status = gBS->OpenProtocol(
+        handle,
+        &gEfiEmclProtocolGuid,
+        (VOID **)&channel->Emcl,
+        AdapterInfo->DriverBindingHandle,
+        handle,
+        EFI_OPEN_PROTOCOL_BY_DRIVER);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    channel->AdapterInfo = AdapterInfo;
+    channel->Handle = handle;
+    channel->SubChannelIndex = SubChannelIndex;
+
+    status = channel->Emcl->SetReceiveCallback(
+        channel->Emcl,
+        NetvscReceiveCallback,
+        channel,
+        TPL_NETVSC_CALLBACK);
+
+    if (!EFI_ERROR(status))
+    {
+        //
+        // Sub-channels use the receive and send buffers of the primary
+        // channel, so only the ring buffers are sized here.
+        //
+        status = channel->Emcl->StartChannel(
+            channel->Emcl,
+            EFI_SIZE_TO_PAGES(NVSC_RING_BUFFER_SIZE),
+            EFI_SIZE_TO_PAGES(NVSC_RING_BUFFER_SIZE));
+    }
+
+    if (EFI_ERROR(status))
+    {
+        gBS->CloseProtocol(
+            handle,
+            &gEfiEmclProtocolGuid,
+            AdapterInfo->DriverBindingHandle,
+            handle);
+
+        goto Cleanup;
+    }
+
+    AdapterInfo->ChannelCount++;
+
+Cleanup:
+
+    if (EFI_ERROR(status) && emclInstalled)
+    {
+        EmclUninstallProtocol(handle);
+    }
+
+    if (devicePath != NULL)
+    {
+        FreePool(devicePath);
+    }
+
+    return status;
+}
+
+
+EFI_STATUS
+NetvscSetRssParameters(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
+
+Routine Description:
+
+    Enables RSS on the VSP, spreading received traffic evenly across all the
+    open channels.
+
+Arguments:
+
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+Returns:
+
+    EFI_SUCCESS - RSS was enabled
+
+    Other       - Failure
+
+--*/
+{
+    //
+    // The default Toeplitz hash key used by Windows.
+    //
+    STATIC CONST UINT8 hashKey[NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_2] =
+    {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+        0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+        0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+    };
+    NETVSC_RSS_PARAMETERS rssParameters;
+    UINT32 index;
+
+    ZeroMem(&rssParameters, sizeof(rssParameters));
+    rssParameters.Parameters.Header.Type = NDIS_OBJECT_TYPE_RSS_PARAMETERS;
+    rssParameters.Parameters.Header.Revision = NDIS_RECEIVE_SCALE_PARAMETERS_REVISION_2;
+    rssParameters.Parameters.Header.Size = sizeof(NDIS_RECEIVE_SCALE_PARAMETERS);
+    rssParameters.Parameters.HashInformation =
+        NDIS_HASH_FUNCTION_TOEPLITZ |
+        NDIS_HASH_IPV4 |
+        NDIS_HASH_TCP_IPV4 |
+        NDIS_HASH_IPV6 |
+        NDIS_HASH_TCP_IPV6;
+
+    rssParameters.Parameters.IndirectionTableSize = sizeof(rssParameters.IndirectionTable);
+    rssParameters.Parameters.IndirectionTableOffset = OFFSET_OF(NETVSC_RSS_PARAMETERS, IndirectionTable);
+    rssParameters.Parameters.HashSecretKeySize = sizeof(rssParameters.HashKey);
+    rssParameters.Parameters.HashSecretKeyOffset = OFFSET_OF(NETVSC_RSS_PARAMETERS, HashKey);
+
+    for (index = 0; index < NDIS_RSS_INDIRECTION_TABLE_MAX_SIZE_REVISION_2; index++)
+    {
+        rssParameters.IndirectionTable[index] = index % AdapterInfo->ChannelCount;
+    }
+
+    CopyMem(rssParameters.HashKey, hashKey, sizeof(hashKey));
+
+    return NetvscOidRequest(
+        AdapterInfo,
+        REMOTE_NDIS_SET_MSG,
+        RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS,
+        &rssParameters,
+        sizeof(rssParameters),
+        NULL,
+        NULL);
+}
+
+
+VOID
+NetvscOpenSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
+
+Routine Description:
+
+    Opens the granted sub-channels that have been offered so far. Once all of
+    them are open RSS is enabled on the VSP. Until then received traffic
+    continues to arrive on the primary channel.
+
+Arguments:
+
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+--*/
+{
+    EFI_STATUS status;
+
+    //
+    // Sub-channels are opened in index order so that the indirection table
+    // can refer to channels by their position in the channel array.
+    //
+    while (AdapterInfo->ChannelCount <= AdapterInfo->SubChannelCount)
+    {
+        status = NetvscOpenSubChannel(AdapterInfo, (UINT16) AdapterInfo->ChannelCount);
+        if (status == EFI_NOT_FOUND)
+        {
+            return;
+        }
+
+        if (EFI_ERROR(status))
+        {
+            DEBUG((EFI_D_WARN, "Netvsc: failed to open sub-channel %d. Status = %r\n", AdapterInfo->ChannelCount, status));
+            AdapterInfo->SubChannelCount = AdapterInfo->ChannelCount - 1;
+            break;
+        }
+    }
+
+    if (AdapterInfo->SubChannelOfferEvt != NULL)
     {
-        status  = EFI_DEVICE_ERROR;
-        goto Exit;
+        gBS->CloseEvent(AdapterInfo->SubChannelOfferEvt);
+        AdapterInfo->SubChannelOfferEvt = NULL;
     }
-    else
+
+    if (AdapterInfo->ChannelCount > 1 && !AdapterInfo->RssEnabled)
     {
-        //
-        // The buffer is used temporarily for a sync transaction.
-        // Hence, dequeueing the buffer from the FreeTxBufferQueue isn't required.
-        //
-        TxQueueDequeue(&AdapterInfo->FreeTxBuffersQueue, (void**)&pRndisMessage);
-        TxQueueEnqueue(&AdapterInfo->FreeTxBuffersQueue, pRndisMessage);
-        rndisBufferIndex = (UINT32)((((UINT64) pRndisMessage) - ((UINT64) AdapterInfo->TxBuffer))/AdapterInfo->TxSectionSize);
+        status = NetvscSetRssParameters(AdapterInfo);
+        if (EFI_ERROR(status))
+        {
+            DEBUG((EFI_D_WARN, "Netvsc: failed to enable vRSS. Status = %r\n", status));
+        }
+        else
+        {
+            AdapterInfo->RssEnabled = TRUE;
+        }
     }
+}
 
-    //
-    // Set RndisMessage properties as needed to set Receive Filters
-    //
-    rndisMsgSize = RNDIS_MESSAGE_SIZE(RNDIS_SET_REQUEST) + sizeof(ndisFilter);
 
-    pSetRequest = &pRndisMessage->Message.SetRequest;
-    pSetRequest->RequestId = SET_FILTER_REQUEST_ID;
-    pSetRequest->Oid = RNDIS_OID_GEN_CURRENT_PACKET_FILTER;
-    pSetRequest->InformationBufferLength = sizeof(ndisFilter);
-    pSetRequest->InformationBufferOffset = sizeof(RNDIS_SET_REQUEST);
-    pSetRequest->DeviceVcHandle = 0;
+VOID
+NetvscCloseSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    )
+/*++
 
-    CopyMem((UINT8*)(pSetRequest) + pSetRequest->InformationBufferOffset, &ndisFilter, sizeof(ndisFilter));
+Routine Description:
 
-    pRndisMessage->NdisMessageType = REMOTE_NDIS_SET_MSG;
-    pRndisMessage->MessageLength = rndisMsgSize;
+    Stops and closes all open sub-channels. Must be called before the primary
+    channel is stopped.
 
-    ZeroMem(&nvspMessage, sizeof(nvspMessage));
-    nvspMessage.Header.MessageType = NvspMessage1TypeSendRNDISPacket;
-    nvspMessage.Messages.Version1Messages.SendRNDISPacket.ChannelType = 1;
-    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionIndex = rndisBufferIndex;
-    nvspMessage.Messages.Version1Messages.SendRNDISPacket.SendBufferSectionSize = rndisMsgSize;
+Arguments:
 
-    status = EmclSendPacketSync(
-        AdapterInfo->Emcl,
-        &nvspMessage,
-        sizeof(nvspMessage),
-        NULL,
-        0);
+    AdapterInfo - Pointer to the vNIC's NIC_DATA_INSTANCE
 
-    if (EFI_ERROR(status))
-    {
-        goto Exit;
-    }
+--*/
+{
+    NETVSC_CHANNEL *channel;
 
-    if (nvspMessage.Header.MessageType != NvspMessage1TypeSendRNDISPacketComplete)
+    if (AdapterInfo->SubChannelOfferEvt != NULL)
     {
-        status = EFI_DEVICE_ERROR;
-        goto Exit;
+        gBS->CloseEvent(AdapterInfo->SubChannelOfferEvt);
+        AdapterInfo->SubChannelOfferEvt = NULL;
     }
 
-    if (nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status != NvspStatusSuccess)
+    while (AdapterInfo->ChannelCount > 1)
     {
-        status = NvspStatusToEfiStatus(nvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status);
-        goto Exit;
-    }
+        AdapterInfo->ChannelCount--;
+        channel = &AdapterInfo->Channels[AdapterInfo->ChannelCount];
 
-    //
-    // This can be called from TPL_CALLBACK. Use WaitForEventInternal instead of gBS->WaitForEvent
-    // which enforces a TPL check for TPL_APPLICATION.
-    //
-    status = mInternalEventServices->WaitForEventInternal(1, &AdapterInfo->RxFilterEvt, &eventIndex);
+        channel->Emcl->StopChannel(channel->Emcl);
 
-    if (EFI_ERROR(status))
-    {
-        AdapterInfo->RxFilter = (UINT8) oldFilter;
-        AdapterInfo->SetRxFilterStatus = (EFI_STATUS) -1;
-        goto Exit;
-    }
+        gBS->CloseProtocol(
+            channel->Handle,
+            &gEfiEmclProtocolGuid,
+            AdapterInfo->DriverBindingHandle,
+            channel->Handle);
 
-    status = AdapterInfo->SetRxFilterStatus;
-    if (EFI_ERROR(status))
-    {
-        AdapterInfo->RxFilter = (UINT8) oldFilter;
+        EmclUninstallProtocol(channel->Handle);
+        ZeroMem(channel, sizeof(NETVSC_CHANNEL));
     }
-    AdapterInfo->SetRxFilterStatus = (EFI_STATUS) -1;
 
-Exit:
-
-    return status;
+    AdapterInfo->SubChannelCount = 0;
+    AdapterInfo->RssEnabled = FALSE;
 }
 
 
@@ -1084,11 +2143,8 @@ Returns:
     RX_PACKET_INSTANCE currPacket;
     UINT32 bytesToBeCopied;
     INT32 index;
-    NVSP_MESSAGE message;
     EFI_STATUS status = EFI_SUCCESS;
 
-    ZeroMem(&message, sizeof(NVSP_MESSAGE));
-
     if (!AdapterInfo->ReceiveStarted)
     {
         status = EFI_NOT_READY;
@@ -1168,25 +2224,11 @@ Returns:
         }
     }
 
-    if (currPacket.CompletionNeeded)
-    {
-
-        //
-        // Send an ACK to NetVSP
-        //
-        message.Header.MessageType = NvspMessage1TypeSendRNDISPacketComplete;
-        message.Messages.Version1Messages.SendRNDISPacketComplete.Status = NvspStatusSuccess;
-
-        AdapterInfo->Emcl->CompletePacket(
-            AdapterInfo->Emcl,
-            currPacket.PacketContext,
-            &message,
-            sizeof(message));
-    }
-    else
-    {
-        FreePool(currPacket.Buffer);
-    }
+    //
+    // The packet data has been consumed from the receive buffer. The VSP is
+    // notified once all the packets of the transfer have been consumed.
+    //
+    RxTransferPacketRelease(AdapterInfo, currPacket.TransferPacket);
 
 Exit:
 
@@ -1194,6 +2236,40 @@ Exit:
 }
 
 
+VOID
+NetvscCompleteReceive(
+    IN  EFI_EMCL_PROTOCOL   *Emcl,
+    IN  VOID                *PacketContext
+    )
+/*++
+
+Routine Description:
+
+    Sends the completion for a packet to the VSP. For a transfer-page packet
+    this returns its receive buffer sections to the VSP.
+
+Arguments:
+
+    Emcl            - The EMCL channel the packet was received on
+
+    PacketContext   - The context provided by EMCL for the received packet
+
+--*/
+{
+    NVSP_MESSAGE message;
+
+    ZeroMem(&message, sizeof(NVSP_MESSAGE));
+    message.Header.MessageType = NvspMessage1TypeSendRNDISPacketComplete;
+    message.Messages.Version1Messages.SendRNDISPacketComplete.Status = NvspStatusSuccess;
+
+    Emcl->CompletePacket(
+        Emcl,
+        PacketContext,
+        &message,
+        sizeof(message));
+}
+
+
 VOID
 NetvscReceiveCallback(
     IN  VOID                                    *ReceiveContext,
@@ -1212,7 +2288,8 @@ Routine Description:
 
 Arguments:
 
-    ReceiveContext       - The context for each receive. It's the pointer to the NIC_DATA_INSTANCE
+    ReceiveContext       - The context for each receive. It's the pointer to the NETVSC_CHANNEL
+                                   the packet was received on
 
     PacketContext         - The context to be used for Emcl->CompletePacket
 
@@ -1229,28 +2306,43 @@ Arguments:
 
 --*/
 {
+    NETVSC_CHANNEL *channel;
     NIC_DATA_INSTANCE *adapterInfo;
     BOOLEAN bufferIsFull;
-    NVSP_MESSAGE outNvspMessage;
     PRNDIS_MESSAGE pRndisMessage;
     PRNDIS_PACKET pRndisPacket;
     PRNDIS_QUERY_COMPLETE pQueryReqComplete;
-    VOID *packetBuffer, *copyPacketBuffer;
+    VOID *packetBuffer;
     UINT32 rangeIndex;
     UINT8 *nodeAddr;
-    UINT32 numDataPkts = 0;
+    RX_TRANSFER_PACKET *transferPacket = NULL;
     RX_PACKET_INSTANCE newPacketInfo;
+    UINT32 checksumStatus;
 
-    ASSERT(RangeCount > 0);
-    ZeroMem(&outNvspMessage, sizeof(NVSP_MESSAGE));
-
-    adapterInfo = (NIC_DATA_INSTANCE *) ReceiveContext;
+    channel = (NETVSC_CHANNEL *) ReceiveContext;
+    adapterInfo = channel->AdapterInfo;
 
     if (!adapterInfo->ReceiveStarted)
     {
         goto Exit;
     }
 
+    //
+    // In-band NVSP messages, such as the send indirection table the VSP
+    // sends once sub-channels are allocated, carry no RNDIS data. Transmits
+    // always use the primary channel, so these are simply completed.
+    //
+    if (RangeCount == 0)
+    {
+        goto Exit;
+    }
+
+    //
+    // The transfer packet holds a reference for the duration of this callback
+    // so it cannot be completed while its ranges are still being queued.
+    //
+    transferPacket = RxTransferPacketAcquire(&adapterInfo->RxTransferPacketPool, channel->Emcl, PacketContext);
+
     //
     // Assumption: Every range is a new packet.
     //
@@ -1277,15 +2369,29 @@ Arguments:
             //
             bufferIsFull = RxQueueIsAlmostFull(&adapterInfo->RxPacketQueue);
 
-            if (bufferIsFull)
+            if (bufferIsFull || transferPacket == NULL)
             {
                 adapterInfo->Statistics.RxDroppedFrames++;
                 break;
             }
 
-            numDataPkts++;
             packetBuffer = ((UINT8*)pRndisPacket) + pRndisPacket->DataOffset;
 
+            //
+            // With receive checksum offload enabled, frames the VSP found to
+            // be corrupt are never indicated to the network stack.
+            //
+            checksumStatus = NetvscGetRxChecksumStatus(
+                pRndisPacket,
+                Ranges[rangeIndex].ByteCount - (UINT32)((UINTN)pRndisPacket - (UINTN)pRndisMessage));
+
+            if (adapterInfo->RxChecksumOffloadEnabled &&
+                (checksumStatus & NDIS_TCPIP_CSUM_RX_FAILED_MASK))
+            {
+                adapterInfo->Statistics.RxDroppedFrames++;
+                break;
+            }
+
             //
             // The packet should start and ends in the specified range.
             //
@@ -1293,24 +2399,15 @@ Arguments:
             ASSERT(((UINT64)packetBuffer + pRndisPacket->DataLength) <= ((UINT64)pRndisMessage + Ranges[rangeIndex].ByteCount));
 
             //
-            // If there are multiple packets, the extra data packets will be copied into separate pools
+            // The packet is left in place in the receive buffer. Each queued
+            // packet holds a reference on the transfer packet, which keeps
+            // its sections pinned until the packet has been received.
             //
-            if (numDataPkts > 1)
-            {
-                copyPacketBuffer = AllocatePool(pRndisPacket->DataLength);
-                if (copyPacketBuffer == NULL)
-                {
-                    adapterInfo->Statistics.RxDroppedFrames++;
-                    break;
-                }
-                CopyMem(copyPacketBuffer, packetBuffer, pRndisPacket->DataLength);
-                packetBuffer = copyPacketBuffer;
-            }
+            transferPacket->RefCount++;
 
-            newPacketInfo.PacketContext = PacketContext;
+            newPacketInfo.TransferPacket = transferPacket;
             newPacketInfo.Buffer = packetBuffer;
             newPacketInfo.BufferLength = pRndisPacket->DataLength;
-            newPacketInfo.CompletionNeeded = (numDataPkts == 1);
             RxQueueEnqueue(&adapterInfo->RxPacketQueue, &newPacketInfo);
 
             adapterInfo->RxInterrupt = TRUE;
@@ -1321,6 +2418,12 @@ Arguments:
 
         case REMOTE_NDIS_QUERY_CMPLT:
             pQueryReqComplete = &pRndisMessage->Message.QueryComplete;
+            if (pQueryReqComplete->RequestId == OID_REQUEST_ID)
+            {
+                NetvscOidRequestComplete(adapterInfo, pRndisMessage, Ranges[rangeIndex].ByteCount);
+                break;
+            }
+
             if (pQueryReqComplete->Status != RNDIS_STATUS_SUCCESS ||
                 pQueryReqComplete->InformationBufferLength != PXE_HWADDR_LEN_ETHER)
             {
@@ -1369,6 +2472,12 @@ Arguments:
             break;
 
         case REMOTE_NDIS_SET_CMPLT:
+            if (pRndisMessage->Message.SetComplete.RequestId == OID_REQUEST_ID)
+            {
+                NetvscOidRequestComplete(adapterInfo, pRndisMessage, Ranges[rangeIndex].ByteCount);
+                break;
+            }
+
             DEBUG((EFI_D_NET, "RNDIS SetFilter Complete.\n"));
             if (pRndisMessage->Message.SetComplete.Status != RNDIS_STATUS_SUCCESS)
             {
@@ -1408,16 +2517,13 @@ Arguments:
 
 Exit:
 
-    if (numDataPkts == 0)
+    if (transferPacket != NULL)
     {
-        outNvspMessage.Header.MessageType = NvspMessage1TypeSendRNDISPacketComplete;
-        outNvspMessage.Messages.Version1Messages.SendRNDISPacketComplete.Status = NvspStatusSuccess;
-
-        adapterInfo->Emcl->CompletePacket(
-            adapterInfo->Emcl,
-            PacketContext,
-            &outNvspMessage,
-            sizeof(outNvspMessage));
+        RxTransferPacketRelease(adapterInfo, transferPacket);
+    }
+    else
+    {
+        NetvscCompleteReceive(channel->Emcl, PacketContext);
     }
 }
 
@@ -1444,6 +2550,11 @@ Returns:
 
 --*/
 {
+    //
+    // Sub-channels are closed before the primary channel.
+    //
+    NetvscCloseSubChannels(AdapterInfo);
+
     if (AdapterInfo->EmclStarted)
     {
         AdapterInfo->Emcl->StopChannel(AdapterInfo->Emcl);
@@ -1488,7 +2599,14 @@ Returns:
         AdapterInfo->RxFilterEvt = NULL;
     }
 
+    if (AdapterInfo->OidRequestEvt != NULL)
+    {
+        gBS->CloseEvent(AdapterInfo->OidRequestEvt);
+        AdapterInfo->OidRequestEvt = NULL;
+    }
+
     RxQueueDestroy(&AdapterInfo->RxPacketQueue);
+    RxTransferPacketPoolDestroy(&AdapterInfo->RxTransferPacketPool);
     TxQueueDestroy(&AdapterInfo->TxedBuffersQueue);
     TxQueueDestroy(&AdapterInfo->FreeTxBuffersQueue);
 
@@ -1773,7 +2891,7 @@ Arguments:
 --*/
 {
     ASSERT(RxQueueIsAlmostFull(Queue) == FALSE);
-    ASSERT(Queue->Buffer[Queue->Tail].PacketContext == NULL &&
+    ASSERT(Queue->Buffer[Queue->Tail].TransferPacket == NULL &&
            Queue->Buffer[Queue->Tail].Buffer == NULL &&
            Queue->Buffer[Queue->Tail].BufferLength == 0);
 
@@ -1805,7 +2923,7 @@ Arguments:
 --*/
 {
     ASSERT(RxQueueIsEmpty(Queue) == FALSE);
-    ASSERT(Queue->Buffer[Queue->Head].PacketContext != NULL &&
+    ASSERT(Queue->Buffer[Queue->Head].TransferPacket != NULL &&
            Queue->Buffer[Queue->Head].Buffer != NULL &&
            Queue->Buffer[Queue->Head].BufferLength != 0);
 
@@ -1815,6 +2933,174 @@ Arguments:
 }
 
 
+EFI_STATUS
+RxTransferPacketPoolInit(
+    IN  RX_TRANSFER_PACKET_POOL *Pool,
+    IN  UINT32                  Length
+    )
+/*++
+
+Routine Description:
+
+    Initializes the pool of transfer packet tracking entries. The entries are
+    preallocated so that the receive path does not allocate memory.
+
+Arguments:
+
+    Pool - The Pool to be initialized.
+
+    Length - The number of entries the Pool needs to have.
+
+Return Value:
+
+    EFI_SUCCESS                    - Pool Initialized.
+
+    EFI_OUT_OF_RESOURCES   - Memory allocation failed.
+
+--*/
+{
+    UINT32 index;
+
+    ASSERT(Length > 0);
+
+    Pool->FreeList = NULL;
+    Pool->Length = Length;
+    Pool->Buffer = AllocateZeroPool(Length * sizeof(RX_TRANSFER_PACKET));
+    if (Pool->Buffer == NULL)
+    {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (index = 0; index < Length; index++)
+    {
+        Pool->Buffer[index].Next = Pool->FreeList;
+        Pool->FreeList = &Pool->Buffer[index];
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+VOID
+RxTransferPacketPoolDestroy(
+    IN  RX_TRANSFER_PACKET_POOL *Pool
+    )
+/*++
+
+Routine Description:
+
+    Destroys the Pool i.e. deallocates memory and zeroes all the variables.
+
+    Any outstanding transfer packets are abandoned. This is only safe once the
+    channel has been stopped.
+
+Arguments:
+
+    Pool - The Pool to be destroyed.
+
+--*/
+{
+    if (Pool->Buffer != NULL)
+    {
+        FreePool(Pool->Buffer);
+    }
+
+    ZeroMem(Pool, sizeof(RX_TRANSFER_PACKET_POOL));
+}
+
+
+RX_TRANSFER_PACKET *
+RxTransferPacketAcquire(
+    IN  RX_TRANSFER_PACKET_POOL *Pool,
+    IN  EFI_EMCL_PROTOCOL       *Emcl,
+    IN  VOID                    *PacketContext
+    )
+/*++
+
+Routine Description:
+
+    Takes a free entry from the pool to track a received transfer packet.
+    The entry is returned holding a single reference.
+
+Arguments:
+
+    Pool            - The Pool.
+
+    Emcl            - The EMCL channel the transfer packet was received on.
+
+    PacketContext   - The EMCL context used to complete the transfer packet.
+
+Return Value:
+
+    The tracking entry, or NULL if the pool is exhausted.
+
+--*/
+{
+    RX_TRANSFER_PACKET *transferPacket;
+
+    transferPacket = Pool->FreeList;
+    if (transferPacket == NULL)
+    {
+        return NULL;
+    }
+
+    Pool->FreeList = transferPacket->Next;
+    transferPacket->Next = NULL;
+    transferPacket->Emcl = Emcl;
+    transferPacket->PacketContext = PacketContext;
+    transferPacket->RefCount = 1;
+
+    return transferPacket;
+}
+
+
+VOID
+RxTransferPacketRelease(
+    IN  NIC_DATA_INSTANCE       *AdapterInfo,
+    IN  RX_TRANSFER_PACKET      *TransferPacket
+    )
+/*++
+
+Routine Description:
+
+    Drops a reference on a transfer packet. When the last reference is
+    dropped the completion is sent to the VSP and the entry is returned
+    to the pool.
+
+Arguments:
+
+    AdapterInfo     - Pointer to the vNIC's NIC_DATA_INSTANCE
+
+    TransferPacket  - The transfer packet to be released.
+
+--*/
+{
+    RX_TRANSFER_PACKET_POOL *pool;
+    EFI_TPL oldTpl;
+
+    ASSERT(TransferPacket->RefCount > 0);
+
+    TransferPacket->RefCount--;
+    if (TransferPacket->RefCount != 0)
+    {
+        return;
+    }
+
+    NetvscCompleteReceive(TransferPacket->Emcl, TransferPacket->PacketContext);
+
+    //
+    // The receive callback takes entries from the pool at a higher TPL.
+    //
+    pool = &AdapterInfo->RxTransferPacketPool;
+    oldTpl = gBS->RaiseTPL(TPL_NETVSC_CALLBACK);
+    TransferPacket->Emcl = NULL;
+    TransferPacket->PacketContext = NULL;
+    TransferPacket->Next = pool->FreeList;
+    pool->FreeList = TransferPacket;
+    gBS->RestoreTPL(oldTpl);
+}
+
+
 EFI_STATUS
 TxQueueInit(
     IN  TX_QUEUE    *Queue,
@@ -24,12 +24,21 @@
 
 #define MAXIMUM_ETHERNET_PACKET_SIZE        1514
 
-// TODO: Make the number of packets in the buffer a PCD variable.
-#define NVSC_DEFAULT_RECEIVE_BUFFER_SIZE    MAXIMUM_ETHERNET_PACKET_SIZE * 128
-#define NVSC_DEFAULT_SEND_BUFFER_SIZE       MAXIMUM_ETHERNET_PACKET_SIZE * 128
+//
+// The receive and send buffers are sized by PcdNetvscReceiveBufferSize and
+// PcdNetvscSendBufferSize. The VMBus ring buffers only carry NVSP control
+// messages and keep a fixed size.
+//
+#define NVSC_RING_BUFFER_SIZE               MAXIMUM_ETHERNET_PACKET_SIZE * 128
 
 #define NETVSC_VERSION 1
 
+//
+// Upper bound on the number of VMBus channels (the primary channel plus the
+// vRSS sub-channels) a single vNIC will use.
+//
+#define NETVSC_MAX_CHANNELS                 16
+
 typedef struct _ETHERNET_HEADER
 {
     UINT8 DestAddr[PXE_HWADDR_LEN_ETHER];
@@ -37,12 +46,31 @@ typedef struct _ETHERNET_HEADER
     UINT16 Type;
 } ETHERNET_HEADER;
 
+//
+// Tracks a single transfer-page packet received from the VSP. Every data
+// packet queued from it references the receive buffer in place, and the
+// completion is sent to the VSP once the last reference is dropped.
+//
+typedef struct _RX_TRANSFER_PACKET
+{
+    struct _RX_TRANSFER_PACKET  *Next;
+    EFI_EMCL_PROTOCOL           *Emcl;
+    VOID                        *PacketContext;
+    UINT32                      RefCount;
+} RX_TRANSFER_PACKET;
+
+typedef struct _RX_TRANSFER_PACKET_POOL
+{
+    RX_TRANSFER_PACKET    *Buffer;
+    RX_TRANSFER_PACKET    *FreeList;
+    UINT32                Length;
+} RX_TRANSFER_PACKET_POOL;
+
 typedef struct _RX_PACKET_INSTANCE
 {
-    VOID * PacketContext;
+    RX_TRANSFER_PACKET * TransferPacket;
     VOID * Buffer;
     UINT32 BufferLength;
-    BOOLEAN CompletionNeeded;
 } RX_PACKET_INSTANCE;
 
 typedef struct _RX_QUEUE
@@ -61,6 +89,19 @@ typedef struct _TX_QUEUE
     UINT32    Tail;
 } TX_QUEUE;
 
+//
+// A VMBus channel of the vNIC. Channel 0 is the primary channel; the others
+// are vRSS sub-channels offered by the VSP on request. All channels share the
+// receive and send buffers established on the primary channel.
+//
+typedef struct _NETVSC_CHANNEL
+{
+    struct _NIC_DATA_INSTANCE   *AdapterInfo;
+    EFI_EMCL_PROTOCOL           *Emcl;
+    EFI_HANDLE                  Handle;
+    UINT16                      SubChannelIndex;
+} NETVSC_CHANNEL;
+
 typedef struct _NIC_DATA_INSTANCE
 {
     EFI_EMCL_PROTOCOL         *Emcl;
@@ -69,6 +110,15 @@ typedef struct _NIC_DATA_INSTANCE
     BOOLEAN                   MediaPresent;
     BOOLEAN                   EmclStarted;
 
+    EFI_HANDLE                DriverBindingHandle;
+    EFI_DEVICE_PATH_PROTOCOL  *BaseDevPath;
+    NETVSC_CHANNEL            Channels[NETVSC_MAX_CHANNELS];
+    UINT32                    ChannelCount;
+    UINT32                    SubChannelCount;
+    EFI_EVENT                 SubChannelOfferEvt;
+    VOID                      *SubChannelOfferRegistration;
+    BOOLEAN                   RssEnabled;
+
     UINT8                     PermNodeAddress[PXE_MAC_LENGTH];
     UINT8                     CurrentNodeAddress[PXE_MAC_LENGTH];
     UINT8                     BroadcastNodeAddress[PXE_MAC_LENGTH];
@@ -79,6 +129,13 @@ typedef struct _NIC_DATA_INSTANCE
     EFI_STATUS                GetStnAddrStatus;
     EFI_EVENT                 InitRndisEvt;
     EFI_STATUS                InitRndisStatus;
+    EFI_EVENT                 OidRequestEvt;
+    EFI_STATUS                OidRequestStatus;
+    VOID                      *OidResponse;
+    UINT32                    OidResponseLength;
+
+    UINT32                    Mtu;
+    UINT32                    MaxFrameSize;
 
     VOID                      *RxBufferAllocation;
     VOID                      *RxBuffer;
@@ -89,6 +146,8 @@ typedef struct _NIC_DATA_INSTANCE
     BOOLEAN                   ReceiveStarted;
     UINT8                     RxFilter;
 
+    BOOLEAN                   RxChecksumOffloadEnabled;
+
     VOID                      *TxBufferAllocation;
     VOID                      *TxBuffer;
     UINT32                    TxBufferPageCount;
@@ -98,6 +157,7 @@ typedef struct _NIC_DATA_INSTANCE
     BOOLEAN                   TxedInterrupt;
 
     RX_QUEUE                  RxPacketQueue;
+    RX_TRANSFER_PACKET_POOL   RxTransferPacketPool;
     TX_QUEUE                  FreeTxBuffersQueue;
     TX_QUEUE                  TxedBuffersQueue;
 } NIC_DATA_INSTANCE;
@@ -163,6 +223,49 @@ NetvscReceive(
     OUT     UINT16                        *Protocol OPTIONAL
     );
 
+EFI_STATUS
+NetvscOidRequest(
+    IN      NIC_DATA_INSTANCE   *AdapterInfo,
+    IN      UINT32              NdisMessageType,
+    IN      UINT32              Oid,
+    IN      VOID                *InformationBuffer OPTIONAL,
+    IN      UINT32              InformationBufferLength,
+    OUT     VOID                *Response OPTIONAL,
+    IN OUT  UINT32              *ResponseLength OPTIONAL
+    );
+
+EFI_STATUS
+NetvscQueryMtu(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    );
+
+EFI_STATUS
+NetvscSetOffloadParameters(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    );
+
+EFI_STATUS
+NetvscAllocateSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    );
+
+VOID
+EFIAPI
+NetvscSubChannelOfferNotify(
+    IN  EFI_EVENT   Event,
+    IN  VOID        *Context
+    );
+
+VOID
+NetvscOpenSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    );
+
+VOID
+NetvscCloseSubChannels(
+    IN  NIC_DATA_INSTANCE *AdapterInfo
+    );
+
 VOID
 NetvscResetStatistics(
     IN  NIC_DATA_INSTANCE *AdapterInfo
@@ -206,6 +309,30 @@ RxQueueDequeue(
     OUT RX_PACKET_INSTANCE      *PacketInfo
     );
 
+EFI_STATUS
+RxTransferPacketPoolInit(
+    IN  RX_TRANSFER_PACKET_POOL *Pool,
+    IN  UINT32                  Length
+    );
+
+VOID
+RxTransferPacketPoolDestroy(
+    IN  RX_TRANSFER_PACKET_POOL *Pool
+    );
+
+RX_TRANSFER_PACKET *
+RxTransferPacketAcquire(
+    IN  RX_TRANSFER_PACKET_POOL *Pool,
+    IN  EFI_EMCL_PROTOCOL       *Emcl,
+    IN  VOID                    *PacketContext
+    );
+
+VOID
+RxTransferPacketRelease(
+    IN  NIC_DATA_INSTANCE       *AdapterInfo,
+    IN  RX_TRANSFER_PACKET      *TransferPacket
+    );
+
 EFI_STATUS
 TxQueueInit(
     IN  TX_QUEUE    *Queue,
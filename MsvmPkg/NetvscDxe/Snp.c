@@ -543,6 +543,8 @@ Return Value:
 
     adapterContext->ControllerHandle = ControllerHandle;
     adapterContext->BaseDevPath = BaseDevicePath;
+    adapterContext->NicInfo.DriverBindingHandle = This->DriverBindingHandle;
+    adapterContext->NicInfo.BaseDevPath = BaseDevicePath;
 
     if (EFI_ERROR(status))
     {
@@ -602,7 +604,9 @@ Return Value:
     snpDriver->Mode.State               = EfiSimpleNetworkStopped;
     snpDriver->Mode.HwAddressSize       = PXE_HWADDR_LEN_ETHER;
     snpDriver->Mode.MediaHeaderSize     = PXE_MAC_HEADER_LEN_ETHER;
-    snpDriver->Mode.MaxPacketSize       = MAXIMUM_ETHERNET_PACKET_SIZE;
+    // MS_HYP_CHANGE - Upper bound until the MTU is negotiated with the VSP in PxeInit,
+    // so that consumers size their receive buffers for jumbo frames.
+    snpDriver->Mode.MaxPacketSize       = PcdGet32 (PcdNetvscMtu) + PXE_MAC_HEADER_LEN_ETHER;
     snpDriver->Mode.NvRamAccessSize     = 0;
     snpDriver->Mode.NvRamSize           = 0;
     snpDriver->Mode.IfType              = PXE_IFTYPE_ETHERNET;
@@ -40,7 +40,12 @@ typedef UINT32                                  *PRNDIS_MEDIUM;
 // General Objects
 //
 
+#define RNDIS_OID_GEN_MAXIMUM_FRAME_SIZE                0x00010106
 #define RNDIS_OID_GEN_CURRENT_PACKET_FILTER             0x0001010E
+#define RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES        0x00010203
+#define RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS          0x00010204
+#define RNDIS_OID_TCP_OFFLOAD_PARAMETERS                0xFC01020C
+#define RNDIS_OID_TCP_OFFLOAD_HARDWARE_CAPABILITIES     0xFC01020F
 
 //
 // 802.3 Objects (Ethernet)
@@ -511,6 +516,161 @@ typedef struct _RNDIS_MESSAGE
 
 
 
+//
+// NDIS object header used by the NDIS 6 OID information buffers
+//
+typedef struct _NDIS_OBJECT_HEADER
+{
+    UINT8                                   Type;
+    UINT8                                   Revision;
+    UINT16                                  Size;
+} NDIS_OBJECT_HEADER, *PNDIS_OBJECT_HEADER;
+
+#define NDIS_OBJECT_TYPE_DEFAULT                    0x80
+#define NDIS_OBJECT_TYPE_RSS_CAPABILITIES           0x88
+#define NDIS_OBJECT_TYPE_RSS_PARAMETERS             0x89
+#define NDIS_OBJECT_TYPE_OFFLOAD                    0xA7
+
+//
+// Receive side scaling (vRSS)
+//
+#define NDIS_RECEIVE_SCALE_CAPABILITIES_REVISION_2  2
+#define NDIS_RECEIVE_SCALE_PARAMETERS_REVISION_2    2
+
+#define NDIS_HASH_FUNCTION_TOEPLITZ                 0x00000001
+#define NDIS_HASH_IPV4                              0x00000100
+#define NDIS_HASH_TCP_IPV4                          0x00000200
+#define NDIS_HASH_IPV6                              0x00000400
+#define NDIS_HASH_TCP_IPV6                          0x00001000
+
+#define NDIS_RSS_INDIRECTION_TABLE_MAX_SIZE_REVISION_2  128
+#define NDIS_RSS_HASH_SECRET_KEY_MAX_SIZE_REVISION_2    40
+
+typedef struct _NDIS_RECEIVE_SCALE_CAPABILITIES
+{
+    NDIS_OBJECT_HEADER                      Header;
+    UINT32                                  CapabilitiesFlags;
+    UINT32                                  NumberOfInterruptMessages;
+    UINT32                                  NumberOfReceiveQueues;
+    UINT16                                  NumberOfIndirectionTableEntries;
+    UINT16                                  Reserved;
+} NDIS_RECEIVE_SCALE_CAPABILITIES, *PNDIS_RECEIVE_SCALE_CAPABILITIES;
+
+//
+// The indirection table and the hash secret key follow the parameters in
+// the same information buffer. Each indirection table entry is the index
+// of the channel that receives the traffic hashed to it.
+//
+typedef struct _NDIS_RECEIVE_SCALE_PARAMETERS
+{
+    NDIS_OBJECT_HEADER                      Header;
+    UINT16                                  Flags;
+    UINT16                                  BaseCpuNumber;
+    UINT32                                  HashInformation;
+    UINT16                                  IndirectionTableSize;
+    UINT16                                  Reserved0;
+    UINT32                                  IndirectionTableOffset;
+    UINT16                                  HashSecretKeySize;
+    UINT16                                  Reserved1;
+    UINT32                                  HashSecretKeyOffset;
+    UINT32                                  ProcessorMasksOffset;
+    UINT32                                  NumberOfProcessorMasks;
+    UINT32                                  ProcessorMasksEntrySize;
+} NDIS_RECEIVE_SCALE_PARAMETERS, *PNDIS_RECEIVE_SCALE_PARAMETERS;
+
+//
+// Task offload (RNDIS_OID_TCP_OFFLOAD_PARAMETERS)
+//
+#define NDIS_OFFLOAD_PARAMETERS_REVISION_3          3
+
+#define NDIS_OFFLOAD_PARAMETERS_NO_CHANGE           0
+#define NDIS_OFFLOAD_PARAMETERS_TX_RX_DISABLED      1
+#define NDIS_OFFLOAD_PARAMETERS_TX_ENABLED_RX_DISABLED  2
+#define NDIS_OFFLOAD_PARAMETERS_RX_ENABLED_TX_DISABLED  3
+#define NDIS_OFFLOAD_PARAMETERS_TX_RX_ENABLED       4
+
+typedef struct _NDIS_OFFLOAD_PARAMETERS
+{
+    NDIS_OBJECT_HEADER                      Header;
+    UINT8                                   IPv4Checksum;
+    UINT8                                   TCPIPv4Checksum;
+    UINT8                                   UDPIPv4Checksum;
+    UINT8                                   TCPIPv6Checksum;
+    UINT8                                   UDPIPv6Checksum;
+    UINT8                                   LsoV1;
+    UINT8                                   IPsecV1;
+    UINT8                                   LsoV2IPv4;
+    UINT8                                   LsoV2IPv6;
+    UINT8                                   TcpConnectionIPv4;
+    UINT8                                   TcpConnectionIPv6;
+    UINT32                                  Flags;
+    UINT8                                   IPsecV2;
+    UINT8                                   IPsecV2IPv4;
+    UINT8                                   RscIPv4;
+    UINT8                                   RscIPv6;
+    UINT8                                   EncapsulatedPacketTaskOffload;
+    UINT8                                   EncapsulationTypes;
+} NDIS_OFFLOAD_PARAMETERS, *PNDIS_OFFLOAD_PARAMETERS;
+
+//
+// Offload capabilities (RNDIS_OID_TCP_OFFLOAD_HARDWARE_CAPABILITIES). Each
+// checksum capability word is a set of two-bit fields, of which only the
+// NDIS_OFFLOAD_SUPPORTED bit is used here.
+//
+#define NDIS_OFFLOAD_REVISION_1                     1
+
+#define NDIS_OFFLOAD_CSUM_TCP_SUPPORTED             0x00000010
+#define NDIS_OFFLOAD_CSUM_UDP_SUPPORTED             0x00000040
+#define NDIS_OFFLOAD_CSUM_IP_SUPPORTED              0x00000100
+
+typedef struct _NDIS_TCP_IP_CHECKSUM_OFFLOAD
+{
+    UINT32                                  IPv4TransmitEncapsulation;
+    UINT32                                  IPv4Transmit;
+    UINT32                                  IPv4ReceiveEncapsulation;
+    UINT32                                  IPv4Receive;
+    UINT32                                  IPv6TransmitEncapsulation;
+    UINT32                                  IPv6Transmit;
+    UINT32                                  IPv6ReceiveEncapsulation;
+    UINT32                                  IPv6Receive;
+} NDIS_TCP_IP_CHECKSUM_OFFLOAD, *PNDIS_TCP_IP_CHECKSUM_OFFLOAD;
+
+//
+// Revision 1 layout. The LSOv1, IPsecV1 and LSOv2 capabilities and the
+// flags that follow the checksum capabilities are not used.
+//
+typedef struct _NDIS_OFFLOAD
+{
+    NDIS_OBJECT_HEADER                      Header;
+    NDIS_TCP_IP_CHECKSUM_OFFLOAD            Checksum;
+    UINT8                                   Unused[84];
+} NDIS_OFFLOAD, *PNDIS_OFFLOAD;
+
+//
+// Per-packet information carried by RNDIS_PACKET. The offset of the data is
+// relative to the beginning of the RNDIS_PER_PACKET_INFO.
+//
+#define RNDIS_PPI_TCPIP_CHECKSUM                    0
+
+typedef struct _RNDIS_PER_PACKET_INFO
+{
+    UINT32                                  Size;
+    UINT32                                  Type;
+    UINT32                                  PerPacketInformationOffset;
+} RNDIS_PER_PACKET_INFO, *PRNDIS_PER_PACKET_INFO;
+
+//
+// NDIS_TCP_IP_CHECKSUM_PACKET_INFO, received with indicated packets.
+//
+#define NDIS_TCPIP_CSUM_RX_TCP_FAILED               0x00000001
+#define NDIS_TCPIP_CSUM_RX_UDP_FAILED               0x00000002
+#define NDIS_TCPIP_CSUM_RX_IP_FAILED                0x00000004
+#define NDIS_TCPIP_CSUM_RX_TCP_SUCCEEDED            0x00000008
+#define NDIS_TCPIP_CSUM_RX_UDP_SUCCEEDED            0x00000010
+#define NDIS_TCPIP_CSUM_RX_IP_SUCCEEDED             0x00000020
+#define NDIS_TCPIP_CSUM_RX_FAILED_MASK              0x00000007
+#define NDIS_TCPIP_CSUM_RX_STATUS_MASK              0x0000003F
+
 //
 // Handy macros
 
@@ -10,6 +10,7 @@ from edk2toolext.invocables.edk2_platform_build import BuildSettingsManager
 from edk2toolext.invocables.edk2_setup import SetupSettingsManager
 from edk2toolext.invocables.edk2_update import UpdateSettingsManager
 from edk2toollib.utility_functions import GetHostInfo
+from edk2toollib.utility_functions import RunCmd
 from edk2toolext.invocables.edk2_setup import RequiredSubmodule
 
 #
@@ -59,10 +60,20 @@ class PlatformBuilder(UefiBuilder, UpdateSettingsManager, SetupSettingsManager,
         self.env.SetValue("BLD_*_BUILD_APPS", "FALSE", "App Build off by default")
         self.env.SetValue("PE_VALIDATION_PATH", self.edk2path.GetAbsolutePathOnThisSystemFromEdk2RelativePath("MsvmPkg", "image_validation.cfg"), "Image validation ignore list")
 
+        #
+        # Build and run the host based unit tests and benchmarks by using
+        # HOST_TEST=TRUE with PlatformBuild.py
+        #
+        if self.env.GetValue("HOST_TEST", "FALSE").upper() == "TRUE":
+            logging.debug("PlatformBuilder building host tests")
+            self.env.SetValue("ACTIVE_PLATFORM", "MsvmPkg/Test/MsvmPkgHostTest.dsc", "Platform Hardcoded")
+            self.env.SetValue("TARGET_ARCH", "X64", "Platform Hardcoded")
+            self.env.SetValue("ARCH", "X64", "Platform hardcoded")
+            self.env.SetValue("BLD_*_BUILD_UNIT_TESTS", "TRUE", "Host tests")
         #
         # Build AARCH64 by using BUILD_ARCH=AARCH64 with PlatformBuild.py
         #
-        if self.env.GetValue("BUILD_ARCH") == "AARCH64":
+        elif self.env.GetValue("BUILD_ARCH") == "AARCH64":
             logging.debug("PlatformBuilder building AARCH64")
             self.env.SetValue("ACTIVE_PLATFORM", "MsvmPkg/MsvmPkgAARCH64.dsc", "Platform Hardcoded")
             self.env.SetValue("TARGET_ARCH", "AARCH64", "Platform Hardcoded")
@@ -87,7 +98,24 @@ class PlatformBuilder(UefiBuilder, UpdateSettingsManager, SetupSettingsManager,
         return 0
 
     def PlatformPostBuild(self):
-        return 0
+        if self.env.GetValue("HOST_TEST", "FALSE").upper() != "TRUE":
+            return 0
+
+        #
+        # Run every host test. Each one returns non-zero when a test or a
+        # benchmark budget fails.
+        #
+        outputDir = os.path.join(self.env.GetValue("BUILD_OUTPUT_BASE"), "X64")
+        failures = 0
+        for name in sorted(os.listdir(outputDir)):
+            if not name.endswith(("Host", "Host.exe")):
+                continue
+            logging.info("Running host test " + name)
+            if RunCmd(os.path.join(outputDir, name), "", workingdir=outputDir) != 0:
+                logging.error("Host test " + name + " failed")
+                failures += 1
+
+        return failures
 
 
     #------------------------------------------------------------------
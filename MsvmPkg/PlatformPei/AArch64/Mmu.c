@@ -197,22 +197,28 @@ GetBlockEntryListFromAddress(
     // Get the Table info from T0SZ
     GetRootTranslationTableInfo(T0SZ, &RootTableLevel, &RootTableEntryCount);
 
-    // If the start address is 0x0 then we use the size of the region to identify the alignment
+    // Identify the Page Level the RegionStart must belong to. Block translations are
+    // not supported at level 0, so any RegionStart aligned to 1GB or more, including
+    // 0x0, starts with a level 1 block. Clamp before computing the level, which
+    // would underflow for RegionStart aligned to 256TB (2^48) or more.
     if (RegionStart == 0)
     {
-        // Identify the highest possible alignment for the Region Size
-        BaseAddressAlignment = LowBitSet64(*BlockEntrySize);
+        PageLevel = 1;
     }
     else
     {
         // Identify the highest possible alignment for the Base Address
         BaseAddressAlignment = LowBitSet64(RegionStart);
+        if (BaseAddressAlignment >= TT_ADDRESS_OFFSET_AT_LEVEL(1))
+        {
+            PageLevel = 1;
+        }
+        else
+        {
+            PageLevel = 3 - ((BaseAddressAlignment - 12) / 9);
+        }
     }
 
-    // Identify the Page Level the RegionStart must belong to. Note that PageLevel
-    // should be at least 1 since block translations are not supported at level 0
-    PageLevel = MAX(3 - ((BaseAddressAlignment - 12) / 9), 1);
-
     // If the required size is smaller than the current block size then we need to go to the page below.
     // The PageLevel was calculated on the Base Address alignment but did not take in account the alignment
     // of the allocation size
@@ -23,6 +23,7 @@
 #include <IsolationTypes.h>
 #include "Hv.h"
 #include "Config.h"
+#include "MemoryMap.h"
 #include <Guid/DxeMemoryProtectionSettings.h>
 #include <UefiConstants.h>
 #include <Hob.h>
@@ -30,6 +31,7 @@
 #include <Library/HobLib.h>
 #include <Library/SafeIntLib.h>
 #include <AcpiReplacementTable.h>
+#include <ConfigBlobIndex.h>
 #include "AllowNamelessAggregate.h"
 #include "AssignStruct.h"
 
@@ -1152,9 +1154,51 @@ Return Value:
     return EFI_SUCCESS;
 }
 
+VOID
+ConfigBlobIndexAdd(
+    IN OUT  CONFIG_BLOB_INDEX*  Index,
+    IN      UEFI_CONFIG_HEADER* Header
+    )
+/*++
+
+Routine Description:
+
+    Records a validated config structure in the config blob index. Only the
+    first structure of each type is located by the index; later ones are
+    counted.
+
+Arguments:
+
+    Index - The config blob index being built.
+
+    Header - A pointer to the header of a validated config structure.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    CONFIG_BLOB_INDEX_ENTRY *entry;
+
+    if (Header->Type >= CONFIG_BLOB_INDEX_ENTRY_COUNT)
+    {
+        return;
+    }
+
+    entry = &Index->Entries[Header->Type];
+    if (entry->Count == 0)
+    {
+        entry->Offset = (UINT32)((UINT64)Header - Index->BlobBase);
+        entry->Length = Header->Length;
+    }
+
+    entry->Count++;
+}
+
 EFI_STATUS
 GetUefiConfigInfo(
-    VOID
+    OUT CONFIG_BLOB_INDEX*  BlobIndex
     )
 /*++
 
@@ -1166,7 +1210,7 @@ Routine Description:
 
 Arguments:
 
-    None.
+    BlobIndex - Returns the index of the validated config blob.
 
 Return Value:
 
@@ -1241,6 +1285,16 @@ Return Value:
 
     PEI_FAIL_FAST_IF_FAILED(PcdSet32S(PcdConfigBlobSize, configCount->TotalConfigBlobSize));
 
+    //
+    // Index each structure as it is validated so that DXE can look up any
+    // structure type without walking the blob again.
+    //
+    ZeroMem(BlobIndex, sizeof(*BlobIndex));
+    BlobIndex->BlobBase = (UINT64)header;
+    BlobIndex->BlobSize = configCount->TotalConfigBlobSize;
+    BlobIndex->EntryCount = CONFIG_BLOB_INDEX_ENTRY_COUNT;
+    ConfigBlobIndexAdd(BlobIndex, header);
+
     //
     // Advance past initial header to other structures.
     //
@@ -1267,6 +1321,7 @@ Return Value:
         }
 
         DebugDumpUefiConfigStruct(header);
+        ConfigBlobIndexAdd(BlobIndex, header);
 
         switch(header->Type)
         {
@@ -1685,6 +1740,50 @@ Return Value:
     return EFI_SUCCESS;
 }
 
+
+VOID
+NormalizeConfigMemoryMap(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Sorts and coalesces the memory map in place, so that resource HOB
+    creation in PEI and the SMBIOS memory structures in DXE both consume the
+    compact table. The SRAT is only used to keep ranges of different NUMA
+    nodes from being merged; the nodes themselves are not recorded.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    MEMORY_MAP_NORMALIZE_STATS stats;
+    UINT32 memoryMapSize;
+
+    memoryMapSize = PcdGet32(PcdMemoryMapSize);
+
+    NormalizeMemoryMap(PcdGetBool(PcdLegacyMemoryMap),
+                       (VOID*)(UINTN)PcdGet64(PcdMemoryMapPtr),
+                       &memoryMapSize,
+                       FindAcpiReplacementTable(EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE),
+                       NULL,
+                       &stats);
+
+    PEI_FAIL_FAST_IF_FAILED(PcdSet32S(PcdMemoryMapSize, memoryMapSize));
+
+    DEBUG((DEBUG_VERBOSE, "Memory map normalization: %lu comparisons, %lu moves, %lu SRAT searches\n",
+        stats.Comparisons,
+        stats.Moves,
+        stats.SratLookups));
+}
+
 EFI_STATUS
 GetConfiguration(
     IN CONST    EFI_PEI_SERVICES**  PeiServices,
@@ -1708,6 +1807,8 @@ Return Value:
 
 --*/
 {
+    CONFIG_BLOB_INDEX blobIndex;
+    BOOLEAN hasBlob;
     EFI_STATUS status;
 
     //
@@ -1717,11 +1818,13 @@ Return Value:
     //
     if (IsHardwareIsolatedNoParavisor())
     {
+        hasBlob = FALSE;
         status = GetIgvmConfigInfo();
     }
     else
     {
-        status = GetUefiConfigInfo();
+        hasBlob = TRUE;
+        status = GetUefiConfigInfo(&blobIndex);
     }
 
     //
@@ -1733,6 +1836,19 @@ Return Value:
         return status;
     }
 
+    NormalizeConfigMemoryMap();
+
+    //
+    // Every structure has been validated; publish the index for DXE. The
+    // memory map structure now ends at the normalized map.
+    //
+    if (hasBlob)
+    {
+        blobIndex.Entries[UefiConfigMemoryMap].Length =
+            sizeof(UEFI_CONFIG_HEADER) + PcdGet32(PcdMemoryMapSize);
+        BuildGuidDataHob(&gMsvmConfigBlobIndexHobGuid, &blobIndex, sizeof(blobIndex));
+    }
+
     //
     // Get the address width.
     //
@@ -158,6 +158,107 @@ Return Value:
 }
 
 
+static
+VOID
+HobpAddSystemMemoryRange(
+    IN OUT  PPLATFORM_INIT_CONTEXT      Context,
+            EFI_PHYSICAL_ADDRESS        BaseAddress,
+            UINT64                      Size,
+            EFI_RESOURCE_ATTRIBUTE_TYPE Attributes,
+            CONST CHAR16                *Description
+    )
+/*++
+
+Routine Description:
+
+    Adds a system memory range hob to the current hob list, accepting the
+    memory first where that is required.
+
+    On hardware isolated platforms with no paravisor, only the part of the
+    range below PcdEagerAcceptMemoryLimit is accepted here. The rest is
+    reported as unaccepted memory, which the DXE core accepts through
+    EDKII_MEMORY_ACCEPT_PROTOCOL when it first allocates from it, and which
+    is otherwise left for the OS to accept. This keeps firmware start time
+    independent of the VM memory size. EfiHvDxe accepts what is left at
+    ExitBootServices for an OS that cannot accept memory itself.
+
+Arguments:
+
+    Context - The platform init context.
+
+    BaseAddress - Base address of the memory range.
+
+    Size - Size of the memory range.
+
+    Attributes - Resource attributes of the accepted part of the range.
+
+    Description - Description used for debug output.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT64 acceptedLimit;
+    UINT64 acceptedSize;
+
+    ASSERT((BaseAddress % EFI_PAGE_SIZE) == 0);
+    ASSERT((Size % EFI_PAGE_SIZE) == 0);
+
+    acceptedSize = Size;
+
+    if (IsHardwareIsolatedNoParavisor())
+    {
+        //
+        // PEI memory, and so the DXE core, is always placed below 4 GB and
+        // must be accepted before it is used.
+        //
+        acceptedLimit = MAX(PcdGet64(PcdEagerAcceptMemoryLimit), BASE_4GB);
+        if (BaseAddress >= acceptedLimit)
+        {
+            acceptedSize = 0;
+        }
+        else if (Size > acceptedLimit - BaseAddress)
+        {
+            acceptedSize = acceptedLimit - BaseAddress;
+        }
+    }
+
+    if (acceptedSize != 0)
+    {
+        HobpAcceptRamPages(Context, BaseAddress / EFI_PAGE_SIZE, acceptedSize / EFI_PAGE_SIZE);
+
+        BuildResourceDescriptorHob(EFI_RESOURCE_SYSTEM_MEMORY,
+                                   Attributes,
+                                   BaseAddress,
+                                   acceptedSize);
+        DEBUG((DEBUG_VERBOSE,
+               "HOB Start % 17lx End %17lx %s\n",
+               BaseAddress,
+               BaseAddress + acceptedSize - 1,
+               Description));
+    }
+
+    if (acceptedSize != Size)
+    {
+        //
+        // The DXE core only adds unaccepted memory that is described as
+        // tested, regardless of how the accepted part is described.
+        //
+        BuildResourceDescriptorHob(EFI_RESOURCE_MEMORY_UNACCEPTED,
+                                   MEMORY_FLAGS,
+                                   BaseAddress + acceptedSize,
+                                   Size - acceptedSize);
+        DEBUG((DEBUG_VERBOSE,
+               "HOB Start % 17lx End %17lx %s\n",
+               BaseAddress + acceptedSize,
+               BaseAddress + Size - 1,
+               L"Unaccepted Memory"));
+    }
+}
+
+
 void
 HobAddMemoryRange(
     IN OUT  PPLATFORM_INIT_CONTEXT  Context,
@@ -184,20 +285,7 @@ Return Value:
 
 --*/
 {
-    ASSERT((BaseAddress % EFI_PAGE_SIZE) == 0);
-    ASSERT((Size % EFI_PAGE_SIZE) == 0);
-
-    HobpAcceptRamPages(Context, BaseAddress / EFI_PAGE_SIZE, Size / EFI_PAGE_SIZE);
-
-    BuildResourceDescriptorHob(EFI_RESOURCE_SYSTEM_MEMORY,
-                               MEMORY_FLAGS,
-                               BaseAddress,
-                               Size);
-    DEBUG((DEBUG_VERBOSE,
-           "HOB Start % 17lx End %17lx %s\n",
-           BaseAddress,
-           BaseAddress + Size - 1,
-           L"Memory"));
+    HobpAddSystemMemoryRange(Context, BaseAddress, Size, MEMORY_FLAGS, L"Memory");
 }
 
 
@@ -329,20 +417,11 @@ Return Value:
 
 --*/
 {
-    ASSERT((BaseAddress % EFI_PAGE_SIZE) == 0);
-    ASSERT((Size % EFI_PAGE_SIZE) == 0);
-
-    HobpAcceptRamPages(Context, BaseAddress / EFI_PAGE_SIZE, Size / EFI_PAGE_SIZE);
-
-    BuildResourceDescriptorHob(EFI_RESOURCE_SYSTEM_MEMORY,
-                               MEMORY_FLAGS & ~EFI_RESOURCE_ATTRIBUTE_TESTED,
-                               BaseAddress,
-                               Size);
-    DEBUG((DEBUG_VERBOSE,
-           "HOB Start % 17lx End %17lx %s\n",
-           BaseAddress,
-           BaseAddress + Size - 1,
-           L"Untested Memory"));
+    HobpAddSystemMemoryRange(Context,
+                             BaseAddress,
+                             Size,
+                             MEMORY_FLAGS & ~EFI_RESOURCE_ATTRIBUTE_TESTED,
+                             L"Untested Memory");
 }
 
 
@@ -15,6 +15,8 @@
 #include <Library/CrashDumpAgentLib.h>
 #include <Library/PcdLib.h>
 #include <Library/HvHypercallLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include "MsCpuid.h"
 #include "StaticAssert1.h"
 
@@ -238,6 +240,92 @@ Return Value:
     }
 }
 
+#if defined(MDE_CPU_X64)
+
+VOID
+HvEnableReferenceTsc(
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    Places the hypervisor reference TSC page so that HvTimerLib can compute
+    the reference time from the TSC instead of reading the reference time
+    counter, which is intercepted on every read.
+
+    The page is reserved memory because the overlay stays in place until the
+    OS moves it; once moved, the zeroed page below reads as invalid and
+    HvTimerLib falls back to the counter.
+
+    X64 only; AARCH64 builds use ArmArchTimerLib rather than HvTimerLib.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    HV_CPUID_RESULT cpuidResult;
+    HV_REFERENCE_TSC_MSR_CONTENTS referenceTsc;
+    VOID *page;
+
+    if (!PcdGetBool(PcdHvEnabled))
+    {
+        return;
+    }
+
+    //
+    // Hardware isolated VMs cannot share an overlay page with the hypervisor.
+    //
+    if (IsHardwareIsolated())
+    {
+        return;
+    }
+
+    MsCpuid(cpuidResult.AsUINT32, HvCpuIdFunctionVersionAndFeatures);
+    if (!cpuidResult.VersionAndFeatures.HypervisorPresent)
+    {
+        return;
+    }
+
+    MsCpuid(cpuidResult.AsUINT32, HvCpuIdFunctionHvInterface);
+    if (cpuidResult.HvInterface.Interface != HvMicrosoftHypervisorInterface)
+    {
+        return;
+    }
+
+    MsCpuid(cpuidResult.AsUINT32, HvCpuIdFunctionMsHvFeatures);
+    if (!cpuidResult.MsHvFeatures.PartitionPrivileges.AccessPartitionReferenceTsc)
+    {
+        DEBUG((DEBUG_INFO, "%a - Reference TSC page is not available\n", __func__));
+        return;
+    }
+
+    page = AllocateReservedPages(1);
+    if (page == NULL)
+    {
+        DEBUG((DEBUG_ERROR, "%a - Failed to allocate the reference TSC page\n", __func__));
+        return;
+    }
+
+    ZeroMem(page, EFI_PAGE_SIZE);
+
+    referenceTsc.AsUINT64 = 0;
+    referenceTsc.Enable = 1;
+    referenceTsc.GpaPageNumber = (UINTN)page >> EFI_PAGE_SHIFT;
+
+    AsmWriteMsr64(HV_X64_MSR_REFERENCE_TSC, referenceTsc.AsUINT64);
+
+    DEBUG((DEBUG_VERBOSE, "%a - Reference TSC page at %p\n", __func__, page));
+}
+
+#endif
+
 VOID
 HvDetectSvsm(
     IN  PSNP_SECRETS    SecretsPage,
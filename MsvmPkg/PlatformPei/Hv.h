@@ -22,6 +22,15 @@ HvDetectDmaPinningRequired(
     VOID
     );
 
+#if defined(MDE_CPU_X64)
+
+VOID
+HvEnableReferenceTsc(
+    VOID
+    );
+
+#endif
+
 typedef struct _SNP_SECRETS {
     UINT8   Reserved[0x140];
     UINT64  SvsmBase;
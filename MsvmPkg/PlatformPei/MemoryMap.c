@@ -0,0 +1,484 @@
+/** @file
+  Memory map normalization.
+
+  The memory map from the loader is consumed range by range: PlatformPei
+  builds a resource HOB for each range, in temporary RAM, and
+  SmbiosPlatformDxe builds memory structures for each range. Large VMs with
+  many NUMA nodes, hot-add regions and persistent memory can describe their
+  memory with thousands of ranges, many of them adjacent. Sorting the map
+  and coalescing adjacent ranges of the same type and NUMA node once, in
+  place, keeps every later consumer proportional to the real shape of guest
+  memory.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiPei.h>
+#include <BiosInterface.h>
+#include <IndustryStandard/Acpi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include "MemoryMap.h"
+
+//
+// Affinity of a range that is not described by the SRAT.
+//
+#define MEMORY_MAP_NO_AFFINITY MAX_UINT64
+
+typedef struct _MEMORY_MAP_NORMALIZER
+{
+    UINT8*                                  Map;
+    UINT32                                  Stride;
+    UINT32                                  Count;
+    BOOLEAN                                 LegacyMemoryMap;
+    UINT8*                                  SratStart;
+    UINT8*                                  SratEnd;
+    EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE* SratHint;
+    MEMORY_MAP_NORMALIZE_STATS              Stats;
+} MEMORY_MAP_NORMALIZER, *PMEMORY_MAP_NORMALIZER;
+
+
+static
+PVM_MEMORY_RANGE
+MemoryMappRange(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer,
+    IN  UINT32                  Index
+    )
+/*++
+
+Routine Description:
+
+    Returns a range of the memory map. Both the legacy and version 5 formats
+    start with the base address and length.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+    Index - The index of the range.
+
+Return Value:
+
+    A pointer to the range.
+
+--*/
+{
+    return (PVM_MEMORY_RANGE)(Normalizer->Map + (UINTN)Index * Normalizer->Stride);
+}
+
+
+static
+UINT32
+MemoryMappFlags(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer,
+    IN  PVM_MEMORY_RANGE        Range
+    )
+/*++
+
+Routine Description:
+
+    Returns the flags of a range. Legacy ranges have no flags.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+    Range - The range.
+
+Return Value:
+
+    The VM_MEMORY_RANGE_FLAG_* flags of the range.
+
+--*/
+{
+    if (Normalizer->LegacyMemoryMap)
+    {
+        return 0;
+    }
+
+    return ((PVM_MEMORY_RANGE_V5)Range)->Flags;
+}
+
+
+static
+VOID
+MemoryMappSwap(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer,
+    IN  UINT32                  First,
+    IN  UINT32                  Second
+    )
+/*++
+
+Routine Description:
+
+    Exchanges two ranges of the memory map.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+    First - The index of the first range.
+
+    Second - The index of the second range.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT8 temp[sizeof(VM_MEMORY_RANGE_V5)];
+
+    CopyMem(temp, MemoryMappRange(Normalizer, First), Normalizer->Stride);
+    CopyMem(MemoryMappRange(Normalizer, First), MemoryMappRange(Normalizer, Second), Normalizer->Stride);
+    CopyMem(MemoryMappRange(Normalizer, Second), temp, Normalizer->Stride);
+    Normalizer->Stats.Moves += 1;
+}
+
+
+static
+VOID
+MemoryMappSiftDown(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer,
+    IN  UINT32                  Root,
+    IN  UINT32                  Count
+    )
+/*++
+
+Routine Description:
+
+    Restores the max-heap property, keyed on base address, below a range.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+    Root - The index of the range that may be out of place.
+
+    Count - The number of ranges in the heap.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT32 child;
+
+    while ((child = (2 * Root) + 1) < Count)
+    {
+        if (child + 1 < Count)
+        {
+            Normalizer->Stats.Comparisons += 1;
+            if (MemoryMappRange(Normalizer, child + 1)->BaseAddress >
+                MemoryMappRange(Normalizer, child)->BaseAddress)
+            {
+                child += 1;
+            }
+        }
+
+        Normalizer->Stats.Comparisons += 1;
+        if (MemoryMappRange(Normalizer, Root)->BaseAddress >=
+            MemoryMappRange(Normalizer, child)->BaseAddress)
+        {
+            return;
+        }
+
+        MemoryMappSwap(Normalizer, Root, child);
+        Root = child;
+    }
+}
+
+
+static
+VOID
+MemoryMappSort(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer
+    )
+/*++
+
+Routine Description:
+
+    Sorts the memory map by base address. Maps that are already sorted, which
+    is the common case, are detected in a single pass. Otherwise an in place
+    heap sort is used, as there is no memory to spare this early in PEI.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT32 index;
+
+    for (index = 1; index < Normalizer->Count; index++)
+    {
+        Normalizer->Stats.Comparisons += 1;
+        if (MemoryMappRange(Normalizer, index - 1)->BaseAddress >
+            MemoryMappRange(Normalizer, index)->BaseAddress)
+        {
+            break;
+        }
+    }
+
+    if (index >= Normalizer->Count)
+    {
+        return;
+    }
+
+    for (index = Normalizer->Count / 2; index > 0; index--)
+    {
+        MemoryMappSiftDown(Normalizer, index - 1, Normalizer->Count);
+    }
+
+    for (index = Normalizer->Count - 1; index > 0; index--)
+    {
+        MemoryMappSwap(Normalizer, 0, index);
+        MemoryMappSiftDown(Normalizer, 0, index);
+    }
+}
+
+
+static
+BOOLEAN
+MemoryMappSratContains(
+    IN  EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE* Affinity,
+    IN  UINT64                                  Address
+    )
+/*++
+
+Routine Description:
+
+    Determines whether an enabled SRAT memory affinity structure describes an
+    address.
+
+Arguments:
+
+    Affinity - The memory affinity structure.
+
+    Address - The address.
+
+Return Value:
+
+    TRUE if the structure describes the address.
+
+--*/
+{
+    UINT64 base;
+    UINT64 length;
+
+    if ((Affinity->Flags & EFI_ACPI_6_2_MEMORY_ENABLED) == 0)
+    {
+        return FALSE;
+    }
+
+    base = LShiftU64(Affinity->AddressBaseHigh, 32) | Affinity->AddressBaseLow;
+    length = LShiftU64(Affinity->LengthHigh, 32) | Affinity->LengthLow;
+
+    return (Address >= base) && (Address - base < length);
+}
+
+
+static
+UINT64
+MemoryMappAffinity(
+    IN  PMEMORY_MAP_NORMALIZER  Normalizer,
+    IN  UINT64                  Address
+    )
+/*++
+
+Routine Description:
+
+    Looks up the NUMA affinity of an address in the SRAT. The structure that
+    matched last time is tried first; ranges are visited in address order, so
+    consecutive ranges nearly always belong to the same structure.
+
+Arguments:
+
+    Normalizer - The normalization state.
+
+    Address - The address.
+
+Return Value:
+
+    The proximity domain in the low 32 bits, with bit 32 set for hot
+    pluggable memory, or MEMORY_MAP_NO_AFFINITY.
+
+--*/
+{
+    EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE* affinity;
+    UINT8* cursor;
+    UINT8 length;
+
+    if (Normalizer->SratStart == NULL)
+    {
+        return MEMORY_MAP_NO_AFFINITY;
+    }
+
+    affinity = Normalizer->SratHint;
+    if ((affinity == NULL) || !MemoryMappSratContains(affinity, Address))
+    {
+        affinity = NULL;
+        Normalizer->Stats.SratLookups += 1;
+
+        for (cursor = Normalizer->SratStart; cursor + 2 <= Normalizer->SratEnd; cursor += length)
+        {
+            length = cursor[1];
+            if ((length < 2) || (cursor + length > Normalizer->SratEnd))
+            {
+                break;
+            }
+
+            if ((cursor[0] == EFI_ACPI_6_2_MEMORY_AFFINITY) &&
+                (length >= sizeof(EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE)) &&
+                MemoryMappSratContains((EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE*)cursor, Address))
+            {
+                affinity = (EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE*)cursor;
+                break;
+            }
+        }
+
+        if (affinity == NULL)
+        {
+            return MEMORY_MAP_NO_AFFINITY;
+        }
+
+        Normalizer->SratHint = affinity;
+    }
+
+    return affinity->ProximityDomain |
+           (((affinity->Flags & EFI_ACPI_6_2_MEMORY_HOT_PLUGGABLE) != 0) ? BIT32 : 0);
+}
+
+
+VOID
+NormalizeMemoryMap(
+    IN      BOOLEAN                         LegacyMemoryMap,
+    IN OUT  VOID*                           MemoryMap,
+    IN OUT  UINT32*                         MemoryMapSize,
+    IN      EFI_ACPI_DESCRIPTION_HEADER*    Srat OPTIONAL,
+    OUT     UINT32*                         ProximityDomains OPTIONAL,
+    OUT     MEMORY_MAP_NORMALIZE_STATS*     Stats OPTIONAL
+    )
+/*++
+
+Routine Description:
+
+    Sorts the memory map by base address and coalesces adjacent ranges that
+    have the same flags and the same NUMA affinity in the SRAT, in place.
+
+    The ranges themselves are only moved and lengthened; every other field,
+    including the Reserved field of version 5 ranges, keeps the value the
+    host gave it.
+
+    Overlapping ranges are left as they are.
+
+Arguments:
+
+    LegacyMemoryMap - TRUE if the map uses VM_MEMORY_RANGE, FALSE if it uses
+        VM_MEMORY_RANGE_V5.
+
+    MemoryMap - The memory map.
+
+    MemoryMapSize - On input, the size of the memory map in bytes. On output,
+        the size of the normalized memory map.
+
+    Srat - The SRAT, if any.
+
+    ProximityDomains - If present, an array with an entry for every input
+        range. Returns the SRAT proximity domain of each output range, or
+        MEMORY_MAP_NO_PROXIMITY_DOMAIN if the SRAT does not describe it.
+
+    Stats - Returns statistics about the normalization.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    MEMORY_MAP_NORMALIZER normalizer;
+    PVM_MEMORY_RANGE current;
+    PVM_MEMORY_RANGE previous;
+    UINT64 affinity;
+    UINT64 previousAffinity;
+    UINT32 flags;
+    UINT32 previousFlags;
+    UINT32 read;
+    UINT32 write;
+
+    ZeroMem(&normalizer, sizeof(normalizer));
+    normalizer.Map = MemoryMap;
+    normalizer.LegacyMemoryMap = LegacyMemoryMap;
+    normalizer.Stride = LegacyMemoryMap ? sizeof(VM_MEMORY_RANGE) : sizeof(VM_MEMORY_RANGE_V5);
+    normalizer.Count = *MemoryMapSize / normalizer.Stride;
+    normalizer.Stats.InputRanges = normalizer.Count;
+
+    if ((Srat != NULL) &&
+        (Srat->Length > sizeof(EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER)))
+    {
+        normalizer.SratStart = (UINT8*)Srat + sizeof(EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER);
+        normalizer.SratEnd = (UINT8*)Srat + Srat->Length;
+    }
+
+    MemoryMappSort(&normalizer);
+
+    previous = NULL;
+    previousAffinity = MEMORY_MAP_NO_AFFINITY;
+    previousFlags = 0;
+    write = 0;
+
+    for (read = 0; read < normalizer.Count; read++)
+    {
+        current = MemoryMappRange(&normalizer, read);
+        flags = MemoryMappFlags(&normalizer, current);
+        affinity = MemoryMappAffinity(&normalizer, current->BaseAddress);
+
+        if ((previous != NULL) &&
+            (flags == previousFlags) &&
+            (affinity == previousAffinity) &&
+            (previous->Length <= MAX_UINT64 - previous->BaseAddress) &&
+            (previous->BaseAddress + previous->Length == current->BaseAddress) &&
+            (current->Length <= MAX_UINT64 - previous->Length))
+        {
+            previous->Length += current->Length;
+            continue;
+        }
+
+        previous = MemoryMappRange(&normalizer, write);
+        if (write != read)
+        {
+            CopyMem(previous, current, normalizer.Stride);
+            normalizer.Stats.Moves += 1;
+        }
+
+        if (ProximityDomains != NULL)
+        {
+            ProximityDomains[write] =
+                (affinity == MEMORY_MAP_NO_AFFINITY) ? MEMORY_MAP_NO_PROXIMITY_DOMAIN : (UINT32)affinity;
+        }
+
+        previousAffinity = affinity;
+        previousFlags = flags;
+        write += 1;
+    }
+
+    normalizer.Stats.OutputRanges = write;
+    *MemoryMapSize = write * normalizer.Stride;
+
+    DEBUG((DEBUG_INFO, "Memory map normalized from %u to %u ranges\n",
+        normalizer.Stats.InputRanges,
+        normalizer.Stats.OutputRanges));
+
+    if (Stats != NULL)
+    {
+        *Stats = normalizer.Stats;
+    }
+}
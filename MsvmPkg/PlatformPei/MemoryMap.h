@@ -0,0 +1,44 @@
+/** @file
+  Memory map normalization.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#pragma once
+
+#include <IndustryStandard/Acpi.h>
+
+//
+// Statistics from a normalization pass, used for logging and by the host
+// benchmark.
+//
+typedef struct _MEMORY_MAP_NORMALIZE_STATS
+{
+    UINT32  InputRanges;
+    UINT32  OutputRanges;
+    UINT64  Comparisons;
+    UINT64  Moves;
+    UINT64  SratLookups;
+} MEMORY_MAP_NORMALIZE_STATS;
+
+//
+// Proximity domain of a range that is not described by the SRAT.
+//
+#define MEMORY_MAP_NO_PROXIMITY_DOMAIN MAX_UINT32
+
+//
+// Sorts and coalesces the memory map in place. The ranges keep the host's
+// layout; the SRAT proximity domain of each output range can be returned in
+// a separate table.
+//
+VOID
+NormalizeMemoryMap(
+    IN      BOOLEAN                         LegacyMemoryMap,
+    IN OUT  VOID*                           MemoryMap,
+    IN OUT  UINT32*                         MemoryMapSize,
+    IN      EFI_ACPI_DESCRIPTION_HEADER*    Srat OPTIONAL,
+    OUT     UINT32*                         ProximityDomains OPTIONAL,
+    OUT     MEMORY_MAP_NORMALIZE_STATS*     Stats OPTIONAL
+    );
@@ -14,6 +14,7 @@
 #include <Hob.h>
 #include <Hv.h>
 #include <AcpiReplacementTable.h>
+#include <Guid/FirmwarePerformance.h>
 #include <Guid/MemoryTypeInformation.h>
 #include <IndustryStandard/Acpi.h>
 #include <IndustryStandard/MemoryMappedConfigurationSpaceAccessTable.h>
@@ -23,6 +24,7 @@
 #include <Library/HobLib.h>
 #include <Library/IoLib.h>
 #include <Library/DeviceStateLib.h>
+#include <Library/PerformanceLib.h>
 
 #if defined(MDE_CPU_AARCH64)
 #include <Mmu.h>
@@ -30,10 +32,12 @@
 #endif
 #if defined (MDE_CPU_X64)
 #include <Library/MtrrLib.h>
+#include <Register/Intel/Cpuid.h>
 #endif
 #include <Library/PeiServicesLib.h>
 #include <Library/ResourcePublicationLib.h>
 #include <Ppi/MasterBootMode.h>
+#include <Ppi/SecPerformance.h>
 #include <IsolationTypes.h>
 
 #if defined (MDE_CPU_X64)
@@ -197,7 +201,10 @@ GetPageTableSize(
 
 Routine Description:
 
-    Calculates the page table size.
+    Calculates the size of the identity mapped page tables that DxeIpl builds
+    from PEI memory. When the processor supports 1GB pages the page directory
+    pointer entries are leaves, so the tables cost one page per 512GB rather
+    than one page per 1GB.
 
 Arguments:
 
@@ -211,8 +218,8 @@ Return Value:
 {
     BOOLEAN pcdUse1GPageTable;
     BOOLEAN page1GSupport;
-    UINT32  regEax;
-    UINT32  regEdx;
+    UINT32  maximumFunction;
+    CPUID_EXTENDED_CPU_SIG_EDX extendedFeatures;
     UINT32  pml4Entries;
     UINT32  pdpEntries;
     UINTN   totalPages;
@@ -229,11 +236,11 @@ Return Value:
     DEBUG((DEBUG_VERBOSE, "PcdUse1GPageTable is %a\n", pcdUse1GPageTable ? "TRUE" : "FALSE" ));
     if (pcdUse1GPageTable)
     {
-        AsmCpuid(0x80000000, &regEax, NULL, NULL, NULL);
-        if (regEax >= 0x80000001)
+        AsmCpuid(CPUID_EXTENDED_FUNCTION, &maximumFunction, NULL, NULL, NULL);
+        if (maximumFunction >= CPUID_EXTENDED_CPU_SIG)
         {
-            AsmCpuid(0x80000001, NULL, NULL, NULL, &regEdx);
-            if ((regEdx & BIT26) != 0)
+            AsmCpuid(CPUID_EXTENDED_CPU_SIG, NULL, NULL, NULL, &extendedFeatures.Uint32);
+            if (extendedFeatures.Bits.Page1GB != 0)
             {
                 page1GSupport = TRUE;
             }
@@ -258,8 +265,13 @@ Return Value:
                                (pdpEntries + 1) * pml4Entries + 1;
     ASSERT(totalPages <= 0x40201);
 
-    DEBUG((DEBUG_VERBOSE, "<<< GetPageTableSize returning %ull\n",
-        (UINTN)EFI_PAGES_TO_SIZE(totalPages)));
+    DEBUG((DEBUG_INFO, "Identity map for %u address bits uses %a pages, %u page table pages\n",
+        PhysicalAddressWidth,
+        page1GSupport ? "1GB" : "2MB",
+        (UINT32)totalPages));
+
+    DEBUG((DEBUG_VERBOSE, "<<< GetPageTableSize returning 0x%lx\n",
+        (UINT64)EFI_PAGES_TO_SIZE(totalPages)));
 
     return (UINTN)(EFI_PAGES_TO_SIZE(totalPages));
 }
@@ -963,6 +975,56 @@ Return Value:
     AddDeviceState(deviceState);
 }
 
+VOID
+PublishSecPerformance(
+    IN CONST    EFI_PEI_SERVICES**  PeiServices
+    )
+/*++
+
+Routine Description:
+
+    Copies the SEC performance data into a HOB so that FirmwarePerformanceDxe
+    can fill in the reset end time of the FPDT basic boot record.
+
+Arguments:
+
+    PeiServices - An indirect pointer to the PEI Services Table.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PEI_SEC_PERFORMANCE_PPI *secPerformancePpi;
+    FIRMWARE_SEC_PERFORMANCE performance;
+    EFI_STATUS status;
+
+    //
+    // Only the X64 SEC produces the PPI.
+    //
+    status = PeiServicesLocatePpi(&gPeiSecPerformancePpiGuid,
+                                  0,
+                                  NULL,
+                                  (VOID**)&secPerformancePpi);
+    if (EFI_ERROR(status))
+    {
+        return;
+    }
+
+    status = secPerformancePpi->GetPerformance(PeiServices,
+                                               secPerformancePpi,
+                                               &performance);
+    if (EFI_ERROR(status))
+    {
+        return;
+    }
+
+    DEBUG((DEBUG_INFO, "SEC started %lu ns after partition creation\n", performance.ResetEnd));
+
+    HobAddGuidData(&gEfiFirmwarePerformanceGuid, &performance, sizeof(performance));
+}
+
 EFI_STATUS
 EFIAPI
 InitializePlatform(
@@ -1046,7 +1108,9 @@ Return Value:
     //
     // Get the configuration from the loader.
     //
+    PERF_INMODULE_BEGIN("GetConfiguration");
     status = GetConfiguration(PeiServices, &context.PhysicalAddressWidth);
+    PERF_INMODULE_END("GetConfiguration");
     if (EFI_ERROR(status))
     {
         ASSERT(FALSE);
@@ -1081,7 +1145,21 @@ Return Value:
     //
     // Init memory map before publishing any other HOBs.
     //
+    PERF_INMODULE_BEGIN("InitializeMemoryMap");
     InitializeMemoryMap(&context);
+    PERF_INMODULE_END("InitializeMemoryMap");
+
+    PublishSecPerformance(PeiServices);
+
+#if defined(MDE_CPU_X64)
+
+    //
+    // Place the reference TSC page so that later modules can read the time
+    // without an intercept. AARCH64 uses the architected timer instead.
+    //
+    HvEnableReferenceTsc();
+
+#endif
 
     //
     // Publish the FV HOB.
@@ -0,0 +1,398 @@
+/** @file
+    Host based benchmark of memory map normalization on very large NUMA VMs.
+
+    Builds synthetic memory maps of 10,000 ranges spread over 16 virtual NUMA
+    nodes, each with ordinary RAM, a persistent memory region and a hot-add
+    region, together with a matching SRAT. The maps are normalized in sorted
+    and shuffled order, in both the version 5 and legacy formats, and with
+    and without the SRAT. Each run is checked for correctness: the output is
+    sorted, covers the same bytes as the input, has exactly the expected
+    number of ranges and carries the right proximity domain. Comparison and
+    copy counts are held to a budget so that regressions show up in CI.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Uefi.h>
+#include <BiosInterface.h>
+#include <IndustryStandard/Acpi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UnitTestLib.h>
+#include "../MemoryMap.h"
+
+#define UNIT_TEST_APP_NAME     "Memory Map Normalization Benchmark"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Shape of the synthetic VM. Every range is 16 MB and the nodes are laid out
+// back to back above 4 GB, so only the SRAT separates neighbouring nodes.
+//
+#define BENCHMARK_NODE_COUNT            16
+#define BENCHMARK_RANGES_PER_NODE       625
+#define BENCHMARK_RANGE_COUNT           (BENCHMARK_NODE_COUNT * BENCHMARK_RANGES_PER_NODE)
+#define BENCHMARK_RANGE_SIZE            SIZE_16MB
+#define BENCHMARK_NODE_SIZE             ((UINT64)BENCHMARK_RANGES_PER_NODE * BENCHMARK_RANGE_SIZE)
+#define BENCHMARK_MEMORY_BASE           SIZE_4GB
+
+//
+// Ranges within each node, by index.
+//
+#define BENCHMARK_PERSISTENT_FIRST      200
+#define BENCHMARK_PERSISTENT_END        250
+#define BENCHMARK_HOT_ADD_FIRST         525
+
+typedef struct {
+    EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER          Header;
+    struct {
+        EFI_ACPI_6_2_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY_STRUCTURE  Processor;
+        EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE                      Memory;
+        EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE                      HotAdd;
+    } Nodes[BENCHMARK_NODE_COUNT];
+} BENCHMARK_SRAT;
+
+typedef struct {
+    CONST CHAR8     *Name;
+    BOOLEAN         LegacyMemoryMap;
+    BOOLEAN         Shuffle;
+    BOOLEAN         UseSrat;
+    UINT32          ExpectedRanges;
+} BENCHMARK_SCENARIO;
+
+//
+// Per node, with the SRAT: RAM, persistent memory, RAM and hot-add RAM.
+// Without the SRAT the hot-add RAM merges with the RAM before it and with
+// the first RAM of the next node. Legacy maps have no flags, so persistent
+// memory merges with the RAM around it.
+//
+STATIC CONST BENCHMARK_SCENARIO  mScenarios[] = {
+    { "V5-sorted",          FALSE, FALSE, TRUE,  4 * BENCHMARK_NODE_COUNT },
+    { "V5-shuffled",        FALSE, TRUE,  TRUE,  4 * BENCHMARK_NODE_COUNT },
+    { "V5-shuffled-nosrat", FALSE, TRUE,  FALSE, (3 * BENCHMARK_NODE_COUNT) - (BENCHMARK_NODE_COUNT - 1) },
+    { "Legacy-shuffled",    TRUE,  TRUE,  TRUE,  2 * BENCHMARK_NODE_COUNT },
+};
+
+STATIC BENCHMARK_SRAT  mSrat;
+STATIC UINT8           *mMemoryMap;
+STATIC UINT32          *mProximityDomains;
+
+
+/**
+  Return the next value of a fixed pseudo random sequence, so that every run
+  shuffles the same way.
+**/
+STATIC
+UINT32
+NextRandom (
+    IN OUT  UINT64  *State
+    )
+{
+    *State = (*State * 6364136223846793005ULL) + 1442695040888963407ULL;
+    return (UINT32)(*State >> 33);
+}
+
+
+/**
+  Return the base address of a range of a node.
+**/
+STATIC
+UINT64
+RangeBase (
+    IN  UINT32  Node,
+    IN  UINT32  Range
+    )
+{
+    return BENCHMARK_MEMORY_BASE + (Node * BENCHMARK_NODE_SIZE) + ((UINT64)Range * BENCHMARK_RANGE_SIZE);
+}
+
+
+/**
+  Fill in an SRAT memory affinity structure.
+**/
+STATIC
+VOID
+BuildMemoryAffinity (
+    OUT EFI_ACPI_6_2_MEMORY_AFFINITY_STRUCTURE  *Affinity,
+    IN  UINT32                                  Node,
+    IN  UINT64                                  Base,
+    IN  UINT64                                  Length,
+    IN  UINT32                                  Flags
+    )
+{
+    Affinity->Type            = EFI_ACPI_6_2_MEMORY_AFFINITY;
+    Affinity->Length          = sizeof (*Affinity);
+    Affinity->ProximityDomain = Node;
+    Affinity->AddressBaseLow  = (UINT32)Base;
+    Affinity->AddressBaseHigh = (UINT32)RShiftU64 (Base, 32);
+    Affinity->LengthLow       = (UINT32)Length;
+    Affinity->LengthHigh      = (UINT32)RShiftU64 (Length, 32);
+    Affinity->Flags           = Flags;
+}
+
+
+/**
+  Build the SRAT for the synthetic VM, with a processor affinity structure
+  ahead of the memory of each node.
+**/
+STATIC
+VOID
+BuildSrat (
+    VOID
+    )
+{
+    UINT32  Node;
+    UINT64  HotAddBase;
+
+    ZeroMem (&mSrat, sizeof (mSrat));
+    mSrat.Header.Header.Signature = EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE;
+    mSrat.Header.Header.Length    = sizeof (mSrat);
+    mSrat.Header.Header.Revision  = EFI_ACPI_6_2_SYSTEM_RESOURCE_AFFINITY_TABLE_REVISION;
+    mSrat.Header.Reserved1        = 1;
+
+    for (Node = 0; Node < BENCHMARK_NODE_COUNT; Node++) {
+        mSrat.Nodes[Node].Processor.Type                   = EFI_ACPI_6_2_PROCESSOR_LOCAL_APIC_SAPIC_AFFINITY;
+        mSrat.Nodes[Node].Processor.Length                 = sizeof (mSrat.Nodes[Node].Processor);
+        mSrat.Nodes[Node].Processor.ProximityDomain7To0    = (UINT8)Node;
+        mSrat.Nodes[Node].Processor.ApicId                 = (UINT8)Node;
+        mSrat.Nodes[Node].Processor.Flags                  = EFI_ACPI_6_2_PROCESSOR_LOCAL_APIC_SAPIC_ENABLED;
+
+        HotAddBase = RangeBase (Node, BENCHMARK_HOT_ADD_FIRST);
+        BuildMemoryAffinity (
+            &mSrat.Nodes[Node].Memory,
+            Node,
+            RangeBase (Node, 0),
+            HotAddBase - RangeBase (Node, 0),
+            EFI_ACPI_6_2_MEMORY_ENABLED
+            );
+        BuildMemoryAffinity (
+            &mSrat.Nodes[Node].HotAdd,
+            Node,
+            HotAddBase,
+            RangeBase (Node, BENCHMARK_RANGES_PER_NODE) - HotAddBase,
+            EFI_ACPI_6_2_MEMORY_ENABLED | EFI_ACPI_6_2_MEMORY_HOT_PLUGGABLE
+            );
+    }
+}
+
+
+/**
+  Build the memory map for a scenario and return its size in bytes.
+**/
+STATIC
+UINT32
+BuildMemoryMap (
+    IN  CONST BENCHMARK_SCENARIO  *Scenario
+    )
+{
+    VM_MEMORY_RANGE_V5  *Range;
+    UINT8               Temp[sizeof (VM_MEMORY_RANGE_V5)];
+    UINT32              Stride;
+    UINT32              Node;
+    UINT32              Index;
+    UINT32              Other;
+    UINT64              Seed;
+
+    Stride = Scenario->LegacyMemoryMap ? sizeof (VM_MEMORY_RANGE) : sizeof (VM_MEMORY_RANGE_V5);
+    ZeroMem (mMemoryMap, BENCHMARK_RANGE_COUNT * sizeof (VM_MEMORY_RANGE_V5));
+
+    for (Node = 0; Node < BENCHMARK_NODE_COUNT; Node++) {
+        for (Index = 0; Index < BENCHMARK_RANGES_PER_NODE; Index++) {
+            Range              = (VM_MEMORY_RANGE_V5 *)(mMemoryMap + (UINTN)((Node * BENCHMARK_RANGES_PER_NODE) + Index) * Stride);
+            Range->BaseAddress = RangeBase (Node, Index);
+            Range->Length      = BENCHMARK_RANGE_SIZE;
+            if (!Scenario->LegacyMemoryMap &&
+                (Index >= BENCHMARK_PERSISTENT_FIRST) &&
+                (Index < BENCHMARK_PERSISTENT_END))
+            {
+                Range->Flags = VM_MEMORY_RANGE_FLAG_PERSISTENT_MEMORY;
+            }
+        }
+    }
+
+    if (Scenario->Shuffle) {
+        Seed = 0x4d656d4d6170ULL;
+        for (Index = BENCHMARK_RANGE_COUNT - 1; Index > 0; Index--) {
+            Other = NextRandom (&Seed) % (Index + 1);
+            CopyMem (Temp, mMemoryMap + (UINTN)Index * Stride, Stride);
+            CopyMem (mMemoryMap + (UINTN)Index * Stride, mMemoryMap + (UINTN)Other * Stride, Stride);
+            CopyMem (mMemoryMap + (UINTN)Other * Stride, Temp, Stride);
+        }
+    }
+
+    return BENCHMARK_RANGE_COUNT * Stride;
+}
+
+
+/**
+  Normalize the memory map of each scenario, check the result and hold the
+  work done to a budget of a small multiple of n log n.
+**/
+STATIC
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkNormalize (
+    IN  UNIT_TEST_CONTEXT  Context
+    )
+{
+    CONST BENCHMARK_SCENARIO    *Scenario;
+    MEMORY_MAP_NORMALIZE_STATS  Stats;
+    VM_MEMORY_RANGE_V5          *Range;
+    VM_MEMORY_RANGE_V5          *Previous;
+    UINTN                       ScenarioIndex;
+    UINT32                      MemoryMapSize;
+    UINT32                      Stride;
+    UINT32                      Index;
+    UINT64                      TotalLength;
+    UINT64                      LogN;
+
+    LogN = HighBitSet32 (BENCHMARK_RANGE_COUNT) + 1;
+
+    for (ScenarioIndex = 0; ScenarioIndex < ARRAY_SIZE (mScenarios); ScenarioIndex++) {
+        Scenario      = &mScenarios[ScenarioIndex];
+        Stride        = Scenario->LegacyMemoryMap ? sizeof (VM_MEMORY_RANGE) : sizeof (VM_MEMORY_RANGE_V5);
+        MemoryMapSize = BuildMemoryMap (Scenario);
+
+        NormalizeMemoryMap (
+            Scenario->LegacyMemoryMap,
+            mMemoryMap,
+            &MemoryMapSize,
+            Scenario->UseSrat ? &mSrat.Header.Header : NULL,
+            mProximityDomains,
+            &Stats
+            );
+
+        DEBUG ((DEBUG_INFO,
+            "%a: %u ranges to %u, %lu comparisons, %lu moves, %lu SRAT searches\n",
+            Scenario->Name,
+            Stats.InputRanges,
+            Stats.OutputRanges,
+            Stats.Comparisons,
+            Stats.Moves,
+            Stats.SratLookups));
+
+        UT_ASSERT_EQUAL (Stats.InputRanges, BENCHMARK_RANGE_COUNT);
+        UT_ASSERT_EQUAL (Stats.OutputRanges, Scenario->ExpectedRanges);
+        UT_ASSERT_EQUAL (MemoryMapSize, Scenario->ExpectedRanges * Stride);
+
+        TotalLength = 0;
+        Previous    = NULL;
+        for (Index = 0; Index < Stats.OutputRanges; Index++) {
+            Range = (VM_MEMORY_RANGE_V5 *)(mMemoryMap + (UINTN)Index * Stride);
+            if (Previous != NULL) {
+                UT_ASSERT_TRUE (Previous->BaseAddress + Previous->Length <= Range->BaseAddress);
+            }
+
+            //
+            // The domain goes to the side table; the host's ranges are not
+            // tagged.
+            //
+            if (!Scenario->LegacyMemoryMap) {
+                UT_ASSERT_EQUAL (Range->Reserved, 0);
+            }
+
+            if (Scenario->UseSrat) {
+                UT_ASSERT_EQUAL (mProximityDomains[Index], (Range->BaseAddress - BENCHMARK_MEMORY_BASE) / BENCHMARK_NODE_SIZE);
+            } else {
+                UT_ASSERT_EQUAL (mProximityDomains[Index], MEMORY_MAP_NO_PROXIMITY_DOMAIN);
+            }
+
+            TotalLength += Range->Length;
+            Previous     = Range;
+        }
+
+        UT_ASSERT_EQUAL (TotalLength, (UINT64)BENCHMARK_RANGE_COUNT * BENCHMARK_RANGE_SIZE);
+
+        //
+        // An already sorted map takes a single pass. Otherwise the heap sort
+        // bounds the work, and the SRAT is searched only when a range leaves
+        // the memory affinity structure that described the previous range.
+        //
+        if (Scenario->Shuffle) {
+            UT_ASSERT_TRUE (Stats.Comparisons <= 2 * BENCHMARK_RANGE_COUNT * LogN);
+            UT_ASSERT_TRUE (Stats.Moves <= BENCHMARK_RANGE_COUNT * (LogN + 1));
+        } else {
+            UT_ASSERT_TRUE (Stats.Comparisons < BENCHMARK_RANGE_COUNT);
+            UT_ASSERT_TRUE (Stats.Moves <= Stats.OutputRanges);
+        }
+
+        if (Scenario->UseSrat) {
+            UT_ASSERT_TRUE (Stats.SratLookups <= 2 * BENCHMARK_NODE_COUNT);
+        } else {
+            UT_ASSERT_EQUAL (Stats.SratLookups, 0);
+        }
+    }
+
+    return UNIT_TEST_PASSED;
+}
+
+
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+    VOID
+    )
+{
+    EFI_STATUS                  Status;
+    UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+    UNIT_TEST_SUITE_HANDLE      Suite;
+
+    mMemoryMap        = AllocatePool (BENCHMARK_RANGE_COUNT * sizeof (VM_MEMORY_RANGE_V5));
+    mProximityDomains = AllocatePool (BENCHMARK_RANGE_COUNT * sizeof (UINT32));
+    if ((mMemoryMap == NULL) || (mProximityDomains == NULL)) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Exit;
+    }
+
+    BuildSrat ();
+
+    Status = InitUnitTestFramework (&Framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    Status = CreateUnitTestSuite (&Suite, Framework, "Memory Map Normalization", "PlatformPei.MemoryMap", NULL, NULL);
+    if (EFI_ERROR (Status)) {
+        goto Exit;
+    }
+
+    AddTestCase (Suite, "10k range maps normalize within budget", "Normalize", BenchmarkNormalize, NULL, NULL, NULL);
+
+    Status = RunAllTestSuites (Framework);
+
+Exit:
+    if (Framework != NULL) {
+        FreeUnitTestFramework (Framework);
+    }
+
+    if (mMemoryMap != NULL) {
+        FreePool (mMemoryMap);
+    }
+
+    if (mProximityDomains != NULL) {
+        FreePool (mProximityDomains);
+    }
+
+    return Status;
+}
+
+
+int
+main (
+    int   argc,
+    char  *argv[]
+    )
+{
+    return UefiTestMain ();
+}
@@ -19,6 +19,8 @@
 #include <Library/PeCoffLib.h>
 #include <Library/PeCoffGetEntryPointLib.h>
 #include <Library/PeCoffExtraActionLib.h>
+#include <Library/TimerLib.h>
+#include <Ppi/SecPerformance.h>
 #include <Ppi/TemporaryRamSupport.h>
 #include <BiosInterface.h>
 #include <IsolationTypes.h>
@@ -42,21 +44,48 @@ TemporaryRamMigration (
     );
 
 
+EFI_STATUS
+EFIAPI
+SecGetPerformance (
+    IN  CONST EFI_PEI_SERVICES          **PeiServices,
+    IN        PEI_SEC_PERFORMANCE_PPI   *This,
+    OUT       FIRMWARE_SEC_PERFORMANCE  *Performance
+    );
+
+
 EFI_PEI_TEMPORARY_RAM_SUPPORT_PPI mTemporaryRamSupportPpi =
 {
     TemporaryRamMigration
 };
 
 
+PEI_SEC_PERFORMANCE_PPI mSecPerformancePpi =
+{
+    SecGetPerformance
+};
+
+
 EFI_PEI_PPI_DESCRIPTOR mPrivateDispatchTable[] =
 {
     {
-        (EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST),
+        EFI_PEI_PPI_DESCRIPTOR_PPI,
         &gEfiTemporaryRamSupportPpiGuid,
         &mTemporaryRamSupportPpi
     },
+    {
+        (EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST),
+        &gPeiSecPerformancePpiGuid,
+        &mSecPerformancePpi
+    },
 };
 
+//
+// Performance counter value sampled on entry to SecCoreStartupWithStack. The
+// counter is the hypervisor reference time, which starts when the partition
+// is created, so this is also the time spent before firmware ran.
+//
+UINT64 mSecStartTime;
+
 HV_HYPERVISOR_ISOLATION_CONFIGURATION mIsolationConfiguration;
 
 UINT32
@@ -1176,6 +1205,13 @@ Return Value:
 
     AsmWriteIdtr (&IdtDescriptor);
 
+    //
+    // Sample the start of SEC for the FPDT. This is done once the isolation
+    // exception handler is in place because reading the reference time may
+    // require an MSR intercept.
+    //
+    mSecStartTime = GetPerformanceCounter();
+
     //
     // |-------------|       <-- TopOfCurrentStack
     // |   Stack     | 32k
@@ -1210,6 +1246,44 @@ Return Value:
 }
 
 
+EFI_STATUS
+EFIAPI
+SecGetPerformance (
+    IN  CONST EFI_PEI_SERVICES          **PeiServices,
+    IN        PEI_SEC_PERFORMANCE_PPI   *This,
+    OUT       FIRMWARE_SEC_PERFORMANCE  *Performance
+    )
+/*++
+
+Routine Description:
+
+    Returns the SEC performance data that is reported in the FPDT basic boot
+    record.
+
+Arguments:
+
+    PeiServices - Pointer to the PEI Services Table.
+
+    This - The SEC performance PPI.
+
+    Performance - Returns the SEC performance data.
+
+Return Value:
+
+    EFI_SUCCESS (always)
+
+--*/
+{
+    //
+    // ResetEnd is the time firmware started running, measured from reset.
+    // The reference time counter starts at zero when the partition is created.
+    //
+    Performance->ResetEnd = GetTimeInNanoSecond(mSecStartTime);
+
+    return EFI_SUCCESS;
+}
+
+
 EFI_STATUS
 EFIAPI
 TemporaryRamMigration(
@@ -0,0 +1,778 @@
+/** @file
+    Host based unit tests of the vmbfs client against a stand-in host endpoint.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../VmbfsEfi.h"
+#include <Library/UnitTestLib.h>
+#include "VmbfsHostEndpoint.h"
+
+#define UNIT_TEST_APP_NAME     "VmbfsDxe Unit Tests"
+#define UNIT_TEST_APP_VERSION  "1.0"
+
+//
+// Large enough to need several RDMA requests, with a partial last one.
+//
+#define LARGE_FILE_SIZE (3 * VMBFS_MAXIMUM_RDMA_SIZE + 123)
+
+#define PAYLOAD_FILE_SIZE (5 * VMBFS_MAXIMUM_MESSAGE_SIZE / 2)
+
+#define SMALL_FILE_PATH L"\\EFI\\BOOT\\BOOTX64.EFI"
+#define PAYLOAD_FILE_PATH L"\\config.bin"
+#define LARGE_FILE_PATH L"\\vmlinuz"
+#define MISSING_FILE_PATH L"\\EFI\\BOOT\\missing.efi"
+
+//
+// Enough blocks to hold the payload file but not the large file.
+//
+#define TEST_CACHE_BLOCK_COUNT 8
+
+typedef struct
+{
+    UINT32 HostVersion;
+    UINT32 CacheBlockCount;
+} VMBFS_TEST_CONTEXT;
+
+VMBFS_HOST_ENDPOINT mEndpoint;
+VMBFS_SIMPLE_FILE_SYSTEM_PROTOCOL mFileSystem;
+VMBFS_HOST_FILE mFiles[4];
+UINT8 mSmallFile[1000];
+UINT8 *mPayloadFile;
+UINT8 *mLargeFile;
+
+VMBFS_TEST_CONTEXT mVersion1Context = { VMBFS_VERSION_WIN10, 0 };
+VMBFS_TEST_CONTEXT mFileHandlesContext = { VMBFS_VERSION_FILE_HANDLES, 0 };
+VMBFS_TEST_CONTEXT mCacheContext = { VMBFS_VERSION_FILE_HANDLES, TEST_CACHE_BLOCK_COUNT };
+
+//
+// Minimal boot services for the client. Waiting on an event delivers the
+// responses queued by the host endpoint until the event is signaled.
+//
+EFI_TPL mTpl = TPL_APPLICATION;
+
+//
+// When set, the next wait fails without delivering anything.
+//
+BOOLEAN mFailNextWait;
+
+EFI_TPL
+EFIAPI
+TestRaiseTpl (
+    IN  EFI_TPL NewTpl
+    )
+{
+    EFI_TPL oldTpl = mTpl;
+
+    mTpl = NewTpl;
+    return oldTpl;
+}
+
+VOID
+EFIAPI
+TestRestoreTpl (
+    IN  EFI_TPL OldTpl
+    )
+{
+    mTpl = OldTpl;
+}
+
+EFI_STATUS
+EFIAPI
+TestAllocatePool (
+    IN  EFI_MEMORY_TYPE PoolType,
+    IN  UINTN Size,
+    OUT VOID **Buffer
+    )
+{
+    *Buffer = AllocatePool(Size);
+    return (*Buffer == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestFreePool (
+    IN  VOID *Buffer
+    )
+{
+    FreePool(Buffer);
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestCreateEvent (
+    IN  UINT32 Type,
+    IN  EFI_TPL NotifyTpl,
+    IN  EFI_EVENT_NOTIFY NotifyFunction OPTIONAL,
+    IN  VOID *NotifyContext OPTIONAL,
+    OUT EFI_EVENT *Event
+    )
+{
+    *Event = AllocateZeroPool(sizeof(BOOLEAN));
+    return (*Event == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestSignalEvent (
+    IN  EFI_EVENT Event
+    )
+{
+    *(BOOLEAN*)Event = TRUE;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestCheckEvent (
+    IN  EFI_EVENT Event
+    )
+{
+    if (!*(BOOLEAN*)Event)
+    {
+        return EFI_NOT_READY;
+    }
+
+    *(BOOLEAN*)Event = FALSE;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestWaitForEvent (
+    IN  UINTN NumberOfEvents,
+    IN  EFI_EVENT *Event,
+    OUT UINTN *Index
+    )
+{
+    ASSERT(NumberOfEvents == 1);
+    ASSERT(mTpl == TPL_APPLICATION);
+
+    if (mFailNextWait)
+    {
+        mFailNextWait = FALSE;
+        return EFI_DEVICE_ERROR;
+    }
+
+    while (!*(BOOLEAN*)Event[0])
+    {
+        //
+        // Nothing will ever signal the event.
+        //
+        if (!VmbfsHostEndpointDeliverResponse(&mEndpoint))
+        {
+            return EFI_DEVICE_ERROR;
+        }
+    }
+
+    *(BOOLEAN*)Event[0] = FALSE;
+    *Index = 0;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+TestCloseEvent (
+    IN  EFI_EVENT Event
+    )
+{
+    FreePool(Event);
+    return EFI_SUCCESS;
+}
+
+EFI_BOOT_SERVICES mBootServices;
+EFI_BOOT_SERVICES *gBS = &mBootServices;
+
+VOID
+FailFastFromMacro(
+    IN  UINTN ErrorCode,
+    IN  CONST CHAR8 *Component,
+    IN  UINTN Line,
+    IN  CONST CHAR8 *Description
+    )
+{
+    DEBUG((DEBUG_ERROR, "%a(%d): %a\n", Component, Line, Description));
+    ASSERT(FALSE);
+    exit(1);
+}
+
+
+VOID
+FillPattern (
+    OUT UINT8 *Buffer,
+    IN  UINTN Size,
+    IN  UINT8 Seed
+    )
+{
+    UINTN index;
+
+    for (index = 0; index < Size; index++)
+    {
+        Buffer[index] = (UINT8)((index * 31 + (index >> 12) + Seed) & 0xFF);
+    }
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+OpenVolume (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    VMBFS_TEST_CONTEXT *testContext = Context;
+
+    VmbfsHostEndpointInitialize(&mEndpoint, testContext->HostVersion, mFiles, ARRAY_SIZE(mFiles));
+
+    ZeroMem(&mFileSystem, sizeof(mFileSystem));
+    CopyMem(&mFileSystem.EfiSimpleFileSystemProtocol,
+            &gVmbFsSimpleFileSystemProtocol,
+            sizeof(mFileSystem.EfiSimpleFileSystemProtocol));
+
+    mFileSystem.FileSystemInformation.EmclProtocol = &mEndpoint.Emcl;
+
+    UT_ASSERT_NOT_EFI_ERROR(VmbfsCacheInitialize(&mFileSystem.FileSystemInformation.Cache,
+                                                 testContext->CacheBlockCount));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+VOID
+EFIAPI
+FreeCache (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    VmbfsCacheFree(&mFileSystem.FileSystemInformation.Cache);
+}
+
+
+UNIT_TEST_STATUS
+ReadWholeFile (
+    IN  EFI_FILE_PROTOCOL *Root,
+    IN  CHAR16 *Path,
+    IN  CONST UINT8 *Expected,
+    IN  UINTN ExpectedSize,
+    IN  UINTN ChunkSize
+    )
+{
+    EFI_FILE_PROTOCOL *file;
+    UINT8 *buffer;
+    UINTN bytesRead;
+    UINTN chunk;
+    EFI_STATUS status;
+
+    status = Root->Open(Root, &file, Path, EFI_FILE_MODE_READ, 0);
+    UT_ASSERT_NOT_EFI_ERROR(status);
+    UT_ASSERT_EQUAL(GetThisEfiFileInfo(file)->FileSize, ExpectedSize);
+
+    buffer = AllocatePool(ExpectedSize + 1);
+    UT_ASSERT_NOT_NULL(buffer);
+
+    bytesRead = 0;
+    while (bytesRead < ExpectedSize)
+    {
+        chunk = MIN(ChunkSize, ExpectedSize + 1 - bytesRead);
+        status = file->Read(file, &chunk, buffer + bytesRead);
+        UT_ASSERT_NOT_EFI_ERROR(status);
+        UT_ASSERT_TRUE(chunk > 0);
+        bytesRead += chunk;
+    }
+
+    UT_ASSERT_EQUAL(bytesRead, ExpectedSize);
+    UT_ASSERT_MEM_EQUAL(buffer, Expected, ExpectedSize);
+
+    FreePool(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+TestReadFiles (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    VMBFS_TEST_CONTEXT *testContext = Context;
+    EFI_FILE_PROTOCOL *root;
+    EFI_FILE_PROTOCOL *file;
+    UINT32 pathReads;
+    UINT32 handleReads;
+    UNIT_TEST_STATUS testStatus;
+
+    UT_ASSERT_NOT_EFI_ERROR(mFileSystem.EfiSimpleFileSystemProtocol.OpenVolume(
+                                &mFileSystem.EfiSimpleFileSystemProtocol,
+                                &root));
+
+    UT_ASSERT_EQUAL(mFileSystem.FileSystemInformation.ProtocolVersion, testContext->HostVersion);
+
+    testStatus = ReadWholeFile(root, SMALL_FILE_PATH, mSmallFile, sizeof(mSmallFile), 100);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+
+    testStatus = ReadWholeFile(root, PAYLOAD_FILE_PATH, mPayloadFile, PAYLOAD_FILE_SIZE, PAYLOAD_FILE_SIZE);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+
+    UT_ASSERT_EQUAL(root->Open(root, &file, L"\\missing", EFI_FILE_MODE_READ, 0), EFI_NOT_FOUND);
+
+    pathReads = mEndpoint.RequestCount[VmbfsMessageTypeReadFile] +
+                mEndpoint.RequestCount[VmbfsMessageTypeReadFileRdma];
+
+    handleReads = mEndpoint.RequestCount[VmbfsMessageTypeReadFileByHandle] +
+                  mEndpoint.RequestCount[VmbfsMessageTypeReadFileRdmaByHandle];
+
+    if (testContext->HostVersion >= VMBFS_VERSION_FILE_HANDLES)
+    {
+        //
+        // Only the opens carry a path, and every handle is released.
+        //
+        UT_ASSERT_EQUAL(pathReads, 0);
+        UT_ASSERT_TRUE(handleReads > 0);
+        UT_ASSERT_EQUAL(mEndpoint.RequestCount[VmbfsMessageTypeGetFileInfo], 0);
+        UT_ASSERT_EQUAL(mEndpoint.PathBytesReceived,
+                        StrSize(SMALL_FILE_PATH) + StrSize(PAYLOAD_FILE_PATH) + StrSize(L"\\missing") -
+                        3 * sizeof(CHAR16));
+        UT_ASSERT_EQUAL(mEndpoint.OpenFileCount, 0);
+    }
+    else
+    {
+        UT_ASSERT_TRUE(pathReads > 0);
+        UT_ASSERT_EQUAL(handleReads, 0);
+        UT_ASSERT_EQUAL(mEndpoint.RequestCount[VmbfsMessageTypeOpenFile], 0);
+    }
+
+    UT_ASSERT_NOT_EFI_ERROR(root->Close(root));
+    UT_ASSERT_FALSE(mEndpoint.ChannelStarted);
+
+    return UNIT_TEST_PASSED;
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+TestPipelinedRead (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    EFI_FILE_PROTOCOL *root;
+    UNIT_TEST_STATUS testStatus;
+
+    UT_ASSERT_NOT_EFI_ERROR(mFileSystem.EfiSimpleFileSystemProtocol.OpenVolume(
+                                &mFileSystem.EfiSimpleFileSystemProtocol,
+                                &root));
+
+    testStatus = ReadWholeFile(root, LARGE_FILE_PATH, mLargeFile, LARGE_FILE_SIZE, LARGE_FILE_SIZE);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+
+    //
+    // All requests of the read were in flight together.
+    //
+    UT_ASSERT_EQUAL(mEndpoint.MaximumResponsesQueued,
+                    MIN(4, PcdGet32(PcdVmbfsMaxOutstandingReads)));
+
+    UT_ASSERT_NOT_EFI_ERROR(root->Close(root));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+UINT32
+GpaRangesInUse (
+    VOID
+    )
+{
+    UINT32 count = 0;
+    UINTN index;
+
+    for (index = 0; index < VMBFS_HOST_MAXIMUM_GPA_RANGES; index++)
+    {
+        if (mEndpoint.GpaRanges[index].InUse)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+TestAbandonedRead (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    EFI_FILE_PROTOCOL *root;
+    EFI_FILE_PROTOCOL *file;
+    UINT8 *buffer;
+    UINTN size;
+
+    UT_ASSERT_NOT_EFI_ERROR(mFileSystem.EfiSimpleFileSystemProtocol.OpenVolume(
+                                &mFileSystem.EfiSimpleFileSystemProtocol,
+                                &root));
+
+    UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, LARGE_FILE_PATH, EFI_FILE_MODE_READ, 0));
+
+    buffer = AllocatePool(LARGE_FILE_SIZE);
+    UT_ASSERT_NOT_NULL(buffer);
+
+    //
+    // The host may still write through the GPA ranges of the requests in
+    // flight, so they outlive the failed read.
+    //
+    mFailNextWait = TRUE;
+    size = LARGE_FILE_SIZE;
+    UT_ASSERT_TRUE(EFI_ERROR(file->Read(file, &size, buffer)));
+    UT_ASSERT_TRUE(GpaRangesInUse() > 0);
+
+    //
+    // The next read waits for them before reusing their handles.
+    //
+    UT_ASSERT_NOT_EFI_ERROR(file->SetPosition(file, 0));
+    size = LARGE_FILE_SIZE;
+    UT_ASSERT_NOT_EFI_ERROR(file->Read(file, &size, buffer));
+    UT_ASSERT_EQUAL(size, LARGE_FILE_SIZE);
+    UT_ASSERT_MEM_EQUAL(buffer, mLargeFile, LARGE_FILE_SIZE);
+    UT_ASSERT_EQUAL(GpaRangesInUse(), 0);
+
+    FreePool(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+    UT_ASSERT_NOT_EFI_ERROR(root->Close(root));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+UINT32
+HostReadCount (
+    VOID
+    )
+{
+    return mEndpoint.RequestCount[VmbfsMessageTypeReadFile] +
+           mEndpoint.RequestCount[VmbfsMessageTypeReadFileRdma] +
+           mEndpoint.RequestCount[VmbfsMessageTypeReadFileByHandle] +
+           mEndpoint.RequestCount[VmbfsMessageTypeReadFileRdmaByHandle];
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+TestCachedRead (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    PVMBFS_CACHE cache = &mFileSystem.FileSystemInformation.Cache;
+    EFI_FILE_PROTOCOL *root;
+    EFI_FILE_PROTOCOL *file;
+    UINT8 buffer[16];
+    CHAR16 name[VMBFS_CONTROLLER_NAME_LENGTH];
+    UINTN size;
+    UINT32 hostReads;
+    UNIT_TEST_STATUS testStatus;
+
+    UT_ASSERT_EQUAL(cache->BlockCount, TEST_CACHE_BLOCK_COUNT);
+
+    UT_ASSERT_NOT_EFI_ERROR(mFileSystem.EfiSimpleFileSystemProtocol.OpenVolume(
+                                &mFileSystem.EfiSimpleFileSystemProtocol,
+                                &root));
+
+    //
+    // Small sequential reads are served from blocks prefetched by the first.
+    //
+    testStatus = ReadWholeFile(root, PAYLOAD_FILE_PATH, mPayloadFile, PAYLOAD_FILE_SIZE, 512);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+    UT_ASSERT_EQUAL(cache->Misses, 1);
+    UT_ASSERT_TRUE(cache->Hits > 0);
+
+    //
+    // The statistics are reported with the controller name.
+    //
+    VmbfsCacheFormatStatistics(cache, L"Vmbfs", name, sizeof(name));
+    UT_ASSERT_TRUE(StrnCmp(name, L"Vmbfs (cache: ", StrLen(L"Vmbfs (cache: ")) == 0);
+    UT_ASSERT_TRUE(StrStr(name, L" 1 misses, ") != NULL);
+
+    //
+    // Reopening the file hits the cache without going to the host.
+    //
+    hostReads = HostReadCount();
+    testStatus = ReadWholeFile(root, PAYLOAD_FILE_PATH, mPayloadFile, PAYLOAD_FILE_SIZE, PAYLOAD_FILE_SIZE);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+    UT_ASSERT_EQUAL(HostReadCount(), hostReads);
+
+    //
+    // A random read of another file fetches only the block it needs.
+    //
+    UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, LARGE_FILE_PATH, EFI_FILE_MODE_READ, 0));
+    UT_ASSERT_NOT_EFI_ERROR(file->SetPosition(file, 5 * VMBFS_CACHE_BLOCK_SIZE + 7));
+    size = sizeof(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Read(file, &size, buffer));
+    UT_ASSERT_EQUAL(size, sizeof(buffer));
+    UT_ASSERT_MEM_EQUAL(buffer, mLargeFile + 5 * VMBFS_CACHE_BLOCK_SIZE + 7, sizeof(buffer));
+    UT_ASSERT_EQUAL(cache->PrefetchedBlocks, 0);
+
+    //
+    // Reading on from the end of that block prefetches the blocks after it.
+    //
+    UT_ASSERT_NOT_EFI_ERROR(file->SetPosition(file, 6 * VMBFS_CACHE_BLOCK_SIZE - sizeof(buffer)));
+    size = sizeof(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Read(file, &size, buffer));
+    size = sizeof(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Read(file, &size, buffer));
+    UT_ASSERT_EQUAL(size, sizeof(buffer));
+    UT_ASSERT_MEM_EQUAL(buffer, mLargeFile + 6 * VMBFS_CACHE_BLOCK_SIZE, sizeof(buffer));
+    UT_ASSERT_EQUAL(cache->PrefetchedBlocks, VMBFS_CACHE_PREFETCH_BLOCKS);
+
+    hostReads = HostReadCount();
+    UT_ASSERT_NOT_EFI_ERROR(file->SetPosition(file, 7 * VMBFS_CACHE_BLOCK_SIZE));
+    size = sizeof(buffer);
+    UT_ASSERT_NOT_EFI_ERROR(file->Read(file, &size, buffer));
+    UT_ASSERT_MEM_EQUAL(buffer, mLargeFile + 7 * VMBFS_CACHE_BLOCK_SIZE, sizeof(buffer));
+    UT_ASSERT_EQUAL(HostReadCount(), hostReads);
+
+    //
+    // Reads larger than the cache go straight to the host.
+    //
+    hostReads = HostReadCount();
+    UT_ASSERT_NOT_EFI_ERROR(file->SetPosition(file, 0));
+    testStatus = ReadWholeFile(root, LARGE_FILE_PATH, mLargeFile, LARGE_FILE_SIZE, LARGE_FILE_SIZE);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+    UT_ASSERT_TRUE(HostReadCount() > hostReads);
+
+    //
+    // A failed write drops the cached data of the file, and its blocks are
+    // the first to be reused.
+    //
+    size = sizeof(buffer);
+    UT_ASSERT_EQUAL(file->Write(file, &size, buffer), EFI_UNSUPPORTED);
+    UT_ASSERT_TRUE(VmbfsCacheLookup(cache, GetThisFileInformation(file)->CacheFileId, 5) == NULL);
+    UT_ASSERT_FALSE(BASE_CR(GetPreviousNode(&cache->LruList, &cache->LruList),
+                            VMBFS_CACHE_BLOCK,
+                            ListEntry)->Valid);
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+
+    testStatus = ReadWholeFile(root, PAYLOAD_FILE_PATH, mPayloadFile, PAYLOAD_FILE_SIZE, PAYLOAD_FILE_SIZE);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+
+    UT_ASSERT_NOT_EFI_ERROR(root->Close(root));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+UINT32
+HostLookupCount (
+    VOID
+    )
+{
+    return mEndpoint.RequestCount[VmbfsMessageTypeGetFileInfo] +
+           mEndpoint.RequestCount[VmbfsMessageTypeOpenFile];
+}
+
+
+UNIT_TEST_STATUS
+EFIAPI
+TestPathLookupCache (
+    IN  UNIT_TEST_CONTEXT Context
+    )
+{
+    VMBFS_TEST_CONTEXT *testContext = Context;
+    EFI_FILE_PROTOCOL *root;
+    EFI_FILE_PROTOCOL *file;
+    UINT8 buffer[16];
+    UINTN size;
+    UINT32 hostLookups;
+    UINTN probe;
+    CHAR16 path[32];
+    UNIT_TEST_STATUS testStatus;
+
+    UT_ASSERT_NOT_EFI_ERROR(mFileSystem.EfiSimpleFileSystemProtocol.OpenVolume(
+                                &mFileSystem.EfiSimpleFileSystemProtocol,
+                                &root));
+
+    //
+    // Repeated probes of a missing path and of an existing file only go to
+    // the host once.
+    //
+    for (probe = 0; probe < 3; probe++)
+    {
+        UT_ASSERT_EQUAL(root->Open(root, &file, MISSING_FILE_PATH, EFI_FILE_MODE_READ, 0), EFI_NOT_FOUND);
+        UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, SMALL_FILE_PATH, EFI_FILE_MODE_READ, 0));
+        UT_ASSERT_EQUAL(GetThisEfiFileInfo(file)->FileSize, sizeof(mSmallFile));
+        UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+    }
+
+    UT_ASSERT_EQUAL(HostLookupCount(), 2);
+    UT_ASSERT_EQUAL(mFileSystem.FileSystemInformation.MetadataHits, 4);
+    UT_ASSERT_EQUAL(mEndpoint.OpenFileCount, 0);
+
+    //
+    // A file opened from the cache can still be read.
+    //
+    testStatus = ReadWholeFile(root, SMALL_FILE_PATH, mSmallFile, sizeof(mSmallFile), 100);
+    UT_ASSERT_EQUAL(testStatus, UNIT_TEST_PASSED);
+    UT_ASSERT_EQUAL(mEndpoint.OpenFileCount, 0);
+
+    if (testContext->HostVersion >= VMBFS_VERSION_FILE_HANDLES)
+    {
+        UT_ASSERT_EQUAL(HostLookupCount(), 3);
+    }
+    else
+    {
+        UT_ASSERT_EQUAL(HostLookupCount(), 2);
+    }
+
+    //
+    // A mutating call drops the cached lookups.
+    //
+    UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, SMALL_FILE_PATH, EFI_FILE_MODE_READ, 0));
+    size = sizeof(buffer);
+    UT_ASSERT_EQUAL(file->Write(file, &size, buffer), EFI_UNSUPPORTED);
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+
+    hostLookups = HostLookupCount();
+    UT_ASSERT_EQUAL(root->Open(root, &file, MISSING_FILE_PATH, EFI_FILE_MODE_READ, 0), EFI_NOT_FOUND);
+    UT_ASSERT_EQUAL(HostLookupCount(), hostLookups + 1);
+
+    //
+    // Probing many missing paths does not push out the files that were found.
+    //
+    UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, SMALL_FILE_PATH, EFI_FILE_MODE_READ, 0));
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+
+    hostLookups = HostLookupCount();
+    for (probe = 0; probe < PcdGet32(PcdVmbfsMetadataCacheEntries); probe++)
+    {
+        UnicodeSPrint(path, sizeof(path), L"\\missing%d", (UINT32)probe);
+        UT_ASSERT_EQUAL(root->Open(root, &file, path, EFI_FILE_MODE_READ, 0), EFI_NOT_FOUND);
+    }
+
+    UT_ASSERT_TRUE(mFileSystem.FileSystemInformation.MetadataNotFoundCount <=
+                   MAX(PcdGet32(PcdVmbfsMetadataCacheEntries) / 2, 1));
+
+    UT_ASSERT_NOT_EFI_ERROR(root->Open(root, &file, SMALL_FILE_PATH, EFI_FILE_MODE_READ, 0));
+    UT_ASSERT_EQUAL(HostLookupCount(), hostLookups + PcdGet32(PcdVmbfsMetadataCacheEntries));
+
+    //
+    // A file opened from the cache that is gone from the host fails its first
+    // read with the host's status and drops the cached lookups.
+    //
+    if (testContext->HostVersion >= VMBFS_VERSION_FILE_HANDLES)
+    {
+        mFiles[1].Path = MISSING_FILE_PATH;
+        size = sizeof(buffer);
+        UT_ASSERT_EQUAL(file->Read(file, &size, buffer), EFI_NOT_FOUND);
+        UT_ASSERT_TRUE(IsListEmpty(&mFileSystem.FileSystemInformation.MetadataList));
+        mFiles[1].Path = SMALL_FILE_PATH;
+    }
+
+    UT_ASSERT_NOT_EFI_ERROR(file->Close(file));
+    UT_ASSERT_NOT_EFI_ERROR(root->Close(root));
+
+    //
+    // Lookups are not remembered once the volume is closed.
+    //
+    UT_ASSERT_TRUE(IsListEmpty(&mFileSystem.FileSystemInformation.MetadataList));
+
+    return UNIT_TEST_PASSED;
+}
+
+
+EFI_STATUS
+EFIAPI
+UefiTestMain (
+    VOID
+    )
+{
+    EFI_STATUS status;
+    UNIT_TEST_FRAMEWORK_HANDLE framework = NULL;
+    UNIT_TEST_SUITE_HANDLE suite;
+
+    mBootServices.RaiseTPL = TestRaiseTpl;
+    mBootServices.RestoreTPL = TestRestoreTpl;
+    mBootServices.AllocatePool = TestAllocatePool;
+    mBootServices.FreePool = TestFreePool;
+    mBootServices.CreateEvent = TestCreateEvent;
+    mBootServices.SignalEvent = TestSignalEvent;
+    mBootServices.CheckEvent = TestCheckEvent;
+    mBootServices.WaitForEvent = TestWaitForEvent;
+    mBootServices.CloseEvent = TestCloseEvent;
+
+    mPayloadFile = AllocatePool(PAYLOAD_FILE_SIZE);
+    mLargeFile = AllocatePool(LARGE_FILE_SIZE);
+    if (mPayloadFile == NULL || mLargeFile == NULL)
+    {
+        status = EFI_OUT_OF_RESOURCES;
+        goto Exit;
+    }
+
+    FillPattern(mSmallFile, sizeof(mSmallFile), 1);
+    FillPattern(mPayloadFile, PAYLOAD_FILE_SIZE, 2);
+    FillPattern(mLargeFile, LARGE_FILE_SIZE, 3);
+
+    mFiles[0].Path = L"\\EFI";
+    mFiles[0].IsDirectory = TRUE;
+    mFiles[1].Path = SMALL_FILE_PATH;
+    mFiles[1].RdmaCapable = TRUE;
+    mFiles[1].Data = mSmallFile;
+    mFiles[1].Size = sizeof(mSmallFile);
+    mFiles[2].Path = PAYLOAD_FILE_PATH;
+    mFiles[2].Data = mPayloadFile;
+    mFiles[2].Size = PAYLOAD_FILE_SIZE;
+    mFiles[3].Path = LARGE_FILE_PATH;
+    mFiles[3].RdmaCapable = TRUE;
+    mFiles[3].Data = mLargeFile;
+    mFiles[3].Size = LARGE_FILE_SIZE;
+
+    status = InitUnitTestFramework(&framework, UNIT_TEST_APP_NAME, gEfiCallerBaseName, UNIT_TEST_APP_VERSION);
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    status = CreateUnitTestSuite(&suite, framework, "Vmbfs Client Tests", "VmbfsDxe.Client", NULL, NULL);
+    if (EFI_ERROR(status))
+    {
+        goto Exit;
+    }
+
+    AddTestCase(suite, "Read files over the version 1.0 protocol", "ReadVersion1", TestReadFiles, OpenVolume, FreeCache, &mVersion1Context);
+    AddTestCase(suite, "Read files by host file handle", "ReadFileHandles", TestReadFiles, OpenVolume, FreeCache, &mFileHandlesContext);
+    AddTestCase(suite, "Read files through the block cache", "ReadCached", TestReadFiles, OpenVolume, FreeCache, &mCacheContext);
+    AddTestCase(suite, "Pipelined RDMA read by path", "PipelinedVersion1", TestPipelinedRead, OpenVolume, FreeCache, &mVersion1Context);
+    AddTestCase(suite, "Pipelined RDMA read by handle", "PipelinedFileHandles", TestPipelinedRead, OpenVolume, FreeCache, &mFileHandlesContext);
+    AddTestCase(suite, "RDMA read abandoned by a failed wait", "AbandonedRead", TestAbandonedRead, OpenVolume, FreeCache, &mFileHandlesContext);
+    AddTestCase(suite, "Path lookup cache over the version 1.0 protocol", "LookupCacheVersion1", TestPathLookupCache, OpenVolume, FreeCache, &mVersion1Context);
+    AddTestCase(suite, "Path lookup cache with host file handles", "LookupCacheFileHandles", TestPathLookupCache, OpenVolume, FreeCache, &mFileHandlesContext);
+    AddTestCase(suite, "Block cache hits, prefetch and bypass", "CacheHits", TestCachedRead, OpenVolume, FreeCache, &mCacheContext);
+
+    status = RunAllTestSuites(framework);
+
+Exit:
+    if (framework != NULL)
+    {
+        FreeUnitTestFramework(framework);
+    }
+
+    return status;
+}
+
+
+int
+main (
+    int argc,
+    char *argv[]
+    )
+{
+    return UefiTestMain();
+}
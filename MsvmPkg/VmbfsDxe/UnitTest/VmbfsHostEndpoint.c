@@ -0,0 +1,756 @@
+/** @file
+    A local stand-in for the host side of the VMBus file system protocol.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include "VmbfsHostEndpoint.h"
+
+#define GetEndpoint(Emcl) ((VMBFS_HOST_ENDPOINT*)(Emcl))
+
+
+VOID*
+VmbfsHostQueueResponse (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  UINT32 Size
+    )
+/*++
+
+Routine Description:
+
+    Reserves a zeroed response at the tail of the response queue.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+    Size - The size of the response in bytes.
+
+Return Value:
+
+    A pointer to the response buffer, or NULL if the queue is full.
+
+--*/
+{
+    VMBFS_HOST_RESPONSE *response;
+
+    if (Endpoint->ResponseCount == VMBFS_HOST_MAXIMUM_QUEUED_RESPONSES ||
+        Size > VMBFS_MAXIMUM_MESSAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    response = &Endpoint->Responses[(Endpoint->ResponseHead + Endpoint->ResponseCount) %
+                                    VMBFS_HOST_MAXIMUM_QUEUED_RESPONSES];
+
+    ZeroMem(response->Buffer, Size);
+    response->Size = Size;
+
+    Endpoint->ResponseCount++;
+    Endpoint->MaximumResponsesQueued = MAX(Endpoint->MaximumResponsesQueued,
+                                           Endpoint->ResponseCount);
+
+    return response->Buffer;
+}
+
+
+CONST VMBFS_HOST_FILE*
+VmbfsHostLookupPath (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  CONST CHAR16 *Path,
+    IN  UINTN PathBytes
+    )
+/*++
+
+Routine Description:
+
+    Finds a file by its path. Paths in requests are not null terminated.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+    Path - The path from the request.
+
+    PathBytes - The length of the path in bytes.
+
+Return Value:
+
+    The file, or NULL if no file has this path.
+
+--*/
+{
+    UINTN index;
+    UINTN pathLength;
+
+    pathLength = PathBytes / sizeof(CHAR16);
+    Endpoint->PathBytesReceived += PathBytes;
+
+    for (index = 0; index < Endpoint->FileCount; index++)
+    {
+        if (StrLen(Endpoint->Files[index].Path) == pathLength &&
+            CompareMem(Endpoint->Files[index].Path, Path, PathBytes) == 0)
+        {
+            return &Endpoint->Files[index];
+        }
+    }
+
+    return NULL;
+}
+
+
+CONST VMBFS_HOST_FILE*
+VmbfsHostLookupHandle (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  UINT64 FileHandle
+    )
+/*++
+
+Routine Description:
+
+    Finds an open file by its host file handle.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+    FileHandle - The file handle from the request.
+
+Return Value:
+
+    The file, or NULL if the handle is not open.
+
+--*/
+{
+    if (Endpoint->NegotiatedVersion < VMBFS_VERSION_FILE_HANDLES ||
+        FileHandle == 0 ||
+        FileHandle > VMBFS_HOST_MAXIMUM_OPEN_FILES)
+    {
+        return NULL;
+    }
+
+    return Endpoint->OpenFiles[FileHandle - 1];
+}
+
+
+VMBFS_HOST_GPA_RANGE*
+VmbfsHostLookupGpaRange (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  UINT32 Handle
+    )
+/*++
+
+Routine Description:
+
+    Finds a GPA range by its handle.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+    Handle - The GPA range handle.
+
+Return Value:
+
+    The GPA range, or NULL if no range has this handle.
+
+--*/
+{
+    UINTN index;
+
+    for (index = 0; index < VMBFS_HOST_MAXIMUM_GPA_RANGES; index++)
+    {
+        if (Endpoint->GpaRanges[index].InUse &&
+            Endpoint->GpaRanges[index].Handle == Handle)
+        {
+            return &Endpoint->GpaRanges[index];
+        }
+    }
+
+    return NULL;
+}
+
+
+UINT32
+VmbfsHostReadFile (
+    IN  CONST VMBFS_HOST_FILE *File,
+    IN  UINT64 Offset,
+    IN  UINT32 ByteCount,
+    OUT VOID *Buffer,
+    OUT UINT32 *BytesRead
+    )
+/*++
+
+Routine Description:
+
+    Reads from an in-memory file.
+
+Arguments:
+
+    File - The file, or NULL if it was not found.
+
+    Offset - The offset within the file at which to read.
+
+    ByteCount - The number of bytes to read.
+
+    Buffer - Receives the data.
+
+    BytesRead - Receives the number of bytes read.
+
+Return Value:
+
+    The VMBFS_STATUS_FILE_RESPONSE of the read.
+
+--*/
+{
+    *BytesRead = 0;
+
+    if (File == NULL)
+    {
+        return VmbfsFileNotFound;
+    }
+
+    if (File->IsDirectory)
+    {
+        return VmbfsFileError;
+    }
+
+    if (Offset >= File->Size)
+    {
+        return VmbfsFileEndOfFile;
+    }
+
+    *BytesRead = (UINT32)MIN(ByteCount, File->Size - Offset);
+    CopyMem(Buffer, File->Data + Offset, *BytesRead);
+    return VmbfsFileSuccess;
+}
+
+
+EFI_STATUS
+VmbfsHostHandleRequest (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  VOID *Request,
+    IN  UINT32 RequestSize
+    )
+/*++
+
+Routine Description:
+
+    Handles a request from the client and queues its response.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+    Request - The request message.
+
+    RequestSize - The size of the request in bytes.
+
+Return Value:
+
+    EFI_SUCCESS if a response was queued.
+
+    EFI_UNSUPPORTED if the request is malformed or not valid for the
+        negotiated version.
+
+    EFI_OUT_OF_RESOURCES if the response queue is full.
+
+--*/
+{
+    CONST VMBFS_HOST_FILE *file;
+    VMBFS_HOST_GPA_RANGE *gpaRange;
+    PVMBFS_MESSAGE_HEADER header;
+    UINT32 bytesRead;
+    UINT32 fileStatus;
+    UINTN index;
+    UINT8 payload[VMBFS_MAXIMUM_PAYLOAD_SIZE(VMBFS_MESSAGE_READ_FILE_RESPONSE)];
+
+    if (RequestSize < sizeof(VMBFS_MESSAGE_HEADER))
+    {
+        return EFI_UNSUPPORTED;
+    }
+
+    header = Request;
+    if (header->Type <= VmbfsMessageTypeInvalid || header->Type >= VmbfsMessageTypeMax)
+    {
+        return EFI_UNSUPPORTED;
+    }
+
+    Endpoint->RequestCount[header->Type]++;
+
+    switch (header->Type)
+    {
+    case VmbfsMessageTypeVersionRequest:
+    {
+        PVMBFS_MESSAGE_VERSION_REQUEST request = Request;
+        PVMBFS_MESSAGE_VERSION_RESPONSE response;
+
+        if (RequestSize != sizeof(*request))
+        {
+            return EFI_UNSUPPORTED;
+        }
+
+        response = VmbfsHostQueueResponse(Endpoint, sizeof(*response));
+        if (response == NULL)
+        {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        response->Header.Type = VmbfsMessageTypeVersionResponse;
+        if ((request->RequestedVersion == VMBFS_VERSION_WIN10 ||
+             request->RequestedVersion == VMBFS_VERSION_FILE_HANDLES) &&
+            request->RequestedVersion <= Endpoint->MaximumVersion)
+        {
+            Endpoint->NegotiatedVersion = request->RequestedVersion;
+            response->Status = VmbfsVersionSupported;
+        }
+        else
+        {
+            response->Status = VmbfsVersionUnsupported;
+        }
+
+        break;
+    }
+
+    case VmbfsMessageTypeGetFileInfo:
+    case VmbfsMessageTypeOpenFile:
+    {
+        PVMBFS_MESSAGE_OPEN_FILE request = Request;
+        PVMBFS_MESSAGE_OPEN_FILE_RESPONSE response;
+        BOOLEAN openFile = (header->Type == VmbfsMessageTypeOpenFile);
+
+        if (openFile && Endpoint->NegotiatedVersion < VMBFS_VERSION_FILE_HANDLES)
+        {
+            return EFI_UNSUPPORTED;
+        }
+
+        file = VmbfsHostLookupPath(Endpoint, request->FilePath, RequestSize - sizeof(*request));
+
+        //
+        // The OpenFile response extends the GetFileInfo response.
+        //
+        response = VmbfsHostQueueResponse(Endpoint,
+                                          openFile ?
+                                              sizeof(VMBFS_MESSAGE_OPEN_FILE_RESPONSE) :
+                                              sizeof(VMBFS_MESSAGE_GET_FILE_INFO_RESPONSE));
+        if (response == NULL)
+        {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        response->Header.Type = openFile ? VmbfsMessageTypeOpenFileResponse : VmbfsMessageTypeGetFileInfoResponse;
+        if (file == NULL)
+        {
+            response->Status = VmbfsFileNotFound;
+            break;
+        }
+
+        response->Status = VmbfsFileSuccess;
+        response->FileSize = file->Size;
+        response->Flags = (file->IsDirectory ? VMBFS_GET_FILE_INFO_FLAG_DIRECTORY : 0) |
+                          (file->RdmaCapable ? VMBFS_GET_FILE_INFO_FLAG_RDMA_CAPABLE : 0);
+
+        if (openFile)
+        {
+            for (index = 0; index < VMBFS_HOST_MAXIMUM_OPEN_FILES; index++)
+            {
+                if (Endpoint->OpenFiles[index] == NULL)
+                {
+                    break;
+                }
+            }
+
+            if (index == VMBFS_HOST_MAXIMUM_OPEN_FILES)
+            {
+                response->Status = VmbfsFileError;
+                break;
+            }
+
+            Endpoint->OpenFiles[index] = file;
+            Endpoint->OpenFileCount++;
+            response->FileHandle = index + 1;
+        }
+
+        break;
+    }
+
+    case VmbfsMessageTypeCloseFile:
+    {
+        PVMBFS_MESSAGE_CLOSE_FILE request = Request;
+        PVMBFS_MESSAGE_CLOSE_FILE_RESPONSE response;
+
+        if (RequestSize != sizeof(*request) ||
+            VmbfsHostLookupHandle(Endpoint, request->FileHandle) == NULL)
+        {
+            return EFI_UNSUPPORTED;
+        }
+
+        response = VmbfsHostQueueResponse(Endpoint, sizeof(*response));
+        if (response == NULL)
+        {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        Endpoint->OpenFiles[request->FileHandle - 1] = NULL;
+        Endpoint->OpenFileCount--;
+
+        response->Header.Type = VmbfsMessageTypeCloseFileResponse;
+        response->Status = VmbfsFileSuccess;
+        break;
+    }
+
+    case VmbfsMessageTypeReadFile:
+    case VmbfsMessageTypeReadFileByHandle:
+    {
+        PVMBFS_MESSAGE_READ_FILE_RESPONSE response;
+        UINT64 offset;
+        UINT32 byteCount;
+
+        if (header->Type == VmbfsMessageTypeReadFile)
+        {
+            PVMBFS_MESSAGE_READ_FILE request = Request;
+
+            if (RequestSize < sizeof(*request))
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            file = VmbfsHostLookupPath(Endpoint, request->FilePath, RequestSize - sizeof(*request));
+            offset = request->Offset;
+            byteCount = request->ByteCount;
+        }
+        else
+        {
+            PVMBFS_MESSAGE_READ_FILE_BY_HANDLE request = Request;
+
+            if (RequestSize != sizeof(*request))
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            file = VmbfsHostLookupHandle(Endpoint, request->FileHandle);
+            if (file == NULL)
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            offset = request->Offset;
+            byteCount = request->ByteCount;
+        }
+
+        fileStatus = VmbfsHostReadFile(file,
+                                       offset,
+                                       MIN(byteCount, sizeof(payload)),
+                                       payload,
+                                       &bytesRead);
+
+        response = VmbfsHostQueueResponse(Endpoint, sizeof(*response) + bytesRead);
+        if (response == NULL)
+        {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        response->Header.Type = VmbfsMessageTypeReadFileResponse;
+        response->Status = fileStatus;
+        CopyMem(response->Payload, payload, bytesRead);
+        break;
+    }
+
+    case VmbfsMessageTypeReadFileRdma:
+    case VmbfsMessageTypeReadFileRdmaByHandle:
+    {
+        PVMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE response;
+        UINT64 offset;
+        UINT32 byteCount;
+        UINT32 handle;
+
+        if (header->Type == VmbfsMessageTypeReadFileRdma)
+        {
+            PVMBFS_MESSAGE_READ_FILE_RDMA request = Request;
+
+            if (RequestSize < sizeof(*request))
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            file = VmbfsHostLookupPath(Endpoint, request->FilePath, RequestSize - sizeof(*request));
+            offset = request->FileOffset;
+            byteCount = request->ByteCount;
+            handle = request->Handle;
+        }
+        else
+        {
+            PVMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE request = Request;
+
+            if (RequestSize != sizeof(*request))
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            file = VmbfsHostLookupHandle(Endpoint, request->FileHandle);
+            if (file == NULL)
+            {
+                return EFI_UNSUPPORTED;
+            }
+
+            offset = request->FileOffset;
+            byteCount = request->ByteCount;
+            handle = request->Handle;
+        }
+
+        gpaRange = VmbfsHostLookupGpaRange(Endpoint, handle);
+        if (gpaRange == NULL ||
+            !gpaRange->Writable ||
+            byteCount > gpaRange->Buffer.BufferSize ||
+            (file != NULL && !file->RdmaCapable))
+        {
+            return EFI_UNSUPPORTED;
+        }
+
+        fileStatus = VmbfsHostReadFile(file,
+                                       offset,
+                                       byteCount,
+                                       gpaRange->Buffer.Buffer,
+                                       &bytesRead);
+
+        response = VmbfsHostQueueResponse(Endpoint, sizeof(*response));
+        if (response == NULL)
+        {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        response->Header.Type = VmbfsMessageTypeReadFileRdmaResponse;
+        response->Status = fileStatus;
+        response->ByteCount = bytesRead;
+        break;
+    }
+
+    default:
+        return EFI_UNSUPPORTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsHostStartChannel (
+    IN  EFI_EMCL_PROTOCOL *This,
+    IN  UINT32 IncomingRingBufferPageCount,
+    IN  UINT32 OutgoingRingBufferPageCount
+    )
+{
+    GetEndpoint(This)->ChannelStarted = TRUE;
+    return EFI_SUCCESS;
+}
+
+
+VOID
+EFIAPI
+VmbfsHostStopChannel (
+    IN  EFI_EMCL_PROTOCOL *This
+    )
+{
+    VMBFS_HOST_ENDPOINT *endpoint = GetEndpoint(This);
+
+    endpoint->ChannelStarted = FALSE;
+    endpoint->NegotiatedVersion = 0;
+    endpoint->ResponseCount = 0;
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsHostSendPacket (
+    IN  EFI_EMCL_PROTOCOL *This,
+    IN  VOID *InlineBuffer,
+    IN  UINT32 InlineBufferLength,
+    IN  EFI_EXTERNAL_BUFFER *ExternalBuffers,
+    IN  UINT32 ExternalBufferCount,
+    IN  EFI_EMCL_COMPLETION_ROUTINE CompletionRoutine OPTIONAL,
+    IN  VOID *CompletionContext OPTIONAL
+    )
+{
+    VMBFS_HOST_ENDPOINT *endpoint = GetEndpoint(This);
+
+    //
+    // The vmbfs pipe carries only in-band messages.
+    //
+    if (!endpoint->ChannelStarted ||
+        ExternalBufferCount != 0 ||
+        CompletionRoutine != NULL ||
+        InlineBufferLength > VMBFS_MAXIMUM_MESSAGE_SIZE)
+    {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return VmbfsHostHandleRequest(endpoint, InlineBuffer, InlineBufferLength);
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsHostSetReceiveCallback (
+    IN  EFI_EMCL_PROTOCOL *This,
+    IN  EFI_EMCL_RECEIVE_PACKET ReceiveCallback OPTIONAL,
+    IN  VOID *ReceiveContext OPTIONAL,
+    IN  EFI_TPL Tpl
+    )
+{
+    VMBFS_HOST_ENDPOINT *endpoint = GetEndpoint(This);
+
+    endpoint->ReceiveCallback = ReceiveCallback;
+    endpoint->ReceiveContext = ReceiveContext;
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsHostCreateGpaRange (
+    IN  EFI_EMCL_PROTOCOL *This,
+    IN  UINT32 Handle,
+    IN  EFI_EXTERNAL_BUFFER *ExternalBuffers,
+    IN  UINT32 ExternalBufferCount,
+    IN  BOOLEAN Writable
+    )
+{
+    VMBFS_HOST_ENDPOINT *endpoint = GetEndpoint(This);
+    UINTN index;
+
+    //
+    // Handles must be unique among the ranges that are in use.
+    //
+    if (ExternalBufferCount != 1 ||
+        VmbfsHostLookupGpaRange(endpoint, Handle) != NULL)
+    {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (index = 0; index < VMBFS_HOST_MAXIMUM_GPA_RANGES; index++)
+    {
+        if (!endpoint->GpaRanges[index].InUse)
+        {
+            endpoint->GpaRanges[index].InUse = TRUE;
+            endpoint->GpaRanges[index].Handle = Handle;
+            endpoint->GpaRanges[index].Writable = Writable;
+            endpoint->GpaRanges[index].Buffer = ExternalBuffers[0];
+            return EFI_SUCCESS;
+        }
+    }
+
+    return EFI_OUT_OF_RESOURCES;
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsHostDestroyGpaRange (
+    IN  EFI_EMCL_PROTOCOL *This,
+    IN  UINT32 Handle
+    )
+{
+    VMBFS_HOST_GPA_RANGE *gpaRange;
+
+    gpaRange = VmbfsHostLookupGpaRange(GetEndpoint(This), Handle);
+    if (gpaRange == NULL)
+    {
+        return EFI_NOT_FOUND;
+    }
+
+    gpaRange->InUse = FALSE;
+    return EFI_SUCCESS;
+}
+
+
+VOID
+VmbfsHostEndpointInitialize (
+    OUT VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  UINT32 MaximumVersion,
+    IN  CONST VMBFS_HOST_FILE *Files,
+    IN  UINTN FileCount
+    )
+/*++
+
+Routine Description:
+
+    Initializes a host endpoint serving the given files.
+
+Arguments:
+
+    Endpoint - The host endpoint to initialize.
+
+    MaximumVersion - The newest protocol version the endpoint accepts.
+
+    Files - The files served by the endpoint. Paths are absolute and use
+        backslash separators, as sent by the client.
+
+    FileCount - The number of entries in Files.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ZeroMem(Endpoint, sizeof(*Endpoint));
+
+    Endpoint->Emcl.StartChannel = VmbfsHostStartChannel;
+    Endpoint->Emcl.StopChannel = VmbfsHostStopChannel;
+    Endpoint->Emcl.SendPacket = VmbfsHostSendPacket;
+    Endpoint->Emcl.SetReceiveCallback = VmbfsHostSetReceiveCallback;
+    Endpoint->Emcl.CreateGpaRange = VmbfsHostCreateGpaRange;
+    Endpoint->Emcl.DestroyGpaRange = VmbfsHostDestroyGpaRange;
+
+    Endpoint->MaximumVersion = MaximumVersion;
+    Endpoint->Files = Files;
+    Endpoint->FileCount = FileCount;
+}
+
+
+BOOLEAN
+VmbfsHostEndpointDeliverResponse (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint
+    )
+/*++
+
+Routine Description:
+
+    Delivers the oldest queued response to the client's receive callback.
+
+Arguments:
+
+    Endpoint - The host endpoint.
+
+Return Value:
+
+    TRUE if a response was delivered, FALSE if none was queued.
+
+--*/
+{
+    VMBFS_HOST_RESPONSE *response;
+
+    if (Endpoint->ResponseCount == 0 || Endpoint->ReceiveCallback == NULL)
+    {
+        return FALSE;
+    }
+
+    response = &Endpoint->Responses[Endpoint->ResponseHead];
+    Endpoint->ResponseHead = (Endpoint->ResponseHead + 1) % VMBFS_HOST_MAXIMUM_QUEUED_RESPONSES;
+    Endpoint->ResponseCount--;
+
+    Endpoint->ReceiveCallback(Endpoint->ReceiveContext,
+                              NULL,
+                              response->Buffer,
+                              response->Size,
+                              0,
+                              0,
+                              NULL);
+
+    return TRUE;
+}
@@ -0,0 +1,88 @@
+/** @file
+    A local stand-in for the host side of the VMBus file system protocol.
+
+    The endpoint implements EFI_EMCL_PROTOCOL over a table of in-memory files
+    so that the vmbfs client can be exercised without Hyper-V. Requests are
+    handled as soon as they are sent and their responses are queued until the
+    client waits for them, which lets pipelined requests build up.
+
+    Copyright (c) Microsoft Corporation.
+    SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+#pragma once
+
+#include <Uefi.h>
+#include <Protocol/Emcl.h>
+#include <Protocol/VmbusFileSystem.h>
+
+#define VMBFS_HOST_MAXIMUM_QUEUED_RESPONSES 32
+#define VMBFS_HOST_MAXIMUM_GPA_RANGES 32
+#define VMBFS_HOST_MAXIMUM_OPEN_FILES 32
+
+typedef struct _VMBFS_HOST_FILE
+{
+    CONST CHAR16 *Path;
+    BOOLEAN IsDirectory;
+    BOOLEAN RdmaCapable;
+    CONST UINT8 *Data;
+    UINT64 Size;
+} VMBFS_HOST_FILE;
+
+typedef struct _VMBFS_HOST_GPA_RANGE
+{
+    BOOLEAN InUse;
+    UINT32 Handle;
+    BOOLEAN Writable;
+    EFI_EXTERNAL_BUFFER Buffer;
+} VMBFS_HOST_GPA_RANGE;
+
+typedef struct _VMBFS_HOST_RESPONSE
+{
+    UINT32 Size;
+    UINT8 Buffer[VMBFS_MAXIMUM_MESSAGE_SIZE];
+} VMBFS_HOST_RESPONSE;
+
+typedef struct _VMBFS_HOST_ENDPOINT
+{
+    //
+    // Must be first; the endpoint is recovered from the protocol pointer.
+    //
+    EFI_EMCL_PROTOCOL Emcl;
+
+    UINT32 MaximumVersion;
+    CONST VMBFS_HOST_FILE *Files;
+    UINTN FileCount;
+
+    EFI_EMCL_RECEIVE_PACKET ReceiveCallback;
+    VOID *ReceiveContext;
+    BOOLEAN ChannelStarted;
+    UINT32 NegotiatedVersion;
+
+    VMBFS_HOST_GPA_RANGE GpaRanges[VMBFS_HOST_MAXIMUM_GPA_RANGES];
+    CONST VMBFS_HOST_FILE *OpenFiles[VMBFS_HOST_MAXIMUM_OPEN_FILES];
+
+    VMBFS_HOST_RESPONSE Responses[VMBFS_HOST_MAXIMUM_QUEUED_RESPONSES];
+    UINT32 ResponseHead;
+    UINT32 ResponseCount;
+
+    //
+    // Statistics checked by the tests.
+    //
+    UINT32 RequestCount[VmbfsMessageTypeMax];
+    UINT32 MaximumResponsesQueued;
+    UINT64 PathBytesReceived;
+    UINT32 OpenFileCount;
+} VMBFS_HOST_ENDPOINT;
+
+VOID
+VmbfsHostEndpointInitialize (
+    OUT VMBFS_HOST_ENDPOINT *Endpoint,
+    IN  UINT32 MaximumVersion,
+    IN  CONST VMBFS_HOST_FILE *Files,
+    IN  UINTN FileCount
+    );
+
+BOOLEAN
+VmbfsHostEndpointDeliverResponse (
+    IN  VMBFS_HOST_ENDPOINT *Endpoint
+    );
@@ -15,6 +15,15 @@ const EFI_SIMPLE_FILE_SYSTEM_PROTOCOL gVmbFsSimpleFileSystemProtocol =
     (EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_OPEN_VOLUME)    VmbfsOpenVolume
 };
 
+//
+// Protocol versions offered to the host, newest first.
+//
+const UINT32 mVmbfsProtocolVersions[] =
+{
+    VMBFS_VERSION_FILE_HANDLES,
+    VMBFS_VERSION_WIN10
+};
+
 const EFI_FILE_SYSTEM_INFO gVmbFsEfiFileSystemInfoPrototype =
 {
     sizeof(EFI_FILE_SYSTEM_INFO),
@@ -56,6 +65,17 @@ Return Value:
 
     if (VmbfsSimpleFileSystemProtocol != NULL)
     {
+        VmbfsCacheReportStatistics(&fileSystemInformation->Cache);
+
+        if (fileSystemInformation->MetadataHits > 0)
+        {
+            DEBUG((DEBUG_INFO,
+                   "Vmbfs metadata cache: %ld lookups answered without the host\n",
+                   fileSystemInformation->MetadataHits));
+        }
+
+        VmbfsMetadataFlush(fileSystemInformation);
+
         if (ChannelOpened)
         {
             fileSystemInformation->EmclProtocol->StopChannel(
@@ -71,6 +91,12 @@ Return Value:
         {
             gBS->FreePool(fileSystemInformation->PacketBuffer);
         }
+
+        if (fileSystemInformation->ReadWindow != NULL)
+        {
+            gBS->FreePool(fileSystemInformation->ReadWindow);
+            fileSystemInformation->ReadWindow = NULL;
+        }
     }
 }
 
@@ -119,6 +145,7 @@ Return Value:
     VMBFS_MESSAGE_VERSION_REQUEST VersionRequestMessage;
     PVMBFS_MESSAGE_VERSION_RESPONSE VersionResponseMessage;
     BOOLEAN ChannelOpened = FALSE;
+    UINTN versionIndex;
 
     ZeroMem(&VersionRequestMessage, sizeof(VMBFS_MESSAGE_VERSION_REQUEST));
 
@@ -130,6 +157,11 @@ Return Value:
         return EFI_SUCCESS;
     }
 
+    InitializeListHead(&fileSystemInformation->MetadataList);
+    fileSystemInformation->MetadataEntryCount = 0;
+    fileSystemInformation->MetadataNotFoundCount = 0;
+    fileSystemInformation->MetadataEntryLimit = PcdGet32(PcdVmbfsMetadataCacheEntries);
+
     //
     // Allocate and initialize datastructures.
     //
@@ -157,6 +189,29 @@ Return Value:
 
     ZeroMem(fileSystemInformation->PacketBuffer, VMBFS_MAXIMUM_MESSAGE_SIZE);
 
+    //
+    // Allocate the window of outstanding RDMA read requests.
+    //
+    fileSystemInformation->ReadWindowSize = PcdGet32(PcdVmbfsMaxOutstandingReads);
+    fileSystemInformation->ReadWindowSize = MAX(fileSystemInformation->ReadWindowSize, 1);
+    fileSystemInformation->ReadWindowSize = MIN(fileSystemInformation->ReadWindowSize, VMBFS_MAXIMUM_READ_WINDOW);
+    fileSystemInformation->ReadWindowOldest = 0;
+    fileSystemInformation->ReadsOutstanding = 0;
+    fileSystemInformation->ReadWindowAbandoned = 0;
+    fileSystemInformation->ReadsAbandoned = 0;
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               fileSystemInformation->ReadWindowSize * sizeof(VMBFS_READ_REQUEST),
+                               (void**)&fileSystemInformation->ReadWindow);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    ZeroMem(fileSystemInformation->ReadWindow,
+            fileSystemInformation->ReadWindowSize * sizeof(VMBFS_READ_REQUEST));
+
     status = gBS->AllocatePool(EfiBootServicesData, sizeof(*allocatedFileProtocol), (void**)&allocatedFileProtocol);
 
     if (EFI_ERROR(status))
@@ -202,34 +257,50 @@ Return Value:
     ChannelOpened = TRUE;
 
     //
-    // Negotiate protocol with the host.
+    // Negotiate protocol with the host, falling back to older versions until
+    // one is accepted.
     //
-    VersionRequestMessage.Header.Type = VmbfsMessageTypeVersionRequest;
-    VersionRequestMessage.RequestedVersion = VMBFS_VERSION_WIN10;
-
-    status = VmbfsSendReceivePacket(fileSystemInformation,
-                                    &VersionRequestMessage,
-                                    sizeof(VersionRequestMessage),
-                                    0,
-                                    NULL,
-                                    0,
-                                    FALSE);
-
-    VersionResponseMessage = (PVMBFS_MESSAGE_VERSION_RESPONSE)fileSystemInformation->PacketBuffer;
-    bytesRead = fileSystemInformation->PacketSize;
-
-    if (bytesRead != sizeof(*VersionResponseMessage) ||
-        VersionResponseMessage->Header.Type != VmbfsMessageTypeVersionResponse)
+    for (versionIndex = 0; versionIndex < ARRAY_SIZE(mVmbfsProtocolVersions); versionIndex++)
     {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        VersionRequestMessage.Header.Type = VmbfsMessageTypeVersionRequest;
+        VersionRequestMessage.RequestedVersion = mVmbfsProtocolVersions[versionIndex];
+
+        status = VmbfsSendReceivePacket(fileSystemInformation,
+                                        &VersionRequestMessage,
+                                        sizeof(VersionRequestMessage),
+                                        0,
+                                        NULL,
+                                        0,
+                                        FALSE);
+
+        if (EFI_ERROR(status))
+        {
+            goto Cleanup;
+        }
+
+        VersionResponseMessage = (PVMBFS_MESSAGE_VERSION_RESPONSE)fileSystemInformation->PacketBuffer;
+        bytesRead = fileSystemInformation->PacketSize;
+
+        if (bytesRead != sizeof(*VersionResponseMessage) ||
+            VersionResponseMessage->Header.Type != VmbfsMessageTypeVersionResponse)
+        {
+            FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        }
+
+        if (VersionResponseMessage->Status == VmbfsVersionSupported)
+        {
+            break;
+        }
     }
 
-    if (VersionResponseMessage->Status != VmbfsVersionSupported)
+    if (versionIndex == ARRAY_SIZE(mVmbfsProtocolVersions))
     {
         status = EFI_DEVICE_ERROR;
         goto Cleanup;
     }
 
+    fileSystemInformation->ProtocolVersion = mVmbfsProtocolVersions[versionIndex];
+
     ASSIGN_STRUCT(&allocatedFileProtocol->EfiFileProtocol, &gVmbFsEfiFileProtocol);
 
     fileInformation->FileSystem = (PVMBFS_SIMPLE_FILE_SYSTEM_PROTOCOL)This;
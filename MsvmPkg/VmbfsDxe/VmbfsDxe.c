@@ -196,6 +196,16 @@ Return Value:
     fileSystemInformation = &simpleFileSystemProtocol->FileSystemInformation;
     ZeroMem(fileSystemInformation, sizeof(*fileSystemInformation));
 
+    //
+    // The file data cache is optional; run without it if it cannot be
+    // allocated.
+    //
+    if (EFI_ERROR(VmbfsCacheInitialize(&fileSystemInformation->Cache,
+                                       PcdGet32(PcdVmbfsCacheBlockCount))))
+    {
+        DEBUG((DEBUG_WARN, "Vmbfs cache could not be allocated\n"));
+    }
+
     status = gBS->OpenProtocol(
         ControllerHandle,
         &gEfiDevicePathProtocolGuid,
@@ -310,6 +320,8 @@ Return Value:
                            ControllerHandle);
     }
 
+    VmbfsCacheFree(&fileSystemInformation->Cache);
+
     gBS->FreePool(SimpleFileSystemProtocol);
 }
 
@@ -537,6 +549,9 @@ Return Value:
 
 --*/
 {
+    PFILESYSTEM_INFORMATION fileSystemInformation;
+    CHAR16 *name;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *simpleFileSystemProtocol;
     EFI_STATUS status;
 
     //
@@ -560,12 +575,41 @@ Return Value:
         return EFI_UNSUPPORTED;
     }
 
-    return LookupUnicodeString2(
+    status = LookupUnicodeString2(
         Language,
         This->SupportedLanguages,
         gVmbfsControllerNameTable,
-        ControllerName,
+        &name,
         (BOOLEAN)(This == &gVmbfsComponentName));
+    if (EFI_ERROR(status))
+    {
+        return status;
+    }
+
+    //
+    // Report the block cache statistics of the volume with its name.
+    //
+    status = gBS->OpenProtocol(
+        ControllerHandle,
+        &gEfiSimpleFileSystemProtocolGuid,
+        (VOID **)&simpleFileSystemProtocol,
+        gVmbfsDriverBindingProtocol.DriverBindingHandle,
+        ControllerHandle,
+        EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+    if (EFI_ERROR(status))
+    {
+        *ControllerName = name;
+        return EFI_SUCCESS;
+    }
+
+    fileSystemInformation = GetThisFileSystemInformation(simpleFileSystemProtocol);
+    VmbfsCacheFormatStatistics(&fileSystemInformation->Cache,
+                               name,
+                               fileSystemInformation->ControllerName,
+                               sizeof(fileSystemInformation->ControllerName));
+
+    *ControllerName = fileSystemInformation->ControllerName;
+    return EFI_SUCCESS;
 }
 
 
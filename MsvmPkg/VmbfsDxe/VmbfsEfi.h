@@ -26,6 +26,7 @@
 #include <Library/CrashLib.h>
 #include <Library/DebugLib.h>
 #include <Library/PrintLib.h>
+#include <Library/PcdLib.h>
 #include <Library/EmclLib.h>
 
 
@@ -43,6 +44,105 @@
 //
 #define VMBFS_MAXIMUM_RDMA_SIZE (7 * 1024 * 1024)
 
+//
+// Upper bound on PcdVmbfsMaxOutstandingReads.
+//
+#define VMBFS_MAXIMUM_READ_WINDOW 16
+
+//
+// An RDMA read request in flight. The host answers pipe requests in the order
+// they were sent, so responses are matched to the oldest outstanding request.
+// Each request in the window uses its own GPA range handle, which is the
+// transaction ID of the request.
+//
+typedef struct _VMBFS_READ_REQUEST {
+    UINT32 Handle;
+    UINT32 ByteCount;
+    UINT64 FileOffset;
+    BOOLEAN Completed;
+    UINT32 Status;
+    UINT32 BytesRead;
+} VMBFS_READ_REQUEST, *PVMBFS_READ_REQUEST;
+
+//
+// File data is cached in blocks of VMBFS_CACHE_BLOCK_SIZE bytes. Missing
+// blocks are fetched from the host in runs of at most VMBFS_CACHE_FILL_BLOCKS,
+// and sequential reads fetch up to VMBFS_CACHE_PREFETCH_BLOCKS blocks past
+// the end of the request.
+//
+#define VMBFS_CACHE_BLOCK_SIZE SIZE_64KB
+#define VMBFS_CACHE_FILL_BLOCKS 8
+#define VMBFS_CACHE_PREFETCH_BLOCKS 4
+
+//
+// Length, in characters, of the controller name reported through the
+// component name protocols. It carries the block cache statistics.
+//
+#define VMBFS_CONTROLLER_NAME_LENGTH 128
+
+//
+// Cache identity of a file. Files are identified by path so that blocks are
+// shared by every handle to the file, including handles opened after the
+// first one was closed.
+//
+typedef struct _VMBFS_CACHE_FILE {
+    LIST_ENTRY ListEntry;
+    UINT32 FileId;
+    UINT64 FileSize;
+    UINTN FilePathLength;
+    CHAR16 FilePath[];
+} VMBFS_CACHE_FILE, *PVMBFS_CACHE_FILE;
+
+typedef struct _VMBFS_CACHE_BLOCK {
+    LIST_ENTRY ListEntry;
+    LIST_ENTRY HashEntry;
+    BOOLEAN Valid;
+    UINT32 FileId;
+    UINT64 BlockIndex;
+    UINT32 DataLength;
+    UINT8 *Data;
+} VMBFS_CACHE_BLOCK, *PVMBFS_CACHE_BLOCK;
+
+typedef struct _VMBFS_CACHE {
+    UINT32 BlockCount;
+    VMBFS_CACHE_BLOCK *Blocks;
+    UINT8 *BlockData;
+    UINT8 *FillBuffer;
+
+    //
+    // Blocks ordered from most to least recently used. Invalid blocks are
+    // kept at the least recently used end so that they are reused first.
+    //
+    LIST_ENTRY LruList;
+
+    //
+    // Valid blocks hashed by file and block index. The bucket count is a
+    // power of two no smaller than the block count.
+    //
+    LIST_ENTRY *HashBuckets;
+    UINT32 HashBucketMask;
+
+    LIST_ENTRY FileList;
+    UINT32 NextFileId;
+
+    UINT64 Hits;
+    UINT64 Misses;
+    UINT64 PrefetchedBlocks;
+} VMBFS_CACHE, *PVMBFS_CACHE;
+
+//
+// Result of a host lookup of a path, kept so that repeated probes of the same
+// path do not go to the host. Paths that were not found are cached as well.
+//
+typedef struct _VMBFS_METADATA_ENTRY {
+    LIST_ENTRY ListEntry;
+    BOOLEAN Found;
+    UINT32 Flags;
+    UINT64 FileSize;
+    UINTN FilePathLength;
+    CHAR16 FilePath[];
+} VMBFS_METADATA_ENTRY, *PVMBFS_METADATA_ENTRY;
+
 typedef struct _FILESYSTEM_INFORMATION {
     EFI_DEVICE_PATH_PROTOCOL *DevicePathProtocol;
     EFI_EMCL_PROTOCOL *EmclProtocol;
@@ -51,6 +151,34 @@ typedef struct _FILESYSTEM_INFORMATION {
     UINT8 *PacketBuffer;
     UINT32 PacketSize;
     SPIN_LOCK VmbusIoLock;
+    UINT32 ProtocolVersion;
+    VMBFS_READ_REQUEST *ReadWindow;
+    UINT32 ReadWindowSize;
+    UINT32 ReadWindowOldest;
+    UINT32 ReadsOutstanding;
+
+    //
+    // Requests left in the window by a read that failed to wait for them,
+    // starting at ReadWindowAbandoned. Their GPA ranges are kept until the
+    // host responds.
+    //
+    UINT32 ReadWindowAbandoned;
+    UINT32 ReadsAbandoned;
+
+    VMBFS_CACHE Cache;
+
+    //
+    // Path lookups in most recently used order. Valid while the volume is open.
+    // Paths that were not found may take at most half of the entries, so that
+    // probing for many missing paths does not push out the files being used.
+    //
+    LIST_ENTRY MetadataList;
+    UINT32 MetadataEntryCount;
+    UINT32 MetadataEntryLimit;
+    UINT32 MetadataNotFoundCount;
+    UINT64 MetadataHits;
+
+    CHAR16 ControllerName[VMBFS_CONTROLLER_NAME_LENGTH];
 } FILESYSTEM_INFORMATION, *PFILESYSTEM_INFORMATION;
 
 typedef struct _VMBFS_SIMPLE_FILE_SYSTEM_PROTOCOL {
@@ -65,6 +193,10 @@ typedef struct _FILE_INFORMATION {
     PVMBFS_SIMPLE_FILE_SYSTEM_PROTOCOL FileSystem;
     UINT64 FileOffset;
     UINTN FilePathLength;
+    BOOLEAN HostFileHandleValid;
+    UINT64 HostFileHandle;
+    UINT32 CacheFileId;
+    UINT64 CacheNextOffset;
 } FILE_INFORMATION, *PFILE_INFORMATION;
 
 typedef struct _VMBFS_FILE {
@@ -105,6 +237,61 @@ VmbfsCloseVolume (
     IN  BOOLEAN ChannelOpened
     );
 
+//
+// Block cache.
+//
+EFI_STATUS
+VmbfsCacheInitialize (
+    OUT PVMBFS_CACHE Cache,
+    IN  UINT32 BlockCount
+    );
+
+VOID
+VmbfsCacheFree (
+    IN  PVMBFS_CACHE Cache
+    );
+
+VOID
+VmbfsCacheReportStatistics (
+    IN  PVMBFS_CACHE Cache
+    );
+
+VOID
+VmbfsCacheFormatStatistics (
+    IN  PVMBFS_CACHE Cache,
+    IN  CONST CHAR16 *Name,
+    OUT CHAR16 *Buffer,
+    IN  UINTN BufferSize
+    );
+
+UINT32
+VmbfsCacheGetFileId (
+    IN  PVMBFS_CACHE Cache,
+    IN  CONST CHAR16 *FilePath,
+    IN  UINTN FilePathLength,
+    IN  UINT64 FileSize
+    );
+
+VOID
+VmbfsCacheInvalidateFile (
+    IN  PFILE_INFORMATION FileInformation
+    );
+
+PVMBFS_CACHE_BLOCK
+VmbfsCacheLookup (
+    IN  PVMBFS_CACHE Cache,
+    IN  UINT32 FileId,
+    IN  UINT64 BlockIndex
+    );
+
+//
+// Path lookup cache.
+//
+VOID
+VmbfsMetadataFlush (
+    IN  PFILESYSTEM_INFORMATION FileSystemInformation
+    );
+
 //
 // File protocol implementation.
 //
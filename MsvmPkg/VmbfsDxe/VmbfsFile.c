@@ -51,9 +51,12 @@ VmbfsReceivePacketCallback (
 
 Routine Description:
 
-    Callback for receiving a packet in the VMBus pipe. Copies the in-place
-    buffer to the buffer in the FILESYSTEM_INFORMATION context and signals
-    the receiver.
+    Callback for receiving a packet in the VMBus pipe. If RDMA reads are
+    outstanding, the packet is the response to the oldest of them and its
+    result is recorded in the read window. An RDMA read response that matches
+    no outstanding request is dropped. Otherwise copies the in-place buffer to
+    the buffer in the FILESYSTEM_INFORMATION context. The receiver is
+    signaled unless the packet was dropped.
 
 Arguments:
 
@@ -80,6 +83,8 @@ Return Value:
 
 {
     PFILESYSTEM_INFORMATION fileSystemInformation;
+    PVMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE readFileResponseMessage;
+    PVMBFS_READ_REQUEST readRequest;
 
     fileSystemInformation = (PFILESYSTEM_INFORMATION)ReceiveContext;
 
@@ -88,13 +93,121 @@ Return Value:
         FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
     }
 
-    CopyMem(fileSystemInformation->PacketBuffer, Buffer, BufferLength);
-    fileSystemInformation->PacketSize = BufferLength;
+    if (fileSystemInformation->ReadsOutstanding > 0)
+    {
+        //
+        // The host handles pipe requests in order, so this is the response to
+        // the oldest outstanding read.
+        //
+        readFileResponseMessage = (PVMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE)Buffer;
+        readRequest = &fileSystemInformation->ReadWindow[fileSystemInformation->ReadWindowOldest];
+
+        if (BufferLength < sizeof(*readFileResponseMessage) ||
+            readFileResponseMessage->Header.Type != VmbfsMessageTypeReadFileRdmaResponse ||
+            readFileResponseMessage->ByteCount > readRequest->ByteCount)
+        {
+            FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        }
+
+        readRequest->Status = readFileResponseMessage->Status;
+        readRequest->BytesRead = readFileResponseMessage->ByteCount;
+        readRequest->Completed = TRUE;
+
+        fileSystemInformation->ReadWindowOldest =
+            (fileSystemInformation->ReadWindowOldest + 1) % fileSystemInformation->ReadWindowSize;
+
+        fileSystemInformation->ReadsOutstanding--;
+    }
+    else if (BufferLength >= sizeof(VMBFS_MESSAGE_HEADER) &&
+             ((PVMBFS_MESSAGE_HEADER)Buffer)->Type == VmbfsMessageTypeReadFileRdmaResponse)
+    {
+        //
+        // Handing it to the synchronous request waiting for its own response
+        // would complete that request with the wrong message.
+        //
+        DEBUG((DEBUG_WARN, "Vmbfs: dropping RDMA read response with no outstanding request\n"));
+        return;
+    }
+    else
+    {
+        CopyMem(fileSystemInformation->PacketBuffer, Buffer, BufferLength);
+        fileSystemInformation->PacketSize = BufferLength;
+    }
 
     gBS->SignalEvent(fileSystemInformation->ReceivePacketEvent);
 }
 
 
+EFI_STATUS
+VmbfsRetireAbandonedReads (
+    IN  PFILESYSTEM_INFORMATION FileSystemInformation
+    )
+
+/*++
+
+Routine Description:
+
+    Waits for the host to respond to the RDMA reads abandoned by a failed
+    VmbfsReadRdma, and destroys their GPA ranges. The host may write through
+    a GPA range until it has responded, so the range is not destroyed
+    earlier. Must be called with the VMBus I/O lock held, before anything
+    else is sent on the pipe.
+
+Arguments:
+
+    FileSystemInformation - The FileSystemInformation context.
+
+Return Value:
+
+    EFI_SUCCESS once no reads are abandoned.
+
+    Error code of WaitForEvent otherwise.
+
+--*/
+
+{
+    volatile VMBFS_READ_REQUEST *readRequest;
+    EFI_STATUS status;
+    UINTN eventIndex;
+
+    if (FileSystemInformation->ReadsAbandoned == 0)
+    {
+        return EFI_SUCCESS;
+    }
+
+    while (FileSystemInformation->ReadsAbandoned > 0)
+    {
+        readRequest = &FileSystemInformation->ReadWindow[FileSystemInformation->ReadWindowAbandoned];
+        while (!readRequest->Completed)
+        {
+            status = gBS->WaitForEvent(1, &FileSystemInformation->ReceivePacketEvent, &eventIndex);
+            if (EFI_ERROR(status))
+            {
+                return status;
+            }
+        }
+
+        FileSystemInformation->EmclProtocol->DestroyGpaRange(
+                FileSystemInformation->EmclProtocol,
+                readRequest->Handle);
+
+        FileSystemInformation->ReadWindowAbandoned =
+            (FileSystemInformation->ReadWindowAbandoned + 1) % FileSystemInformation->ReadWindowSize;
+
+        FileSystemInformation->ReadsAbandoned--;
+    }
+
+    ASSERT(FileSystemInformation->ReadsOutstanding == 0);
+
+    //
+    // Clear the signals of responses that were not waited on.
+    //
+    gBS->CheckEvent(FileSystemInformation->ReceivePacketEvent);
+
+    return EFI_SUCCESS;
+}
+
+
 EFI_STATUS
 VmbfsSendReceivePacket (
     IN  PFILESYSTEM_INFORMATION FileSystemInformation,
@@ -149,6 +262,12 @@ Return Value:
 
     AcquireSpinLock(&FileSystemInformation->VmbusIoLock);
 
+    status = VmbfsRetireAbandonedReads(FileSystemInformation);
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
     if (ExternalBufferLength > 0)
     {
         externalBuffers[0].Buffer = ExternalBuffer;
@@ -204,6 +323,326 @@ Cleanup:
 }
 
 
+EFI_STATUS
+VmbfsQueryHostFile (
+    IN  PFILE_INFORMATION FileInformation,
+    IN  CONST CHAR16 *FilePath,
+    IN  UINTN FilePathLengthInBytes,
+    IN  BOOLEAN OpenFile,
+    OUT UINT32 *Flags,
+    OUT UINT64 *FileSize,
+    OUT UINT64 *HostFileHandle
+    )
+
+/*++
+
+Routine Description:
+
+    Looks up a file on the host with a GetFileInfo message, or with an
+    OpenFile message if a host file handle is wanted. Both carry only the path,
+    and the OpenFile response extends the GetFileInfo response with the file
+    handle.
+
+Arguments:
+
+    FileInformation - Any file on the volume.
+
+    FilePath - The path of the file, without a terminating NULL.
+
+    FilePathLengthInBytes - The length of the path in bytes.
+
+    OpenFile - TRUE to open a host file handle for the file.
+
+    Flags - On success, the VMBFS_GET_FILE_INFO_FLAG_* flags of the file.
+
+    FileSize - On success, the size of the file.
+
+    HostFileHandle - On success, the host file handle if OpenFile is TRUE.
+
+Return Value:
+
+    EFI_SUCCESS - The file was found.
+
+    EFI_NOT_FOUND - The file does not exist on the host.
+
+    EFI_DEVICE_ERROR - The host reported an error.
+
+--*/
+
+{
+    PVMBFS_MESSAGE_GET_FILE_INFO getFileInfoMessage;
+    PVMBFS_MESSAGE_GET_FILE_INFO_RESPONSE getFileInfoResponseMessage;
+    PVMBFS_MESSAGE_OPEN_FILE_RESPONSE openFileResponseMessage;
+    UINTN expectedResponseSize;
+    EFI_STATUS status;
+
+    if (FilePathLengthInBytes > VMBFS_MAXIMUM_PAYLOAD_SIZE(*getFileInfoMessage))
+    {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    getFileInfoMessage = GetPacketBuffer(FileInformation, VMBFS_MESSAGE_GET_FILE_INFO);
+    ZeroMem(getFileInfoMessage, sizeof(*getFileInfoMessage));
+
+    if (OpenFile)
+    {
+        getFileInfoMessage->Header.Type = VmbfsMessageTypeOpenFile;
+        expectedResponseSize = sizeof(VMBFS_MESSAGE_OPEN_FILE_RESPONSE);
+    }
+    else
+    {
+        getFileInfoMessage->Header.Type = VmbfsMessageTypeGetFileInfo;
+        expectedResponseSize = sizeof(VMBFS_MESSAGE_GET_FILE_INFO_RESPONSE);
+    }
+
+    CopyMem(getFileInfoMessage->FilePath,
+            FilePath,
+            FilePathLengthInBytes);
+
+    status = VmbfsSendReceivePacket(GetFileSystemInformation(FileInformation),
+                                    getFileInfoMessage,
+                                    sizeof(*getFileInfoMessage) + FilePathLengthInBytes,
+                                    0,
+                                    NULL,
+                                    0,
+                                    FALSE);
+
+    if (EFI_ERROR(status))
+    {
+        return status;
+    }
+
+    getFileInfoResponseMessage = GetPacketBuffer(FileInformation, VMBFS_MESSAGE_GET_FILE_INFO_RESPONSE);
+    openFileResponseMessage = GetPacketBuffer(FileInformation, VMBFS_MESSAGE_OPEN_FILE_RESPONSE);
+
+    if (GetPacketSize(FileInformation) != expectedResponseSize ||
+        getFileInfoResponseMessage->Header.Type !=
+            (OpenFile ? VmbfsMessageTypeOpenFileResponse : VmbfsMessageTypeGetFileInfoResponse))
+    {
+        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    }
+
+    if (getFileInfoResponseMessage->Status == VmbfsFileNotFound)
+    {
+        return EFI_NOT_FOUND;
+    }
+
+    if (getFileInfoResponseMessage->Status != VmbfsFileSuccess)
+    {
+        return EFI_DEVICE_ERROR;
+    }
+
+    *Flags = getFileInfoResponseMessage->Flags;
+    *FileSize = getFileInfoResponseMessage->FileSize;
+
+    if (OpenFile)
+    {
+        *HostFileHandle = openFileResponseMessage->FileHandle;
+    }
+
+    return EFI_SUCCESS;
+}
+
+
+PVMBFS_METADATA_ENTRY
+VmbfsMetadataLookup (
+    IN  PFILESYSTEM_INFORMATION FileSystemInformation,
+    IN  CONST CHAR16 *FilePath,
+    IN  UINTN FilePathLength
+    )
+
+/*++
+
+Routine Description:
+
+    Finds the result of an earlier host lookup of a path on the volume.
+
+Arguments:
+
+    FileSystemInformation - The volume.
+
+    FilePath - The path of the file.
+
+    FilePathLength - The length of the path in characters.
+
+Return Value:
+
+    The cache entry, or NULL if the path must be looked up on the host.
+
+--*/
+
+{
+    LIST_ENTRY *entry;
+    PVMBFS_METADATA_ENTRY metadataEntry;
+
+    for (entry = GetFirstNode(&FileSystemInformation->MetadataList);
+         !IsNull(&FileSystemInformation->MetadataList, entry);
+         entry = GetNextNode(&FileSystemInformation->MetadataList, entry))
+    {
+        metadataEntry = BASE_CR(entry, VMBFS_METADATA_ENTRY, ListEntry);
+
+        if (metadataEntry->FilePathLength == FilePathLength &&
+            CompareMem(metadataEntry->FilePath, FilePath, FilePathLength * sizeof(CHAR16)) == 0)
+        {
+            //
+            // Keep the list in most recently used order.
+            //
+            RemoveEntryList(entry);
+            InsertHeadList(&FileSystemInformation->MetadataList, entry);
+            FileSystemInformation->MetadataHits++;
+            return metadataEntry;
+        }
+    }
+
+    return NULL;
+}
+
+
+VOID
+VmbfsMetadataInsert (
+    IN  PFILESYSTEM_INFORMATION FileSystemInformation,
+    IN  CONST CHAR16 *FilePath,
+    IN  UINTN FilePathLength,
+    IN  BOOLEAN Found,
+    IN  UINT32 Flags,
+    IN  UINT64 FileSize
+    )
+
+/*++
+
+Routine Description:
+
+    Records the result of a host lookup of a path on the volume, evicting the
+    least recently used entry if the cache is full. A path that was not found
+    evicts the least recently used path that was not found instead once those
+    fill half of the cache. Failures are ignored since the path is then looked
+    up on the host again.
+
+Arguments:
+
+    FileSystemInformation - The volume.
+
+    FilePath - The path of the file.
+
+    FilePathLength - The length of the path in characters.
+
+    Found - FALSE if the file does not exist on the host.
+
+    Flags - The VMBFS_GET_FILE_INFO_FLAG_* flags of the file.
+
+    FileSize - The size of the file.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    LIST_ENTRY *entry;
+    PVMBFS_METADATA_ENTRY metadataEntry;
+    PVMBFS_METADATA_ENTRY evictedEntry;
+    EFI_STATUS status;
+
+    if (FileSystemInformation->MetadataEntryLimit == 0)
+    {
+        return;
+    }
+
+    evictedEntry = NULL;
+    if (!Found &&
+        FileSystemInformation->MetadataNotFoundCount >= MAX(FileSystemInformation->MetadataEntryLimit / 2, 1))
+    {
+        for (entry = GetPreviousNode(&FileSystemInformation->MetadataList, &FileSystemInformation->MetadataList);
+             !IsNull(&FileSystemInformation->MetadataList, entry);
+             entry = GetPreviousNode(&FileSystemInformation->MetadataList, entry))
+        {
+            metadataEntry = BASE_CR(entry, VMBFS_METADATA_ENTRY, ListEntry);
+            if (!metadataEntry->Found)
+            {
+                evictedEntry = metadataEntry;
+                break;
+            }
+        }
+    }
+    else if (FileSystemInformation->MetadataEntryCount >= FileSystemInformation->MetadataEntryLimit)
+    {
+        entry = GetPreviousNode(&FileSystemInformation->MetadataList, &FileSystemInformation->MetadataList);
+        evictedEntry = BASE_CR(entry, VMBFS_METADATA_ENTRY, ListEntry);
+    }
+
+    if (evictedEntry != NULL)
+    {
+        if (!evictedEntry->Found)
+        {
+            FileSystemInformation->MetadataNotFoundCount--;
+        }
+
+        RemoveEntryList(&evictedEntry->ListEntry);
+        gBS->FreePool(evictedEntry);
+        FileSystemInformation->MetadataEntryCount--;
+    }
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               sizeof(*metadataEntry) + FilePathLength * sizeof(CHAR16),
+                               (void**)&metadataEntry);
+
+    if (EFI_ERROR(status))
+    {
+        return;
+    }
+
+    metadataEntry->Found = Found;
+    metadataEntry->Flags = Flags;
+    metadataEntry->FileSize = FileSize;
+    metadataEntry->FilePathLength = FilePathLength;
+    CopyMem(metadataEntry->FilePath, FilePath, FilePathLength * sizeof(CHAR16));
+
+    InsertHeadList(&FileSystemInformation->MetadataList, &metadataEntry->ListEntry);
+    FileSystemInformation->MetadataEntryCount++;
+    if (!Found)
+    {
+        FileSystemInformation->MetadataNotFoundCount++;
+    }
+}
+
+
+VOID
+VmbfsMetadataFlush (
+    IN  PFILESYSTEM_INFORMATION FileSystemInformation
+    )
+
+/*++
+
+Routine Description:
+
+    Drops all cached host lookups of the volume.
+
+Arguments:
+
+    FileSystemInformation - The volume.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    LIST_ENTRY *entry;
+
+    while (!IsListEmpty(&FileSystemInformation->MetadataList))
+    {
+        entry = GetFirstNode(&FileSystemInformation->MetadataList);
+        RemoveEntryList(entry);
+        gBS->FreePool(BASE_CR(entry, VMBFS_METADATA_ENTRY, ListEntry));
+    }
+
+    FileSystemInformation->MetadataEntryCount = 0;
+    FileSystemInformation->MetadataNotFoundCount = 0;
+}
+
+
 EFI_STATUS
 EFIAPI
 VmbfsOpen (
@@ -259,7 +698,6 @@ Return Value:
     VMBFS_FILE* allocatedFileProtocol = NULL;
     PFILE_INFORMATION parentFileInformation;
     CHAR16 *parentFilePath;
-    UINT32 bytesRead;
     PFILE_INFORMATION fileInformation = NULL;
     EFI_FILE_INFO* efiFileInfo = NULL;
     CHAR16* filePath = NULL;
@@ -268,8 +706,9 @@ Return Value:
     UINTN parentFilePathLength = 0;
     UINTN filePathLengthInBytes;
     PVMBFS_MESSAGE_GET_FILE_INFO getFileInfoMessage = NULL;
-    PVMBFS_MESSAGE_GET_FILE_INFO_RESPONSE getFileInfoResponseMessage = NULL;
-    UINTN getFileInfoMessageSize;
+    PVMBFS_METADATA_ENTRY metadataEntry;
+    UINT32 flags = 0;
+    BOOLEAN useFileHandles;
     EFI_STATUS status = EFI_SUCCESS;
 
     parentFileInformation = GetThisFileInformation(This);
@@ -324,8 +763,6 @@ Return Value:
     //
     filePathLengthInBytes -= sizeof(CHAR16);
 
-    getFileInfoMessageSize = sizeof(*getFileInfoMessage) + filePathLengthInBytes;
-
     if (filePathLengthInBytes > VMBFS_MAXIMUM_PAYLOAD_SIZE(*getFileInfoMessage))
     {
         status = EFI_BAD_BUFFER_SIZE;
@@ -341,201 +778,1305 @@ Return Value:
         pathFormat = L"%ls\\%ls";
     }
 
-    UnicodeSPrint(filePath,
-                  filePathLengthInBytes + sizeof(CHAR16),
-                  pathFormat,
-                  parentFilePath,
-                  FileName);
+    UnicodeSPrint(filePath,
+                  filePathLengthInBytes + sizeof(CHAR16),
+                  pathFormat,
+                  parentFilePath,
+                  FileName);
+
+    efiFileInfo->Size = sizeof(EFI_FILE_INFO) + filePathLengthInBytes + sizeof(CHAR16);
+
+    //
+    // Probes of paths that were already looked up on this volume are answered
+    // from the metadata cache, including paths that do not exist. Files found
+    // this way open their host file handle on first read.
+    //
+    metadataEntry = VmbfsMetadataLookup(GetFileSystemInformation(parentFileInformation),
+                                        filePath,
+                                        filePathLengthInBytes / sizeof(CHAR16));
+
+    if (metadataEntry != NULL)
+    {
+        if (!metadataEntry->Found)
+        {
+            status = EFI_NOT_FOUND;
+            goto Cleanup;
+        }
+
+        flags = metadataEntry->Flags;
+        efiFileInfo->FileSize = metadataEntry->FileSize;
+    }
+    else
+    {
+        useFileHandles =
+            (GetFileSystemInformation(parentFileInformation)->ProtocolVersion >= VMBFS_VERSION_FILE_HANDLES);
+
+        status = VmbfsQueryHostFile(parentFileInformation,
+                                    filePath,
+                                    filePathLengthInBytes,
+                                    useFileHandles,
+                                    &flags,
+                                    &efiFileInfo->FileSize,
+                                    &fileInformation->HostFileHandle);
+
+        if (status == EFI_NOT_FOUND || !EFI_ERROR(status))
+        {
+            VmbfsMetadataInsert(GetFileSystemInformation(parentFileInformation),
+                                filePath,
+                                filePathLengthInBytes / sizeof(CHAR16),
+                                !EFI_ERROR(status),
+                                flags,
+                                efiFileInfo->FileSize);
+        }
+
+        if (EFI_ERROR(status))
+        {
+            goto Cleanup;
+        }
+
+        fileInformation->HostFileHandleValid = useFileHandles;
+    }
+
+    efiFileInfo->PhysicalSize = efiFileInfo->FileSize;
+    efiFileInfo->Attribute |= EFI_FILE_READ_ONLY;
+
+    if ((flags & VMBFS_GET_FILE_INFO_FLAG_DIRECTORY) != 0)
+    {
+        fileInformation->IsDirectory = TRUE;
+        efiFileInfo->Attribute |= EFI_FILE_DIRECTORY;
+    }
+
+    fileInformation->RdmaCapable = ((flags & VMBFS_GET_FILE_INFO_FLAG_RDMA_CAPABLE) != 0);
+
+    fileInformation->FileSystem = parentFileInformation->FileSystem;
+
+    fileInformation->FilePathLength = filePathLengthInBytes / sizeof(CHAR16);
+
+    if (!fileInformation->IsDirectory)
+    {
+        fileInformation->CacheFileId =
+            VmbfsCacheGetFileId(&GetFileSystemInformation(parentFileInformation)->Cache,
+                                filePath,
+                                fileInformation->FilePathLength,
+                                efiFileInfo->FileSize);
+    }
+
+    CopyMem(&allocatedFileProtocol->EfiFileProtocol, This, sizeof(allocatedFileProtocol->EfiFileProtocol));
+
+    fileInformation->FileSystem->FileSystemInformation.ReferenceCount++;
+
+    *NewHandle = &allocatedFileProtocol->EfiFileProtocol;
+    status = EFI_SUCCESS;
+
+Cleanup:
+    if (EFI_ERROR(status))
+    {
+        if (allocatedFileProtocol != NULL)
+        {
+            gBS->FreePool(allocatedFileProtocol);
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+VmbfsCloseHostFile (
+    IN  PFILE_INFORMATION FileInformation
+    )
+
+/*++
+
+Routine Description:
+
+    Releases the host file handle of a file. Failures are ignored since the
+    handle is not used again.
+
+Arguments:
+
+    FileInformation - The file whose host file handle is released.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    VMBFS_MESSAGE_CLOSE_FILE closeFileMessage;
+    PVMBFS_MESSAGE_CLOSE_FILE_RESPONSE closeFileResponseMessage;
+    EFI_STATUS status;
+
+    ZeroMem(&closeFileMessage, sizeof(closeFileMessage));
+    closeFileMessage.Header.Type = VmbfsMessageTypeCloseFile;
+    closeFileMessage.FileHandle = FileInformation->HostFileHandle;
+
+    status = VmbfsSendReceivePacket(GetFileSystemInformation(FileInformation),
+                                    &closeFileMessage,
+                                    sizeof(closeFileMessage),
+                                    0,
+                                    NULL,
+                                    0,
+                                    FALSE);
+
+    if (EFI_ERROR(status))
+    {
+        return;
+    }
+
+    closeFileResponseMessage = GetPacketBuffer(FileInformation, VMBFS_MESSAGE_CLOSE_FILE_RESPONSE);
+
+    if (GetPacketSize(FileInformation) != sizeof(*closeFileResponseMessage) ||
+        closeFileResponseMessage->Header.Type != VmbfsMessageTypeCloseFileResponse)
+    {
+        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    }
+
+    FileInformation->HostFileHandleValid = FALSE;
+}
+
+
+EFI_STATUS
+EFIAPI
+VmbfsClose (
+    IN  EFI_FILE_PROTOCOL *This
+    )
+
+/*++
+
+Routine Description:
+
+    Closes a file, releasing its host file handle if it has one, and frees
+    the descriptors.
+
+Arguments:
+
+    This - The EFI file protocol to close.
+
+Return Value:
+
+    EFI_SUCCESS.
+
+--*/
+
+{
+    PFILE_INFORMATION fileInformation;
+
+    fileInformation = GetThisFileInformation(This);
+
+    if (fileInformation->HostFileHandleValid)
+    {
+        VmbfsCloseHostFile(fileInformation);
+    }
+
+    fileInformation->FileSystem->FileSystemInformation.ReferenceCount--;
+
+    if (fileInformation->FileSystem->FileSystemInformation.ReferenceCount == 0)
+    {
+        VmbfsCloseVolume(fileInformation->FileSystem, TRUE);
+    }
+
+    gBS->FreePool(This);
+
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+VmbfsErrorToEfiError(
+    IN  UINT32 Error
+    )
+/*++
+
+Routine Description:
+
+    Converts a Vmbfs error to an EFI error.
+
+Arguments:
+
+    Error - A Vmbfs error returned by the host.
+
+Return Value:
+
+    The corresponding EFI error code.
+
+--*/
+{
+    switch (Error)
+    {
+    case VmbfsFileSuccess:
+        return EFI_SUCCESS;
+
+    case VmbfsFileNotFound:
+        return EFI_NOT_FOUND;
+
+    case VmbfsFileEndOfFile:
+        return EFI_END_OF_FILE;
+
+    default:
+        return EFI_DEVICE_ERROR;
+    }
+}
+
+
+EFI_STATUS
+VmbfsReadPayload(
+    IN  VMBFS_FILE *File,
+    IN  UINT64 FileOffset,
+    OUT VOID *Buffer,
+    IN  UINTN BufferSize,
+    OUT UINTN *BytesRead
+    )
+/*++
+
+Routine Description:
+
+    Issues a single file read request to the host and copies the results
+    into the provided buffer.
+
+Arguments:
+
+    File - A pointer to the file.
+
+    FileOffset - The offset within the file at which to read.
+
+    Buffer - A pointer to the buffer to read into.
+
+    BufferSize - The size of the buffer in bytes.
+
+    BytesRead - On return, the number of bytes of the file that were
+        successfully read into the buffer.
+
+Return Value:
+
+    EFI_STATUS.
+
+--*/
+{
+    UINTN bytesReceived;
+    UINTN bytesRequested;
+    PVMBFS_MESSAGE_READ_FILE readFileMessage;
+    PVMBFS_MESSAGE_READ_FILE_BY_HANDLE readFileByHandleMessage;
+    PVMBFS_MESSAGE_READ_FILE_RESPONSE readFileResponseMessage;
+    VOID *message;
+    UINTN messageSize;
+    EFI_STATUS status;
+
+    bytesRequested = MIN(BufferSize, VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileResponseMessage));
+
+    if (File->FileInformation.HostFileHandleValid)
+    {
+        readFileByHandleMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_BY_HANDLE);
+        ZeroMem(readFileByHandleMessage, sizeof(*readFileByHandleMessage));
+        readFileByHandleMessage->Header.Type = VmbfsMessageTypeReadFileByHandle;
+        readFileByHandleMessage->FileHandle = File->FileInformation.HostFileHandle;
+        readFileByHandleMessage->Offset = FileOffset;
+        readFileByHandleMessage->ByteCount = (UINT32)bytesRequested;
+        message = readFileByHandleMessage;
+        messageSize = sizeof(*readFileByHandleMessage);
+    }
+    else
+    {
+        //
+        // Ensure the path will fit in the request message.
+        //
+        if (File->FileInformation.FilePathLength * sizeof(CHAR16) > VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileMessage))
+        {
+            status = EFI_BUFFER_TOO_SMALL;
+            goto Cleanup;
+        }
+
+        readFileMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE);
+        ZeroMem(readFileMessage, sizeof(*readFileMessage));
+        readFileMessage->Header.Type = VmbfsMessageTypeReadFile;
+        readFileMessage->Offset = FileOffset;
+        readFileMessage->ByteCount = (UINT32)bytesRequested;
+        CopyMem(readFileMessage->FilePath,
+                File->EfiFileInfo.FileName,
+                File->FileInformation.FilePathLength * sizeof(CHAR16));
+        message = readFileMessage;
+        messageSize = sizeof(*readFileMessage) + File->FileInformation.FilePathLength * sizeof(CHAR16);
+    }
+
+    status = VmbfsSendReceivePacket(GetFileSystemInformation(&File->FileInformation),
+                                    message,
+                                    messageSize,
+                                    0,
+                                    NULL,
+                                    0,
+                                    FALSE);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    readFileResponseMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RESPONSE);
+    bytesReceived = GetPacketSize(&File->FileInformation);
+
+    if (bytesReceived < sizeof(*readFileResponseMessage) ||
+        readFileResponseMessage->Header.Type != VmbfsMessageTypeReadFileResponse)
+    {
+        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    }
+
+    status = VmbfsErrorToEfiError(readFileResponseMessage->Status);
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    bytesReceived -= sizeof(VMBFS_MESSAGE_READ_FILE_RESPONSE);
+    if (bytesReceived > bytesRequested)
+    {
+        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+    }
+
+    CopyMem((UINT8*)Buffer,
+            readFileResponseMessage->Payload,
+            bytesReceived);
+
+    *BytesRead = bytesReceived;
+    status = EFI_SUCCESS;
+
+Cleanup:
+    return status;
+}
+
+
+EFI_STATUS
+VmbfsReadRdma(
+    IN  VMBFS_FILE *File,
+    IN  UINT64 FileOffset,
+    OUT VOID *Buffer,
+    IN  UINTN BufferSize,
+    OUT UINTN *BytesRead
+    )
+/*++
+
+Routine Description:
+
+    Reads from the file using vRDMA to allow the host to directly write the
+    result to guest memory without copying through the ring.
+
+    The read is split into requests of at most VMBFS_MAXIMUM_RDMA_SIZE bytes
+    against disjoint file offsets, and up to ReadWindowSize of them are kept
+    in flight, each with its own GPA range handle. Requests are retired in
+    the order they were sent. Reading stops at the first request that the
+    host does not fill completely.
+
+    If waiting for a response fails, the requests still in flight are left
+    in the window with their GPA ranges, since the host may still write into
+    the buffer through them. The next request on the pipe waits for them
+    first; closing the channel tears them down otherwise.
+
+Arguments:
+
+    File - A pointer to the file.
+
+    FileOffset - The offset within the file at which to read.
+
+    Buffer - A pointer to the buffer to read into.
+
+    BufferSize - The size of the buffer in bytes. This should not extend past
+        the end of the file.
+
+    BytesRead - On return, the number of contiguous bytes of the file that
+        were successfully read into the buffer.
+
+Return Value:
+
+    EFI_STATUS.
+
+--*/
+{
+    UINTN bytesIssued;
+    UINTN bytesRead;
+    BOOLEAN endOfData;
+    EFI_EXTERNAL_BUFFER externalBuffer;
+    PFILESYSTEM_INFORMATION fileSystemInformation;
+    UINT32 issueIndex;
+    UINT32 pendingCount;
+    PVMBFS_MESSAGE_READ_FILE_RDMA readFileMessage;
+    PVMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE readFileByHandleMessage;
+    UINT32 messageSize;
+    volatile VMBFS_READ_REQUEST *readRequest;
+    UINT32 retireIndex;
+    EFI_STATUS status;
+    EFI_STATUS waitStatus;
+    UINTN eventIndex;
+    EFI_TPL tpl;
+
+    //
+    // Ensure the path will fit in the request message.
+    //
+    if (!File->FileInformation.HostFileHandleValid &&
+        File->FileInformation.FilePathLength * sizeof(CHAR16) > VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileMessage))
+    {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    fileSystemInformation = GetFileSystemInformation(&File->FileInformation);
+    bytesIssued = 0;
+    bytesRead = 0;
+    endOfData = FALSE;
+    pendingCount = 0;
+    retireIndex = 0;
+    status = EFI_SUCCESS;
+
+    AcquireSpinLock(&fileSystemInformation->VmbusIoLock);
+
+    status = VmbfsRetireAbandonedReads(fileSystemInformation);
+    if (EFI_ERROR(status))
+    {
+        ReleaseSpinLock(&fileSystemInformation->VmbusIoLock);
+        return status;
+    }
+
+    ASSERT(fileSystemInformation->ReadsOutstanding == 0);
+    fileSystemInformation->ReadWindowOldest = 0;
+
+    for (;;)
+    {
+        //
+        // Fill the window. A slot is reused only once its request has been
+        // retired and its GPA range destroyed.
+        //
+        while (!EFI_ERROR(status) &&
+               !endOfData &&
+               bytesIssued < BufferSize &&
+               pendingCount < fileSystemInformation->ReadWindowSize)
+        {
+            issueIndex = (retireIndex + pendingCount) % fileSystemInformation->ReadWindowSize;
+            readRequest = &fileSystemInformation->ReadWindow[issueIndex];
+            readRequest->Handle = issueIndex + 1;
+            readRequest->ByteCount = (UINT32)MIN(BufferSize - bytesIssued, VMBFS_MAXIMUM_RDMA_SIZE);
+            readRequest->FileOffset = FileOffset + bytesIssued;
+            readRequest->Completed = FALSE;
+            readRequest->Status = VmbfsFileError;
+            readRequest->BytesRead = 0;
+
+            externalBuffer.Buffer = (UINT8*)Buffer + bytesIssued;
+            externalBuffer.BufferSize = readRequest->ByteCount;
+            status = fileSystemInformation->EmclProtocol->CreateGpaRange(
+                                fileSystemInformation->EmclProtocol,
+                                readRequest->Handle,
+                                &externalBuffer,
+                                1,
+                                TRUE);
+
+            if (EFI_ERROR(status))
+            {
+                break;
+            }
+
+            if (File->FileInformation.HostFileHandleValid)
+            {
+                readFileByHandleMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RDMA_BY_HANDLE);
+                ZeroMem(readFileByHandleMessage, sizeof(*readFileByHandleMessage));
+                readFileByHandleMessage->Header.Type = VmbfsMessageTypeReadFileRdmaByHandle;
+                readFileByHandleMessage->FileHandle = File->FileInformation.HostFileHandle;
+                readFileByHandleMessage->Handle = readRequest->Handle;
+                readFileByHandleMessage->FileOffset = readRequest->FileOffset;
+                readFileByHandleMessage->ByteCount = readRequest->ByteCount;
+                messageSize = sizeof(*readFileByHandleMessage);
+            }
+            else
+            {
+                readFileMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RDMA);
+                ZeroMem(readFileMessage, sizeof(*readFileMessage));
+                readFileMessage->Header.Type = VmbfsMessageTypeReadFileRdma;
+                readFileMessage->Handle = readRequest->Handle;
+                readFileMessage->FileOffset = readRequest->FileOffset;
+                readFileMessage->ByteCount = readRequest->ByteCount;
+                CopyMem(readFileMessage->FilePath,
+                        File->EfiFileInfo.FileName,
+                        File->FileInformation.FilePathLength * sizeof(CHAR16));
+                messageSize = (UINT32)(sizeof(*readFileMessage) +
+                                       File->FileInformation.FilePathLength * sizeof(CHAR16));
+            }
+
+            tpl = gBS->RaiseTPL(TPL_CALLBACK);
+            fileSystemInformation->ReadsOutstanding++;
+            gBS->RestoreTPL(tpl);
+
+            status = fileSystemInformation->EmclProtocol->SendPacket(
+                                fileSystemInformation->EmclProtocol,
+                                GetPacketBuffer(&File->FileInformation, VOID),
+                                messageSize,
+                                NULL,
+                                0,
+                                NULL,
+                                NULL);
+
+            if (EFI_ERROR(status))
+            {
+                tpl = gBS->RaiseTPL(TPL_CALLBACK);
+                fileSystemInformation->ReadsOutstanding--;
+                gBS->RestoreTPL(tpl);
+
+                fileSystemInformation->EmclProtocol->DestroyGpaRange(
+                        fileSystemInformation->EmclProtocol,
+                        readRequest->Handle);
+
+                break;
+            }
+
+            bytesIssued += readRequest->ByteCount;
+            pendingCount++;
+        }
+
+        if (pendingCount == 0)
+        {
+            break;
+        }
+
+        //
+        // Retire the oldest request once the host has responded to it.
+        //
+        readRequest = &fileSystemInformation->ReadWindow[retireIndex];
+        while (!readRequest->Completed)
+        {
+            waitStatus = gBS->WaitForEvent(1, &fileSystemInformation->ReceivePacketEvent, &eventIndex);
+            if (EFI_ERROR(waitStatus))
+            {
+                status = waitStatus;
+                goto Cleanup;
+            }
+        }
+
+        fileSystemInformation->EmclProtocol->DestroyGpaRange(
+                fileSystemInformation->EmclProtocol,
+                readRequest->Handle);
+
+        retireIndex = (retireIndex + 1) % fileSystemInformation->ReadWindowSize;
+        pendingCount--;
+
+        //
+        // Once an error or a short read is seen, the remaining requests are
+        // only drained.
+        //
+        if (EFI_ERROR(status) || endOfData)
+        {
+            continue;
+        }
+
+        status = VmbfsErrorToEfiError(readRequest->Status);
+        if (EFI_ERROR(status))
+        {
+            continue;
+        }
+
+        bytesRead += readRequest->BytesRead;
+        if (readRequest->BytesRead < readRequest->ByteCount)
+        {
+            endOfData = TRUE;
+        }
+    }
+
+Cleanup:
+    if (pendingCount > 0)
+    {
+        //
+        // Only reached with requests pending if waiting failed. Keep their
+        // GPA ranges until the host has responded to them.
+        //
+        fileSystemInformation->ReadWindowAbandoned = retireIndex;
+        fileSystemInformation->ReadsAbandoned = pendingCount;
+    }
+    else
+    {
+        ASSERT(fileSystemInformation->ReadsOutstanding == 0);
+
+        //
+        // Responses may have signaled the receive event more often than it
+        // was waited on. Clear it so the next synchronous request waits for
+        // its own response.
+        //
+        gBS->CheckEvent(fileSystemInformation->ReceivePacketEvent);
+    }
+
+    ReleaseSpinLock(&fileSystemInformation->VmbusIoLock);
+
+    if (!EFI_ERROR(status))
+    {
+        *BytesRead = bytesRead;
+    }
+
+    return status;
+}
+
+
+EFI_STATUS
+VmbfsReadFromHost (
+    IN  VMBFS_FILE *File,
+    IN  UINT64 FileOffset,
+    OUT VOID *Buffer,
+    IN  UINTN BufferSize,
+    OUT UINTN *BytesRead
+    )
+/*++
+
+Routine Description:
+
+    Reads from the file on the host, bypassing the cache.
+
+Arguments:
+
+    File - A pointer to the file.
+
+    FileOffset - The offset within the file at which to read.
+
+    Buffer - A pointer to the buffer to read into.
+
+    BufferSize - The size of the buffer in bytes.
+
+    BytesRead - On return, the number of bytes of the file that were
+        successfully read into the buffer.
+
+Return Value:
+
+    EFI_STATUS.
+
+--*/
+{
+    UINTN bytesRead;
+    UINTN bytesReadThisTime;
+    UINT32 flags;
+    UINT64 fileSize;
+    EFI_STATUS status;
+
+    bytesRead = 0;
+
+    //
+    // Files opened from the metadata cache get their host file handle when
+    // they are first read.
+    //
+    if (!File->FileInformation.HostFileHandleValid &&
+        GetFileSystemInformation(&File->FileInformation)->ProtocolVersion >= VMBFS_VERSION_FILE_HANDLES)
+    {
+        status = VmbfsQueryHostFile(&File->FileInformation,
+                                    File->EfiFileInfo.FileName,
+                                    File->FileInformation.FilePathLength * sizeof(CHAR16),
+                                    TRUE,
+                                    &flags,
+                                    &fileSize,
+                                    &File->FileInformation.HostFileHandle);
+
+        if (EFI_ERROR(status))
+        {
+            //
+            // The host no longer matches the cached lookup the file was
+            // opened from, so none of the cached lookups can be trusted.
+            //
+            VmbfsMetadataFlush(GetFileSystemInformation(&File->FileInformation));
+            return status;
+        }
+
+        File->FileInformation.HostFileHandleValid = TRUE;
+    }
+
+    while (bytesRead < BufferSize &&
+           (FileOffset + bytesRead) < File->EfiFileInfo.FileSize)
+    {
+        if (File->FileInformation.RdmaCapable)
+        {
+            //
+            // Do not pipeline requests past the end of the file.
+            //
+            status = VmbfsReadRdma(File,
+                                   FileOffset + bytesRead,
+                                   (UINT8*)Buffer + bytesRead,
+                                   (UINTN)MIN(BufferSize - bytesRead,
+                                              File->EfiFileInfo.FileSize - (FileOffset + bytesRead)),
+                                   &bytesReadThisTime);
+        }
+        else
+        {
+            status = VmbfsReadPayload(File,
+                                      FileOffset + bytesRead,
+                                      (UINT8*)Buffer + bytesRead,
+                                      BufferSize - bytesRead,
+                                      &bytesReadThisTime);
+        }
+
+        if (EFI_ERROR(status))
+        {
+            return status;
+        }
+
+        bytesRead += bytesReadThisTime;
+    }
+
+    *BytesRead = bytesRead;
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+VmbfsCacheInitialize (
+    OUT PVMBFS_CACHE Cache,
+    IN  UINT32 BlockCount
+    )
+/*++
+
+Routine Description:
+
+    Initializes the block cache of a file system.
+
+Arguments:
+
+    Cache - The cache to initialize.
+
+    BlockCount - The number of blocks in the cache. Zero disables the cache.
+
+Return Value:
+
+    EFI_SUCCESS on success.
+
+    EFI_OUT_OF_RESOURCES if the cache could not be allocated. The cache is
+        left disabled.
+
+--*/
+{
+    UINT32 bucketCount;
+    UINT32 index;
+    EFI_STATUS status;
+
+    ZeroMem(Cache, sizeof(*Cache));
+    InitializeListHead(&Cache->LruList);
+    InitializeListHead(&Cache->FileList);
+    Cache->NextFileId = 1;
+
+    if (BlockCount == 0)
+    {
+        return EFI_SUCCESS;
+    }
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               BlockCount * sizeof(VMBFS_CACHE_BLOCK),
+                               (void**)&Cache->Blocks);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               (UINTN)BlockCount * VMBFS_CACHE_BLOCK_SIZE,
+                               (void**)&Cache->BlockData);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               VMBFS_CACHE_FILL_BLOCKS * VMBFS_CACHE_BLOCK_SIZE,
+                               (void**)&Cache->FillBuffer);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    bucketCount = GetPowerOfTwo32(BlockCount);
+    if (bucketCount < BlockCount)
+    {
+        bucketCount <<= 1;
+    }
+
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               bucketCount * sizeof(LIST_ENTRY),
+                               (void**)&Cache->HashBuckets);
+
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
+    }
+
+    for (index = 0; index < bucketCount; index++)
+    {
+        InitializeListHead(&Cache->HashBuckets[index]);
+    }
+
+    Cache->HashBucketMask = bucketCount - 1;
+
+    for (index = 0; index < BlockCount; index++)
+    {
+        ZeroMem(&Cache->Blocks[index], sizeof(Cache->Blocks[index]));
+        Cache->Blocks[index].Data = Cache->BlockData + (UINTN)index * VMBFS_CACHE_BLOCK_SIZE;
+        InsertTailList(&Cache->LruList, &Cache->Blocks[index].ListEntry);
+    }
+
+    Cache->BlockCount = BlockCount;
+    status = EFI_SUCCESS;
+
+Cleanup:
+    if (EFI_ERROR(status))
+    {
+        VmbfsCacheFree(Cache);
+        status = EFI_OUT_OF_RESOURCES;
+    }
+
+    return status;
+}
+
+
+VOID
+VmbfsCacheFree (
+    IN  PVMBFS_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Frees the block cache of a file system, leaving it disabled.
+
+Arguments:
+
+    Cache - The cache to free.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LIST_ENTRY *entry;
+
+    while (!IsListEmpty(&Cache->FileList))
+    {
+        entry = GetFirstNode(&Cache->FileList);
+        RemoveEntryList(entry);
+        gBS->FreePool(BASE_CR(entry, VMBFS_CACHE_FILE, ListEntry));
+    }
+
+    InitializeListHead(&Cache->LruList);
+
+    if (Cache->HashBuckets != NULL)
+    {
+        gBS->FreePool(Cache->HashBuckets);
+        Cache->HashBuckets = NULL;
+    }
+
+    if (Cache->FillBuffer != NULL)
+    {
+        gBS->FreePool(Cache->FillBuffer);
+        Cache->FillBuffer = NULL;
+    }
+
+    if (Cache->BlockData != NULL)
+    {
+        gBS->FreePool(Cache->BlockData);
+        Cache->BlockData = NULL;
+    }
+
+    if (Cache->Blocks != NULL)
+    {
+        gBS->FreePool(Cache->Blocks);
+        Cache->Blocks = NULL;
+    }
+
+    Cache->BlockCount = 0;
+}
+
+
+VOID
+VmbfsCacheReportStatistics (
+    IN  PVMBFS_CACHE Cache
+    )
+/*++
+
+Routine Description:
+
+    Reports the hit ratio of the block cache to the debug output.
+
+Arguments:
+
+    Cache - The cache.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT64 lookups;
+
+    lookups = Cache->Hits + Cache->Misses;
+
+    if (Cache->BlockCount == 0 || lookups == 0)
+    {
+        return;
+    }
+
+    DEBUG((DEBUG_INFO,
+           "Vmbfs cache: %ld hits, %ld misses (%ld%% hit ratio), %ld blocks prefetched\n",
+           Cache->Hits,
+           Cache->Misses,
+           DivU64x64Remainder(MultU64x32(Cache->Hits, 100), lookups, NULL),
+           Cache->PrefetchedBlocks));
+}
+
+
+VOID
+VmbfsCacheFormatStatistics (
+    IN  PVMBFS_CACHE Cache,
+    IN  CONST CHAR16 *Name,
+    OUT CHAR16 *Buffer,
+    IN  UINTN BufferSize
+    )
+/*++
+
+Routine Description:
+
+    Formats a name followed by the hit ratio of the block cache, for the
+    controller name reported through the component name protocols.
+
+Arguments:
+
+    Cache - The cache.
+
+    Name - The name to report the statistics under.
+
+    Buffer - The buffer to receive the string.
+
+    BufferSize - The size of the buffer in bytes.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT64 lookups;
+
+    lookups = Cache->Hits + Cache->Misses;
+
+    if (Cache->BlockCount == 0)
+    {
+        UnicodeSPrint(Buffer, BufferSize, L"%s (cache disabled)", Name);
+        return;
+    }
+
+    UnicodeSPrint(Buffer,
+                  BufferSize,
+                  L"%s (cache: %ld hits, %ld misses, %ld%% hit ratio, %ld blocks prefetched)",
+                  Name,
+                  Cache->Hits,
+                  Cache->Misses,
+                  (lookups == 0) ? 0 : DivU64x64Remainder(MultU64x32(Cache->Hits, 100), lookups, NULL),
+                  Cache->PrefetchedBlocks);
+}
+
+
+LIST_ENTRY*
+VmbfsCacheHashBucket (
+    IN  PVMBFS_CACHE Cache,
+    IN  UINT32 FileId,
+    IN  UINT64 BlockIndex
+    )
+/*++
+
+Routine Description:
+
+    Returns the hash bucket of a block of a file. Consecutive blocks of a
+    file fall into consecutive buckets.
+
+Arguments:
+
+    Cache - The cache.
+
+    FileId - The identity of the file.
+
+    BlockIndex - The index of the block within the file.
+
+Return Value:
+
+    The head of the bucket's list.
+
+--*/
+{
+    UINT32 hash;
+
+    hash = (FileId * 0x9E3779B1) + (UINT32)BlockIndex;
+
+    return &Cache->HashBuckets[hash & Cache->HashBucketMask];
+}
+
+
+VOID
+VmbfsCacheDropFileBlocks (
+    IN  PVMBFS_CACHE Cache,
+    IN  UINT32 FileId
+    )
+/*++
+
+Routine Description:
+
+    Invalidates the cached blocks of a file and moves them to the least
+    recently used end of the cache so that they are reused first.
+
+Arguments:
+
+    Cache - The cache.
+
+    FileId - The identity of the file.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UINT32 index;
+
+    for (index = 0; index < Cache->BlockCount; index++)
+    {
+        if (Cache->Blocks[index].Valid &&
+            Cache->Blocks[index].FileId == FileId)
+        {
+            Cache->Blocks[index].Valid = FALSE;
+            RemoveEntryList(&Cache->Blocks[index].HashEntry);
+            RemoveEntryList(&Cache->Blocks[index].ListEntry);
+            InsertTailList(&Cache->LruList, &Cache->Blocks[index].ListEntry);
+        }
+    }
+}
+
 
-    efiFileInfo->Size = sizeof(EFI_FILE_INFO) + filePathLengthInBytes + sizeof(CHAR16);
+UINT32
+VmbfsCacheGetFileId (
+    IN  PVMBFS_CACHE Cache,
+    IN  CONST CHAR16 *FilePath,
+    IN  UINTN FilePathLength,
+    IN  UINT64 FileSize
+    )
+/*++
 
-    //
-    // Build a GetFileInfo message.
-    //
-    getFileInfoMessage = GetPacketBuffer(parentFileInformation, VMBFS_MESSAGE_GET_FILE_INFO);
-    ZeroMem(getFileInfoMessage, sizeof(*getFileInfoMessage));
-    getFileInfoMessage->Header.Type = VmbfsMessageTypeGetFileInfo;
+Routine Description:
 
-    CopyMem(getFileInfoMessage->FilePath,
-            filePath,
-            filePathLengthInBytes);
+    Returns the cache identity of a file, creating it on first use. If the
+    host reports a different size than when the file was last opened, its
+    cached blocks are dropped.
+
+Arguments:
 
+    Cache - The cache.
 
-    status = VmbfsSendReceivePacket(GetFileSystemInformation(parentFileInformation),
-                                    getFileInfoMessage,
-                                    getFileInfoMessageSize,
-                                    0,
-                                    NULL,
-                                    0,
-                                    FALSE);
+    FilePath - The path of the file.
 
-    if (EFI_ERROR(status))
-    {
-        goto Cleanup;
-    }
+    FilePathLength - The length of the path in characters.
 
-    getFileInfoResponseMessage = GetPacketBuffer(parentFileInformation, VMBFS_MESSAGE_GET_FILE_INFO_RESPONSE);
-    bytesRead = GetPacketSize(parentFileInformation);
+    FileSize - The size of the file reported by the host.
 
-    if (bytesRead != sizeof(*getFileInfoResponseMessage) ||
-        getFileInfoResponseMessage->Header.Type != VmbfsMessageTypeGetFileInfoResponse)
-    {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
-    }
+Return Value:
 
-    if (getFileInfoResponseMessage->Status == VmbfsFileNotFound)
+    The file identity, or zero if the file is not cached.
+
+--*/
+{
+    LIST_ENTRY *entry;
+    PVMBFS_CACHE_FILE cacheFile;
+    EFI_STATUS status;
+
+    if (Cache->BlockCount == 0)
     {
-        status = EFI_NOT_FOUND;
-        goto Cleanup;
+        return 0;
     }
 
-    if (getFileInfoResponseMessage->Status != VmbfsFileSuccess)
+    for (entry = GetFirstNode(&Cache->FileList);
+         !IsNull(&Cache->FileList, entry);
+         entry = GetNextNode(&Cache->FileList, entry))
     {
-        status = EFI_DEVICE_ERROR;
-        goto Cleanup;
+        cacheFile = BASE_CR(entry, VMBFS_CACHE_FILE, ListEntry);
+
+        if (cacheFile->FilePathLength == FilePathLength &&
+            CompareMem(cacheFile->FilePath, FilePath, FilePathLength * sizeof(CHAR16)) == 0)
+        {
+            if (cacheFile->FileSize != FileSize)
+            {
+                VmbfsCacheDropFileBlocks(Cache, cacheFile->FileId);
+                cacheFile->FileSize = FileSize;
+            }
+
+            return cacheFile->FileId;
+        }
     }
 
-    efiFileInfo->FileSize = getFileInfoResponseMessage->FileSize;
-    efiFileInfo->PhysicalSize = getFileInfoResponseMessage->FileSize;
-    efiFileInfo->Attribute |= EFI_FILE_READ_ONLY;
+    status = gBS->AllocatePool(EfiBootServicesData,
+                               sizeof(*cacheFile) + FilePathLength * sizeof(CHAR16),
+                               (void**)&cacheFile);
 
-    if ((getFileInfoResponseMessage->Flags & VMBFS_GET_FILE_INFO_FLAG_DIRECTORY) != 0)
+    if (EFI_ERROR(status))
     {
-        fileInformation->IsDirectory = TRUE;
-        efiFileInfo->Attribute |= EFI_FILE_DIRECTORY;
+        return 0;
     }
 
-    fileInformation->RdmaCapable = ((getFileInfoResponseMessage->Flags & VMBFS_GET_FILE_INFO_FLAG_RDMA_CAPABLE) != 0);
+    cacheFile->FileId = Cache->NextFileId++;
+    cacheFile->FileSize = FileSize;
+    cacheFile->FilePathLength = FilePathLength;
+    CopyMem(cacheFile->FilePath, FilePath, FilePathLength * sizeof(CHAR16));
+    InsertTailList(&Cache->FileList, &cacheFile->ListEntry);
 
-    fileInformation->FileSystem = parentFileInformation->FileSystem;
+    return cacheFile->FileId;
+}
 
-    fileInformation->FilePathLength = filePathLengthInBytes / sizeof(CHAR16);
 
-    CopyMem(&allocatedFileProtocol->EfiFileProtocol, This, sizeof(allocatedFileProtocol->EfiFileProtocol));
+VOID
+VmbfsCacheInvalidateFile (
+    IN  PFILE_INFORMATION FileInformation
+    )
+/*++
 
-    fileInformation->FileSystem->FileSystemInformation.ReferenceCount++;
+Routine Description:
 
-    *NewHandle = &allocatedFileProtocol->EfiFileProtocol;
-    status = EFI_SUCCESS;
+    Drops the cached blocks of a file so that the next read goes to the host.
 
-Cleanup:
-    if (EFI_ERROR(status))
+Arguments:
+
+    FileInformation - The file.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (FileInformation->CacheFileId == 0)
     {
-        if (allocatedFileProtocol != NULL)
-        {
-            gBS->FreePool(allocatedFileProtocol);
-        }
+        return;
     }
 
-    return status;
+    VmbfsCacheDropFileBlocks(&GetFileSystemInformation(FileInformation)->Cache,
+                             FileInformation->CacheFileId);
 }
 
 
-EFI_STATUS
-EFIAPI
-VmbfsClose (
-    IN  EFI_FILE_PROTOCOL *This
+PVMBFS_CACHE_BLOCK
+VmbfsCacheLookup (
+    IN  PVMBFS_CACHE Cache,
+    IN  UINT32 FileId,
+    IN  UINT64 BlockIndex
     )
-
 /*++
 
 Routine Description:
 
-    Closes a file.  No open state is maintained on the host, so just free the
-    descriptors.
+    Finds a block of a file in the cache by looking in its hash bucket.
 
 Arguments:
 
-    This - The EFI file protocol to close.
+    Cache - The cache.
+
+    FileId - The identity of the file.
+
+    BlockIndex - The index of the block within the file.
 
 Return Value:
 
-    EFI_SUCCESS.
+    The block, or NULL if it is not cached.
 
 --*/
-
 {
-    PFILE_INFORMATION fileInformation;
-
-    fileInformation = GetThisFileInformation(This);
+    LIST_ENTRY *bucket;
+    LIST_ENTRY *entry;
+    PVMBFS_CACHE_BLOCK block;
 
-    fileInformation->FileSystem->FileSystemInformation.ReferenceCount--;
+    bucket = VmbfsCacheHashBucket(Cache, FileId, BlockIndex);
 
-    if (fileInformation->FileSystem->FileSystemInformation.ReferenceCount == 0)
+    for (entry = GetFirstNode(bucket);
+         !IsNull(bucket, entry);
+         entry = GetNextNode(bucket, entry))
     {
-        VmbfsCloseVolume(fileInformation->FileSystem, TRUE);
-    }
+        block = BASE_CR(entry, VMBFS_CACHE_BLOCK, HashEntry);
 
-    gBS->FreePool(This);
+        if (block->FileId == FileId && block->BlockIndex == BlockIndex)
+        {
+            return block;
+        }
+    }
 
-    return EFI_SUCCESS;
+    return NULL;
 }
 
 
-EFI_STATUS
-VmbfsErrorToEfiError(
-    IN  UINT32 Error
+VOID
+VmbfsCacheInsert (
+    IN  PVMBFS_CACHE Cache,
+    IN  UINT32 FileId,
+    IN  UINT64 BlockIndex,
+    IN  CONST UINT8 *Data,
+    IN  UINT32 DataLength
     )
 /*++
 
 Routine Description:
 
-    Converts a Vmbfs error to an EFI error.
+    Stores a block of a file in the cache, evicting the least recently used
+    block.
 
 Arguments:
 
-    Error - A Vmbfs error returned by the host.
+    Cache - The cache.
+
+    FileId - The identity of the file.
+
+    BlockIndex - The index of the block within the file.
+
+    Data - The data of the block.
+
+    DataLength - The length of the data, which is less than a full block only
+        for the last block of the file.
 
 Return Value:
 
-    The corresponding EFI error code.
+    None.
 
 --*/
 {
-    switch (Error)
-    {
-    case VmbfsFileSuccess:
-        return EFI_SUCCESS;
-
-    case VmbfsFileNotFound:
-        return EFI_NOT_FOUND;
+    PVMBFS_CACHE_BLOCK block;
 
-    case VmbfsFileEndOfFile:
-        return EFI_END_OF_FILE;
+    block = BASE_CR(GetPreviousNode(&Cache->LruList, &Cache->LruList), VMBFS_CACHE_BLOCK, ListEntry);
 
-    default:
-        return EFI_DEVICE_ERROR;
+    if (block->Valid)
+    {
+        RemoveEntryList(&block->HashEntry);
     }
+
+    block->Valid = TRUE;
+    block->FileId = FileId;
+    block->BlockIndex = BlockIndex;
+    block->DataLength = DataLength;
+    CopyMem(block->Data, Data, DataLength);
+    InsertHeadList(VmbfsCacheHashBucket(Cache, FileId, BlockIndex), &block->HashEntry);
+
+    RemoveEntryList(&block->ListEntry);
+    InsertHeadList(&Cache->LruList, &block->ListEntry);
 }
 
 
 EFI_STATUS
-VmbfsReadPayload(
+VmbfsCacheFill (
     IN  VMBFS_FILE *File,
-    IN  UINT64 FileOffset,
-    OUT VOID *Buffer,
-    IN  UINTN BufferSize,
-    OUT UINTN *BytesRead
+    IN  UINT64 BlockIndex,
+    IN  UINT64 BlockCount
     )
 /*++
 
 Routine Description:
 
-    Issues a single file read request to the host and copies the results
-    into the provided buffer.
+    Reads a run of blocks of the file from the host into the cache.
 
 Arguments:
 
     File - A pointer to the file.
 
-    FileOffset - The offset within the file at which to read.
-
-    Buffer - A pointer to the buffer to read into.
-
-    BufferSize - The size of the buffer in bytes.
+    BlockIndex - The index of the first block to read.
 
-    BytesRead - On return, the number of bytes of the file that were
-        successfully read into the buffer.
+    BlockCount - The number of blocks to read, at most VMBFS_CACHE_FILL_BLOCKS.
 
 Return Value:
 
@@ -543,79 +2084,42 @@ Return Value:
 
 --*/
 {
-    UINTN bytesReceived;
-    UINTN bytesRequested;
-    PVMBFS_MESSAGE_READ_FILE readFileMessage;
-    PVMBFS_MESSAGE_READ_FILE_RESPONSE readFileResponseMessage;
+    PVMBFS_CACHE cache;
+    UINTN bytesRead;
+    UINT64 fileOffset;
+    UINTN offset;
     EFI_STATUS status;
 
-    //
-    // Ensure the path will fit in the request message.
-    //
-    if (File->FileInformation.FilePathLength * sizeof(CHAR16) > VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileMessage))
-    {
-        status = EFI_BUFFER_TOO_SMALL;
-        goto Cleanup;
-    }
-
-    bytesRequested = MIN(BufferSize, VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileResponseMessage));
-    readFileMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE);
-    ZeroMem(readFileMessage, sizeof(*readFileMessage));
-    readFileMessage->Header.Type = VmbfsMessageTypeReadFile;
-    readFileMessage->Offset = FileOffset;
-    readFileMessage->ByteCount = (UINT32)bytesRequested;
-    CopyMem(readFileMessage->FilePath,
-            File->EfiFileInfo.FileName,
-            File->FileInformation.FilePathLength * sizeof(CHAR16));
-
-    status = VmbfsSendReceivePacket(GetFileSystemInformation(&File->FileInformation),
-                                    readFileMessage,
-                                    sizeof(*readFileMessage) + File->FileInformation.FilePathLength * sizeof(CHAR16),
-                                    0,
-                                    NULL,
-                                    0,
-                                    FALSE);
-
-    if (EFI_ERROR(status))
-    {
-        goto Cleanup;
-    }
-
-    readFileResponseMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RESPONSE);
-    bytesReceived = GetPacketSize(&File->FileInformation);
+    cache = &GetFileSystemInformation(&File->FileInformation)->Cache;
+    fileOffset = MultU64x32(BlockIndex, VMBFS_CACHE_BLOCK_SIZE);
 
-    if (bytesReceived < sizeof(*readFileResponseMessage) ||
-        readFileResponseMessage->Header.Type != VmbfsMessageTypeReadFileResponse)
-    {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
-    }
+    status = VmbfsReadFromHost(File,
+                               fileOffset,
+                               cache->FillBuffer,
+                               (UINTN)MIN(BlockCount * VMBFS_CACHE_BLOCK_SIZE,
+                                          File->EfiFileInfo.FileSize - fileOffset),
+                               &bytesRead);
 
-    status = VmbfsErrorToEfiError(readFileResponseMessage->Status);
     if (EFI_ERROR(status))
     {
-        goto Cleanup;
+        return status;
     }
 
-    bytesReceived -= sizeof(VMBFS_MESSAGE_READ_FILE_RESPONSE);
-    if (bytesReceived > bytesRequested)
+    for (offset = 0; offset < bytesRead; offset += VMBFS_CACHE_BLOCK_SIZE)
     {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        VmbfsCacheInsert(cache,
+                         File->FileInformation.CacheFileId,
+                         BlockIndex + offset / VMBFS_CACHE_BLOCK_SIZE,
+                         cache->FillBuffer + offset,
+                         (UINT32)MIN(bytesRead - offset, VMBFS_CACHE_BLOCK_SIZE));
     }
 
-    CopyMem((UINT8*)Buffer,
-            readFileResponseMessage->Payload,
-            bytesReceived);
-
-    *BytesRead = bytesReceived;
-    status = EFI_SUCCESS;
-
-Cleanup:
-    return status;
+    return EFI_SUCCESS;
 }
 
 
 EFI_STATUS
-VmbfsReadRdma(
+VmbfsCacheRead (
     IN  VMBFS_FILE *File,
     IN  UINT64 FileOffset,
     OUT VOID *Buffer,
@@ -626,9 +2130,10 @@ VmbfsReadRdma(
 
 Routine Description:
 
-    Issues a single file read request to the host, using vRDMA to
-    allow the host to directly write the result to guest memory
-    without copying through the ring.
+    Reads from the file through the block cache. Missing blocks are read
+    from the host in runs. If the read continues where the previous read of
+    this handle ended, the run is extended past the end of the request to
+    prefetch the blocks that are likely to be read next.
 
 Arguments:
 
@@ -638,7 +2143,8 @@ Arguments:
 
     Buffer - A pointer to the buffer to read into.
 
-    BufferSize - The size of the buffer in bytes.
+    BufferSize - The size of the buffer in bytes. This must not be larger
+        than the cache.
 
     BytesRead - On return, the number of bytes of the file that were
         successfully read into the buffer.
@@ -649,69 +2155,107 @@ Return Value:
 
 --*/
 {
-    UINTN bytesReceived;
-    UINTN bytesRequested;
-    PVMBFS_MESSAGE_READ_FILE_RDMA readFileMessage;
-    PVMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE readFileResponseMessage;
+    PVMBFS_CACHE_BLOCK block;
+    UINT64 blockIndex;
+    UINT32 blockOffset;
+    UINTN bytesRead;
+    UINTN bytesToCopy;
+    PVMBFS_CACHE cache;
+    UINT64 fileBlockCount;
+    UINT64 lastBlockIndex;
+    UINT64 runLength;
+    BOOLEAN sequential;
     EFI_STATUS status;
 
-    //
-    // Ensure the path will fit in the request message.
-    //
-    if (File->FileInformation.FilePathLength * sizeof(CHAR16) > VMBFS_MAXIMUM_PAYLOAD_SIZE(*readFileMessage))
+    cache = &GetFileSystemInformation(&File->FileInformation)->Cache;
+    bytesRead = 0;
+    status = EFI_SUCCESS;
+
+    if (FileOffset >= File->EfiFileInfo.FileSize)
     {
-        status = EFI_BUFFER_TOO_SMALL;
         goto Cleanup;
     }
 
-    bytesRequested = MIN(BufferSize, VMBFS_MAXIMUM_RDMA_SIZE);
-    readFileMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RDMA);
-    ZeroMem(readFileMessage, sizeof(*readFileMessage));
-    readFileMessage->Header.Type = VmbfsMessageTypeReadFileRdma;
-    readFileMessage->Handle = 1;
-    readFileMessage->FileOffset = FileOffset;
-    readFileMessage->ByteCount = (UINT32)bytesRequested;
-    CopyMem(readFileMessage->FilePath,
-            File->EfiFileInfo.FileName,
-            File->FileInformation.FilePathLength * sizeof(CHAR16));
-
-    status = VmbfsSendReceivePacket(GetFileSystemInformation(&File->FileInformation),
-                                    readFileMessage,
-                                    sizeof(*readFileMessage) + File->FileInformation.FilePathLength * sizeof(CHAR16),
-                                    readFileMessage->Handle,
-                                    Buffer,
-                                    bytesRequested,
-                                    TRUE);
+    BufferSize = (UINTN)MIN(BufferSize, File->EfiFileInfo.FileSize - FileOffset);
+    lastBlockIndex = DivU64x32(FileOffset + BufferSize - 1, VMBFS_CACHE_BLOCK_SIZE);
+    fileBlockCount = DivU64x32(File->EfiFileInfo.FileSize + VMBFS_CACHE_BLOCK_SIZE - 1, VMBFS_CACHE_BLOCK_SIZE);
+    sequential = (FileOffset == File->FileInformation.CacheNextOffset);
 
-    if (EFI_ERROR(status))
+    while (bytesRead < BufferSize)
     {
-        goto Cleanup;
-    }
+        blockIndex = DivU64x32(FileOffset + bytesRead, VMBFS_CACHE_BLOCK_SIZE);
+        block = VmbfsCacheLookup(cache, File->FileInformation.CacheFileId, blockIndex);
 
-    readFileResponseMessage = GetPacketBuffer(&File->FileInformation, VMBFS_MESSAGE_READ_FILE_RDMA_RESPONSE);
-    bytesReceived = GetPacketSize(&File->FileInformation);
+        if (block != NULL)
+        {
+            cache->Hits++;
+        }
+        else
+        {
+            cache->Misses++;
+
+            //
+            // Read the missing blocks up to the next cached one, extended past
+            // the request if the file is being read sequentially.
+            //
+            runLength = lastBlockIndex - blockIndex + 1;
+            if (sequential)
+            {
+                runLength += VMBFS_CACHE_PREFETCH_BLOCKS;
+            }
+
+            runLength = MIN(runLength, fileBlockCount - blockIndex);
+            runLength = MIN(runLength, VMBFS_CACHE_FILL_BLOCKS);
+            runLength = MIN(runLength, cache->BlockCount);
+
+            for (blockOffset = 1; blockOffset < runLength; blockOffset++)
+            {
+                if (VmbfsCacheLookup(cache, File->FileInformation.CacheFileId, blockIndex + blockOffset) != NULL)
+                {
+                    runLength = blockOffset;
+                    break;
+                }
+            }
+
+            status = VmbfsCacheFill(File, blockIndex, runLength);
+            if (EFI_ERROR(status))
+            {
+                goto Cleanup;
+            }
+
+            if (blockIndex + runLength > lastBlockIndex + 1)
+            {
+                cache->PrefetchedBlocks += blockIndex + runLength - (lastBlockIndex + 1);
+            }
+
+            block = VmbfsCacheLookup(cache, File->FileInformation.CacheFileId, blockIndex);
+            if (block == NULL)
+            {
+                break;
+            }
+        }
 
-    if (bytesReceived < sizeof(*readFileResponseMessage) ||
-        readFileResponseMessage->Header.Type != VmbfsMessageTypeReadFileRdmaResponse)
-    {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
-    }
+        RemoveEntryList(&block->ListEntry);
+        InsertHeadList(&cache->LruList, &block->ListEntry);
 
-    status = VmbfsErrorToEfiError(readFileResponseMessage->Status);
-    if (EFI_ERROR(status))
-    {
-        goto Cleanup;
+        blockOffset = (UINT32)((FileOffset + bytesRead) - MultU64x32(blockIndex, VMBFS_CACHE_BLOCK_SIZE));
+        if (blockOffset >= block->DataLength)
+        {
+            break;
+        }
+
+        bytesToCopy = MIN(block->DataLength - blockOffset, BufferSize - bytesRead);
+        CopyMem((UINT8*)Buffer + bytesRead, block->Data + blockOffset, bytesToCopy);
+        bytesRead += bytesToCopy;
     }
 
-    if (readFileResponseMessage->ByteCount > bytesRequested)
+Cleanup:
+    if (!EFI_ERROR(status))
     {
-        FAIL_FAST_UNEXPECTED_HOST_BEHAVIOR();
+        File->FileInformation.CacheNextOffset = FileOffset + bytesRead;
+        *BytesRead = bytesRead;
     }
 
-    *BytesRead = readFileResponseMessage->ByteCount;
-    status = EFI_SUCCESS;
-
-Cleanup:
     return status;
 }
 
@@ -731,6 +2275,9 @@ Routine Description:
     Reads Size bytes starting at the offset indicated in the file information
     structure : FileEntry->FileData.Infomation.FileOffset.
 
+    Reads go through the block cache unless it is disabled or the read is
+    larger than the cache, in which case they go straight to the host.
+
 Arguments:
 
     This - A pointer to the EFI_FILE_PROTOCOL instance that is the file handle
@@ -751,12 +2298,12 @@ Return Value:
 
 {
     UINTN bytesRead;
-    UINTN bytesReadThisTime;
+    PVMBFS_CACHE cache;
     VMBFS_FILE *file;
     EFI_STATUS status;
 
-    bytesRead = 0;
     file = (VMBFS_FILE *)This;
+    cache = &GetFileSystemInformation(&file->FileInformation)->Cache;
 
     if (file->FileInformation.IsDirectory)
     {
@@ -764,32 +2311,27 @@ Return Value:
         goto Cleanup;
     }
 
-    while (bytesRead < *BufferSize &&
-           (file->FileInformation.FileOffset + bytesRead) < file->EfiFileInfo.FileSize)
+    if (file->FileInformation.CacheFileId != 0 &&
+        *BufferSize <= (UINTN)cache->BlockCount * VMBFS_CACHE_BLOCK_SIZE)
     {
-        if (file->FileInformation.RdmaCapable)
-        {
-            status = VmbfsReadRdma(file,
-                                   file->FileInformation.FileOffset + bytesRead,
-                                   (UINT8*)Buffer + bytesRead,
-                                   *BufferSize - bytesRead,
-                                   &bytesReadThisTime);
-        }
-        else
-        {
-            status = VmbfsReadPayload(file,
-                                      file->FileInformation.FileOffset + bytesRead,
-                                      (UINT8*)Buffer + bytesRead,
-                                      *BufferSize - bytesRead,
-                                      &bytesReadThisTime);
-        }
-
-        if (EFI_ERROR(status))
-        {
-            goto Cleanup;
-        }
+        status = VmbfsCacheRead(file,
+                                file->FileInformation.FileOffset,
+                                Buffer,
+                                *BufferSize,
+                                &bytesRead);
+    }
+    else
+    {
+        status = VmbfsReadFromHost(file,
+                                   file->FileInformation.FileOffset,
+                                   Buffer,
+                                   *BufferSize,
+                                   &bytesRead);
+    }
 
-        bytesRead += bytesReadThisTime;
+    if (EFI_ERROR(status))
+    {
+        goto Cleanup;
     }
 
     file->FileInformation.FileOffset += bytesRead;
@@ -813,7 +2355,9 @@ VmbfsWrite (
 
 Routine Description:
 
-    VMBus file system does not support writes.
+    VMBus file system does not support writes. The cached blocks of the file
+    and the cached path lookups of the volume are dropped so that they are
+    read again from the host.
 
 Arguments:
 
@@ -832,6 +2376,9 @@ Return Value:
 --*/
 
 {
+    VmbfsCacheInvalidateFile(GetThisFileInformation(This));
+    VmbfsMetadataFlush(GetFileSystemInformation(GetThisFileInformation(This)));
+
     return EFI_UNSUPPORTED;
 }
 
@@ -1045,6 +2592,10 @@ Routine Description:
     SetInfo() to change the Attribute field are permitted before it is closed.
     The file attributes will be valid the next time the file is opened with Open().
 
+    VMBus file system does not support SetInfo(). The cached blocks of the
+    file and the cached path lookups of the volume are dropped so that they
+    are read again from the host.
+
     An InformationType of EFI_FILE_SYSTEM_INFO_ID or EFI_FILE_SYSTEM_VOLUME_LABEL_ID
     may not be used on read-only media.
 
@@ -1068,6 +2619,9 @@ Return Value:
 --*/
 
 {
+    VmbfsCacheInvalidateFile(GetThisFileInformation(This));
+    VmbfsMetadataFlush(GetFileSystemInformation(GetThisFileInformation(This)));
+
     return EFI_UNSUPPORTED;
 }
 
@@ -1113,6 +2667,10 @@ Routine Description:
     handle is closed. If the file cannot be deleted, the warning code
     EFI_WARN_DELETE_FAILURE is returned, but the handle is still closed.
 
+    VMBus file system does not support Delete(). The cached blocks of the
+    file and the cached path lookups of the volume are dropped so that they
+    are read again from the host.
+
 Arguments:
 
     This - A pointer to the EFI_FILE_PROTOCOL instance that is the file handle to delete.
@@ -1124,6 +2682,9 @@ Return Value:
 --*/
 
 {
+    VmbfsCacheInvalidateFile(GetThisFileInformation(This));
+    VmbfsMetadataFlush(GetFileSystemInformation(GetThisFileInformation(This)));
+
     return EFI_UNSUPPORTED;
 }
 
@@ -36,6 +36,23 @@ VMBUS_DEVICE_PATH gVmbusChannelNode =
     {0}
 };
 
+VMBUS_SUBCHANNEL_DEVICE_PATH gVmbusSubChannelNode =
+{
+    {
+        {
+            HARDWARE_DEVICE_PATH,
+            HW_VENDOR_DP,
+            {
+                (UINT8) (sizeof (VMBUS_SUBCHANNEL_DEVICE_PATH)),
+                (UINT8) ((sizeof (VMBUS_SUBCHANNEL_DEVICE_PATH)) >> 8)
+            }
+        },
+        EFI_VMBUS_SUBCHANNEL_DEVICE_PATH_GUID
+    },
+    0,
+    0
+};
+
 
 EFI_STATUS
 EFIAPI
@@ -1005,7 +1022,21 @@ Return Value:
 
     ChannelContext->DevicePath.VmbusChannelNode.InterfaceType = Offer->InterfaceType;
     ChannelContext->DevicePath.VmbusChannelNode.InterfaceInstance = Offer->InterfaceInstance;
-    ChannelContext->DevicePath.End = gEfiEndNode;
+    ChannelContext->SubChannelIndex = Offer->SubChannelIndex;
+
+    if (ChannelContext->SubChannelIndex == 0)
+    {
+        ChannelContext->DevicePath.End = gEfiEndNode;
+    }
+    else
+    {
+        CopyMem(&ChannelContext->SubChannelDevicePath.VmbusSubChannelNode,
+                &gVmbusSubChannelNode,
+                sizeof(VMBUS_SUBCHANNEL_DEVICE_PATH));
+
+        ChannelContext->SubChannelDevicePath.VmbusSubChannelNode.SubChannelIndex = Offer->SubChannelIndex;
+        ChannelContext->SubChannelDevicePath.End = gEfiEndNode;
+    }
     ChannelContext->ChannelId = Offer->ChildRelId;
     ChannelContext->ConnectionId.AsUINT32 = Offer->ConnectionId;
     ChannelContext->RootContext = RootContext;
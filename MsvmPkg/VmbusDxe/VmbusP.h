@@ -109,6 +109,15 @@ typedef struct
 
 } VMBUS_CHANNEL_DEVICE_PATH;
 
+typedef struct
+{
+    VMBUS_ROOT_NODE VmbusRootNode;
+    VMBUS_DEVICE_PATH VmbusChannelNode;
+    VMBUS_SUBCHANNEL_DEVICE_PATH VmbusSubChannelNode;
+    EFI_DEVICE_PATH_PROTOCOL End;
+
+} VMBUS_CHANNEL_SUBCHANNEL_DEVICE_PATH;
+
 extern VMBUS_ROOT_NODE gVmbusRootNode;
 extern EFI_DEVICE_PATH_PROTOCOL gEfiEndNode;
 
@@ -162,7 +171,18 @@ typedef struct _VMBUS_CHANNEL_CONTEXT
     EFI_HANDLE Handle;
     EFI_VMBUS_LEGACY_PROTOCOL LegacyVmbusProtocol;
     EFI_VMBUS_PROTOCOL VmbusProtocol;
-    VMBUS_CHANNEL_DEVICE_PATH DevicePath;
+
+    //
+    // Sub-channels share the primary channel's device path prefix, with a
+    // sub-channel node in place of the end node.
+    //
+    union
+    {
+        VMBUS_CHANNEL_DEVICE_PATH DevicePath;
+        VMBUS_CHANNEL_SUBCHANNEL_DEVICE_PATH SubChannelDevicePath;
+    };
+
+    UINT16 SubChannelIndex;
     LIST_ENTRY Link;
     UINT32 ChannelId;
     HV_CONNECTION_ID ConnectionId;